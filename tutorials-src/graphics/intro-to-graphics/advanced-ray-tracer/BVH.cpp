@@ -0,0 +1,516 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Number of buckets centroids are binned into when looking for a split. More is slower to build but finds better splits.
+const int NUM_BINS = 16;
+// Relative cost of visiting a node versus testing a triangle
+const float TRAVERSAL_COST = 1.0f;
+
+static float SurfaceArea(glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 extent = boundsMax - boundsMin;
+	if (extent.x < 0.0f)
+	{
+		return 0.0f;
+	}
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+float RayIntersectsTriangle(glm::vec3 p, glm::vec3 d, glm::vec3 v0, glm::vec3 e1, glm::vec3 e2, bool plane)
+{
+	glm::vec3 h = glm::cross(d, e2);
+	float a = glm::dot(e1, h);
+	if (a > -0.00001f && a < 0.00001f)
+	{
+		return -1.0f;
+	}
+
+	float f = 1.0f / a;
+	glm::vec3 s = p - v0;
+	float u = f * glm::dot(s, h);
+	if (u < 0.0f || u > 1.0f)
+	{
+		return -1.0f;
+	}
+
+	glm::vec3 q = glm::cross(s, e1);
+	float v = f * glm::dot(d, q);
+	if (v < 0.0f || (plane ? v > 1.0f : u + v > 1.0f))
+	{
+		return -1.0f;
+	}
+
+	float t = f * glm::dot(e2, q);
+	return t > 0.00001f ? t : -1.0f;
+}
+
+// The nearer of the two places the ray crosses the sphere, or the farther if the ray starts inside it.
+// d isn't normalized in an object's space, so the quadratic keeps its dot(d, d).
+static float RayIntersectsSphere(glm::vec3 p, glm::vec3 d, glm::vec3 center, float radius)
+{
+	glm::vec3 oc = p - center;
+	float a = glm::dot(d, d);
+	float b = glm::dot(oc, d);
+	float c = glm::dot(oc, oc) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (discriminant < 0.0f)
+	{
+		return -1.0f;
+	}
+
+	float root = std::sqrt(discriminant);
+	float t = (-b - root) / a;
+	if (t > 0.00001f)
+	{
+		return t;
+	}
+	t = (-b + root) / a;
+	return t > 0.00001f ? t : -1.0f;
+}
+
+// Slab test, the same as the tree's boxes get, except this one needs where the ray enters it, or leaves it if the ray starts inside.
+static float RayIntersectsBox(glm::vec3 p, glm::vec3 d, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 invDir = 1.0f / d;
+	glm::vec3 t0 = (boundsMin - p) * invDir;
+	glm::vec3 t1 = (boundsMax - p) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+	float exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+	if (enter > exit)
+	{
+		return -1.0f;
+	}
+	if (enter > 0.00001f)
+	{
+		return enter;
+	}
+	return exit > 0.00001f ? exit : -1.0f;
+}
+
+float RayIntersectsPrimitive(glm::vec3 p, glm::vec3 d, const TriangleEdges& primitive)
+{
+	switch (primitive.kind)
+	{
+	case PRIMITIVE_SPHERE:
+		return RayIntersectsSphere(p, d, primitive.v0, primitive.radius);
+	case PRIMITIVE_BOX:
+		return RayIntersectsBox(p, d, primitive.v0, primitive.e1);
+	default:
+		return RayIntersectsTriangle(p, d, primitive.v0, primitive.e1, primitive.e2, primitive.kind == PRIMITIVE_PLANE);
+	}
+}
+
+glm::vec3 PrimitiveNormal(const TriangleEdges& primitive, glm::vec3 surfaceNormal, glm::vec3 point)
+{
+	if (primitive.kind == PRIMITIVE_SPHERE)
+	{
+		return glm::normalize(point - primitive.v0);
+	}
+
+	if (primitive.kind == PRIMITIVE_BOX)
+	{
+		// The face the point is on is the one it's furthest out toward, measured against the box's size along each axis
+		glm::vec3 center = (primitive.v0 + primitive.e1) * 0.5f;
+		glm::vec3 q = (point - center) / ((primitive.e1 - primitive.v0) * 0.5f);
+		glm::vec3 a = glm::abs(q);
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			return glm::vec3(q.x < 0.0f ? -1.0f : 1.0f, 0.0f, 0.0f);
+		}
+		if (a.y >= a.z)
+		{
+			return glm::vec3(0.0f, q.y < 0.0f ? -1.0f : 1.0f, 0.0f);
+		}
+		return glm::vec3(0.0f, 0.0f, q.z < 0.0f ? -1.0f : 1.0f);
+	}
+
+	return surfaceNormal;
+}
+
+void BVH::Build(std::vector<SceneTriangle>& triangles)
+{
+	int count = (int)triangles.size();
+	std::vector<glm::vec3> boundsMin(count);
+	std::vector<glm::vec3> boundsMax(count);
+	for (int i = 0; i < count; ++i)
+	{
+		Scene::PrimitiveBounds(triangles[i], boundsMin[i], boundsMax[i]);
+	}
+
+	std::vector<int> order;
+	Build(boundsMin, boundsMax, order);
+
+	// Put the triangles in leaf order so each leaf only needs a first index and a count
+	std::vector<SceneTriangle> sorted(count);
+	for (int i = 0; i < count; ++i)
+	{
+		sorted[i] = triangles[order[i]];
+	}
+	triangles.swap(sorted);
+}
+
+void BVH::Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax, std::vector<int>& order)
+{
+	nodes.clear();
+	depth = 0;
+	int count = (int)boundsMin.size();
+	order.resize(count);
+	if (count == 0)
+	{
+		return;
+	}
+
+	std::vector<BuildPrimitive> info(count);
+	for (int i = 0; i < count; ++i)
+	{
+		info[i].boundsMin = boundsMin[i];
+		info[i].boundsMax = boundsMax[i];
+		info[i].centroid = (boundsMin[i] + boundsMax[i]) * 0.5f;
+		order[i] = i;
+	}
+
+	// A binary tree with at least one primitive per leaf never has more than 2n - 1 nodes
+	nodes.reserve(count * 2);
+	_rightChild.clear();
+	BuildNode(info, order, 0, count, 1);
+	Link(0, -1);
+	_rightChild.clear();
+}
+
+void BVH::Refit(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax)
+{
+	// Children always come after their parent, so walking backwards reaches both children of a node before the node itself
+	for (int i = (int)nodes.size() - 1; i >= 0; --i)
+	{
+		BVHNode& n = nodes[i];
+		if (n.leaf == -1)
+		{
+			const BVHNode& left = nodes[i + 1];
+			const BVHNode& right = nodes[RightChild(i)];
+			n.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			n.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+			continue;
+		}
+
+		int first = n.leaf >> LEAF_COUNT_BITS;
+		int end = first + (n.leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		n.boundsMin = glm::vec3(FLT_MAX);
+		n.boundsMax = glm::vec3(-FLT_MAX);
+		for (int j = first; j < end; ++j)
+		{
+			n.boundsMin = glm::min(n.boundsMin, boundsMin[j]);
+			n.boundsMax = glm::max(n.boundsMax, boundsMax[j]);
+		}
+	}
+}
+
+float BVH::Cost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+
+	// Under the surface area heuristic a ray through the root passes through each node with a chance of the node's area over the root's,
+	// then pays TRAVERSAL_COST for an inner node or a test per primitive for a leaf
+	float rootArea = SurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax);
+	if (rootArea <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	float cost = 0.0f;
+	for (unsigned int i = 0; i < nodes.size(); ++i)
+	{
+		float chance = SurfaceArea(nodes[i].boundsMin, nodes[i].boundsMax) / rootArea;
+		cost += chance * (nodes[i].leaf == -1 ? TRAVERSAL_COST : (float)(nodes[i].leaf & ((1 << LEAF_COUNT_BITS) - 1)));
+	}
+	return cost;
+}
+
+int BVH::BuildNode(std::vector<BuildPrimitive>& info, std::vector<int>& order, int first, int count, int level)
+{
+	depth = std::max(depth, level);
+
+	int index = (int)nodes.size();
+	nodes.push_back(BVHNode());
+	_rightChild.push_back(-1);
+
+	glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+	glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+	glm::vec3 centroidMin = glm::vec3(FLT_MAX);
+	glm::vec3 centroidMax = glm::vec3(-FLT_MAX);
+	for (int i = first; i < first + count; ++i)
+	{
+		const BuildPrimitive& t = info[order[i]];
+		boundsMin = glm::min(boundsMin, t.boundsMin);
+		boundsMax = glm::max(boundsMax, t.boundsMax);
+		centroidMin = glm::min(centroidMin, t.centroid);
+		centroidMax = glm::max(centroidMax, t.centroid);
+	}
+	nodes[index].boundsMin = boundsMin;
+	nodes[index].boundsMax = boundsMax;
+	nodes[index].missIndex = -1;
+	nodes[index].leaf = (first << LEAF_COUNT_BITS) | count;
+
+	if (count <= 2)
+	{
+		return index;
+	}
+
+	// Find the cheapest split. Centroids are binned along each axis, then every boundary between bins is priced as
+	// the area of each side times the triangles on that side, relative to the area of this node.
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		int binCounts[NUM_BINS] = {};
+		glm::vec3 binMin[NUM_BINS];
+		glm::vec3 binMax[NUM_BINS];
+		for (int b = 0; b < NUM_BINS; ++b)
+		{
+			binMin[b] = glm::vec3(FLT_MAX);
+			binMax[b] = glm::vec3(-FLT_MAX);
+		}
+
+		float scale = NUM_BINS / extent;
+		for (int i = first; i < first + count; ++i)
+		{
+			const BuildPrimitive& t = info[order[i]];
+			int b = std::min(NUM_BINS - 1, (int)((t.centroid[axis] - centroidMin[axis]) * scale));
+			++binCounts[b];
+			binMin[b] = glm::min(binMin[b], t.boundsMin);
+			binMax[b] = glm::max(binMax[b], t.boundsMax);
+		}
+
+		// Sweep from the right to get the cost of everything past each boundary, then from the left to finish each cost
+		float rightArea[NUM_BINS];
+		int rightCount[NUM_BINS];
+		glm::vec3 sweepMin = glm::vec3(FLT_MAX);
+		glm::vec3 sweepMax = glm::vec3(-FLT_MAX);
+		int sweepCount = 0;
+		for (int b = NUM_BINS - 1; b > 0; --b)
+		{
+			sweepMin = glm::min(sweepMin, binMin[b]);
+			sweepMax = glm::max(sweepMax, binMax[b]);
+			sweepCount += binCounts[b];
+			rightArea[b] = SurfaceArea(sweepMin, sweepMax);
+			rightCount[b] = sweepCount;
+		}
+
+		sweepMin = glm::vec3(FLT_MAX);
+		sweepMax = glm::vec3(-FLT_MAX);
+		sweepCount = 0;
+		for (int b = 0; b < NUM_BINS - 1; ++b)
+		{
+			sweepMin = glm::min(sweepMin, binMin[b]);
+			sweepMax = glm::max(sweepMax, binMax[b]);
+			sweepCount += binCounts[b];
+			if (sweepCount == 0 || rightCount[b + 1] == 0)
+			{
+				continue;
+			}
+
+			float cost = SurfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Splitting isn't worth it if testing every triangle here is cheaper, as long as the leaf isn't too big to encode
+	float parentArea = SurfaceArea(boundsMin, boundsMax);
+	float splitCost = parentArea > 0.0f ? TRAVERSAL_COST + bestCost / parentArea : FLT_MAX;
+	if (count <= MAX_LEAF_TRIANGLES && (bestAxis == -1 || splitCost >= (float)count))
+	{
+		return index;
+	}
+
+	int mid;
+	if (bestAxis != -1)
+	{
+		float scale = NUM_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		float axisMin = centroidMin[bestAxis];
+		int* middle = std::partition(&order[first], &order[first] + count, [&](int i)
+		{
+			int b = std::min(NUM_BINS - 1, (int)((info[i].centroid[bestAxis] - axisMin) * scale));
+			return b <= bestSplit;
+		});
+		mid = (int)(middle - &order[0]);
+	}
+	else
+	{
+		// Every centroid is in the same place, which can happen with a lot of tiny or stacked triangles. Just cut the list in half.
+		mid = first + count / 2;
+	}
+
+	nodes[index].leaf = -1;
+	BuildNode(info, order, first, mid - first, level + 1);
+	int right = BuildNode(info, order, mid, first + count - mid, level + 1);
+	_rightChild[index] = right;
+	return index;
+}
+
+void BVH::Link(int node, int miss)
+{
+	nodes[node].missIndex = miss;
+	if (nodes[node].leaf != -1)
+	{
+		return;
+	}
+
+	// Missing the left subtree moves on to the right one, missing the right one moves on to wherever this node's miss goes
+	Link(node + 1, _rightChild[node]);
+	Link(_rightChild[node], miss);
+}
+
+void BVH::BuildTreelet(int levels, std::vector<BVHTreeletNode>& treelet) const
+{
+	treelet.clear();
+	AddTreeletNode(0, levels, treelet);
+
+	// The last nodes of the treelet miss past its end, which is the end of the walk
+	for (unsigned int i = 0; i < treelet.size(); ++i)
+	{
+		if (treelet[i].missIndex == (int)treelet.size())
+		{
+			treelet[i].missIndex = -1;
+		}
+	}
+}
+
+void BVH::AddTreeletNode(int node, int levels, std::vector<BVHTreeletNode>& treelet) const
+{
+	int index = (int)treelet.size();
+	treelet.push_back(BVHTreeletNode());
+	treelet[index].boundsMin = nodes[node].boundsMin;
+	treelet[index].boundsMax = nodes[node].boundsMax;
+
+	if (levels > 1 && nodes[node].leaf == -1)
+	{
+		treelet[index].node = -1;
+		treelet[index].subtreeEnd = -1;
+		AddTreeletNode(node + 1, levels - 1, treelet);
+		AddTreeletNode(RightChild(node), levels - 1, treelet);
+	}
+	else
+	{
+		// A node's miss link leads to the first node after its subtree, or nowhere if the subtree runs to the end of the tree
+		treelet[index].node = node;
+		treelet[index].subtreeEnd = nodes[node].missIndex == -1 ? (int)nodes.size() : nodes[node].missIndex;
+	}
+
+	// Depth first order again, so missing this node moves on to whatever was added after its subtree
+	treelet[index].missIndex = (int)treelet.size();
+}
+
+int BVH::Intersect(const std::vector<TriangleEdges>& edges, glm::vec3 origin, glm::vec3 dir, float maxT, float& t) const
+{
+	int found = -1;
+	t = maxT;
+	if (nodes.empty())
+	{
+		return found;
+	}
+
+	glm::vec3 invDir = 1.0f / dir;
+	int node = 0;
+	while (node != -1)
+	{
+		const BVHNode& n = nodes[node];
+
+		// Slab test, the ray's entry and exit along each axis
+		glm::vec3 t0 = (n.boundsMin - origin) * invDir;
+		glm::vec3 t1 = (n.boundsMax - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, t));
+
+		if (enter > exit)
+		{
+			node = n.missIndex;
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			++node;
+			continue;
+		}
+
+		int first = n.leaf >> LEAF_COUNT_BITS;
+		int end = first + (n.leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		for (int i = first; i < end; ++i)
+		{
+			float hit = RayIntersectsPrimitive(origin, dir, edges[i]);
+			if (hit != -1.0f && hit < t)
+			{
+				t = hit;
+				found = i;
+			}
+		}
+		node = n.missIndex;
+	}
+	return found;
+}
+
+bool BVH::Occluded(const std::vector<TriangleEdges>& edges, glm::vec3 origin, glm::vec3 dir, float maxT) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	glm::vec3 invDir = 1.0f / dir;
+	int node = 0;
+	while (node != -1)
+	{
+		const BVHNode& n = nodes[node];
+		glm::vec3 t0 = (n.boundsMin - origin) * invDir;
+		glm::vec3 t1 = (n.boundsMax - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+
+		if (enter > exit)
+		{
+			node = n.missIndex;
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			++node;
+			continue;
+		}
+
+		int first = n.leaf >> LEAF_COUNT_BITS;
+		int end = first + (n.leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		for (int i = first; i < end; ++i)
+		{
+			float hit = RayIntersectsPrimitive(origin, dir, edges[i]);
+			if (hit != -1.0f && hit < maxT)
+			{
+				return true;
+			}
+		}
+		node = n.missIndex;
+	}
+	return false;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include "Scene.h"
+
+// One node of the flattened tree, laid out to match the node struct in the Fragment Shader under std430 packing.
+// Nodes are stored depth first so an inner node's left child is always the next node. Rather than child links
+// every node keeps a miss link, the node to visit next if the ray misses this one's box (or after a leaf has been tested).
+// That lets the shader walk the tree without a stack: go to i + 1 on a hit, go to missIndex on a miss, stop at -1.
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	int missIndex;
+	glm::vec3 boundsMax;
+	// -1 for inner nodes, otherwise the leaf's first triangle shifted up by LEAF_COUNT_BITS with the triangle count in the low bits
+	int leaf;
+};
+
+const int LEAF_COUNT_BITS = 4;
+const int MAX_LEAF_TRIANGLES = 8;
+
+// A node of the treelet, the top few levels of the tree that the Compute Shader copies into shared memory.
+// Laid out to match the treeletNode struct in RayTracing.glsl. The treelet is flattened the same way as the tree with
+// miss links of its own. Nodes at its bottom level stand for their whole subtree, which is the run of nodes [node, subtreeEnd) of the tree.
+struct BVHTreeletNode
+{
+	glm::vec3 boundsMin;
+	int missIndex;
+	glm::vec3 boundsMax;
+	// -1 if the node's children follow it in the treelet, otherwise the node's index in the tree
+	int node;
+	int subtreeEnd;
+	int pad[3];
+};
+
+// Levels of the tree in the treelet, it has at most 2^TREELET_LEVELS - 1 nodes
+const int TREELET_LEVELS = 6;
+
+class BVH
+{
+public:
+	// Builds the tree over the scene's triangles with the surface area heuristic. The triangles are reordered
+	// so every leaf covers a contiguous run of them, upload the scene after building.
+	void Build(std::vector<SceneTriangle>& triangles);
+
+	// Builds the tree over any set of boxes, such as whole objects. Leaves refer to the boxes by their place in order,
+	// which is filled in with the index of the box at each place.
+	void Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax, std::vector<int>& order);
+
+	// Fits every node's box to new bounds for the primitives, given in leaf order, keeping the shape of the tree.
+	// Much quicker than building, but the tree gets worse for tracing as the primitives move away from where it was built.
+	void Refit(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax);
+
+	// How expensive the tree is to trace a ray through by the surface area heuristic, the same measure Build minimizes.
+	float Cost() const;
+
+	// Nearest hit along the ray closer than maxT, the same test the shader does. Returns the triangle index or -1.
+	// edges are the built triangles' Scene::Edges.
+	int Intersect(const std::vector<TriangleEdges>& edges, glm::vec3 origin, glm::vec3 dir, float maxT, float& t) const;
+
+	// Whether the ray hits anything closer than maxT. Stops at the first hit rather than looking for the closest, which is all a shadow ray needs.
+	bool Occluded(const std::vector<TriangleEdges>& edges, glm::vec3 origin, glm::vec3 dir, float maxT) const;
+
+	// Copies the top levels of the tree into treelet, see BVHTreeletNode.
+	void BuildTreelet(int levels, std::vector<BVHTreeletNode>& treelet) const;
+
+	// An inner node's right child is wherever its left subtree's misses lead to
+	int RightChild(int node) const { return nodes[node + 1].missIndex; }
+
+	std::vector<BVHNode> nodes;
+	int depth;
+private:
+	struct BuildPrimitive
+	{
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		glm::vec3 centroid;
+	};
+
+	int BuildNode(std::vector<BuildPrimitive>& info, std::vector<int>& order, int first, int count, int level);
+	void Link(int node, int miss);
+	void AddTreeletNode(int node, int levels, std::vector<BVHTreeletNode>& treelet) const;
+
+	// Build scratch, the right child of each inner node until the miss links are filled in
+	std::vector<int> _rightChild;
+};
+
+// Mller-Trumbore, matches rayIntersectsTriangle in RayTracing.glsl. Takes the triangle's first corner and the edges from it. Returns -1.0 on a miss.
+// With plane set it tests the whole parallelogram the edges make instead, see PRIMITIVE_PLANE.
+float RayIntersectsTriangle(glm::vec3 p, glm::vec3 d, glm::vec3 v0, glm::vec3 e1, glm::vec3 e2, bool plane = false);
+
+// Tests a ray against a primitive of any kind, matches rayIntersectsPrimitive in RayTracing.glsl. Returns -1.0 on a miss.
+float RayIntersectsPrimitive(glm::vec3 p, glm::vec3 d, const TriangleEdges& primitive);
+
+// The normal of a primitive at a point on it. Worked out from the point for spheres and boxes, for triangles and planes it's surfaceNormal.
+glm::vec3 PrimitiveNormal(const TriangleEdges& primitive, glm::vec3 surfaceNormal, glm::vec3 point);
@@ -0,0 +1,167 @@
+#include "Benchmark.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// Quotes a string for JSON. Names and GL renderer strings are plain text, so only quotes, backslashes and control characters need escaping.
+static std::string Quote(const std::string& s)
+{
+	std::string quoted = "\"";
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			quoted += ' ';
+		}
+		else
+		{
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+CameraPose CameraPath::At(int frame, int frames) const
+{
+	// How far along the path, in keys
+	float along = frames > 1 ? (float)frame / (frames - 1) * (keys.size() - 1) : 0.0f;
+	int key = std::min((int)along, (int)keys.size() - 2);
+	float t = along - key;
+	const CameraKey& a = keys[key];
+	const CameraKey& b = keys[key + 1];
+
+	float angle = glm::radians(a.angle + (b.angle - a.angle) * t);
+	float distance = a.distance + (b.distance - a.distance) * t;
+
+	CameraPose pose;
+	pose.eye = glm::vec3(distance * std::sin(angle), a.height + (b.height - a.height) * t, distance * std::cos(angle));
+	pose.center = a.center + (b.center - a.center) * t;
+	return pose;
+}
+
+const std::vector<CameraPath>& BenchmarkPaths()
+{
+	// The window's camera starts at (4, 8, 8) looking at (0, 0.5, 0), which is 26.57 degrees round and 8.94 out
+	static const std::vector<CameraPath> paths =
+	{
+		{ "orbit", { { 26.57f, 8.94f, 8.0f, glm::vec3(0.0f, 0.5f, 0.0f) }, { 386.57f, 8.94f, 8.0f, glm::vec3(0.0f, 0.5f, 0.0f) } } },
+		{ "sweep", { { -70.0f, 6.0f, 1.0f, glm::vec3(0.0f, 0.5f, 0.0f) }, { 70.0f, 6.0f, 1.0f, glm::vec3(0.0f, 0.5f, 0.0f) } } },
+		{ "closeup", { { 26.57f, 8.94f, 8.0f, glm::vec3(0.0f, 0.5f, 0.0f) }, { 26.57f, 2.5f, 2.0f, glm::vec3(0.0f, 1.5f, 0.0f) } } }
+	};
+	return paths;
+}
+
+void BenchmarkRun::AddFrame(double milliseconds, const RayCounts& frameRays)
+{
+	frameMilliseconds.push_back(milliseconds);
+	rays.primary += frameRays.primary;
+	rays.shadow += frameRays.shadow;
+	rays.reflection += frameRays.reflection;
+}
+
+double BenchmarkRun::TotalMilliseconds() const
+{
+	double total = 0.0;
+	for (double ms : frameMilliseconds)
+	{
+		total += ms;
+	}
+	return total;
+}
+
+void BenchmarkReport::Describe(const std::string& key, const std::string& value)
+{
+	_description.push_back(std::make_pair(key, Quote(value)));
+}
+
+void BenchmarkReport::Describe(const std::string& key, double value)
+{
+	std::ostringstream s;
+	s << value;
+	_description.push_back(std::make_pair(key, s.str()));
+}
+
+void BenchmarkReport::Add(const BenchmarkRun& run)
+{
+	_runs.push_back(run);
+}
+
+double BenchmarkReport::Percentile(const std::vector<double>& times, double p)
+{
+	if (times.empty())
+	{
+		return 0.0;
+	}
+	int rank = (int)std::ceil(p / 100.0 * times.size());
+	return times[std::min(std::max(rank, 1), (int)times.size()) - 1];
+}
+
+void BenchmarkReport::Print() const
+{
+	for (const BenchmarkRun& run : _runs)
+	{
+		double seconds = run.TotalMilliseconds() / 1000.0;
+		std::cout << run.tracer << " " << run.path << ": " << run.TotalMilliseconds() / run.frameMilliseconds.size() << "ms/frame, "
+			<< run.rays.Total() / seconds / 1000000.0 << " million rays/s" << std::endl;
+	}
+}
+
+bool BenchmarkReport::WriteJSON(const std::string& fileName) const
+{
+	std::ofstream file(fileName, std::ios::out);
+	if (!file.good())
+	{
+		return false;
+	}
+
+	file << "{\n";
+	for (const auto& entry : _description)
+	{
+		file << "\t" << Quote(entry.first) << ": " << entry.second << ",\n";
+	}
+
+	file << "\t\"runs\": [";
+	for (unsigned int r = 0; r < _runs.size(); ++r)
+	{
+		const BenchmarkRun& run = _runs[r];
+		std::vector<double> sorted = run.frameMilliseconds;
+		std::sort(sorted.begin(), sorted.end());
+		int frames = (int)sorted.size();
+		double seconds = run.TotalMilliseconds() / 1000.0;
+
+		file << (r == 0 ? "\n" : ",\n");
+		file << "\t\t{\n";
+		file << "\t\t\t\"tracer\": " << Quote(run.tracer) << ",\n";
+		file << "\t\t\t\"path\": " << Quote(run.path) << ",\n";
+		file << "\t\t\t\"width\": " << run.width << ",\n";
+		file << "\t\t\t\"height\": " << run.height << ",\n";
+		file << "\t\t\t\"frames\": " << frames << ",\n";
+		file << "\t\t\t\"msPerFrame\": " << (frames > 0 ? run.TotalMilliseconds() / frames : 0.0) << ",\n";
+		file << "\t\t\t\"percentiles\": { \"min\": " << (frames > 0 ? sorted.front() : 0.0) << ", \"p50\": " << Percentile(sorted, 50.0) << ", \"p90\": " << Percentile(sorted, 90.0)
+			<< ", \"p95\": " << Percentile(sorted, 95.0) << ", \"p99\": " << Percentile(sorted, 99.0) << ", \"max\": " << (frames > 0 ? sorted.back() : 0.0) << " },\n";
+		file << "\t\t\t\"rays\": { \"primary\": " << run.rays.primary << ", \"shadow\": " << run.rays.shadow << ", \"reflection\": " << run.rays.reflection << " },\n";
+		if (seconds > 0.0)
+		{
+			file << "\t\t\t\"raysPerSecond\": { \"primary\": " << run.rays.primary / seconds << ", \"shadow\": " << run.rays.shadow / seconds
+				<< ", \"reflection\": " << run.rays.reflection / seconds << ", \"total\": " << run.rays.Total() / seconds << " },\n";
+		}
+
+		// Every frame's time in order, so a run can be plotted or checked for hitches
+		file << "\t\t\t\"frameMs\": [";
+		for (int f = 0; f < frames; ++f)
+		{
+			file << (f == 0 ? "" : ", ") << run.frameMilliseconds[f];
+		}
+		file << "]\n";
+		file << "\t\t}";
+	}
+	file << "\n\t]\n}\n";
+	return file.good();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <string>
+#include "CpuTracer.h"
+
+// Where the camera is at one point of a path. The eye goes round the middle of the floor, angle degrees round from the +Z axis,
+// distance out and height up, and looks at center.
+struct CameraKey
+{
+	float angle;
+	float distance;
+	float height;
+	glm::vec3 center;
+};
+
+// The eye and what it looks at, for calcCameraRays
+struct CameraPose
+{
+	glm::vec3 eye;
+	glm::vec3 center;
+};
+
+// A scripted camera path, the same frames every run so runs can be compared. The camera moves evenly from key to key,
+// and a path of any number of frames covers all of them.
+struct CameraPath
+{
+	std::string name;
+	std::vector<CameraKey> keys;
+
+	// Where the camera is on the frame'th of frames frames
+	CameraPose At(int frame, int frames) const;
+};
+
+// The paths the benchmark runs: orbit goes once round the scene from where the window's camera starts, sweep passes low over the floor
+// where most rays reflect, and closeup pushes in on the cubes until they fill the screen.
+const std::vector<CameraPath>& BenchmarkPaths();
+
+// One tracer's run down one path
+struct BenchmarkRun
+{
+	std::string tracer;
+	std::string path;
+	int width;
+	int height;
+	// How long each frame took, in order
+	std::vector<double> frameMilliseconds;
+	// The rays traced over all the frames
+	RayCounts rays;
+
+	void AddFrame(double milliseconds, const RayCounts& frameRays);
+	double TotalMilliseconds() const;
+};
+
+// Collects the runs and writes them out as JSON, with each run's time per frame, the percentiles of its frame times and its rays per second of each kind.
+class BenchmarkReport
+{
+public:
+	// Things about the run that aren't measurements, such as the scene's size or the GL renderer, written at the top of the report.
+	// Numbers go in as they are, anything else is written as a string.
+	void Describe(const std::string& key, const std::string& value);
+	void Describe(const std::string& key, double value);
+
+	void Add(const BenchmarkRun& run);
+
+	// Prints a line per run, its mean frame time and millions of rays per second
+	void Print() const;
+	bool WriteJSON(const std::string& fileName) const;
+
+	// The p'th percentile of the times, 0 to 100, by the nearest rank. times has to be sorted.
+	static double Percentile(const std::vector<double>& times, double p);
+private:
+	std::vector<std::pair<std::string, std::string>> _description;
+	std::vector<BenchmarkRun> _runs;
+};
@@ -0,0 +1,410 @@
+/*
+Title: Advanced Ray Tracer
+File Name: ComputeShader.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+References:
+https://github.com/LWJGL/lwjgl3-wiki/wiki/2.6.1.-Ray-tracing-with-OpenGL-Compute-Shaders-(Part-I)
+
+Description:
+The same ray tracer as the Fragment Shader, run as a compute shader
+instead of by drawing a quad. Each work group traces an 8x8 tile of the
+screen and writes it straight into an image, which main.cpp copies to
+the window. Being a compute shader means the work group can share
+memory: before tracing, its invocations copy the top levels of the
+top level tree, which every ray walks through, and the corners of the first
+triangles into shared memory (see stageScene in RayTracing.glsl).
+
+With DENOISE defined, finished pixels go into the noisy image instead,
+along with the G-buffer of what each pixel's camera ray hit, for
+DenoiseShader.glsl to filter into the output image.
+
+With TEMPORAL_CACHE defined, pixels reuse last frame's shadows and 
+reflections wherever they still hold (see traceCached in 
+RayTracing.glsl). In the wavefront stages a pixel whose shadows are 
+reused queues no rays toward the lights at all, so the queue, and the 
+dispatch that traces it, shrinks to the pixels that need them.
+
+The stage uniform picks what a dispatch does. TRACE_STAGE traces each
+pixel's rays start to finish like the Fragment Shader. The other stages
+split the frame into waves instead: one ray from the camera per pixel,
+then the shadow rays of the pixels that hit something, packed into a
+queue, then a pass adding each pixel's light up and following its
+reflections. Pixels
+that see nothing don't leave invocations idle while their neighbours
+trace secondary rays, the queue only holds work that has to be done.
+HYBRID_STAGE traces no rays from the camera at all. The scene has been
+rasterized into a G-buffer first (see RasterVertexShader.glsl), which
+gives each pixel the point its camera ray would hit, and the stage
+carries on from there with the shadow and reflection rays.
+*/
+
+#version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
+
+// The size of the shared memory copies, these have to fit in the 32KB of shared memory every GPU has.
+// MAX_TREELET_NODES holds a tree of TREELET_LEVELS levels (see BVH.h), and MAX_SHARED_TRIANGLES matches main.cpp.
+#define SHARED_STAGING
+#define MAX_TREELET_NODES 63
+#define MAX_SHARED_TRIANGLES 384
+
+// Each work group is an 8x8 tile of pixels. Neighbouring pixels' rays go much the same way through the tree, so they tend to read the same nodes.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// The structs, buffers and functions that do the tracing are shared with the Fragment Shader, main.cpp pastes them in here.
+#include "RayTracing.glsl"
+
+// The uniform variables, these storing the camera position and the four corner rays of the camera's view.
+uniform vec3 eye;
+uniform vec3 ray00;
+uniform vec3 ray01;
+uniform vec3 ray10;
+uniform vec3 ray11;
+
+// What this dispatch does, these match the constants in main.cpp.
+#define TRACE_STAGE 0
+#define PRIMARY_STAGE 1
+#define SIZE_STAGE 2
+#define SECONDARY_STAGE 3
+#define RESOLVE_STAGE 4
+#define HYBRID_STAGE 5
+uniform int stage;
+
+// The hybrid stage's G-buffer, what the rasterizer found each pixel's camera ray would hit: the point, the normal there and the triangle's index, -1 for nothing.
+uniform sampler2D rasterPositions;
+uniform sampler2D rasterNormals;
+uniform isampler2D rasterTriangles;
+
+// Where the finished pixels go.
+layout(binding = 1, rgba8) writeonly uniform image2D outputImage;
+
+// With more lights than are sampled per pixel, every frame is noisy, so accumulate is set and each frame is added into the
+// accumulation image on image unit 0, the same one progressive mode uses, and the average of the frames so far is shown.
+// frameNumber counts the frames since the camera last moved, and picks the lights each pixel is shaded by.
+uniform bool accumulate;
+uniform int frameNumber;
+layout(binding = 0, rgba32f) uniform image2D accumulation;
+
+// What each pixel's camera ray hit, written by the primary stage. index is -1 if it hit nothing.
+// queueStart is where the pixel's rays toward the lights are in the queue, one for each light it is shaded by, in the order pickLight gives them.
+// cached says which of the point's shadows and reflection the temporal cache has, so they aren't traced, and fits in what would be padding.
+struct pixelHit {
+	vec3 point;
+	int index;
+	vec3 dir;
+	int queueStart;
+	vec3 normal;
+	int cached;
+};
+
+#define CACHED_SHADOWS 1
+#define CACHED_REFLECTION 2
+
+layout(std430, binding = 3) buffer PixelHits
+{
+	pixelHit hits[];
+};
+
+// One ray toward a light waiting to be traced, and once it has been, the light it brought to the pixel.
+struct queuedRay {
+	vec3 color;
+	int pixel;
+};
+
+// queueLength is set back to 0 by main.cpp before every primary stage.
+layout(std430, binding = 4) buffer RayQueue
+{
+	uint queueLength;
+	queuedRay queue[];
+};
+
+// The size of the secondary stage's dispatch, which is read straight from here by glDispatchComputeIndirect so the CPU never has to wait to find out how long the queue got.
+layout(std430, binding = 5) writeonly buffer DispatchSize
+{
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+};
+
+// Traces one ray of the queue, numbered by work group and then by invocation within it: the shadow ray toward one light from the point the pixel's camera ray hit.
+void traceQueued()
+{
+	uint index = gl_WorkGroupID.x * gl_WorkGroupSize.x * gl_WorkGroupSize.y + gl_LocalInvocationIndex;
+	if (index >= queueLength)
+	{
+		return;
+	}
+
+	// The pixel's seed picks the same light for this ray as trace would for the same pixel.
+	int pixel = queue[index].pixel;
+	int width = imageSize(outputImage).x;
+	int n = int(index) - hits[pixel].queueStart;
+	float weight;
+	pointLight light = lights[pickLight(pixelSeed(ivec2(pixel % width, pixel / width), frameNumber), n, weight)];
+
+	hitinfo i;
+	i.point = hits[pixel].point;
+	i.index = hits[pixel].index;
+	i.normal = hits[pixel].normal;
+	vec3 pointToLight = light.position - i.point;
+	queue[index].color = vec3(0.0);
+	if (lightReaches(light.position, pointToLight, i))
+	{
+		queue[index].color = shadeLight(pointToLight, hits[pixel].dir, i, light.intensity) * weight;
+#ifdef TEMPORAL_CACHE
+		// Kept for the frames after, which reuse the shadows of the points they still see.
+		if (cachesShadows())
+		{
+			atomicOr(history[pixel].visible, 1u << uint(n));
+		}
+#endif
+	}
+}
+
+#ifdef DENOISE
+// The frame before it's denoised, and the G-buffer that guides the denoiser: the normal with the depth in alpha, and the albedo.
+layout(binding = 2, rgba32f) writeonly uniform image2D noisyImage;
+layout(binding = 3, rgba32f) writeonly uniform image2D normalDepthImage;
+layout(binding = 4, rgba8) writeonly uniform image2D albedoImage;
+
+void writeGBuffer(ivec2 pixel, vec3 normal, float depth, vec3 albedo)
+{
+	imageStore(normalDepthImage, pixel, vec4(normal, depth));
+	imageStore(albedoImage, pixel, vec4(albedo, 1.0));
+}
+#endif
+
+// Writes a finished pixel, averaging it with the frames before it when accumulating.
+void writePixel(ivec2 pixel, vec3 pixColor)
+{
+#ifdef DENOISE
+	// The denoiser stands in for averaging frames, so main.cpp never accumulates with it
+	imageStore(noisyImage, pixel, vec4(pixColor, 1.0));
+#else
+	if (accumulate)
+	{
+		// The alpha channel counts the frames, the same as the progressive mode's samples.
+		vec4 sum = (frameNumber == 0 ? vec4(0.0) : imageLoad(accumulation, pixel)) + vec4(pixColor, 1.0);
+		imageStore(accumulation, pixel, sum);
+		pixColor = sum.rgb / sum.a;
+	}
+	imageStore(outputImage, pixel, vec4(pixColor, 1.0));
+#endif
+}
+
+void main(void)
+{
+	// The queue's length is only known once the primary stage has finished, a single invocation turns it into a number of work groups.
+	// This stage is dispatched as one work group, and it doesn't trace anything so it doesn't need the shared memory.
+	if (stage == SIZE_STAGE)
+	{
+		if (gl_LocalInvocationIndex == 0)
+		{
+			uint groupSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+			numGroupsX = (queueLength + groupSize - 1) / groupSize;
+			numGroupsY = 1;
+			numGroupsZ = 1;
+		}
+		return;
+	}
+
+	// Every stage that traces rays starts from shared memory. This waits for the whole work group, so nothing can return before it.
+	stageScene();
+
+	if (stage == SECONDARY_STAGE)
+	{
+		traceQueued();
+		addRayCounts();
+		return;
+	}
+
+	// The tiles along the right and top edges hang off the screen unless its size is a multiple of 8.
+	ivec2 size = imageSize(outputImage);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (pixel.x >= size.x || pixel.y >= size.y)
+	{
+		return;
+	}
+	int p = pixel.y * size.x + pixel.x;
+
+	// The ray through the center of the pixel, interpolated between the four corner rays the same as the Fragment Shader does.
+	vec2 pos = (vec2(pixel) + 0.5) / vec2(size);
+	vec3 dir = normalize(mix(mix(ray00, ray01, pos.y), mix(ray10, ray11, pos.y), pos.x));
+
+	if (stage == TRACE_STAGE)
+	{
+#ifdef TEMPORAL_CACHE
+		writePixel(pixel, traceCached(eye, dir, pixelSeed(pixel, frameNumber), p, size).rgb);
+#else
+		writePixel(pixel, trace(eye, dir, pixelSeed(pixel, frameNumber)).rgb);
+#endif
+#ifdef DENOISE
+		writeGBuffer(pixel, firstNormal, firstDepth, firstAlbedo);
+#endif
+		addRayCounts();
+		return;
+	}
+
+	if (stage == HYBRID_STAGE)
+	{
+		// The same as tracePath from the first point on, with the first point from the G-buffer rather than a ray.
+		vec3 pixColor = vec3(0.0, 0.0, 0.0);
+		hitinfo i;
+		i.index = texelFetch(rasterTriangles, pixel, 0).r;
+		if (i.index != -1)
+		{
+			i.point = texelFetch(rasterPositions, pixel, 0).xyz;
+			i.normal = texelFetch(rasterNormals, pixel, 0).xyz;
+			pixColor = surfaces[i.index].color * 0.1;
+			uint seed = pixelSeed(pixel, frameNumber);
+			for (int j = 0; j < lightsPerPoint(); j++)
+			{
+				float weight;
+				pointLight light = lights[pickLight(seed, j, weight)];
+				pixColor += addToPixColor(light.position, light.position - i.point, dir, i, light.intensity) * weight;
+			}
+
+			float throughput = 1.0;
+			if (continuePath(0, seed, throughput))
+			{
+				pixColor += tracePath(i.point, normalize(dir - (2 * dot(dir, i.normal) * i.normal)), seed, 1, throughput);
+			}
+		}
+		writePixel(pixel, pixColor);
+#ifdef DENOISE
+		if (i.index != -1)
+		{
+			writeGBuffer(pixel, i.normal, length(i.point - eye), surfaces[i.index].color);
+		}
+		else
+		{
+			writeGBuffer(pixel, vec3(0.0), 0.0, vec3(0.0));
+		}
+#endif
+		addRayCounts();
+		return;
+	}
+
+	if (stage == PRIMARY_STAGE)
+	{
+		hitinfo i;
+		hits[p].dir = dir;
+		hits[p].index = -1;
+		hits[p].cached = 0;
+#ifdef TEMPORAL_CACHE
+		history[p].index = -1;
+#endif
+#ifdef COUNT_RAYS
+		tracedPrimary++;
+#endif
+		if (intersectTriangles(eye, dir, i))
+		{
+			hits[p].point = i.point;
+			hits[p].index = i.index;
+			hits[p].normal = i.normal;
+
+#ifdef TEMPORAL_CACHE
+			// A point whose shadows are in the cache doesn't queue any rays.
+			bool reuseShadows;
+			bool reuseReflection;
+			history[p] = startHistory(i, dir, pixelSeed(pixel, frameNumber), size, reuseShadows, reuseReflection);
+			hits[p].cached = (reuseShadows ? CACHED_SHADOWS : 0) | (reuseReflection ? CACHED_REFLECTION : 0);
+			if (reuseShadows)
+			{
+				addRayCounts();
+				return;
+			}
+#endif
+
+			// Claim a place in the queue for a ray toward each light the point is shaded by.
+			uint start = atomicAdd(queueLength, uint(lightsPerPoint()));
+			hits[p].queueStart = int(start);
+			for (int j = 0; j < lightsPerPoint(); j++)
+			{
+				queue[start + uint(j)].pixel = p;
+			}
+		}
+		addRayCounts();
+		return;
+	}
+
+	// RESOLVE_STAGE, some ambient light plus what each of the pixel's queued rays brought, then the reflections from where the camera ray hit.
+	vec3 pixColor = vec3(0.0, 0.0, 0.0);
+	if (hits[p].index != -1)
+	{
+		pixColor = surfaces[hits[p].index].color * 0.1;
+		uint seed = pixelSeed(pixel, frameNumber);
+		if ((hits[p].cached & CACHED_SHADOWS) == 0)
+		{
+			for (int j = 0; j < lightsPerPoint(); j++)
+			{
+				pixColor += queue[hits[p].queueStart + j].color;
+			}
+		}
+#ifdef TEMPORAL_CACHE
+		else
+		{
+			// Shaded by the lights the cache says reach the point, the same as traceQueued would have.
+			hitinfo i;
+			i.point = hits[p].point;
+			i.index = hits[p].index;
+			i.normal = hits[p].normal;
+			uint visible = history[p].visible;
+			for (int j = 0; j < lightsPerPoint(); j++)
+			{
+				float weight;
+				pointLight light = lights[pickLight(seed, j, weight)];
+				if ((visible & (1u << uint(j))) != 0u)
+				{
+					pixColor += shadeLight(light.position - i.point, dir, i, light.intensity) * weight;
+				}
+			}
+		}
+#endif
+
+		// The same as tracePath carrying on from its first point.
+		float throughput = 1.0;
+		if (continuePath(0, seed, throughput))
+		{
+			vec3 normal = hits[p].normal;
+#ifdef TEMPORAL_CACHE
+			if ((hits[p].cached & CACHED_REFLECTION) == 0)
+			{
+				history[p].reflection = tracePath(hits[p].point, normalize(dir - (2 * dot(dir, normal) * normal)), seed, 1, throughput);
+			}
+			pixColor += history[p].reflection;
+#else
+			pixColor += tracePath(hits[p].point, normalize(dir - (2 * dot(dir, normal) * normal)), seed, 1, throughput);
+#endif
+		}
+	}
+	writePixel(pixel, pixColor);
+#ifdef DENOISE
+	if (hits[p].index != -1)
+	{
+		writeGBuffer(pixel, hits[p].normal, length(hits[p].point - eye), surfaces[hits[p].index].color);
+	}
+	else
+	{
+		writeGBuffer(pixel, vec3(0.0), 0.0, vec3(0.0));
+	}
+#endif
+	addRayCounts();
+}
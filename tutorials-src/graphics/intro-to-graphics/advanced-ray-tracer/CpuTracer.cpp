@@ -0,0 +1,548 @@
+#include "CpuTracer.h"
+#include "TemporalCache.h"
+#include <cmath>
+#include <algorithm>
+
+// These all match the constants in the Fragment Shaders
+const float MAX_SCENE_BOUNDS = 100.0f;
+const float REFLECTION_LEVEL = 0.5f;
+const float REFLECTION_POWER = 0.35f;
+const float ROULETTE_THROUGHPUT = 0.1f;
+// How far short of the point a shadow ray stops, so the surface being lit doesn't shadow itself
+const float SHADOW_BIAS = 0.1f;
+
+// Pixels are traced in square tiles, small enough that there are plenty to share between threads
+const int TILE_SIZE = 16;
+
+// Packets cover 4x2 pixels, squarer packets stay more coherent than a row of 8
+const int PACKET_WIDTH = 4;
+const int PACKET_HEIGHT = 2;
+
+CpuTracer::CpuTracer(const Scene& scene, const BVH& bvh, TracerMode mode, int lightSamples, int maxBounces) : _scene(scene), _bvh(bvh), _mode(mode), _maxBounces(maxBounces)
+{
+	_edges = scene.Edges();
+	_surfaces = scene.Surfaces();
+	_packets.Build(bvh, _edges);
+	_lights.Build(scene.lights, lightSamples);
+#if defined(PACKET_TRACING)
+	_usePackets = true;
+#else
+	_usePackets = false;
+#endif
+}
+
+void CpuTracer::SetPacketTracing(bool enabled)
+{
+#if defined(PACKET_TRACING)
+	_usePackets = enabled;
+#else
+	(void)enabled;
+#endif
+}
+
+bool CpuTracer::PacketTracing() const
+{
+	return _usePackets;
+}
+
+// Ray through the center of a pixel, the same as the Fragment Shader's dir.
+// The shader's textureCoord runs from 0 at the bottom of the window, the image's rows run from the top.
+static glm::vec3 PixelDir(const CameraRays& camera, const Image& image, int x, int y)
+{
+	float u = (x + 0.5f) / image.width;
+	float v = (image.height - y - 0.5f) / image.height;
+	return glm::normalize(glm::mix(glm::mix(camera.ray00, camera.ray01, v), glm::mix(camera.ray10, camera.ray11, v), u));
+}
+
+RayCounts CpuTracer::Render(const CameraRays& camera, Image& image, int frameNumber, ThreadPool& pool, GBuffer* gbuffer, TemporalCache* cache) const
+{
+	if (gbuffer != nullptr)
+	{
+		gbuffer->Resize(image.width, image.height);
+	}
+
+	// The basic tracer only traces rays from the camera, there's nothing to reuse
+	if (_mode == TracerMode::Basic)
+	{
+		cache = nullptr;
+	}
+	if (cache != nullptr)
+	{
+		cache->BeginFrame(camera, image.width, image.height);
+	}
+	return TraceRegion(camera, image, gbuffer, cache, frameNumber, pool, 0, 0, image.width, image.height);
+}
+
+RayCounts CpuTracer::RenderRegion(const CameraRays& camera, Image& image, int frameNumber, ThreadPool& pool, int x0, int y0, int x1, int y1) const
+{
+	return TraceRegion(camera, image, nullptr, nullptr, frameNumber, pool, std::max(x0, 0), std::max(y0, 0), std::min(x1, image.width), std::min(y1, image.height));
+}
+
+RayCounts CpuTracer::TraceRegion(const CameraRays& camera, Image& image, GBuffer* gbuffer, TemporalCache* cache, int frameNumber, ThreadPool& pool, int regionX0, int regionY0, int regionX1, int regionY1) const
+{
+	int tilesX = (regionX1 - regionX0 + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (regionY1 - regionY0 + TILE_SIZE - 1) / TILE_SIZE;
+
+	// Each thread counts into its own slot so nothing is shared while tracing
+	std::vector<RayCounts> threadCounts(pool.Size(), RayCounts());
+
+	pool.Run(tilesX * tilesY, [&](int tile, int thread)
+	{
+		int x0 = regionX0 + (tile % tilesX) * TILE_SIZE;
+		int y0 = regionY0 + (tile / tilesX) * TILE_SIZE;
+		int x1 = std::min(regionX1, x0 + TILE_SIZE);
+		int y1 = std::min(regionY1, y0 + TILE_SIZE);
+		RayCounts& counts = threadCounts[thread];
+
+		if (_usePackets)
+		{
+			for (int y = y0; y < y1; y += PACKET_HEIGHT)
+			{
+				for (int x = x0; x < x1; x += PACKET_WIDTH)
+				{
+					TracePacket(camera, image, gbuffer, cache, frameNumber, x, y, x1, y1, counts);
+				}
+			}
+			return;
+		}
+
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int x = x0; x < x1; ++x)
+			{
+				HitInfo first;
+				glm::vec3 dir = PixelDir(camera, image, x, y);
+				uint32_t seed = LightTable::PixelSeed(x, image.height - 1 - y, frameNumber);
+				if (cache != nullptr)
+				{
+					image.At(x, y) = TraceCached(camera.eye, dir, seed, *cache, cache->Current(x, y), counts, first);
+				}
+				else
+				{
+					image.At(x, y) = TracePath(camera.eye, dir, seed, 0, 1.0f, counts, gbuffer != nullptr ? &first : nullptr);
+				}
+				if (gbuffer != nullptr)
+				{
+					SetGBuffer(*gbuffer, x, y, camera.eye, first);
+				}
+			}
+		}
+	});
+
+	RayCounts total = RayCounts();
+	for (unsigned int i = 0; i < threadCounts.size(); ++i)
+	{
+		total.primary += threadCounts[i].primary;
+		total.shadow += threadCounts[i].shadow;
+		total.reflection += threadCounts[i].reflection;
+	}
+	return total;
+}
+
+bool CpuTracer::IntersectTriangles(glm::vec3 origin, glm::vec3 dir, HitInfo& info) const
+{
+	float t;
+	int index = _usePackets ? _packets.Intersect(origin, dir, MAX_SCENE_BOUNDS, t) : _bvh.Intersect(_edges, origin, dir, MAX_SCENE_BOUNDS, t);
+	if (index == -1)
+	{
+		return false;
+	}
+
+	info.point = origin + dir * t;
+	info.normal = PrimitiveNormal(_edges[index], _surfaces[index].normal, info.point);
+	info.index = index;
+	return true;
+}
+
+// GLSL leaves pow undefined for a negative base. Drivers compute it as exp2(y * log2(x)), which gives NaN and is then thrown away
+// by the max(0, ...) around it, so treat it as 0 here rather than letting even powers of negative numbers light the surface.
+static float ShaderPow(float x, float y)
+{
+	return x < 0.0f ? 0.0f : std::pow(x, y);
+}
+
+bool CpuTracer::Occluded(glm::vec3 origin, glm::vec3 dir, float maxDist) const
+{
+	return _usePackets ? _packets.Occluded(origin, dir, maxDist) : _bvh.Occluded(_edges, origin, dir, maxDist);
+}
+
+bool CpuTracer::LightReaches(glm::vec3 lightPos, glm::vec3 pointToLight, const HitInfo& eyeHitPoint, RayCounts& counts) const
+{
+	// Shadow ray, from the light toward the point. Anything it hits more than SHADOW_BIAS short of the point blocks the light.
+	++counts.shadow;
+	return !Occluded(lightPos, glm::normalize(eyeHitPoint.point - lightPos), glm::length(pointToLight) - SHADOW_BIAS);
+}
+
+glm::vec3 CpuTracer::AddToPixColor(glm::vec3 lightPos, glm::vec3 pointToLight, glm::vec3 dir, const HitInfo& eyeHitPoint, float lightIntensity, RayCounts& counts) const
+{
+	if (!LightReaches(lightPos, pointToLight, eyeHitPoint, counts))
+	{
+		return glm::vec3(0.0f);
+	}
+
+	return ShadeLight(pointToLight, dir, eyeHitPoint, lightIntensity);
+}
+
+glm::vec3 CpuTracer::ShadeLight(glm::vec3 pointToLight, glm::vec3 dir, const HitInfo& eyeHitPoint, float lightIntensity) const
+{
+	const TriangleSurface& surface = _surfaces[eyeHitPoint.index];
+	float dist = glm::length(pointToLight);
+	glm::vec3 normalPTL = pointToLight / dist;
+	glm::vec3 r = glm::normalize((2.0f * glm::dot(eyeHitPoint.normal, normalPTL) * eyeHitPoint.normal) - normalPTL);
+	float specular = std::max(0.0f, ShaderPow(glm::dot(r, -dir), 4.0f)) / (dist * dist);
+	float diffuse = std::max(0.0f, glm::dot(eyeHitPoint.normal, normalPTL)) / (dist * dist);
+	glm::vec3 direct = (surface.color * diffuse * lightIntensity) + (lightIntensity * specular * glm::vec3(1.0f));
+
+	// The intermediate tracer has no reflections, so all of the surface is its own color
+	return _mode == TracerMode::Advanced ? direct * (1.0f - REFLECTION_LEVEL) : direct;
+}
+
+// The seed for the bounce'th point along a pixel's path, the same as bounceSeed in RayTracing.glsl
+static uint32_t BounceSeed(uint32_t seed, int bounce)
+{
+	return seed ^ ((uint32_t)bounce * 0x9E3779B9u);
+}
+
+bool CpuTracer::ContinuePath(int bounce, uint32_t seed, float& throughput) const
+{
+	if (_mode != TracerMode::Advanced || bounce >= _maxBounces)
+	{
+		return false;
+	}
+
+	throughput *= REFLECTION_LEVEL * REFLECTION_POWER;
+	if (throughput >= ROULETTE_THROUGHPUT)
+	{
+		return true;
+	}
+
+	// Russian roulette, a path with little left to add only goes on some of the time, and is brighter to make up for the ones that stop
+	float survive = throughput / ROULETTE_THROUGHPUT;
+	if (LightTable::HashToFloat(LightTable::Hash(seed - 1u)) >= survive)
+	{
+		return false;
+	}
+	throughput = ROULETTE_THROUGHPUT;
+	return true;
+}
+
+glm::vec3 CpuTracer::TracePath(glm::vec3 origin, glm::vec3 dir, uint32_t seed, int bounce, float throughput, RayCounts& counts, HitInfo* first) const
+{
+	glm::vec3 pixColor = glm::vec3(0.0f);
+	if (first != nullptr)
+	{
+		first->index = -1;
+	}
+	for (; bounce <= _maxBounces; ++bounce)
+	{
+		HitInfo i;
+		if (bounce == 0)
+		{
+			++counts.primary;
+		}
+		else
+		{
+			++counts.reflection;
+		}
+		if (!IntersectTriangles(origin, dir, i))
+		{
+			break;
+		}
+		if (first != nullptr && first->index == -1)
+		{
+			*first = i;
+		}
+
+		const TriangleSurface& surface = _surfaces[i.index];
+		if (_mode == TracerMode::Basic)
+		{
+			return surface.color;
+		}
+
+		// Some ambient light, then the contribution of each light the point is shaded by
+		glm::vec3 pointColor = surface.color * 0.1f;
+		uint32_t pointSeed = BounceSeed(seed, bounce);
+		for (int j = 0; j < _lights.PerPoint(); ++j)
+		{
+			float weight;
+			const LightTableEntry& light = _lights.entries[_lights.Pick(pointSeed, j, weight)];
+			pointColor += AddToPixColor(light.position, light.position - i.point, dir, i, light.intensity, counts) * weight;
+		}
+		pixColor += pointColor * throughput;
+
+		// One reflection ray for the point, whichever lights it was shaded by
+		if (!ContinuePath(bounce, pointSeed, throughput))
+		{
+			break;
+		}
+		dir = glm::normalize(dir - (2.0f * glm::dot(dir, i.normal) * i.normal));
+		origin = i.point;
+	}
+	return pixColor;
+}
+
+glm::vec3 CpuTracer::Trace(glm::vec3 origin, glm::vec3 dir, uint32_t seed, RayCounts& counts) const
+{
+	return TracePath(origin, dir, seed, 0, 1.0f, counts);
+}
+
+bool CpuTracer::CachesShadows() const
+{
+	return !_lights.Sampled() && _lights.PerPoint() <= HISTORY_MAX_LIGHTS;
+}
+
+void CpuTracer::StartHistory(const TemporalCache& cache, const HitInfo& hit, glm::vec3 dir, uint32_t seed, HistoryEntry& entry, bool& reuseShadows, bool& reuseReflection) const
+{
+	entry.point = hit.point;
+	entry.index = hit.index;
+	entry.dir = dir;
+	entry.visible = 0;
+	entry.reflection = glm::vec3(0.0f);
+	reuseShadows = false;
+	reuseReflection = false;
+
+	const HistoryEntry* previous = cache.Find(hit.point, hit.index);
+	if (previous == nullptr)
+	{
+		// Points that come into view together start at different ages, so they don't all have to be traced again on the same frame
+		entry.age = (int)(LightTable::Hash(seed) % HISTORY_FRAMES);
+		return;
+	}
+	if (previous->age + 1 >= HISTORY_FRAMES)
+	{
+		entry.age = 0;
+		return;
+	}
+
+	entry.age = previous->age + 1;
+	reuseShadows = CachesShadows();
+	if (reuseShadows)
+	{
+		entry.visible = previous->visible;
+	}
+
+	// The reflection goes off the way the camera ray comes in, so it only holds while the camera ray points the same way
+	reuseReflection = glm::dot(previous->dir, dir) >= HISTORY_COSINE;
+	if (reuseReflection)
+	{
+		entry.dir = previous->dir;
+		entry.reflection = previous->reflection;
+	}
+}
+
+glm::vec3 CpuTracer::TraceCached(glm::vec3 origin, glm::vec3 dir, uint32_t seed, const TemporalCache& cache, HistoryEntry& entry, RayCounts& counts, HitInfo& first) const
+{
+	++counts.primary;
+	if (!IntersectTriangles(origin, dir, first))
+	{
+		first.index = -1;
+		entry.index = -1;
+		return glm::vec3(0.0f);
+	}
+
+	bool reuseShadows;
+	bool reuseReflection;
+	StartHistory(cache, first, dir, seed, entry, reuseShadows, reuseReflection);
+
+	// The same as TracePath's first point, but for where the shadows and the reflection come from
+	glm::vec3 pixColor = _surfaces[first.index].color * 0.1f;
+	for (int j = 0; j < _lights.PerPoint(); ++j)
+	{
+		float weight;
+		const LightTableEntry& light = _lights.entries[_lights.Pick(seed, j, weight)];
+		glm::vec3 pointToLight = light.position - first.point;
+		bool reaches;
+		if (reuseShadows)
+		{
+			reaches = ((entry.visible >> j) & 1u) != 0;
+		}
+		else
+		{
+			reaches = LightReaches(light.position, pointToLight, first, counts);
+			if (reaches && CachesShadows())
+			{
+				entry.visible |= 1u << j;
+			}
+		}
+
+		if (reaches)
+		{
+			pixColor += ShadeLight(pointToLight, dir, first, light.intensity) * weight;
+		}
+	}
+
+	float throughput = 1.0f;
+	if (ContinuePath(0, seed, throughput))
+	{
+		if (!reuseReflection)
+		{
+			entry.reflection = TracePath(first.point, glm::normalize(dir - (2.0f * glm::dot(dir, first.normal) * first.normal)), seed, 1, throughput, counts);
+		}
+		pixColor += entry.reflection;
+	}
+	return pixColor;
+}
+
+void CpuTracer::SetGBuffer(GBuffer& gbuffer, int x, int y, glm::vec3 eye, const HitInfo& first) const
+{
+	int pixel = y * gbuffer.width + x;
+	if (first.index == -1)
+	{
+		gbuffer.normals[pixel] = glm::vec3(0.0f);
+		gbuffer.depths[pixel] = 0.0f;
+		gbuffer.albedos[pixel] = glm::vec3(0.0f);
+		return;
+	}
+	gbuffer.normals[pixel] = first.normal;
+	gbuffer.depths[pixel] = glm::length(first.point - eye);
+	gbuffer.albedos[pixel] = _surfaces[first.index].color;
+}
+
+void CpuTracer::TracePacket(const CameraRays& camera, Image& image, GBuffer* gbuffer, TemporalCache* cache, int frameNumber, int x0, int y0, int x1, int y1, RayCounts& counts) const
+{
+	// Camera rays for the pixels of this packet that are inside the tile
+	RayPacket primary;
+	primary.active = 0;
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		int x = x0 + lane % PACKET_WIDTH;
+		int y = y0 + lane / PACKET_WIDTH;
+		if (x < x1 && y < y1)
+		{
+			primary.Set(lane, camera.eye, PixelDir(camera, image, x, y), MAX_SCENE_BOUNDS);
+			++counts.primary;
+		}
+	}
+	_packets.Intersect(primary);
+
+	glm::vec3 colors[PACKET_SIZE];
+	HitInfo hits[PACKET_SIZE];
+	uint32_t seeds[PACKET_SIZE];
+	int hitMask = 0;
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		colors[lane] = glm::vec3(0.0f);
+		hits[lane].index = -1;
+		if ((primary.active & (1 << lane)) && primary.index[lane] != -1)
+		{
+			seeds[lane] = LightTable::PixelSeed(x0 + lane % PACKET_WIDTH, image.height - 1 - (y0 + lane / PACKET_WIDTH), frameNumber);
+			hits[lane].point = camera.eye + glm::vec3(primary.dx[lane], primary.dy[lane], primary.dz[lane]) * primary.t[lane];
+			hits[lane].index = primary.index[lane];
+			hits[lane].normal = PrimitiveNormal(_edges[hits[lane].index], _surfaces[hits[lane].index].normal, hits[lane].point);
+			colors[lane] = _surfaces[hits[lane].index].color * (_mode == TracerMode::Basic ? 1.0f : 0.1f);
+			hitMask |= 1 << lane;
+		}
+	}
+
+	// Where the cache has the shadows or the reflection of a lane's point, the lane sits out of those rays
+	HistoryEntry* entries[PACKET_SIZE];
+	bool reuseShadows[PACKET_SIZE];
+	bool reuseReflection[PACKET_SIZE];
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		reuseShadows[lane] = false;
+		reuseReflection[lane] = false;
+		if (cache == nullptr || (primary.active & (1 << lane)) == 0)
+		{
+			continue;
+		}
+
+		entries[lane] = &cache->Current(x0 + lane % PACKET_WIDTH, y0 + lane / PACKET_WIDTH);
+		entries[lane]->index = -1;
+		if (hitMask & (1 << lane))
+		{
+			StartHistory(*cache, hits[lane], glm::vec3(primary.dx[lane], primary.dy[lane], primary.dz[lane]), seeds[lane], *entries[lane], reuseShadows[lane], reuseReflection[lane]);
+		}
+	}
+
+	if (_mode != TracerMode::Basic)
+	{
+		for (int j = 0; j < _lights.PerPoint(); ++j)
+		{
+			// When every light is used, every shadow ray toward one light starts at the light, so these make an even more coherent packet than the camera rays.
+			// Sampled lights differ from lane to lane, which makes for a less coherent packet, but still only one per light sample.
+			RayPacket shadow;
+			shadow.active = 0;
+			const LightTableEntry* lights[PACKET_SIZE];
+			float weights[PACKET_SIZE];
+			for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			{
+				if (hitMask & (1 << lane))
+				{
+					lights[lane] = &_lights.entries[_lights.Pick(seeds[lane], j, weights[lane])];
+					if (reuseShadows[lane])
+					{
+						continue;
+					}
+					glm::vec3 lightToPoint = hits[lane].point - lights[lane]->position;
+					shadow.Set(lane, lights[lane]->position, glm::normalize(lightToPoint), glm::length(lightToPoint) - SHADOW_BIAS);
+					++counts.shadow;
+				}
+			}
+			_packets.Occluded(shadow);
+
+			for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			{
+				if ((hitMask & (1 << lane)) == 0)
+				{
+					continue;
+				}
+
+				if (reuseShadows[lane])
+				{
+					if (((entries[lane]->visible >> j) & 1u) == 0)
+					{
+						continue;
+					}
+				}
+				else if (shadow.index[lane] != -1)
+				{
+					continue;
+				}
+				else if (cache != nullptr && CachesShadows())
+				{
+					entries[lane]->visible |= 1u << j;
+				}
+				glm::vec3 pointToLight = lights[lane]->position - hits[lane].point;
+
+				glm::vec3 dir = glm::vec3(primary.dx[lane], primary.dy[lane], primary.dz[lane]);
+				colors[lane] += ShadeLight(pointToLight, dir, hits[lane], lights[lane]->intensity) * weights[lane];
+			}
+		}
+
+		// Reflection rays scatter in every direction, the rest of each path is traced one ray at a time
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			float throughput = 1.0f;
+			if ((hitMask & (1 << lane)) && ContinuePath(0, seeds[lane], throughput))
+			{
+				if (reuseReflection[lane])
+				{
+					colors[lane] += entries[lane]->reflection;
+					continue;
+				}
+
+				glm::vec3 dir = glm::vec3(primary.dx[lane], primary.dy[lane], primary.dz[lane]);
+				glm::vec3 normal = hits[lane].normal;
+				glm::vec3 reflection = TracePath(hits[lane].point, glm::normalize(dir - (2.0f * glm::dot(dir, normal) * normal)), seeds[lane], 1, throughput, counts);
+				colors[lane] += reflection;
+				if (cache != nullptr)
+				{
+					entries[lane]->reflection = reflection;
+				}
+			}
+		}
+	}
+
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (primary.active & (1 << lane))
+		{
+			image.At(x0 + lane % PACKET_WIDTH, y0 + lane / PACKET_WIDTH) = colors[lane];
+			if (gbuffer != nullptr)
+			{
+				SetGBuffer(*gbuffer, x0 + lane % PACKET_WIDTH, y0 + lane / PACKET_WIDTH, camera.eye, hits[lane]);
+			}
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cstdint>
+#include "Scene.h"
+#include "BVH.h"
+#include "PacketBVH.h"
+#include "LightTable.h"
+#include "Image.h"
+#include "ThreadPool.h"
+
+// Which of the three ray tracer tutorials to reproduce.
+// Basic is flat color, Intermediate adds the scene's lights with shadows, Advanced adds reflections.
+enum class TracerMode
+{
+	Basic,
+	Intermediate,
+	Advanced
+};
+
+// The uniforms the Fragment Shader gets, the camera position and the four corner rays from calcCameraRays
+struct CameraRays
+{
+	glm::vec3 eye;
+	glm::vec3 ray00;
+	glm::vec3 ray01;
+	glm::vec3 ray10;
+	glm::vec3 ray11;
+};
+
+struct RayCounts
+{
+	uint64_t primary;
+	uint64_t shadow;
+	uint64_t reflection;
+
+	uint64_t Total() const { return primary + shadow + reflection; }
+};
+
+class TemporalCache;
+struct HistoryEntry;
+
+// The Fragment Shader's trace, addToPixColor and intersectTriangles on the CPU. It renders the same picture as the
+// GPU does for the same scene and camera, which makes it a reference to check the shaders against, and lets the
+// tutorials render on machines without a GPU. The image is split into tiles that are traced on a thread pool.
+class CpuTracer
+{
+public:
+	// Each point is shaded by lightSamples of the scene's lights, or all of them if there are no more than that (see LightTable.h).
+	// In Advanced mode rays from the camera reflect up to maxBounces times.
+	CpuTracer(const Scene& scene, const BVH& bvh, TracerMode mode, int lightSamples, int maxBounces);
+
+	// Packets of 8 camera and shadow rays with 8 wide triangle tests, on by default when built with AVX2.
+	// Off traces one ray at a time through BVH::Intersect, the same as the shader does.
+	void SetPacketTracing(bool enabled);
+	bool PacketTracing() const;
+
+	// Traces one ray through the center of every pixel of image, at image's size. Returns the rays traced.
+	// frameNumber picks the lights each pixel is shaded by, the same ones the shaders pick on that frame since the camera last moved.
+	// If gbuffer is given it's resized to match and filled in with what each pixel's ray hit first, for the denoiser.
+	// If cache is given, shadows and reflections the last frame rendered with it traced are reused wherever they still hold, see TemporalCache.h.
+	RayCounts Render(const CameraRays& camera, Image& image, int frameNumber, ThreadPool& pool, GBuffer* gbuffer = nullptr, TemporalCache* cache = nullptr) const;
+	// Traces only the pixels from x0, y0 up to but not including x1, y1 of a frame the size of image, leaving the rest of image as it was.
+	// Each pixel comes out the same as Render would trace it. The render farm's workers trace their tiles with it, see RenderFarm.h.
+	RayCounts RenderRegion(const CameraRays& camera, Image& image, int frameNumber, ThreadPool& pool, int x0, int y0, int x1, int y1) const;
+
+	// Color seen along one ray, adding to counts for every ray it takes. seed picks the lights and where the path ends, see LightTable::PixelSeed.
+	glm::vec3 Trace(glm::vec3 origin, glm::vec3 dir, uint32_t seed, RayCounts& counts) const;
+private:
+	struct HitInfo
+	{
+		glm::vec3 point;
+		// The surface's normal at point, see PrimitiveNormal
+		glm::vec3 normal;
+		int index;
+	};
+
+	bool IntersectTriangles(glm::vec3 origin, glm::vec3 dir, HitInfo& info) const;
+	// Whether anything is within maxDist along the ray, for shadows
+	bool Occluded(glm::vec3 origin, glm::vec3 dir, float maxDist) const;
+	// The shadow ray of addToPixColor, whether the light reaches the point rather than something being in the way
+	bool LightReaches(glm::vec3 lightPos, glm::vec3 pointToLight, const HitInfo& eyeHitPoint, RayCounts& counts) const;
+	glm::vec3 AddToPixColor(glm::vec3 lightPos, glm::vec3 pointToLight, glm::vec3 dir, const HitInfo& eyeHitPoint, float lightIntensity, RayCounts& counts) const;
+	// Everything addToPixColor does after finding the point isn't in shadow
+	glm::vec3 ShadeLight(glm::vec3 pointToLight, glm::vec3 dir, const HitInfo& eyeHitPoint, float lightIntensity) const;
+	// The shaders' continuePath and tracePath, the reflections of a path from its bounce'th point on
+	bool ContinuePath(int bounce, uint32_t seed, float& throughput) const;
+	// If first is given it's set to the first point the path hits, with an index of -1 if it hits nothing.
+	glm::vec3 TracePath(glm::vec3 origin, glm::vec3 dir, uint32_t seed, int bounce, float throughput, RayCounts& counts, HitInfo* first = nullptr) const;
+	// Render's work once the G-buffer and cache are ready, split into tiles over the pool
+	RayCounts TraceRegion(const CameraRays& camera, Image& image, GBuffer* gbuffer, TemporalCache* cache, int frameNumber, ThreadPool& pool, int x0, int y0, int x1, int y1) const;
+	// Traces the packet of pixels with its top left corner at x0, y0, leaving out any past x1, y1
+	void TracePacket(const CameraRays& camera, Image& image, GBuffer* gbuffer, TemporalCache* cache, int frameNumber, int x0, int y0, int x1, int y1, RayCounts& counts) const;
+	// Whether every light's shadow fits in a HistoryEntry. Sampled lights change every frame, so there's nothing to reuse of theirs.
+	bool CachesShadows() const;
+	// Starts a pixel's entry in the cache for this frame from where its camera ray hit, and keeps whatever of last frame's can be reused
+	void StartHistory(const TemporalCache& cache, const HitInfo& hit, glm::vec3 dir, uint32_t seed, HistoryEntry& entry, bool& reuseShadows, bool& reuseReflection) const;
+	// TracePath from the camera with the cache, the first point's shadows and reflection come from entry where they can and are kept there where they're traced.
+	// first is set the same as TracePath's.
+	glm::vec3 TraceCached(glm::vec3 origin, glm::vec3 dir, uint32_t seed, const TemporalCache& cache, HistoryEntry& entry, RayCounts& counts, HitInfo& first) const;
+	// Fills in a pixel of the G-buffer from its camera ray's first hit
+	void SetGBuffer(GBuffer& gbuffer, int x, int y, glm::vec3 eye, const HitInfo& first) const;
+
+	const Scene& _scene;
+	const BVH& _bvh;
+	TracerMode _mode;
+	int _maxBounces;
+	// The scene's triangles split the same way the shaders get them, what the intersection tests read apart from what shading reads
+	std::vector<TriangleEdges> _edges;
+	std::vector<TriangleSurface> _surfaces;
+	PacketBVH _packets;
+	LightTable _lights;
+	bool _usePackets;
+};
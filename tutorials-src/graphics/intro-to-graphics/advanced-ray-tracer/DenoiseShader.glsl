@@ -0,0 +1,176 @@
+/*
+Title: Advanced Ray Tracer
+File Name: DenoiseShader.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Denoises the frame the Compute Shader traced, with the same edge 
+avoiding -trous filter as the CPU tracer's (see Denoiser.h). The 
+tracer writes the noisy frame and a G-buffer of what each pixel's 
+camera ray hit first, its normal, depth and albedo.
+
+The stage uniform picks what a dispatch does. VARIANCE_STAGE estimates 
+how noisy each pixel is from its neighbours on the same surface. Each 
+ATROUS_STAGE dispatch is one pass of the filter, a 5x5 kernel with its 
+taps stepSize pixels apart, each tap weighted by how alike its normal, 
+depth, albedo and luminance are to the pixel's. main.cpp runs the passes 
+with stepSize doubling, back and forth between two images, and the last 
+pass writes the output image that is copied to the window.
+*/
+
+#version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// What this dispatch does, these match the constants in main.cpp.
+#define VARIANCE_STAGE 0
+#define ATROUS_STAGE 1
+uniform int stage;
+// How far apart the taps of this pass are
+uniform int stepSize;
+// Set on the last pass, which writes the output image rather than filterTarget
+uniform bool lastPass;
+
+// How strongly each guide stops the filter, these match Denoiser.h.
+#define NORMAL_POWER 128.0
+#define SIGMA_DEPTH 1.0
+#define SIGMA_LUMINANCE 4.0
+#define SIGMA_ALBEDO 0.05
+#define EPSILON 0.0001
+
+layout(binding = 1, rgba8) writeonly uniform image2D outputImage;
+// What the Compute Shader wrote. The normal is zero where the ray hit nothing.
+layout(binding = 2, rgba32f) readonly uniform image2D noisyImage;
+layout(binding = 3, rgba32f) readonly uniform image2D normalDepthImage;
+layout(binding = 4, rgba8) readonly uniform image2D albedoImage;
+// The color with its variance in alpha, read from one of these and written to the other
+layout(binding = 5, rgba32f) readonly uniform image2D filterSource;
+layout(binding = 6, rgba32f) writeonly uniform image2D filterTarget;
+
+// The B3 spline, the weights of the 5x5 kernel along each axis
+const float kernel[5] = float[5](1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float luminance(vec3 color)
+{
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Whether two pixels' normals face the same way, close enough to be the same surface. Pixels off the image load as zero, which never do.
+bool sameSurface(vec4 a, vec4 b)
+{
+	return dot(a.xyz, b.xyz) > 0.9;
+}
+
+// How fast the depth changes from the pixel to its neighbours on the same surface, which is how far apart depths can be and still be the same surface.
+float depthGradient(ivec2 pixel, vec4 center)
+{
+	float gradient = 0.0;
+	ivec2 neighbours[4] = ivec2[4](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+	for (int n = 0; n < 4; n++)
+	{
+		vec4 other = imageLoad(normalDepthImage, pixel + neighbours[n]);
+		if (sameSurface(center, other))
+		{
+			gradient = max(gradient, abs(center.w - other.w));
+		}
+	}
+	return gradient;
+}
+
+void main(void)
+{
+	ivec2 size = imageSize(normalDepthImage);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (pixel.x >= size.x || pixel.y >= size.y)
+	{
+		return;
+	}
+	vec4 normalDepth = imageLoad(normalDepthImage, pixel);
+
+	if (stage == VARIANCE_STAGE)
+	{
+		// The variance of the luminance over the 3x3 block around the pixel, counting only the neighbours on the same surface.
+		float sum = 0.0;
+		float sumSquares = 0.0;
+		float count = 0.0;
+		for (int j = -1; j <= 1; j++)
+		{
+			for (int i = -1; i <= 1; i++)
+			{
+				ivec2 q = pixel + ivec2(i, j);
+				if (sameSurface(normalDepth, imageLoad(normalDepthImage, q)))
+				{
+					float l = luminance(imageLoad(noisyImage, q).rgb);
+					sum += l;
+					sumSquares += l * l;
+					count += 1.0;
+				}
+			}
+		}
+		float mean = sum / max(count, 1.0);
+		float variance = count > 0.0 ? max(0.0, sumSquares / count - mean * mean) : 0.0;
+		imageStore(filterTarget, pixel, vec4(imageLoad(noisyImage, pixel).rgb, variance));
+		return;
+	}
+
+	// ATROUS_STAGE
+	vec4 center = imageLoad(filterSource, pixel);
+	vec3 albedo = imageLoad(albedoImage, pixel).rgb;
+	float centerLuminance = luminance(center.rgb);
+	float luminanceScale = SIGMA_LUMINANCE * sqrt(center.a) + EPSILON;
+	float depthScale = SIGMA_DEPTH * depthGradient(pixel, normalDepth) * float(stepSize);
+
+	vec3 color = vec3(0.0);
+	float variance = 0.0;
+	float weights = 0.0;
+	for (int j = -2; j <= 2; j++)
+	{
+		for (int i = -2; i <= 2; i++)
+		{
+			ivec2 q = pixel + ivec2(i, j) * stepSize;
+			vec4 tap = imageLoad(filterSource, q);
+			vec4 otherNormalDepth = imageLoad(normalDepthImage, q);
+			vec3 albedoDifference = albedo - imageLoad(albedoImage, q).rgb;
+
+			float normalWeight = pow(max(0.0, dot(normalDepth.xyz, otherNormalDepth.xyz)), NORMAL_POWER);
+			float depthDistance = abs(normalDepth.w - otherNormalDepth.w) / (depthScale * float(abs(i) + abs(j)) + EPSILON);
+			float luminanceDistance = abs(centerLuminance - luminance(tap.rgb)) / luminanceScale;
+			float albedoDistance = dot(albedoDifference, albedoDifference) / SIGMA_ALBEDO;
+			float w = kernel[i + 2] * kernel[j + 2] * normalWeight * exp(-(depthDistance + luminanceDistance + albedoDistance));
+
+			color += tap.rgb * w;
+			// The variance of a weighted average goes with the square of the weights
+			variance += tap.a * w * w;
+			weights += w;
+		}
+	}
+
+	// A pixel that saw nothing has no normal, not even a match with itself, and stays as it is
+	vec4 result = weights > 0.0 ? vec4(color / weights, variance / (weights * weights)) : center;
+	if (lastPass)
+	{
+		imageStore(outputImage, pixel, vec4(result.rgb, 1.0));
+	}
+	else
+	{
+		imageStore(filterTarget, pixel, result);
+	}
+}
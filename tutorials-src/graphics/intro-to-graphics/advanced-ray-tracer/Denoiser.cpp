@@ -0,0 +1,342 @@
+#include "Denoiser.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(DENOISE_SIMD)
+#include <immintrin.h>
+#endif
+
+// The B3 spline, the weights of the 5x5 kernel along each axis
+static const float KERNEL[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+// Keeps the edge stops from dividing by zero where the depth is flat or there's no noise
+static const float EPSILON = 0.0001f;
+
+static float Luminance(float r, float g, float b)
+{
+	return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// How alike two normals are, from their dot product. Facing apart, or either of them zero, gives no weight.
+static float NormalWeight(float d)
+{
+	d = std::max(d, 0.0f);
+	for (int i = 0; i < DENOISE_NORMAL_SQUARINGS; ++i)
+	{
+		d *= d;
+	}
+	return d;
+}
+
+Denoiser::Denoiser(int iterations) : _iterations(iterations)
+{
+#if defined(DENOISE_SIMD)
+	_useSIMD = true;
+#else
+	_useSIMD = false;
+#endif
+}
+
+void Denoiser::SetSIMD(bool enabled)
+{
+#if defined(DENOISE_SIMD)
+	_useSIMD = enabled;
+#else
+	(void)enabled;
+#endif
+}
+
+bool Denoiser::SIMD() const
+{
+	return _useSIMD;
+}
+
+void Denoiser::Load(const Image& image, const GBuffer& gbuffer, ThreadPool& pool)
+{
+	_width = image.width;
+	_height = image.height;
+	_border = 2 * (1 << (_iterations - 1)) + 8;
+	_stride = _width + 2 * _border;
+	int size = _stride * (_height + 2 * _border);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		_red[i].assign(size, 0.0f);
+		_green[i].assign(size, 0.0f);
+		_blue[i].assign(size, 0.0f);
+		_variance[i].assign(size, 0.0f);
+	}
+	_normalX.assign(size, 0.0f);
+	_normalY.assign(size, 0.0f);
+	_normalZ.assign(size, 0.0f);
+	_depth.assign(size, 0.0f);
+	_depthGradient.assign(size, 0.0f);
+	_albedoRed.assign(size, 0.0f);
+	_albedoGreen.assign(size, 0.0f);
+	_albedoBlue.assign(size, 0.0f);
+
+	for (int y = 0; y < _height; ++y)
+	{
+		for (int x = 0; x < _width; ++x)
+		{
+			int p = Index(x, y);
+			int pixel = y * _width + x;
+			_red[0][p] = image.pixels[pixel].r;
+			_green[0][p] = image.pixels[pixel].g;
+			_blue[0][p] = image.pixels[pixel].b;
+			_normalX[p] = gbuffer.normals[pixel].x;
+			_normalY[p] = gbuffer.normals[pixel].y;
+			_normalZ[p] = gbuffer.normals[pixel].z;
+			_depth[p] = gbuffer.depths[pixel];
+			_albedoRed[p] = gbuffer.albedos[pixel].r;
+			_albedoGreen[p] = gbuffer.albedos[pixel].g;
+			_albedoBlue[p] = gbuffer.albedos[pixel].b;
+		}
+	}
+
+	pool.Run(_height, [&](int y, int)
+	{
+		for (int x = 0; x < _width; ++x)
+		{
+			int p = Index(x, y);
+
+			// How fast the depth changes from this pixel to its neighbours on the same surface, which is how far apart depths can be
+			// and still be the same surface. A floor seen at a glancing angle changes depth quickly from pixel to pixel.
+			int neighbours[4] = { p - 1, p + 1, p - _stride, p + _stride };
+			float gradient = 0.0f;
+			for (int n : neighbours)
+			{
+				if (_normalX[p] * _normalX[n] + _normalY[p] * _normalY[n] + _normalZ[p] * _normalZ[n] > 0.9f)
+				{
+					gradient = std::max(gradient, std::abs(_depth[p] - _depth[n]));
+				}
+			}
+			_depthGradient[p] = gradient;
+
+			// The variance of the luminance over the 3x3 block around the pixel, counting only the neighbours that face the same way.
+			// SVGF gets this from the pixel's own history, without one this is the best guess at how noisy the pixel is.
+			float sum = 0.0f;
+			float sumSquares = 0.0f;
+			int count = 0;
+			for (int j = -1; j <= 1; ++j)
+			{
+				for (int i = -1; i <= 1; ++i)
+				{
+					int q = p + j * _stride + i;
+					if (_normalX[p] * _normalX[q] + _normalY[p] * _normalY[q] + _normalZ[p] * _normalZ[q] > 0.9f)
+					{
+						float l = Luminance(_red[0][q], _green[0][q], _blue[0][q]);
+						sum += l;
+						sumSquares += l * l;
+						++count;
+					}
+				}
+			}
+			if (count > 0)
+			{
+				float mean = sum / count;
+				_variance[0][p] = std::max(0.0f, sumSquares / count - mean * mean);
+			}
+		}
+	});
+}
+
+void Denoiser::PassRow(int y, int step, int source)
+{
+	int target = 1 - source;
+	for (int x = 0; x < _width; ++x)
+	{
+		int p = Index(x, y);
+		float luminance = Luminance(_red[source][p], _green[source][p], _blue[source][p]);
+		float luminanceScale = DENOISE_SIGMA_LUMINANCE * std::sqrt(_variance[source][p]) + EPSILON;
+
+		float red = 0.0f;
+		float green = 0.0f;
+		float blue = 0.0f;
+		float variance = 0.0f;
+		float weights = 0.0f;
+		for (int j = -2; j <= 2; ++j)
+		{
+			for (int i = -2; i <= 2; ++i)
+			{
+				int q = p + (j * _stride + i) * step;
+				float normal = NormalWeight(_normalX[p] * _normalX[q] + _normalY[p] * _normalY[q] + _normalZ[p] * _normalZ[q]);
+				float depth = std::abs(_depth[p] - _depth[q]) / (DENOISE_SIGMA_DEPTH * _depthGradient[p] * step * (std::abs(i) + std::abs(j)) + EPSILON);
+				float color = std::abs(luminance - Luminance(_red[source][q], _green[source][q], _blue[source][q])) / luminanceScale;
+				float ar = _albedoRed[p] - _albedoRed[q];
+				float ag = _albedoGreen[p] - _albedoGreen[q];
+				float ab = _albedoBlue[p] - _albedoBlue[q];
+				float albedo = (ar * ar + ag * ag + ab * ab) / DENOISE_SIGMA_ALBEDO;
+				float w = KERNEL[i + 2] * KERNEL[j + 2] * normal * std::exp(-(depth + color + albedo));
+
+				red += _red[source][q] * w;
+				green += _green[source][q] * w;
+				blue += _blue[source][q] * w;
+				// The variance of a weighted average goes with the square of the weights
+				variance += _variance[source][q] * w * w;
+				weights += w;
+			}
+		}
+
+		// A pixel that saw nothing has no normal, not even a match with itself, and stays as it is
+		if (weights > 0.0f)
+		{
+			_red[target][p] = red / weights;
+			_green[target][p] = green / weights;
+			_blue[target][p] = blue / weights;
+			_variance[target][p] = variance / (weights * weights);
+		}
+		else
+		{
+			_red[target][p] = _red[source][p];
+			_green[target][p] = _green[source][p];
+			_blue[target][p] = _blue[source][p];
+			_variance[target][p] = _variance[source][p];
+		}
+	}
+}
+
+#if defined(DENOISE_SIMD)
+// e^x for x <= 0, to within about 0.02%, which is plenty for a weight. x is split into a whole power of 2, which goes straight into
+// the exponent bits, and a fraction, which a polynomial takes care of.
+static __m256 ExpNegative(__m256 x)
+{
+	x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+	__m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+	__m256 whole = _mm256_floor_ps(t);
+	__m256 f = _mm256_sub_ps(t, whole);
+
+	// 2^f for f from 0 to 1, the Taylor series of e^(f ln 2)
+	__m256 p = _mm256_set1_ps(0.00133335581f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.00961812911f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.0555041087f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.240226507f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.693147181f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+	__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+static __m256 Luminance(__m256 r, __m256 g, __m256 b)
+{
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.2126f)), _mm256_mul_ps(g, _mm256_set1_ps(0.7152f))), _mm256_mul_ps(b, _mm256_set1_ps(0.0722f)));
+}
+
+// The same as PassRow for 8 pixels of the row at a time. The last block of a row runs into the padding, which is filtered
+// along with it and, having no normal, keeps its zeros.
+void Denoiser::PassRowSIMD(int y, int step, int source)
+{
+	int target = 1 - source;
+	const float* red = _red[source].data();
+	const float* green = _green[source].data();
+	const float* blue = _blue[source].data();
+	const float* varianceIn = _variance[source].data();
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+	for (int x = 0; x < _width; x += 8)
+	{
+		int p = Index(x, y);
+		__m256 nx = _mm256_loadu_ps(&_normalX[p]);
+		__m256 ny = _mm256_loadu_ps(&_normalY[p]);
+		__m256 nz = _mm256_loadu_ps(&_normalZ[p]);
+		__m256 z = _mm256_loadu_ps(&_depth[p]);
+		__m256 depthScale = _mm256_mul_ps(_mm256_loadu_ps(&_depthGradient[p]), _mm256_set1_ps(DENOISE_SIGMA_DEPTH * step));
+		__m256 ar = _mm256_loadu_ps(&_albedoRed[p]);
+		__m256 ag = _mm256_loadu_ps(&_albedoGreen[p]);
+		__m256 ab = _mm256_loadu_ps(&_albedoBlue[p]);
+		__m256 luminance = Luminance(_mm256_loadu_ps(red + p), _mm256_loadu_ps(green + p), _mm256_loadu_ps(blue + p));
+		__m256 luminanceScale = _mm256_add_ps(_mm256_mul_ps(_mm256_sqrt_ps(_mm256_loadu_ps(varianceIn + p)), _mm256_set1_ps(DENOISE_SIGMA_LUMINANCE)), _mm256_set1_ps(EPSILON));
+		__m256 invLuminanceScale = _mm256_div_ps(_mm256_set1_ps(1.0f), luminanceScale);
+
+		__m256 sumRed = zero;
+		__m256 sumGreen = zero;
+		__m256 sumBlue = zero;
+		__m256 sumVariance = zero;
+		__m256 weights = zero;
+		for (int j = -2; j <= 2; ++j)
+		{
+			for (int i = -2; i <= 2; ++i)
+			{
+				int q = p + (j * _stride + i) * step;
+
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_loadu_ps(&_normalX[q])), _mm256_mul_ps(ny, _mm256_loadu_ps(&_normalY[q]))), _mm256_mul_ps(nz, _mm256_loadu_ps(&_normalZ[q])));
+				d = _mm256_max_ps(d, zero);
+				for (int s = 0; s < DENOISE_NORMAL_SQUARINGS; ++s)
+				{
+					d = _mm256_mul_ps(d, d);
+				}
+
+				__m256 depthDenominator = _mm256_add_ps(_mm256_mul_ps(depthScale, _mm256_set1_ps((float)(std::abs(i) + std::abs(j)))), _mm256_set1_ps(EPSILON));
+				__m256 depth = _mm256_div_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(z, _mm256_loadu_ps(&_depth[q]))), depthDenominator);
+
+				__m256 r = _mm256_loadu_ps(red + q);
+				__m256 g = _mm256_loadu_ps(green + q);
+				__m256 b = _mm256_loadu_ps(blue + q);
+				__m256 color = _mm256_mul_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(luminance, Luminance(r, g, b))), invLuminanceScale);
+
+				__m256 dr = _mm256_sub_ps(ar, _mm256_loadu_ps(&_albedoRed[q]));
+				__m256 dg = _mm256_sub_ps(ag, _mm256_loadu_ps(&_albedoGreen[q]));
+				__m256 db = _mm256_sub_ps(ab, _mm256_loadu_ps(&_albedoBlue[q]));
+				__m256 albedo = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_mul_ps(db, db)), _mm256_set1_ps(1.0f / DENOISE_SIGMA_ALBEDO));
+
+				__m256 exponent = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_add_ps(depth, color), albedo));
+				__m256 w = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(KERNEL[i + 2] * KERNEL[j + 2]), d), ExpNegative(exponent));
+
+				sumRed = _mm256_add_ps(sumRed, _mm256_mul_ps(r, w));
+				sumGreen = _mm256_add_ps(sumGreen, _mm256_mul_ps(g, w));
+				sumBlue = _mm256_add_ps(sumBlue, _mm256_mul_ps(b, w));
+				sumVariance = _mm256_add_ps(sumVariance, _mm256_mul_ps(_mm256_loadu_ps(varianceIn + q), _mm256_mul_ps(w, w)));
+				weights = _mm256_add_ps(weights, w);
+			}
+		}
+
+		// Pixels with no weight keep what they had. Dividing by a weight of 1 there keeps the division from making NaNs to throw away.
+		__m256 weighted = _mm256_cmp_ps(weights, zero, _CMP_GT_OQ);
+		__m256 invWeights = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_blendv_ps(_mm256_set1_ps(1.0f), weights, weighted));
+		_mm256_storeu_ps(&_red[target][p], _mm256_blendv_ps(_mm256_loadu_ps(red + p), _mm256_mul_ps(sumRed, invWeights), weighted));
+		_mm256_storeu_ps(&_green[target][p], _mm256_blendv_ps(_mm256_loadu_ps(green + p), _mm256_mul_ps(sumGreen, invWeights), weighted));
+		_mm256_storeu_ps(&_blue[target][p], _mm256_blendv_ps(_mm256_loadu_ps(blue + p), _mm256_mul_ps(sumBlue, invWeights), weighted));
+		_mm256_storeu_ps(&_variance[target][p], _mm256_blendv_ps(_mm256_loadu_ps(varianceIn + p), _mm256_mul_ps(sumVariance, _mm256_mul_ps(invWeights, invWeights)), weighted));
+	}
+}
+#endif
+
+void Denoiser::Filter(Image& image, const GBuffer& gbuffer, ThreadPool& pool)
+{
+	if (image.width == 0 || image.height == 0 || _iterations < 1)
+	{
+		return;
+	}
+
+	Load(image, gbuffer, pool);
+
+	// Each pass reads the planes the last one wrote. The rows of a pass are independent, so they're shared between the threads.
+	int source = 0;
+	for (int i = 0; i < _iterations; ++i)
+	{
+		int step = 1 << i;
+		pool.Run(_height, [&](int y, int)
+		{
+#if defined(DENOISE_SIMD)
+			if (_useSIMD)
+			{
+				PassRowSIMD(y, step, source);
+				return;
+			}
+#endif
+			PassRow(y, step, source);
+		});
+		source = 1 - source;
+	}
+
+	for (int y = 0; y < _height; ++y)
+	{
+		for (int x = 0; x < _width; ++x)
+		{
+			int p = Index(x, y);
+			image.At(x, y) = glm::vec3(_red[source][p], _green[source][p], _blue[source][p]);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include "Image.h"
+#include "ThreadPool.h"
+
+// The wide passes take 8 pixels of a row at a time with AVX2, builds without it filter one pixel at a time
+#if defined(__AVX2__)
+#define DENOISE_SIMD 1
+#endif
+
+// How strongly each guide stops the filter, these match DenoiseShader.glsl. Normals are compared by their dot product to this power,
+// depths by how far apart they are against how fast the depth changes around the pixel, colors by how far apart their luminance is
+// against how noisy the pixel is, and albedos by the square of how far apart they are.
+// The CPU raises the dot product to the power of 128 by squaring it DENOISE_NORMAL_SQUARINGS times.
+const float DENOISE_NORMAL_POWER = 128.0f;
+const int DENOISE_NORMAL_SQUARINGS = 7;
+const float DENOISE_SIGMA_DEPTH = 1.0f;
+const float DENOISE_SIGMA_LUMINANCE = 4.0f;
+const float DENOISE_SIGMA_ALBEDO = 0.05f;
+
+// Edge avoiding -trous filter, the spatial part of SVGF (spatiotemporal variance-guided filtering). Each pass blurs every pixel
+// with a 5x5 kernel whose taps are step pixels apart, step doubling every pass, so five passes cover a 125 pixel wide area for the cost
+// of 125 taps. Taps only count as much as they look like the same surface: a similar normal, depth and albedo in the G-buffer, and a color
+// no further off than the noise there explains. The noise is estimated from the pixel's neighbours, then filtered along with the color
+// so later passes trust it less as the picture gets smoother. Shadow and reflection noise is blurred away while the edges of the
+// geometry stay sharp, which lets the tracer take one sample per pixel and still give a clean picture.
+class Denoiser
+{
+public:
+	// Passes of the filter, 5 gives taps up to 16 pixels apart
+	Denoiser(int iterations = 5);
+
+	// Filters image in place, guided by gbuffer, which has to be the same size
+	void Filter(Image& image, const GBuffer& gbuffer, ThreadPool& pool);
+
+	// Wide passes on by default when built with AVX2, off filters one pixel at a time
+	void SetSIMD(bool enabled);
+	bool SIMD() const;
+
+	int Iterations() const { return _iterations; }
+private:
+	// Copies the image and G-buffer into the padded planes, and works out each pixel's depth gradient and starting variance
+	void Load(const Image& image, const GBuffer& gbuffer, ThreadPool& pool);
+	// One pass of the filter over row y, from the source planes into the destination planes
+	void PassRow(int y, int step, int source);
+#if defined(DENOISE_SIMD)
+	void PassRowSIMD(int y, int step, int source);
+#endif
+
+	int _iterations;
+	bool _useSIMD;
+
+	// The planes are padded with _border pixels all round, wider than the farthest tap plus a block of 8, so taps never need bounds checks.
+	// Padding has a zero normal, which gives it no weight.
+	int _width;
+	int _height;
+	int _border;
+	int _stride;
+	int Index(int x, int y) const { return (y + _border) * _stride + x + _border; }
+
+	// Color and variance, twice over, passes read from one and write to the other
+	std::vector<float> _red[2];
+	std::vector<float> _green[2];
+	std::vector<float> _blue[2];
+	std::vector<float> _variance[2];
+	// The guides, which stay the same through all the passes
+	std::vector<float> _normalX;
+	std::vector<float> _normalY;
+	std::vector<float> _normalZ;
+	std::vector<float> _depth;
+	std::vector<float> _depthGradient;
+	std::vector<float> _albedoRed;
+	std::vector<float> _albedoGreen;
+	std::vector<float> _albedoBlue;
+};
@@ -0,0 +1,126 @@
+#include "Image.h"
+#include <fstream>
+#include <cmath>
+#include <limits>
+
+static unsigned char ToByte(float c)
+{
+	c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+	return (unsigned char)(c * 255.0f + 0.5f);
+}
+
+Image::Image()
+{
+	width = 0;
+	height = 0;
+}
+
+Image::Image(int w, int h)
+{
+	Resize(w, h);
+}
+
+void Image::Resize(int w, int h)
+{
+	width = w;
+	height = h;
+	pixels.assign(w * h, glm::vec3(0.0f));
+}
+
+void GBuffer::Resize(int w, int h)
+{
+	width = w;
+	height = h;
+	normals.assign(w * h, glm::vec3(0.0f));
+	depths.assign(w * h, 0.0f);
+	albedos.assign(w * h, glm::vec3(0.0f));
+}
+
+bool Image::WritePPM(const std::string& fileName) const
+{
+	std::ofstream file(fileName, std::ios::out | std::ios::binary);
+	if (!file.good())
+	{
+		return false;
+	}
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> bytes(pixels.size() * 3);
+	for (unsigned int i = 0; i < pixels.size(); ++i)
+	{
+		bytes[i * 3] = ToByte(pixels[i].x);
+		bytes[i * 3 + 1] = ToByte(pixels[i].y);
+		bytes[i * 3 + 2] = ToByte(pixels[i].z);
+	}
+	file.write((const char*)bytes.data(), bytes.size());
+	return file.good();
+}
+
+bool Image::ReadPPM(const std::string& fileName)
+{
+	std::ifstream file(fileName, std::ios::in | std::ios::binary);
+	if (!file.good())
+	{
+		return false;
+	}
+
+	std::string magic;
+	int w, h, maxValue;
+	file >> magic >> w >> h >> maxValue;
+	// Exactly one whitespace character separates the header from the pixels
+	file.get();
+	if (magic != "P6" || w <= 0 || h <= 0 || maxValue != 255)
+	{
+		return false;
+	}
+
+	Resize(w, h);
+	std::vector<unsigned char> bytes(pixels.size() * 3);
+	file.read((char*)bytes.data(), bytes.size());
+	if (!file.good())
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < pixels.size(); ++i)
+	{
+		pixels[i] = glm::vec3(bytes[i * 3], bytes[i * 3 + 1], bytes[i * 3 + 2]) / 255.0f;
+	}
+	return true;
+}
+
+bool Image::Diff(const Image& a, const Image& b, float threshold, ImageDiff& diff)
+{
+	diff.maxError = 0.0f;
+	diff.rmse = 0.0f;
+	diff.psnr = std::numeric_limits<float>::infinity();
+	diff.differing = 0;
+	if (a.width != b.width || a.height != b.height)
+	{
+		return false;
+	}
+
+	double sumSq = 0.0;
+	for (unsigned int i = 0; i < a.pixels.size(); ++i)
+	{
+		bool differs = false;
+		for (int c = 0; c < 3; ++c)
+		{
+			float error = std::fabs(ToByte(a.pixels[i][c]) - ToByte(b.pixels[i][c])) / 255.0f;
+			diff.maxError = error > diff.maxError ? error : diff.maxError;
+			sumSq += error * error;
+			differs = differs || error > threshold;
+		}
+		if (differs)
+		{
+			++diff.differing;
+		}
+	}
+
+	diff.rmse = (float)std::sqrt(sumSq / (a.pixels.size() * 3));
+	if (diff.rmse > 0.0f)
+	{
+		diff.psnr = 20.0f * std::log10(1.0f / diff.rmse);
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <string>
+
+// How far apart two images are, see Image::Diff
+struct ImageDiff
+{
+	// Largest difference in any one channel, in 0 to 1 color
+	float maxError;
+	float rmse;
+	// Peak signal to noise ratio in dB, infinite for identical images
+	float psnr;
+	// Pixels with some channel further apart than the threshold
+	int differing;
+};
+
+// An RGB image in floating point, row 0 is the top of the picture like the files it's saved to.
+// Colors are clamped to 0 to 1 when written, the same as the framebuffer does for the GPU tracer.
+class Image
+{
+public:
+	Image();
+	Image(int w, int h);
+
+	void Resize(int w, int h);
+	glm::vec3& At(int x, int y) { return pixels[y * width + x]; }
+	const glm::vec3& At(int x, int y) const { return pixels[y * width + x]; }
+
+	// Binary PPM (P6), which just about any image viewer opens
+	bool WritePPM(const std::string& fileName) const;
+	bool ReadPPM(const std::string& fileName);
+
+	// Compares two images of the same size after quantizing both to 8 bits, like they'd be on disk.
+	// Returns false if the sizes don't match.
+	static bool Diff(const Image& a, const Image& b, float threshold, ImageDiff& diff);
+
+	int width;
+	int height;
+	std::vector<glm::vec3> pixels;
+};
+
+// What each pixel's camera ray hit first, written by the tracer alongside the image for the denoiser (see Denoiser.h).
+// Laid out like Image, row 0 is the top of the picture.
+struct GBuffer
+{
+	void Resize(int w, int h);
+
+	int width;
+	int height;
+	// The surface's normal, zero where the ray hit nothing
+	std::vector<glm::vec3> normals;
+	// How far along the ray the surface is
+	std::vector<float> depths;
+	// The surface's own color, before any light
+	std::vector<glm::vec3> albedos;
+};
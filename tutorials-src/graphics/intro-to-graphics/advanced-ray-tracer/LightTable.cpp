@@ -0,0 +1,105 @@
+#include "LightTable.h"
+
+uint32_t LightTable::Hash(uint32_t v)
+{
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+float LightTable::HashToFloat(uint32_t h)
+{
+	return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+void LightTable::Build(const std::vector<SceneLight>& lights, int samples)
+{
+	_samples = samples;
+	int count = (int)lights.size();
+	entries.resize(count);
+
+	float total = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		total += lights[i].intensity;
+	}
+
+	// Each light's share of the table, scaled so that a column holds 1. Lights with less than a column's worth are topped up
+	// from one with more than a column's worth, until every column is full.
+	std::vector<float> scaled(count);
+	std::vector<int> small;
+	std::vector<int> large;
+	for (int i = 0; i < count; ++i)
+	{
+		entries[i].position = lights[i].position;
+		entries[i].intensity = lights[i].intensity;
+		entries[i].probability = total > 0.0f ? lights[i].intensity / total : 1.0f / count;
+		entries[i].threshold = 1.0f;
+		entries[i].alias = i;
+		entries[i].pad = 0.0f;
+
+		scaled[i] = entries[i].probability * count;
+		if (scaled[i] < 1.0f)
+		{
+			small.push_back(i);
+		}
+		else
+		{
+			large.push_back(i);
+		}
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		int less = small.back();
+		small.pop_back();
+		int more = large.back();
+		large.pop_back();
+
+		entries[less].threshold = scaled[less];
+		entries[less].alias = more;
+		scaled[more] -= 1.0f - scaled[less];
+		if (scaled[more] < 1.0f)
+		{
+			small.push_back(more);
+		}
+		else
+		{
+			large.push_back(more);
+		}
+	}
+
+	// Whatever is left holds a whole column apart from rounding, and keeps its threshold of 1
+}
+
+int LightTable::PerPoint() const
+{
+	return Sampled() ? _samples : (int)entries.size();
+}
+
+bool LightTable::Sampled() const
+{
+	return (int)entries.size() > _samples;
+}
+
+int LightTable::Pick(uint32_t seed, int n, float& weight) const
+{
+	if (!Sampled())
+	{
+		weight = 1.0f;
+		return n;
+	}
+
+	// One hash picks the column, and the next picks between its two lights
+	uint32_t h = Hash(seed + (uint32_t)n);
+	int column = (int)(h % (uint32_t)entries.size());
+	int light = HashToFloat(Hash(h)) < entries[column].threshold ? column : entries[column].alias;
+
+	weight = 1.0f / (_samples * entries[light].probability);
+	return light;
+}
+
+uint32_t LightTable::PixelSeed(int x, int y, int frameNumber)
+{
+	return Hash((uint32_t)x + Hash((uint32_t)y + Hash((uint32_t)frameNumber)));
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <cstdint>
+#include "Scene.h"
+
+// A light as the shaders see it, along with its column of the alias table. Laid out to match the pointLight struct in RayTracing.glsl under std430 packing.
+struct LightTableEntry
+{
+	glm::vec3 position;
+	float intensity;
+	// A random number from 0 to 1 below threshold picks this column's own light, anything else picks alias
+	float threshold;
+	int alias;
+	// The chance of this light being picked at all. What it brings is divided by this, so that on average it brings as much as it would if it were always used.
+	float probability;
+	float pad;
+};
+
+// Shading a point with every light costs a shadow ray and a reflection ray for each of them, so the frame gets slower with every light added.
+// Instead, once there are more lights than samples, each point is shaded by only samples of them, picked at random, with the brighter ones picked
+// more often. Each frame is noisy, but the noise averages out over frames and the cost stays the same however many lights there are.
+// Lights are picked in constant time with an alias table (Vose's method): each column holds one light and the share of its column that
+// goes to one other, so picking is choosing a column, then a random number to choose between its two.
+class LightTable
+{
+public:
+	// Builds the table over the lights. samples is how many of them each point is shaded by.
+	void Build(const std::vector<SceneLight>& lights, int samples);
+
+	// How many lights each point is shaded by, all of them when there are no more than samples.
+	int PerPoint() const;
+	// Whether the lights are picked at random, rather than every one of them used
+	bool Sampled() const;
+
+	// The n'th light to shade a point with, n going up to PerPoint. Sets weight to what to multiply what the light brings by.
+	// The same as pickLight in RayTracing.glsl, so the CPU picks the same lights as the GPU for the same seed.
+	int Pick(uint32_t seed, int n, float& weight) const;
+
+	// A different seed for every pixel and frame, the same as pixelSeed in RayTracing.glsl. The pixel is counted from the bottom left, like gl_FragCoord.
+	static uint32_t PixelSeed(int x, int y, int frameNumber);
+
+	// The shaders' pcgHash, which scrambles every bit of its input into every bit of its output, and hashToFloat, which makes a number from 0 up to 1 out of it.
+	static uint32_t Hash(uint32_t v);
+	static float HashToFloat(uint32_t h);
+
+	std::vector<LightTableEntry> entries;
+private:
+	int _samples;
+};
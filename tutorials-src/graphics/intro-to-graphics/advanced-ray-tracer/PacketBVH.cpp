@@ -0,0 +1,480 @@
+#include "PacketBVH.h"
+#include <cfloat>
+
+#if defined(PACKET_TRACING)
+#include <immintrin.h>
+
+// The packet's stack never holds more nodes than the tree is deep. Trees deeper than this, which takes a very
+// lopsided scene, are traced a ray at a time instead.
+const int MAX_STACK = 128;
+
+// Index of the lowest set bit
+static int LowestLane(int mask)
+{
+	int lane = 0;
+	while ((mask & 1) == 0)
+	{
+		mask >>= 1;
+		++lane;
+	}
+	return lane;
+}
+
+void PacketBVH::Build(const BVH& bvh, const std::vector<TriangleEdges>& edges)
+{
+	_bvh = &bvh;
+	_edges = &edges;
+	_blocks.clear();
+	_leafBlock.assign(bvh.nodes.size(), -1);
+
+	for (unsigned int node = 0; node < bvh.nodes.size(); ++node)
+	{
+		int leaf = bvh.nodes[node].leaf;
+		if (leaf == -1)
+		{
+			continue;
+		}
+
+		TriangleBlock block = TriangleBlock();
+		int first = leaf >> LEAF_COUNT_BITS;
+		int count = leaf & ((1 << LEAF_COUNT_BITS) - 1);
+		for (int i = 0; i < 8; ++i)
+		{
+			// Fill the spare lanes with a copy of the first triangle's corner and zero edges, which can't be hit
+			const TriangleEdges& t = edges[first + (i < count ? i : 0)];
+			bool flat = i < count && (t.kind == PRIMITIVE_TRIANGLE || t.kind == PRIMITIVE_PLANE);
+			glm::vec3 e1 = flat ? t.e1 : glm::vec3(0.0f);
+			glm::vec3 e2 = flat ? t.e2 : glm::vec3(0.0f);
+			if (i < count && !flat)
+			{
+				block.analytic |= 1 << i;
+			}
+			block.v0x[i] = t.v0.x;
+			block.v0y[i] = t.v0.y;
+			block.v0z[i] = t.v0.z;
+			block.e1x[i] = e1.x;
+			block.e1y[i] = e1.y;
+			block.e1z[i] = e1.z;
+			block.e2x[i] = e2.x;
+			block.e2y[i] = e2.y;
+			block.e2z[i] = e2.z;
+			block.maxUV[i] = t.kind == PRIMITIVE_PLANE ? 2.0f : 1.0f;
+			block.index[i] = i < count ? first + i : -1;
+		}
+
+		_leafBlock[node] = (int)_blocks.size();
+		_blocks.push_back(block);
+	}
+}
+
+// Mller-Trumbore against all eight triangles at once. Each step mirrors RayIntersectsTriangle, but instead of
+// returning early a lane is just marked as missed, and the closest of the lanes that are left wins.
+// A plane passes the same test as a triangle with u + v allowed up to 2. Spheres and boxes have no use for it, so their lanes
+// miss it and are tested on their own afterwards.
+int PacketBVH::IntersectBlock(const TriangleBlock& block, glm::vec3 origin, glm::vec3 dir, float& t, bool anyHit) const
+{
+	const __m256 epsilon = _mm256_set1_ps(0.00001f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 dx = _mm256_set1_ps(dir.x);
+	__m256 dy = _mm256_set1_ps(dir.y);
+	__m256 dz = _mm256_set1_ps(dir.z);
+	__m256 e1x = _mm256_loadu_ps(block.e1x);
+	__m256 e1y = _mm256_loadu_ps(block.e1y);
+	__m256 e1z = _mm256_loadu_ps(block.e1z);
+	__m256 e2x = _mm256_loadu_ps(block.e2x);
+	__m256 e2y = _mm256_loadu_ps(block.e2y);
+	__m256 e2z = _mm256_loadu_ps(block.e2z);
+
+	// h = cross(d, e2), a = dot(e1, h)
+	__m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+	__m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+	__m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+	__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+	__m256 hit = _mm256_or_ps(_mm256_cmp_ps(a, _mm256_sub_ps(zero, epsilon), _CMP_LE_OQ), _mm256_cmp_ps(a, epsilon, _CMP_GE_OQ));
+
+	__m256 f = _mm256_div_ps(one, a);
+
+	// s = p - v0, u = f * dot(s, h)
+	__m256 sx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_loadu_ps(block.v0x));
+	__m256 sy = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_loadu_ps(block.v0y));
+	__m256 sz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_loadu_ps(block.v0z));
+	__m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+	// q = cross(s, e1), v = f * dot(d, q)
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+	__m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_loadu_ps(block.maxUV), _CMP_LE_OQ));
+
+	// t = f * dot(e2, q), it has to be in front of the ray and closer than anything found so far
+	__m256 hitT = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(hitT, epsilon, _CMP_GT_OQ), _mm256_cmp_ps(hitT, _mm256_set1_ps(t), _CMP_LT_OQ)));
+
+	int found = -1;
+	int mask = _mm256_movemask_ps(hit);
+	if (mask != 0)
+	{
+		if (anyHit)
+		{
+			return block.index[LowestLane(mask)];
+		}
+
+		// Closest lane. Ties go to the lowest lane, the same triangle the one at a time loop would keep.
+		hitT = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), hitT, hit);
+		__m256 closest = _mm256_min_ps(hitT, _mm256_permute2f128_ps(hitT, hitT, 1));
+		closest = _mm256_min_ps(closest, _mm256_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+		closest = _mm256_min_ps(closest, _mm256_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+		mask &= _mm256_movemask_ps(_mm256_cmp_ps(hitT, closest, _CMP_EQ_OQ));
+
+		found = block.index[LowestLane(mask)];
+		t = _mm256_cvtss_f32(closest);
+	}
+
+	// Spheres and boxes one at a time. A tie with a triangle goes to the triangle, which is fine as nothing in a scene should touch that exactly.
+	int analytic = block.analytic;
+	while (analytic != 0)
+	{
+		int lane = LowestLane(analytic);
+		analytic &= analytic - 1;
+		float hitAt = RayIntersectsPrimitive(origin, dir, (*_edges)[block.index[lane]]);
+		if (hitAt > 0.0f && hitAt < t)
+		{
+			if (anyHit)
+			{
+				return block.index[lane];
+			}
+			found = block.index[lane];
+			t = hitAt;
+		}
+	}
+	return found;
+}
+
+int PacketBVH::Intersect(glm::vec3 origin, glm::vec3 dir, float maxT, float& t) const
+{
+	// The same stackless walk as BVH::Intersect, only the leaves are tested eight triangles at a time
+	const std::vector<BVHNode>& nodes = _bvh->nodes;
+	int found = -1;
+	t = maxT;
+	if (nodes.empty())
+	{
+		return found;
+	}
+
+	glm::vec3 invDir = 1.0f / dir;
+	int node = 0;
+	while (node != -1)
+	{
+		const BVHNode& n = nodes[node];
+		glm::vec3 t0 = (n.boundsMin - origin) * invDir;
+		glm::vec3 t1 = (n.boundsMax - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+		float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, t));
+
+		if (enter > exit)
+		{
+			node = n.missIndex;
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			++node;
+			continue;
+		}
+
+		int index = IntersectBlock(_blocks[_leafBlock[node]], origin, dir, t);
+		if (index != -1)
+		{
+			found = index;
+		}
+		node = n.missIndex;
+	}
+	return found;
+}
+
+void PacketBVH::Intersect(RayPacket& packet) const
+{
+	const std::vector<BVHNode>& nodes = _bvh->nodes;
+	if (nodes.empty() || packet.active == 0)
+	{
+		return;
+	}
+
+	if (_bvh->depth >= MAX_STACK)
+	{
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if (packet.active & (1 << lane))
+			{
+				packet.index[lane] = Intersect(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.t[lane], packet.t[lane]);
+			}
+		}
+		return;
+	}
+
+	__m256 ox = _mm256_loadu_ps(packet.ox);
+	__m256 oy = _mm256_loadu_ps(packet.oy);
+	__m256 oz = _mm256_loadu_ps(packet.oz);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 invDx = _mm256_div_ps(one, _mm256_loadu_ps(packet.dx));
+	__m256 invDy = _mm256_div_ps(one, _mm256_loadu_ps(packet.dy));
+	__m256 invDz = _mm256_div_ps(one, _mm256_loadu_ps(packet.dz));
+	__m256 zero = _mm256_setzero_ps();
+
+	// Children are visited nearest first for the packet as a whole, judged by the direction of its first ray
+	int lead = LowestLane(packet.active);
+	glm::vec3 leadDir = glm::vec3(packet.dx[lead], packet.dy[lead], packet.dz[lead]);
+
+	// With several rays there's no single miss link to follow, so the packet keeps a stack of nodes still to visit
+	int stack[MAX_STACK];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		int node = stack[--top];
+		const BVHNode& n = nodes[node];
+
+		// Slab test for all eight rays against the one box, each against its own closest hit so far
+		__m256 tMax = _mm256_loadu_ps(packet.t);
+		__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.x), ox), invDx);
+		__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.x), ox), invDx);
+		__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.y), oy), invDy);
+		__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.y), oy), invDy);
+		__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.z), oz), invDz);
+		__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.z), oz), invDz);
+		__m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+		__m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), tMax));
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ)) & packet.active;
+
+		if (mask == 0)
+		{
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			int left = node + 1;
+			int right = _bvh->RightChild(node);
+			const BVHNode& l = nodes[left];
+			const BVHNode& r = nodes[right];
+			glm::vec3 toRight = (r.boundsMin + r.boundsMax) - (l.boundsMin + l.boundsMax);
+			// Push the far child first so the near one is visited next
+			if (glm::dot(toRight, leadDir) >= 0.0f)
+			{
+				stack[top++] = right;
+				stack[top++] = left;
+			}
+			else
+			{
+				stack[top++] = left;
+				stack[top++] = right;
+			}
+			continue;
+		}
+
+		// Leaf, test each ray that reached it against the whole block
+		const TriangleBlock& block = _blocks[_leafBlock[node]];
+		while (mask != 0)
+		{
+			int lane = LowestLane(mask);
+			mask &= mask - 1;
+			int index = IntersectBlock(block, glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.t[lane]);
+			if (index != -1)
+			{
+				packet.index[lane] = index;
+			}
+		}
+	}
+}
+
+bool PacketBVH::Occluded(glm::vec3 origin, glm::vec3 dir, float maxT) const
+{
+	const std::vector<BVHNode>& nodes = _bvh->nodes;
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	glm::vec3 invDir = 1.0f / dir;
+	int node = 0;
+	while (node != -1)
+	{
+		const BVHNode& n = nodes[node];
+		glm::vec3 t0 = (n.boundsMin - origin) * invDir;
+		glm::vec3 t1 = (n.boundsMax - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+		float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxT));
+
+		if (enter > exit)
+		{
+			node = n.missIndex;
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			++node;
+			continue;
+		}
+
+		if (IntersectBlock(_blocks[_leafBlock[node]], origin, dir, maxT, true) != -1)
+		{
+			return true;
+		}
+		node = n.missIndex;
+	}
+	return false;
+}
+
+void PacketBVH::Occluded(RayPacket& packet) const
+{
+	const std::vector<BVHNode>& nodes = _bvh->nodes;
+	if (nodes.empty() || packet.active == 0)
+	{
+		return;
+	}
+
+	if (_bvh->depth >= MAX_STACK)
+	{
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if ((packet.active & (1 << lane)) && Occluded(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.t[lane]))
+			{
+				packet.index[lane] = 0;
+			}
+		}
+		return;
+	}
+
+	__m256 ox = _mm256_loadu_ps(packet.ox);
+	__m256 oy = _mm256_loadu_ps(packet.oy);
+	__m256 oz = _mm256_loadu_ps(packet.oz);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 invDx = _mm256_div_ps(one, _mm256_loadu_ps(packet.dx));
+	__m256 invDy = _mm256_div_ps(one, _mm256_loadu_ps(packet.dy));
+	__m256 invDz = _mm256_div_ps(one, _mm256_loadu_ps(packet.dz));
+	__m256 tMax = _mm256_loadu_ps(packet.t);
+	__m256 zero = _mm256_setzero_ps();
+
+	// Lanes that haven't been blocked yet
+	int open = packet.active;
+	int lead = LowestLane(open);
+	glm::vec3 leadDir = glm::vec3(packet.dx[lead], packet.dy[lead], packet.dz[lead]);
+
+	int stack[MAX_STACK];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0 && open != 0)
+	{
+		int node = stack[--top];
+		const BVHNode& n = nodes[node];
+
+		__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.x), ox), invDx);
+		__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.x), ox), invDx);
+		__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.y), oy), invDy);
+		__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.y), oy), invDy);
+		__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMin.z), oz), invDz);
+		__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.boundsMax.z), oz), invDz);
+		__m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+		__m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), tMax));
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ)) & open;
+
+		if (mask == 0)
+		{
+			continue;
+		}
+
+		if (n.leaf == -1)
+		{
+			// Order matters less than for the closest hit, but blockers near the start of the ray are found sooner
+			int left = node + 1;
+			int right = _bvh->RightChild(node);
+			const BVHNode& l = nodes[left];
+			const BVHNode& r = nodes[right];
+			glm::vec3 toRight = (r.boundsMin + r.boundsMax) - (l.boundsMin + l.boundsMax);
+			if (glm::dot(toRight, leadDir) >= 0.0f)
+			{
+				stack[top++] = right;
+				stack[top++] = left;
+			}
+			else
+			{
+				stack[top++] = left;
+				stack[top++] = right;
+			}
+			continue;
+		}
+
+		const TriangleBlock& block = _blocks[_leafBlock[node]];
+		while (mask != 0)
+		{
+			int lane = LowestLane(mask);
+			mask &= mask - 1;
+			float t = packet.t[lane];
+			int index = IntersectBlock(block, glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), t, true);
+			if (index != -1)
+			{
+				packet.index[lane] = index;
+				open &= ~(1 << lane);
+			}
+		}
+	}
+}
+
+#else
+
+void PacketBVH::Build(const BVH& bvh, const std::vector<TriangleEdges>& edges)
+{
+	_bvh = &bvh;
+	_edges = &edges;
+}
+
+int PacketBVH::Intersect(glm::vec3 origin, glm::vec3 dir, float maxT, float& t) const
+{
+	return _bvh->Intersect(*_edges, origin, dir, maxT, t);
+}
+
+bool PacketBVH::Occluded(glm::vec3 origin, glm::vec3 dir, float maxT) const
+{
+	return _bvh->Occluded(*_edges, origin, dir, maxT);
+}
+
+void PacketBVH::Occluded(RayPacket& packet) const
+{
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if ((packet.active & (1 << lane)) && Occluded(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.t[lane]))
+		{
+			packet.index[lane] = 0;
+		}
+	}
+}
+
+void PacketBVH::Intersect(RayPacket& packet) const
+{
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (packet.active & (1 << lane))
+		{
+			float t;
+			int index = Intersect(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.t[lane], t);
+			if (index != -1)
+			{
+				packet.t[lane] = t;
+				packet.index[lane] = index;
+			}
+		}
+	}
+}
+
+#endif
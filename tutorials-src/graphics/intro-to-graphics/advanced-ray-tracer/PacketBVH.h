@@ -0,0 +1,84 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include "Scene.h"
+#include "BVH.h"
+
+// Packet tracing needs AVX2, builds without it still have PacketBVH but it traces one ray at a time through BVH::Intersect
+#if defined(__AVX2__)
+#define PACKET_TRACING 1
+#endif
+
+const int PACKET_SIZE = 8;
+
+// Eight rays traced through the tree together. Rays that start close together and point the same way, like neighbouring
+// camera rays or shadow rays toward one light, visit nearly the same nodes, so each box test is shared by all of them.
+struct RayPacket
+{
+	float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+	float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	// Closest hit so far, start at the farthest distance to look
+	float t[PACKET_SIZE];
+	// Triangle each ray hit, -1 for a miss
+	int index[PACKET_SIZE];
+	// Bit i is set if lane i holds a ray, partial packets are fine
+	int active;
+
+	void Set(int lane, glm::vec3 origin, glm::vec3 dir, float maxT)
+	{
+		ox[lane] = origin.x;
+		oy[lane] = origin.y;
+		oz[lane] = origin.z;
+		dx[lane] = dir.x;
+		dy[lane] = dir.y;
+		dz[lane] = dir.z;
+		t[lane] = maxT;
+		index[lane] = -1;
+		active |= 1 << lane;
+	}
+};
+
+// Eight triangles in structure of arrays form, so one ray can be tested against all of them at once. Only what the
+// intersection test reads is kept: the first corner and the two edges from it, the same as TriangleEdges.
+struct TriangleBlock
+{
+	float v0x[8], v0y[8], v0z[8];
+	float e1x[8], e1y[8], e1z[8];
+	float e2x[8], e2y[8], e2z[8];
+	// The most u + v can be for a hit, 1 for a triangle and 2 for a plane, which is the whole parallelogram
+	float maxUV[8];
+	// Index into the scene's triangles, unused lanes have zero edges so they never hit
+	int index[8];
+	// Bit i is set if lane i holds a sphere or a box. Those lanes have zero edges too, and are tested one at a time after the rest.
+	int analytic;
+};
+
+// The same tree as BVH, with each leaf's triangles (at most MAX_LEAF_TRIANGLES, which is 8) packed into one TriangleBlock.
+class PacketBVH
+{
+public:
+	// Keeps pointers to bvh and edges, the built triangles' Scene::Edges, which have to outlive this
+	void Build(const BVH& bvh, const std::vector<TriangleEdges>& edges);
+
+	// Nearest hit along one ray closer than maxT, the same answer as BVH::Intersect. Returns the triangle index or -1.
+	int Intersect(glm::vec3 origin, glm::vec3 dir, float maxT, float& t) const;
+
+	// Nearest hit for every active lane, closer than that lane's t
+	void Intersect(RayPacket& packet) const;
+
+	// Any hit closer than maxT, see BVH::Occluded
+	bool Occluded(glm::vec3 origin, glm::vec3 dir, float maxT) const;
+
+	// Sets index to some triangle for every active lane that hits anything closer than its t, and leaves t alone.
+	// Each lane drops out as soon as it's blocked and the walk ends once they all have.
+	void Occluded(RayPacket& packet) const;
+private:
+	// anyHit returns as soon as one lane hits, without finding which is closest or updating t
+	int IntersectBlock(const TriangleBlock& block, glm::vec3 origin, glm::vec3 dir, float& t, bool anyHit = false) const;
+
+	const BVH* _bvh;
+	const std::vector<TriangleEdges>* _edges;
+	// Block of each leaf node, -1 for inner nodes
+	std::vector<int> _leafBlock;
+	std::vector<TriangleBlock> _blocks;
+};
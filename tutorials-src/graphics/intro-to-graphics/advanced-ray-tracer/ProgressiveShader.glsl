@@ -0,0 +1,58 @@
+/*
+Title: Advanced Ray Tracer
+File Name: ProgressiveShader.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Displays the accumulation image of the progressive mode. Every pixel 
+holds the sum of the samples traced through it since the camera last 
+moved, with the number of samples in alpha, so showing it is a matter 
+of dividing one by the other.
+*/
+
+#version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
+
+uniform int pixelStride;
+// How many pixels of each block have been traced since the camera last moved, pixelStride * pixelStride once the first pass is done.
+uniform int tracedPixels;
+// The order the pixels of a block are traced in, the pixel at (x, y) of a block is traced on frame order[y * pixelStride + x] of a pass.
+uniform int order[64];
+layout(binding = 0, rgba32f) readonly uniform image2D accumulation;
+
+in vec2 textureCoord;
+
+out vec4 color;
+
+void main(void)
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+	// Until the first pass after the camera moves is done, some pixels still hold samples from the old view. Show the
+	// block's first pixel in their place, which is traced on the very first frame, so the picture starts out blocky and fills in.
+	ivec2 inBlock = pixel % pixelStride;
+	if (order[inBlock.y * pixelStride + inBlock.x] >= tracedPixels)
+	{
+		pixel -= inBlock;
+	}
+
+	vec4 sum = imageLoad(accumulation, pixel);
+	color = vec4(sum.rgb / max(sum.a, 1.0), 1.0);
+}
@@ -0,0 +1,48 @@
+/*
+Title: Advanced Ray Tracer
+File Name: RasterFragmentShader.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Writes the G-buffer of the hybrid path: for every pixel, the point in 
+the world its camera ray would hit, the normal there and the index of 
+the triangle, which is everything the Compute Shader's HYBRID_STAGE 
+needs to shade the point and trace its shadow and reflection rays. The 
+depth test keeps the nearest triangle, as the ray would. Pixels that 
+see nothing keep the index of -1 they are cleared to.
+*/
+
+#version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
+
+in vec3 worldPosition;
+flat in vec3 worldNormal;
+flat in int triangle;
+
+layout(location = 0) out vec4 positionOut;
+layout(location = 1) out vec4 normalOut;
+layout(location = 2) out int triangleOut;
+
+void main(void)
+{
+	positionOut = vec4(worldPosition, 1.0);
+	normalOut = vec4(worldNormal, 0.0);
+	triangleOut = triangle;
+}
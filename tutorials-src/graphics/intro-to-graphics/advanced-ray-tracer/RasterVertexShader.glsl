@@ -0,0 +1,59 @@
+/*
+Title: Advanced Ray Tracer
+File Name: RasterVertexShader.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Draws the scene's triangles for the hybrid path, which rasterizes what 
+the camera sees rather than tracing a ray from the camera for every 
+pixel. main.cpp draws each object's triangles with its transform, and 
+projects them with a matrix built from the same corner rays the Compute 
+Shader traces along, so every pixel sees what its camera ray would hit. 
+The fragment shader (RasterFragmentShader.glsl) writes the G-buffer the 
+Compute Shader carries on from.
+*/
+
+#version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
+
+// A corner of a triangle in its object's space, the triangle's normal, and where the triangle is in the triangle buffer.
+layout(location = 0) in vec3 vertexIn;
+layout(location = 1) in vec3 normalIn;
+layout(location = 2) in int triangleIn;
+
+// The object's transform into the world, the matrix that turns its normals into the world, and the camera's projection.
+uniform mat4 objectToWorld;
+uniform mat3 normalToWorld;
+uniform mat4 viewProjection;
+
+out vec3 worldPosition;
+flat out vec3 worldNormal;
+flat out int triangle;
+
+void main(void)
+{
+	vec4 world = objectToWorld * vec4(vertexIn, 1.0);
+	worldPosition = world.xyz;
+
+	// The same as intersectTriangles turning the normal of what a ray hit into the world.
+	worldNormal = normalize(normalToWorld * normalIn);
+	triangle = triangleIn;
+	gl_Position = viewProjection * world;
+}
@@ -0,0 +1,1060 @@
+/*
+Title: Advanced Ray Tracer
+File Name: RayTracing.glsl
+Copyright  2015
+Original authors: Brockton Roth
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+The ray tracing itself, shared by the Fragment Shader and the Compute
+Shader. GLSL has no #include of its own, so main.cpp pastes this file
+in wherever a shader has the line #include "RayTracing.glsl". This is
+not a shader by itself and has no #version line.
+
+The scene is made of objects, each with its own tree over its own
+triangles, in its own space. A top level tree over where the objects
+are in the world leads rays to the objects they might hit, and rays are
+moved into an object's space to walk its tree (see SceneBVH.h). Moving
+an object only changes the top level.
+
+The lights are in a buffer too. When there are more of them than
+lightSamples, each point is shaded by lightSamples of them picked at
+random, brighter lights more often (see LightTable.h). The shader that
+calls trace gives it a seed that changes every frame, and averages the
+frames.
+
+Rays from the camera are reflected up to maxBounces times, each point
+along the way lit the same way as the first. Paths that have little
+left to add end early by Russian roulette (see continuePath).
+
+A shader that calls trace (or anything else that traces rays) has to
+call addRayCounts before it finishes, so the rays are counted when
+benchmarking.
+
+When main.cpp defines DENOISE, trace also keeps what the ray from the
+camera hit first, for the shader to write to the G-buffer the denoiser
+is guided by (see DenoiseShader.glsl).
+
+When main.cpp defines TEMPORAL_CACHE, traceCached stands in for trace
+in the Compute Shader. It keeps what every pixel's shadow rays and
+reflection found in a history buffer, and reuses last frame's wherever
+the camera still sees the same point (see TemporalCache.h).
+
+A shader that defines SHARED_STAGING (only compute shaders can) gets
+rays that start from a copy of the top of the top level tree in shared
+memory, along with the corners and edges of the first
+sharedTriangleCount triangles. It has to call stageScene from every
+invocation before tracing anything.
+*/
+
+// What each entry of the triangle buffer is, see PrimitiveKind in Scene.h
+#define PRIMITIVE_TRIANGLE 0
+#define PRIMITIVE_SPHERE 1
+#define PRIMITIVE_BOX 2
+#define PRIMITIVE_PLANE 3
+
+// Every one of our triangles is kept as its first corner and the two edges from it, which is all rayIntersectsTriangle needs, 
+// so it doesn't have to work the edges out again for every ray. See TriangleEdges in Scene.h.
+// A plane is kept the same way. A sphere is its center v0 and its radius, and a box runs from v0 to e1.
+struct triangle {
+	vec3 v0;
+	int kind;
+	vec3 e1;
+	float radius;
+	vec3 e2;
+};
+
+// What the triangle looks like, a normal and a color. Only read for the triangle a ray hits, so it is kept apart from the corners 
+// and tree walks don't pull it into the cache along with them.
+struct surface {
+	vec3 normal;
+	vec3 color;
+};
+
+// A node of the bounding volume hierarchy. See BVH.h for how the tree is laid out.
+struct node {
+	vec3 boundsMin;
+	int missIndex;
+	vec3 boundsMax;
+	int leaf;
+};
+
+// Create some constants
+#define MAX_SCENE_BOUNDS 100.0
+#define LEAF_COUNT_BITS 4
+
+// A point light, along with its column of the alias table that lights are picked from. See LightTable.h.
+struct pointLight {
+	vec3 position;
+	// This is used to multiply the brightness given off by the light. Higher value means more light.
+	float intensity;
+	float threshold;
+	int alias;
+	float probability;
+};
+
+// An object placed in the world. Its tree is the run of nodes [root, end).
+struct instance {
+	mat4 worldToObject;
+	int root;
+	int end;
+};
+
+// The triangles and the trees over them are built on the CPU and passed in through shader storage buffers.
+// Unlike uniforms these can be as large as the GPU's memory allows, so the scene isn't limited to a handful of hardcoded triangles.
+// The triangles are sorted so that every leaf of a tree covers a contiguous run of them.
+layout(std430, binding = 0) readonly buffer Triangles
+{
+	triangle triangles[];
+};
+
+// The surfaces of the triangles, in the same order.
+layout(std430, binding = 9) readonly buffer Surfaces
+{
+	surface surfaces[];
+};
+
+// The trees of all the objects, one after another.
+layout(std430, binding = 1) readonly buffer Nodes
+{
+	node nodes[];
+};
+
+// These two change whenever objects move. The leaves of the top level tree cover runs of instances rather than triangles.
+layout(std430, binding = 6) readonly buffer Instances
+{
+	instance instances[];
+};
+
+layout(std430, binding = 7) readonly buffer TopNodes
+{
+	node topNodes[];
+};
+
+// The lights used to be four positions hardcoded into the shader. Now there can be as many as we like, and each point is shaded
+// by at most lightSamples of them, so a scene with hundreds of lights costs about the same to trace as one with four.
+layout(std430, binding = 8) readonly buffer Lights
+{
+	pointLight lights[];
+};
+
+uniform int lightSamples;
+
+// main.cpp defines COUNT_RAYS when benchmarking, to count the rays of each kind that get traced. Each invocation counts its own rays
+// and adds them to the totals once, with addRayCounts, since an atomic add for every ray would all be fighting over the same three numbers.
+#ifdef COUNT_RAYS
+layout(std430, binding = 10) buffer RayCounts
+{
+	uint primaryRays;
+	uint shadowRays;
+	uint reflectionRays;
+};
+
+uint tracedPrimary = 0u;
+uint tracedShadow = 0u;
+uint tracedReflection = 0u;
+#endif
+
+// The first surface trace's ray hit, its normal, how far along the ray it is and its own color. All zero if the ray hit nothing.
+#ifdef DENOISE
+vec3 firstNormal = vec3(0.0);
+float firstDepth = 0.0;
+vec3 firstAlbedo = vec3(0.0);
+#endif
+
+// Adds up the rays this invocation has traced. Call it once, after the last of them.
+void addRayCounts()
+{
+#ifdef COUNT_RAYS
+	if (tracedPrimary != 0u)
+	{
+		atomicAdd(primaryRays, tracedPrimary);
+	}
+	if (tracedShadow != 0u)
+	{
+		atomicAdd(shadowRays, tracedShadow);
+	}
+	if (tracedReflection != 0u)
+	{
+		atomicAdd(reflectionRays, tracedReflection);
+	}
+#endif
+}
+
+#ifdef SHARED_STAGING
+// The top few levels of the top level tree, with miss links of their own. See BVHTreeletNode in BVH.h.
+struct treeletNode {
+	vec3 boundsMin;
+	int missIndex;
+	vec3 boundsMax;
+	// -1 if this node's children follow it in the treelet, otherwise where its subtree starts in topNodes.
+	int node;
+	// Where that subtree ends in topNodes.
+	int subtreeEnd;
+};
+
+layout(std430, binding = 2) readonly buffer Treelet
+{
+	treeletNode treelet[];
+};
+
+// How many triangles, from the start of the triangle buffer, have their corners in shared memory. Never more than MAX_SHARED_TRIANGLES.
+uniform int sharedTriangleCount;
+
+// Every ray passes through the top of the top level tree, so every invocation of a work group would otherwise read the same few nodes from memory.
+// Shared memory is on the chip and is shared by the work group, so they are read once per work group and then come almost for free.
+shared treeletNode sharedTreelet[MAX_TREELET_NODES];
+shared triangle sharedTriangles[MAX_SHARED_TRIANGLES];
+
+// Copies the treelet and the first triangles into shared memory. Every invocation of the work group copies its share,
+// then they all wait for each other, so this must be called from every invocation, before any of them returns.
+void stageScene()
+{
+	int groupSize = int(gl_WorkGroupSize.x * gl_WorkGroupSize.y);
+	int treeletSize = min(treelet.length(), MAX_TREELET_NODES);
+	for (int i = int(gl_LocalInvocationIndex); i < treeletSize; i += groupSize)
+	{
+		sharedTreelet[i] = treelet[i];
+	}
+	for (int i = int(gl_LocalInvocationIndex); i < sharedTriangleCount; i += groupSize)
+	{
+		sharedTriangles[i] = triangles[i];
+	}
+
+	memoryBarrierShared();
+	barrier();
+}
+#endif
+
+// What a ray hit. The normal has been turned from the object's space into the world, the rest of the triangle can be looked up by index.
+struct hitinfo
+{
+	vec3 point;
+	int index;
+	vec3 normal;
+	int instance;
+};
+
+// Determines whether or not a ray in a given direction hits a given triangle.
+// Returns -1.0 if it does not; otherwise returns the value t at which the ray hits the triangle, which can be used to determine the point of collision.
+// p is point on ray, d is ray direction, v0 is the first point of the triangle and e1 and e2 are its two edges from v0.
+// With plane set the whole parallelogram the two edges make is tested instead of the triangle.
+float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 e1, vec3 e2, bool plane)
+{
+	vec3 h,s,q;
+	float a,f,u,v, t;
+
+	// Cross ray direction with triangle edge
+	h = cross(d, e2);
+
+	// Dot the other triangle edge with the above cross product
+	a = dot(e1, h);
+
+	// If a is zero or realy close to zero, then there's no collision.
+	if (a > -0.00001 && a < 0.00001)
+	{
+		return -1.0;
+	}
+
+	// Take the inverse of a.
+	f = 1/a;
+
+	// Get vector from first triangle vertex toward cameraPos (or in the scope of this function, the vec3 p that is a point on the ray direction)
+	s = vec3(p.x - v0.x, p.y - v0.y, p.z - v0.z);
+
+	// Dot your s value with your h value from earlier (cross(d, e2)), then multiply by the inverse of a.
+	u = f * dot(s, h);
+
+	// If this value is not between 0 and 1, then there's no collision.
+	if (u < 0.0 || u > 1.0)
+	{
+		return -1.0;
+	}
+
+	// Cross your s value with edge 1 (e1).
+	q = cross(s, e1);
+
+	// Dot the ray direction with this new q value, and then multiply by the inverse of a.
+	v = f * dot(d, q);
+
+	// If v is less than 0, or u + v are greater than 1, then there's no collision. A plane only needs v to be no more than 1.
+	if (v < 0.0 || (plane ? v > 1.0 : u + v > 1.0))
+	{
+		return -1.0;
+	}
+
+	// At this stage we can compute t to find out where the intersection point is on the line
+	t = f * dot(e2, q);
+
+	// If t is greater than zero
+	if (t > 0.00001)
+	{
+		// The ray does intersect the triangle, and we return the t value.
+		return t;
+	}
+
+	// Otherwise, there is a line intersection, but not a ray intersection, so we return -1.0.
+	return -1.0;
+}
+
+// The nearer of the two places the ray crosses the sphere, or the farther if the ray starts inside it. Returns -1.0 on a miss.
+// d isn't normalized in an object's space, so the quadratic keeps its dot(d, d).
+float raySphere(vec3 p, vec3 d, vec3 center, float radius)
+{
+	vec3 oc = p - center;
+	float a = dot(d, d);
+	float b = dot(oc, d);
+	float discriminant = b * b - a * (dot(oc, oc) - radius * radius);
+	if (discriminant < 0.0)
+	{
+		return -1.0;
+	}
+
+	float root = sqrt(discriminant);
+	float t = (-b - root) / a;
+	if (t > 0.00001)
+	{
+		return t;
+	}
+	t = (-b + root) / a;
+	return t > 0.00001 ? t : -1.0;
+}
+
+// Where the ray enters the box, or leaves it if the ray starts inside. Returns -1.0 on a miss.
+float rayBox(vec3 p, vec3 d, vec3 boundsMin, vec3 boundsMax)
+{
+	vec3 t0 = (boundsMin - p) / d;
+	vec3 t1 = (boundsMax - p) / d;
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+	float enter = max(max(tNear.x, tNear.y), tNear.z);
+	float exit = min(min(tFar.x, tFar.y), tFar.z);
+	if (enter > exit)
+	{
+		return -1.0;
+	}
+	if (enter > 0.00001)
+	{
+		return enter;
+	}
+	return exit > 0.00001 ? exit : -1.0;
+}
+
+// Tests the ray against a primitive of whichever kind it is
+float rayIntersectsPrimitive(vec3 p, vec3 d, triangle t)
+{
+	if (t.kind == PRIMITIVE_SPHERE)
+	{
+		return raySphere(p, d, t.v0, t.radius);
+	}
+	if (t.kind == PRIMITIVE_BOX)
+	{
+		return rayBox(p, d, t.v0, t.e1);
+	}
+	return rayIntersectsTriangle(p, d, t.v0, t.e1, t.e2, t.kind == PRIMITIVE_PLANE);
+}
+
+// Tests the ray against primitive j, reading it from shared memory if it was staged there.
+float rayIntersectsPrimitive(vec3 p, vec3 d, int j)
+{
+#ifdef SHARED_STAGING
+	if (j < sharedTriangleCount)
+	{
+		return rayIntersectsPrimitive(p, d, sharedTriangles[j]);
+	}
+#endif
+	return rayIntersectsPrimitive(p, d, triangles[j]);
+}
+
+// The normal of primitive j at a point on it, in the object's space. Spheres and boxes work it out from the point, anything flat has it in its surface.
+vec3 primitiveNormal(int j, vec3 point)
+{
+	triangle t = triangles[j];
+	if (t.kind == PRIMITIVE_SPHERE)
+	{
+		return normalize(point - t.v0);
+	}
+	if (t.kind == PRIMITIVE_BOX)
+	{
+		// The face the point is on is the one it's furthest out toward, measured against the box's size along each axis
+		vec3 q = (point - (t.v0 + t.e1) * 0.5) / ((t.e1 - t.v0) * 0.5);
+		vec3 a = abs(q);
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			return vec3(sign(q.x), 0.0, 0.0);
+		}
+		if (a.y >= a.z)
+		{
+			return vec3(0.0, sign(q.y), 0.0);
+		}
+		return vec3(0.0, 0.0, sign(q.z));
+	}
+	return surfaces[j].normal;
+}
+
+// Slab test of a ray against a box, getting where the ray enters and exits it along each axis.
+// Returns false if the ray misses the box, or only reaches it past maxDist.
+bool rayIntersectsBox(vec3 origin, vec3 invDir, vec3 boundsMin, vec3 boundsMax, float maxDist)
+{
+	vec3 t0 = (boundsMin - origin) * invDir;
+	vec3 t1 = (boundsMax - origin) * invDir;
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+	float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+	float exit = min(min(tFar.x, tFar.y), min(tFar.z, maxDist));
+	return enter <= exit;
+}
+
+// Walks the nodes of an object's tree from first up to end, looking for a triangle closer than smallest. If it finds one, smallest and index are updated and it returns true.
+// The nodes are stored so that the walk needs no stack: on a hit we step to the next node (the first child), and on a miss,
+// or once a leaf is done, we jump to the node's miss link. A miss link of -1 means the whole tree has been visited.
+// A subtree is a contiguous run of nodes, and every miss link out of it leads past its end, so the same walk also covers just one subtree.
+bool intersectNodes(vec3 origin, vec3 dir, vec3 invDir, int first, int end, inout float smallest, inout int index)
+{
+	bool found = false;
+	int i = first;
+	while (i != -1 && i < end)
+	{
+		// The ray missed the box, or only reaches it past a triangle we have already hit.
+		if (!rayIntersectsBox(origin, invDir, nodes[i].boundsMin, nodes[i].boundsMax, smallest))
+		{
+			i = nodes[i].missIndex;
+			continue;
+		}
+
+		// Inner node, move on to its children.
+		if (nodes[i].leaf == -1)
+		{
+			i++;
+			continue;
+		}
+
+		// Leaf node, test each of its triangles.
+		int firstTriangle = nodes[i].leaf >> LEAF_COUNT_BITS;
+		int endTriangle = firstTriangle + (nodes[i].leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		for (int j = firstTriangle; j < endTriangle; j++)
+		{
+			// Compute distance t using above function to determine how far along the ray the triangle collides.
+			float t = rayIntersectsPrimitive(origin, dir, j);
+
+			// If t = -1.0 then there was no intersection, we also ignore it if t is not < smallest, as that would mean we already found a triangle that
+			// was closer (and thus collides first).
+			if (t != -1.0 && t < smallest)
+			{
+				// This t becomes the new smallest, and we pass out the triangle index. Its color and normal can be found from that.
+				smallest = t;
+				index = j;
+
+				// Make sure we set found to true, signifying that the ray collided with something.
+				found = true;
+			}
+		}
+
+		i = nodes[i].missIndex;
+	}
+
+	return found;
+}
+
+// Tests the ray against the instances of a leaf of the top level tree.
+bool intersectInstances(vec3 origin, vec3 dir, int leaf, inout float smallest, inout hitinfo info)
+{
+	bool found = false;
+	int first = leaf >> LEAF_COUNT_BITS;
+	int end = first + (leaf & ((1 << LEAF_COUNT_BITS) - 1));
+	for (int k = first; k < end; k++)
+	{
+		// Move the ray into the object's space. The direction isn't normalized again, so distances along it are the same as in the world and smallest still applies.
+		vec3 objectOrigin = (instances[k].worldToObject * vec4(origin, 1.0)).xyz;
+		vec3 objectDir = mat3(instances[k].worldToObject) * dir;
+		if (intersectNodes(objectOrigin, objectDir, 1.0 / objectDir, instances[k].root, instances[k].end, smallest, info.index))
+		{
+			info.instance = k;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// Walks the top level tree from first up to end the same way, testing the objects in the leaves the ray reaches.
+bool intersectTopNodes(vec3 origin, vec3 dir, vec3 invDir, int first, int end, inout float smallest, inout hitinfo info)
+{
+	bool found = false;
+	int i = first;
+	while (i != -1 && i < end)
+	{
+		if (!rayIntersectsBox(origin, invDir, topNodes[i].boundsMin, topNodes[i].boundsMax, smallest))
+		{
+			i = topNodes[i].missIndex;
+			continue;
+		}
+
+		if (topNodes[i].leaf == -1)
+		{
+			i++;
+			continue;
+		}
+
+		found = intersectInstances(origin, dir, topNodes[i].leaf, smallest, info) || found;
+		i = topNodes[i].missIndex;
+	}
+	return found;
+}
+
+// Given an origin point, a direction, and a variable to pass information back out to, this will test a ray against the triangles in the scene.
+// It will then return true or false, based on whether or not the ray collided with anything.
+// If it did, then the hitinfo object will be filled with a point of collision, the normal there and an index referring to which triangle it intersects with first.
+// Rather than testing every triangle, this walks the bounding volume hierarchies and skips every box the ray misses (or only enters past the closest hit so far).
+bool intersectTriangles(vec3 origin, vec3 dir, out hitinfo info)
+{
+	// Smallest will be the smallest distance between the origin point and the point of collision.
+	float smallest = MAX_SCENE_BOUNDS;
+	bool found = false;
+
+	// Dividing by the direction once here lets every box test multiply instead.
+	vec3 invDir = 1.0 / dir;
+
+#ifdef SHARED_STAGING
+	// Walk the treelet in shared memory the same way, and whenever the ray reaches one of its nodes that stands for a whole subtree, walk that subtree in the full tree.
+	int i = 0;
+	while (i != -1)
+	{
+		if (!rayIntersectsBox(origin, invDir, sharedTreelet[i].boundsMin, sharedTreelet[i].boundsMax, smallest))
+		{
+			i = sharedTreelet[i].missIndex;
+			continue;
+		}
+
+		if (sharedTreelet[i].node == -1)
+		{
+			i++;
+			continue;
+		}
+
+		found = intersectTopNodes(origin, dir, invDir, sharedTreelet[i].node, sharedTreelet[i].subtreeEnd, smallest, info) || found;
+		i = sharedTreelet[i].missIndex;
+	}
+#else
+	found = intersectTopNodes(origin, dir, invDir, 0, topNodes.length(), smallest, info);
+#endif
+
+	if (found)
+	{
+		info.point = origin + (dir * smallest);
+
+		// Normals go from the object's space to the world by the transpose of the inverse of its transform, which keeps them at right angles to the surface.
+		// The inverse is worldToObject, so this only needs the transpose. Spheres and boxes need the point in the object's space to find theirs.
+		mat4 worldToObject = instances[info.instance].worldToObject;
+		vec3 objectPoint = (worldToObject * vec4(info.point, 1.0)).xyz;
+		info.normal = normalize(transpose(mat3(worldToObject)) * primitiveNormal(info.index, objectPoint));
+	}
+	return found;
+}
+
+// Whether the ray hits anything before it has gone maxDist, walking the nodes of an object's tree from first up to end like intersectNodes does.
+bool occludedNodes(vec3 origin, vec3 dir, vec3 invDir, int first, int end, float maxDist)
+{
+	int i = first;
+	while (i != -1 && i < end)
+	{
+		if (!rayIntersectsBox(origin, invDir, nodes[i].boundsMin, nodes[i].boundsMax, maxDist))
+		{
+			i = nodes[i].missIndex;
+			continue;
+		}
+
+		if (nodes[i].leaf == -1)
+		{
+			i++;
+			continue;
+		}
+
+		int firstTriangle = nodes[i].leaf >> LEAF_COUNT_BITS;
+		int endTriangle = firstTriangle + (nodes[i].leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		for (int j = firstTriangle; j < endTriangle; j++)
+		{
+			float t = rayIntersectsPrimitive(origin, dir, j);
+			if (t != -1.0 && t < maxDist)
+			{
+				return true;
+			}
+		}
+
+		i = nodes[i].missIndex;
+	}
+
+	return false;
+}
+
+// Whether the ray hits anything before maxDist in the top level tree from first up to end.
+bool occludedTopNodes(vec3 origin, vec3 dir, vec3 invDir, int first, int end, float maxDist)
+{
+	int i = first;
+	while (i != -1 && i < end)
+	{
+		if (!rayIntersectsBox(origin, invDir, topNodes[i].boundsMin, topNodes[i].boundsMax, maxDist))
+		{
+			i = topNodes[i].missIndex;
+			continue;
+		}
+
+		if (topNodes[i].leaf == -1)
+		{
+			i++;
+			continue;
+		}
+
+		int firstInstance = topNodes[i].leaf >> LEAF_COUNT_BITS;
+		int endInstance = firstInstance + (topNodes[i].leaf & ((1 << LEAF_COUNT_BITS) - 1));
+		for (int k = firstInstance; k < endInstance; k++)
+		{
+			vec3 objectOrigin = (instances[k].worldToObject * vec4(origin, 1.0)).xyz;
+			vec3 objectDir = mat3(instances[k].worldToObject) * dir;
+			if (occludedNodes(objectOrigin, objectDir, 1.0 / objectDir, instances[k].root, instances[k].end, maxDist))
+			{
+				return true;
+			}
+		}
+
+		i = topNodes[i].missIndex;
+	}
+
+	return false;
+}
+
+// Determines whether a ray hits anything before it has gone maxDist. This is all a shadow needs to know: any surface at all in the way
+// puts the point in shadow, so unlike intersectTriangles, which keeps going to find the closest hit, this stops at the first one it finds.
+// It walks the trees the same way, only boxes farther than maxDist are skipped rather than ones past the closest hit so far.
+bool occluded(vec3 origin, vec3 dir, float maxDist)
+{
+#ifdef COUNT_RAYS
+	tracedShadow++;
+#endif
+	vec3 invDir = 1.0 / dir;
+
+#ifdef SHARED_STAGING
+	int i = 0;
+	while (i != -1)
+	{
+		if (!rayIntersectsBox(origin, invDir, sharedTreelet[i].boundsMin, sharedTreelet[i].boundsMax, maxDist))
+		{
+			i = sharedTreelet[i].missIndex;
+			continue;
+		}
+
+		if (sharedTreelet[i].node == -1)
+		{
+			i++;
+			continue;
+		}
+
+		if (occludedTopNodes(origin, dir, invDir, sharedTreelet[i].node, sharedTreelet[i].subtreeEnd, maxDist))
+		{
+			return true;
+		}
+		i = sharedTreelet[i].missIndex;
+	}
+	return false;
+#else
+	return occludedTopNodes(origin, dir, invDir, 0, topNodes.length(), maxDist);
+#endif
+}
+
+// The reflection Level variable determines how much of the original surface you see versus the reflection.
+#define REFLECTION_LEVEL 0.5
+// The reflection power variable determines the strength of the reflected light.
+#define REFLECTION_POWER 0.35
+
+// Once less than this much of what a path sees would reach the pixel, it plays Russian roulette to decide whether to go on. See continuePath.
+#define ROULETTE_THROUGHPUT 0.1
+
+// How many times a ray from the camera is reflected, at most. 0 only shades what the camera sees.
+uniform int maxBounces;
+
+// Whether the light reaches the point, the shadow ray of addToPixColor.
+bool lightReaches(vec3 lightPos, vec3 pointToLight, hitinfo eyeHitPoint)
+{
+	// Now we render things from the light point of view, so we cast a ray with the light position as the origin.
+	// The direction vector is from the light position toward the point on the triangle that we're trying to render.
+	// If it hits any surface more than a little (0.1) short of the point, then this is in shadow, since the light is hitting another object first.
+	return !occluded(lightPos, normalize(eyeHitPoint.point - lightPos), length(pointToLight) - 0.1);
+}
+
+// Everything addToPixColor does once the light is known to reach the point.
+vec3 shadeLight(vec3 pointToLight, vec3 dir, hitinfo eyeHitPoint, float lightIntensity)
+{
+	// Get the distance from point on surface to light
+	float dist = length(pointToLight);
+
+	// Normalize our pointToLight.
+	vec3 normalPTL = pointToLight / dist;
+
+	// Get a reflection vector bouncing the light ray off the surface of the triangle.
+	vec3 r = normalize((2 * dot(eyeHitPoint.normal, normalPTL) * eyeHitPoint.normal) - normalPTL);
+
+	// Calculate specular and diffuse lighting normally.
+	float specular = max(0, pow(dot(r,-dir), 4)) / pow(dist, 2);
+	float diffuse = max(0, dot(eyeHitPoint.normal, normalPTL)) / pow(dist, 2);
+
+	// Add in our diffuse light and specular (we do white light, for specula) and factor in the reflection level and lightIntensity.
+	// The rest of what we see of the surface (so if the level is .5, then half of it) is its reflection.
+	return ((surfaces[eyeHitPoint.index].color * diffuse * lightIntensity) + (lightIntensity * specular * vec3(1.0, 1.0, 1.0))) * (1 - REFLECTION_LEVEL);
+}
+
+// Takes the position of a light, a vector from the point of collision toward the light, a vector direction from the origin toward the point of collision,
+// a hitinfo object containing data in regards to the ray-triangle collision, and a float determining the brightness of a light.
+// This is the light's share of the surface's own color. What the surface reflects is added by tracePath, once for all the lights.
+vec3 addToPixColor(vec3 lightPos, vec3 pointToLight, vec3 dir, hitinfo eyeHitPoint, float lightIntensity)
+{
+	if (!lightReaches(lightPos, pointToLight, eyeHitPoint))
+	{
+		return vec3(0.0, 0.0, 0.0);
+	}
+	return shadeLight(pointToLight, dir, eyeHitPoint, lightIntensity);
+}
+
+// Scrambles every bit of its input into every bit of its output (the PCG hash), which makes a cheap random number generator.
+uint pcgHash(uint v)
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// A number from 0 up to but not including 1 out of a hash, exactly the same on the CPU.
+float hashToFloat(uint h)
+{
+	return float(h >> 8) * (1.0 / 16777216.0);
+}
+
+// A different seed for every pixel and frame, so the lights picked for a pixel change from frame to frame. Matches LightTable::PixelSeed.
+uint pixelSeed(ivec2 pixel, int frameNumber)
+{
+	return pcgHash(uint(pixel.x) + pcgHash(uint(pixel.y) + pcgHash(uint(frameNumber))));
+}
+
+// The seed for the bounce'th point along a pixel's path, so each point picks its own lights. The first point uses the pixel's seed as it is.
+uint bounceSeed(uint seed, int bounce)
+{
+	return seed ^ (uint(bounce) * 0x9E3779B9u);
+}
+
+// How many lights each point is shaded by, all of them when there are no more than lightSamples.
+int lightsPerPoint()
+{
+	return min(lights.length(), lightSamples);
+}
+
+// The n'th light to shade a point with, n going up to lightsPerPoint, and what to multiply what it brings by. Matches LightTable::Pick.
+// With more lights than lightSamples, each is picked at random with the brighter lights picked more often, and what a light brings is
+// divided by how likely it was to be picked. A pixel is shaded by a different few lights every frame, but on average it gets the light of all of them.
+int pickLight(uint seed, int n, out float weight)
+{
+	if (lights.length() <= lightSamples)
+	{
+		weight = 1.0;
+		return n;
+	}
+
+	// One hash picks a column of the alias table, and the next picks between the column's own light and its alias.
+	uint h = pcgHash(seed + uint(n));
+	int column = int(h % uint(lights.length()));
+	int light = hashToFloat(pcgHash(h)) < lights[column].threshold ? column : lights[column].alias;
+
+	weight = 1.0 / (float(lightSamples) * lights[light].probability);
+	return light;
+}
+
+// Whether the path goes on to reflect off the bounce'th point it hit, and if so how much of what it sees from there reaches the pixel, in throughput.
+// Each reflection only passes on REFLECTION_LEVEL * REFLECTION_POWER of what it sees, so after a couple of bounces there's little left worth tracing.
+// Rather than always tracing to maxBounces, once the throughput drops below ROULETTE_THROUGHPUT the path only goes on with a chance in proportion
+// to it, and makes up for the paths that stopped by being brighter when it does. On average the picture is the same, and the number of rays a pixel
+// can take is still capped by maxBounces, but most paths stop long before it.
+bool continuePath(int bounce, uint seed, inout float throughput)
+{
+	if (bounce >= maxBounces)
+	{
+		return false;
+	}
+
+	throughput *= REFLECTION_LEVEL * REFLECTION_POWER;
+	if (throughput >= ROULETTE_THROUGHPUT)
+	{
+		return true;
+	}
+
+	// The light picks use seed + n for small n, seed - 1 is well clear of them.
+	float survive = throughput / ROULETTE_THROUGHPUT;
+	if (hashToFloat(pcgHash(seed - 1u)) >= survive)
+	{
+		return false;
+	}
+	throughput = ROULETTE_THROUGHPUT;
+	return true;
+}
+
+// Follows a ray and its reflections from the bounce'th point of a path on, adding up the color of everything it hits, scaled by how much of it reaches the pixel.
+// Every point is lit by the lights, and the reflection is one more ray that carries on from there. It is traced once for the point rather than once per light.
+vec3 tracePath(vec3 origin, vec3 dir, uint seed, int bounce, float throughput)
+{
+	vec3 pixColor = vec3(0.0, 0.0, 0.0);
+	for (; bounce <= maxBounces; bounce++)
+	{
+		// Create object to get our hitinfo back out of the intersectTriangles function.
+		hitinfo i;
+#ifdef COUNT_RAYS
+		if (bounce == 0)
+		{
+			tracedPrimary++;
+		}
+		else
+		{
+			tracedReflection++;
+		}
+#endif
+
+		// If the ray doesn't hit any triangles, then this ray sees nothing and the path ends.
+		if (!intersectTriangles(origin, dir, i))
+		{
+			break;
+		}
+#ifdef DENOISE
+		if (bounce == 0)
+		{
+			firstNormal = i.normal;
+			firstDepth = length(i.point - origin);
+			firstAlbedo = surfaces[i.index].color;
+		}
+#endif
+
+		// Start with some ambient light.
+		vec3 pointColor = surfaces[i.index].color * 0.1;
+
+		// For each light the point is shaded by.
+		uint pointSeed = bounceSeed(seed, bounce);
+		for (int j = 0; j < lightsPerPoint(); j++)
+		{
+			float weight;
+			pointLight light = lights[pickLight(pointSeed, j, weight)];
+
+			// Call our addToPixColor function to calculate the color given off by this light, using a vector from the point of collision toward the light.
+			// Essentially, we're rendering the scene from the light's point of view for each light to get this pixel color.
+			pointColor += addToPixColor(light.position, light.position - i.point, dir, i, light.intensity) * weight;
+		}
+		pixColor += pointColor * throughput;
+
+		if (!continuePath(bounce, pointSeed, throughput))
+		{
+			break;
+		}
+
+		// Gets a vector in the direction of the reflected ray, and carries on along it.
+		dir = normalize(dir - (2 * dot(dir, i.normal) * i.normal));
+		origin = i.point;
+	}
+
+	return pixColor;
+}
+
+// Trace a ray from an origin point in a given direction and calculate/return the color value of the point that ray hits.
+// seed picks the lights each point is shaded by and how far the path goes, see pickLight and continuePath.
+vec4 trace(vec3 origin, vec3 dir, uint seed)
+{
+	return vec4(tracePath(origin, dir, seed, 0, 1.0), 1.0);
+}
+
+#ifdef TEMPORAL_CACHE
+// These match the constants in TemporalCache.h: the most frames a pixel's shadows and reflection are reused for, the most lights whose shadows
+// can be kept, how far last frame's point can be from this frame's for every unit of distance from the camera, and how far the ray from the
+// camera can turn, as a cosine, before the reflection is traced again.
+#define HISTORY_FRAMES 8
+#define HISTORY_MAX_LIGHTS 32
+#define HISTORY_DISTANCE 0.01
+#define HISTORY_COSINE 0.9998
+
+// What a pixel's camera ray hit and what was traced from there. See HistoryEntry in TemporalCache.h.
+struct historyEntry {
+	vec3 point;
+	int index;
+	vec3 dir;
+	// Bit n is set if the n'th light reached the point
+	uint visible;
+	vec3 reflection;
+	int age;
+};
+
+// Last frame's history and this frame's, an entry for every pixel. main.cpp swaps the two buffers between frames.
+layout(std430, binding = 11) readonly buffer PreviousHistory
+{
+	historyEntry previousHistory[];
+};
+
+layout(std430, binding = 12) buffer History
+{
+	historyEntry history[];
+};
+
+// The camera last frame was traced from, and whether there is a last frame to reuse at all.
+uniform vec3 previousEye;
+uniform vec3 previousRay00;
+uniform vec3 previousRay01;
+uniform vec3 previousRay10;
+uniform bool historyValid;
+
+// Whether every light's shadow fits in a historyEntry. Sampled lights change every frame, so there's nothing to reuse of theirs.
+bool cachesShadows()
+{
+	return lights.length() <= min(lightSamples, HISTORY_MAX_LIGHTS);
+}
+
+// The pixel of last frame's screen, of size pixels, that the point was seen through. -1 if it was off the screen or behind the camera.
+int reproject(vec3 point, ivec2 size)
+{
+	// The corner rays end on a parallelogram, so every ray through the screen is ray00 + u * right + v * up, for u and v from 0 to 1.
+	// Scale the ray toward the point out to that plane, then take it apart into u and v.
+	vec3 right = previousRay10 - previousRay00;
+	vec3 up = previousRay01 - previousRay00;
+	vec3 normal = cross(right, up);
+	vec3 toPoint = point - previousEye;
+	float planeDistance = dot(previousRay00, normal);
+	float pointDistance = dot(toPoint, normal);
+	if (planeDistance * pointDistance <= 0.0)
+	{
+		return -1;
+	}
+
+	vec3 onPlane = toPoint * (planeDistance / pointDistance) - previousRay00;
+	vec2 uv = vec2(dot(cross(onPlane, up), normal), dot(cross(right, onPlane), normal)) / dot(normal, normal);
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThanEqual(uv, vec2(1.0))))
+	{
+		return -1;
+	}
+
+	ivec2 pixel = min(ivec2(uv * vec2(size)), size - 1);
+	return pixel.y * size.x + pixel.x;
+}
+
+// Starts a pixel's entry for this frame from where its camera ray hit, keeping whatever of last frame's can be reused. Matches CpuTracer::StartHistory.
+historyEntry startHistory(hitinfo i, vec3 dir, uint seed, ivec2 size, out bool reuseShadows, out bool reuseReflection)
+{
+	historyEntry entry;
+	entry.point = i.point;
+	entry.index = i.index;
+	entry.dir = dir;
+	entry.visible = 0u;
+	entry.reflection = vec3(0.0);
+	reuseShadows = false;
+	reuseReflection = false;
+
+	// The point is disoccluded if the pixel that saw it last frame saw something else in front of it, or the same primitive somewhere else,
+	// which only happens along its edges. Points that come into view together start at different ages, so they aren't all traced again together.
+	int previous = historyValid ? reproject(i.point, size) : -1;
+	if (previous == -1 || previousHistory[previous].index != i.index || length(previousHistory[previous].point - i.point) > HISTORY_DISTANCE * length(i.point - previousEye))
+	{
+		entry.age = int(pcgHash(seed) % uint(HISTORY_FRAMES));
+		return entry;
+	}
+	if (previousHistory[previous].age + 1 >= HISTORY_FRAMES)
+	{
+		entry.age = 0;
+		return entry;
+	}
+
+	entry.age = previousHistory[previous].age + 1;
+	reuseShadows = cachesShadows();
+	if (reuseShadows)
+	{
+		entry.visible = previousHistory[previous].visible;
+	}
+
+	// The reflection goes off the way the camera ray comes in, so it only holds while the camera ray points the same way.
+	reuseReflection = dot(previousHistory[previous].dir, dir) >= HISTORY_COSINE;
+	if (reuseReflection)
+	{
+		entry.dir = previousHistory[previous].dir;
+		entry.reflection = previousHistory[previous].reflection;
+	}
+	return entry;
+}
+
+// trace for pixel p of a screen of size pixels, with the cache. The ray from the camera is always traced, since that's what tells whether
+// last frame's history still holds. The first point's shadows and reflection come from the history where they can, and are kept in this
+// frame's where they're traced. Matches CpuTracer::TraceCached.
+vec4 traceCached(vec3 origin, vec3 dir, uint seed, int p, ivec2 size)
+{
+	hitinfo i;
+#ifdef COUNT_RAYS
+	tracedPrimary++;
+#endif
+	if (!intersectTriangles(origin, dir, i))
+	{
+		history[p].index = -1;
+		return vec4(0.0, 0.0, 0.0, 1.0);
+	}
+#ifdef DENOISE
+	firstNormal = i.normal;
+	firstDepth = length(i.point - origin);
+	firstAlbedo = surfaces[i.index].color;
+#endif
+
+	bool reuseShadows;
+	bool reuseReflection;
+	historyEntry entry = startHistory(i, dir, seed, size, reuseShadows, reuseReflection);
+
+	// The same as tracePath's first point, but for where the shadows and the reflection come from.
+	vec3 pixColor = surfaces[i.index].color * 0.1;
+	for (int j = 0; j < lightsPerPoint(); j++)
+	{
+		float weight;
+		pointLight light = lights[pickLight(seed, j, weight)];
+		vec3 pointToLight = light.position - i.point;
+		bool reaches;
+		if (reuseShadows)
+		{
+			reaches = (entry.visible & (1u << uint(j))) != 0u;
+		}
+		else
+		{
+			reaches = lightReaches(light.position, pointToLight, i);
+			if (reaches && cachesShadows())
+			{
+				entry.visible |= 1u << uint(j);
+			}
+		}
+
+		if (reaches)
+		{
+			pixColor += shadeLight(pointToLight, dir, i, light.intensity) * weight;
+		}
+	}
+
+	float throughput = 1.0;
+	if (continuePath(0, seed, throughput))
+	{
+		if (!reuseReflection)
+		{
+			entry.reflection = tracePath(i.point, normalize(dir - (2 * dot(dir, i.normal) * i.normal)), seed, 1, throughput);
+		}
+		pixColor += entry.reflection;
+	}
+
+	history[p] = entry;
+	return vec4(pixColor, 1.0);
+}
+#endif
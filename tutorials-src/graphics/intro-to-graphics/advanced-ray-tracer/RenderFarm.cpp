@@ -0,0 +1,733 @@
+#include "RenderFarm.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "ws2_32.lib")
+#endif
+static const FarmSocket NO_SOCKET = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+static const FarmSocket NO_SOCKET = -1;
+#endif
+
+// What the farm and its workers send each other. Every message starts with a FarmHeader, and some have more after it.
+enum FarmMessage
+{
+	// Worker to farm on connecting, value is how many triangles its scene has
+	FARM_HELLO,
+	// Farm to worker, a FarmFrame follows
+	FARM_FRAME,
+	// Farm to worker, value is the tile to trace
+	FARM_TILE,
+	// Worker to farm, value is the tile traced, followed by the rays it took and then its pixels a row at a time
+	FARM_PIXELS,
+	// Farm to worker, there's nothing more to trace
+	FARM_QUIT
+};
+
+struct FarmHeader
+{
+	int32_t message;
+	int32_t value;
+};
+
+// What a worker needs to trace the frame's tiles, besides the scene it built itself
+struct FarmFrame
+{
+	CameraRays camera;
+	int32_t width;
+	int32_t height;
+	int32_t frameNumber;
+};
+
+// How long a worker keeps trying to reach a farm that isn't listening yet
+const int CONNECT_ATTEMPTS = 50;
+const int CONNECT_WAIT_MILLISECONDS = 200;
+// How long a new connection has to send its hello before it's closed, and how many can be waiting to at once. Past that, new
+// connections are closed straight away, so nothing that connects and says nothing can use up the farm's sockets.
+const double HELLO_SECONDS = 5.0;
+const unsigned int MAX_JOINING = 16;
+
+// Windows has to start its sockets before they're used. Elsewhere, writing to a worker that has gone raises SIGPIPE, which would end
+// the farm rather than let it hand the worker's tiles to the others, so it's ignored and the write fails instead.
+static void StartSockets()
+{
+#if defined(_WIN32)
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+static void StopSockets()
+{
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
+
+static void CloseSocket(FarmSocket connection)
+{
+#if defined(_WIN32)
+	closesocket(connection);
+#else
+	close(connection);
+#endif
+}
+
+// Messages are small and each one waits on the last, so they go out straight away rather than being held back to fill a packet
+static void SetNoDelay(FarmSocket connection)
+{
+	int noDelay = 1;
+	setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+static bool SendAll(FarmSocket connection, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		int sent = (int)send(connection, bytes, (int)std::min(size, (size_t)1 << 20), 0);
+		if (sent <= 0)
+		{
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool ReceiveAll(FarmSocket connection, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		int received = (int)recv(connection, bytes, (int)std::min(size, (size_t)1 << 20), 0);
+		if (received <= 0)
+		{
+			return false;
+		}
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+// The frame is cut into FARM_TILE_SIZE tiles, numbered a row at a time from the top left
+static int TileCount(int width, int height)
+{
+	return ((width + FARM_TILE_SIZE - 1) / FARM_TILE_SIZE) * ((height + FARM_TILE_SIZE - 1) / FARM_TILE_SIZE);
+}
+
+static void TileBounds(int tile, int width, int height, int& x0, int& y0, int& x1, int& y1)
+{
+	int tilesX = (width + FARM_TILE_SIZE - 1) / FARM_TILE_SIZE;
+	x0 = (tile % tilesX) * FARM_TILE_SIZE;
+	y0 = (tile / tilesX) * FARM_TILE_SIZE;
+	x1 = std::min(width, x0 + FARM_TILE_SIZE);
+	y1 = std::min(height, y0 + FARM_TILE_SIZE);
+}
+
+RenderFarm::RenderFarm(int triangles) : _triangles(triangles), _listener(NO_SOCKET), _port(0), _rendering(false), _width(0), _height(0), _frameNumber(0), _remaining(0)
+{
+	StartSockets();
+}
+
+RenderFarm::~RenderFarm()
+{
+	Shutdown();
+	StopSockets();
+}
+
+bool RenderFarm::Listen(int port, bool listenAll)
+{
+	_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (_listener == NO_SOCKET)
+	{
+		return false;
+	}
+#if !defined(_WIN32)
+	// The workers this process starts shouldn't hold the farm's socket open, and a port the last run used can be listened on again straight away
+	fcntl(_listener, F_SETFD, FD_CLOEXEC);
+	int reuse = 1;
+	setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(listenAll ? INADDR_ANY : INADDR_LOOPBACK);
+	address.sin_port = htons((uint16_t)port);
+	if (bind(_listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(_listener, SOMAXCONN) != 0)
+	{
+		CloseSocket(_listener);
+		_listener = NO_SOCKET;
+		return false;
+	}
+
+	// Find out which port was picked, if it was left to the system
+	socklen_t length = sizeof(address);
+	getsockname(_listener, (sockaddr*)&address, &length);
+	_port = ntohs(address.sin_port);
+	return true;
+}
+
+int RenderFarm::Port() const
+{
+	return _port;
+}
+
+bool RenderFarm::SpawnWorkers(const std::string& program, const std::vector<std::string>& arguments, int count)
+{
+	std::vector<std::string> words = arguments;
+	words.insert(words.begin(), program);
+	words.push_back("--farm-worker");
+	words.push_back("127.0.0.1");
+	words.push_back(std::to_string(_port));
+
+#if defined(_WIN32)
+	std::string commandLine;
+	for (const std::string& word : words)
+	{
+		commandLine += "\"" + word + "\" ";
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		// CreateProcess can write to the command line it's given, so each gets its own copy
+		std::string line = commandLine;
+		STARTUPINFOA startup = {};
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION info = {};
+		if (!CreateProcessA(nullptr, &line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info))
+		{
+			return false;
+		}
+		CloseHandle(info.hThread);
+		_processes.push_back(info.hProcess);
+	}
+#else
+	std::vector<char*> argv;
+	for (std::string& word : words)
+	{
+		argv.push_back(&word[0]);
+	}
+	argv.push_back(nullptr);
+	for (int i = 0; i < count; ++i)
+	{
+		pid_t process = fork();
+		if (process == 0)
+		{
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		if (process < 0)
+		{
+			return false;
+		}
+		_processes.push_back(process);
+	}
+#endif
+	return true;
+}
+
+bool RenderFarm::WaitForWorkers(int count, double timeoutSeconds)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<FarmSocket> ready;
+	while ((int)_workers.size() < count)
+	{
+		double left = timeoutSeconds - std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		if (left <= 0.0 || !Wait(left, ready))
+		{
+			return false;
+		}
+
+		// Workers have nothing to send before the first frame, so one with something to read has gone
+		for (FarmSocket socket : ready)
+		{
+			for (unsigned int i = 0; i < _workers.size(); ++i)
+			{
+				if (_workers[i].socket == socket)
+				{
+					Drop(i);
+					break;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void RenderFarm::Accept()
+{
+	FarmSocket connection = accept(_listener, nullptr, nullptr);
+	if (connection == NO_SOCKET)
+	{
+		return;
+	}
+	if (_joining.size() >= MAX_JOINING)
+	{
+		CloseSocket(connection);
+		return;
+	}
+	SetNoDelay(connection);
+
+	Joining joining;
+	joining.socket = connection;
+	joining.received = 0;
+	joining.since = std::chrono::high_resolution_clock::now();
+	_joining.push_back(joining);
+}
+
+bool RenderFarm::ReadHello(Joining& joining)
+{
+	// select found something to read, so one recv won't block, but it may not bring the whole hello
+	int received = (int)recv(joining.socket, (char*)joining.hello + joining.received, (int)(sizeof(joining.hello) - joining.received), 0);
+	if (received <= 0)
+	{
+		CloseSocket(joining.socket);
+		return false;
+	}
+	joining.received += received;
+	if (joining.received < sizeof(joining.hello))
+	{
+		return true;
+	}
+
+	// A worker built from other options would trace another scene, so its tiles wouldn't fit
+	FarmHeader hello = { joining.hello[0], joining.hello[1] };
+	if (hello.message != FARM_HELLO || hello.value != _triangles)
+	{
+		std::cout << "Turned away a worker whose scene doesn't match this one" << std::endl;
+		FarmHeader quit = { FARM_QUIT, 0 };
+		SendAll(joining.socket, &quit, sizeof(quit));
+		CloseSocket(joining.socket);
+		return false;
+	}
+
+	Worker worker;
+	worker.socket = joining.socket;
+	worker.traced = 0;
+	worker.stolen = 0;
+	_workers.push_back(worker);
+
+	// One that joins part way through a frame starts on it straight away
+	if (_rendering && !StartWorker(_workers.back()))
+	{
+		Drop((unsigned int)_workers.size() - 1);
+	}
+	return false;
+}
+
+bool RenderFarm::Wait(double timeoutSeconds, std::vector<FarmSocket>& ready)
+{
+	// While connections are joining, wake up at least once a second to close the ones that have waited too long
+	if (!_joining.empty() && (timeoutSeconds < 0.0 || timeoutSeconds > 1.0))
+	{
+		timeoutSeconds = 1.0;
+	}
+
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(_listener, &readable);
+	FarmSocket highest = _listener;
+	for (const Worker& worker : _workers)
+	{
+		FD_SET(worker.socket, &readable);
+		highest = std::max(highest, worker.socket);
+	}
+	for (const Joining& joining : _joining)
+	{
+		FD_SET(joining.socket, &readable);
+		highest = std::max(highest, joining.socket);
+	}
+	timeval wait;
+	wait.tv_sec = (long)timeoutSeconds;
+	wait.tv_usec = (long)((timeoutSeconds - (long)timeoutSeconds) * 1000000.0);
+	if (select((int)highest + 1, &readable, nullptr, nullptr, timeoutSeconds < 0.0 ? nullptr : &wait) < 0)
+	{
+		return false;
+	}
+
+	// Before any joining connection can become a worker, so only sockets that were workers when select returned are in it
+	ready.clear();
+	for (const Worker& worker : _workers)
+	{
+		if (FD_ISSET(worker.socket, &readable))
+		{
+			ready.push_back(worker.socket);
+		}
+	}
+
+	auto now = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < _joining.size();)
+	{
+		bool joining = true;
+		if (FD_ISSET(_joining[i].socket, &readable))
+		{
+			joining = ReadHello(_joining[i]);
+		}
+		else if (std::chrono::duration<double>(now - _joining[i].since).count() > HELLO_SECONDS)
+		{
+			CloseSocket(_joining[i].socket);
+			joining = false;
+		}
+
+		if (joining)
+		{
+			++i;
+		}
+		else
+		{
+			_joining.erase(_joining.begin() + i);
+		}
+	}
+	if (FD_ISSET(_listener, &readable))
+	{
+		Accept();
+	}
+	return true;
+}
+
+bool RenderFarm::StartWorker(Worker& worker)
+{
+	FarmHeader header = { FARM_FRAME, 0 };
+	FarmFrame frame = { _camera, _width, _height, _frameNumber };
+	if (!SendAll(worker.socket, &header, sizeof(header)) || !SendAll(worker.socket, &frame, sizeof(frame)))
+	{
+		return false;
+	}
+	for (int i = 0; i < FARM_TILES_IN_FLIGHT; ++i)
+	{
+		SendTile(worker);
+	}
+	return true;
+}
+
+int RenderFarm::NextTile(Worker& worker)
+{
+	if (!_orphans.empty())
+	{
+		int tile = _orphans.front();
+		_orphans.pop_front();
+		return tile;
+	}
+
+	// Out of tiles of its own, so steal the far half of the longest run left. Taking half rather than one keeps the tiles
+	// it gets together, and means the two workers split what's left rather than coming back to steal again after every tile.
+	if (worker.run.empty())
+	{
+		Worker* victim = nullptr;
+		for (Worker& other : _workers)
+		{
+			if (other.run.size() > (victim != nullptr ? victim->run.size() : 0))
+			{
+				victim = &other;
+			}
+		}
+		if (victim == nullptr)
+		{
+			return -1;
+		}
+		size_t count = (victim->run.size() + 1) / 2;
+		worker.run.assign(victim->run.end() - count, victim->run.end());
+		victim->run.erase(victim->run.end() - count, victim->run.end());
+		worker.stolen += (int)count;
+	}
+
+	int tile = worker.run.front();
+	worker.run.pop_front();
+	return tile;
+}
+
+void RenderFarm::SendTile(Worker& worker)
+{
+	int tile = NextTile(worker);
+	if (tile == -1)
+	{
+		return;
+	}
+	worker.pending.push_back(tile);
+	FarmHeader header = { FARM_TILE, tile };
+	SendAll(worker.socket, &header, sizeof(header));
+}
+
+bool RenderFarm::ReceiveTile(Worker& worker, Image& image, FarmStats& stats)
+{
+	FarmHeader header;
+	if (!ReceiveAll(worker.socket, &header, sizeof(header)) || header.message != FARM_PIXELS)
+	{
+		return false;
+	}
+
+	// Only take pixels for a tile the worker was sent
+	std::vector<int>::iterator sent = std::find(worker.pending.begin(), worker.pending.end(), header.value);
+	if (sent == worker.pending.end())
+	{
+		return false;
+	}
+
+	int x0, y0, x1, y1;
+	TileBounds(header.value, _width, _height, x0, y0, x1, y1);
+	RayCounts rays;
+	std::vector<glm::vec3> pixels((x1 - x0) * (y1 - y0));
+	if (!ReceiveAll(worker.socket, &rays, sizeof(rays)) || !ReceiveAll(worker.socket, pixels.data(), sizeof(glm::vec3) * pixels.size()))
+	{
+		return false;
+	}
+	worker.pending.erase(sent);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		std::copy(pixels.begin() + (y - y0) * (x1 - x0), pixels.begin() + (y - y0 + 1) * (x1 - x0), &image.At(x0, y));
+	}
+	stats.rays.primary += rays.primary;
+	stats.rays.shadow += rays.shadow;
+	stats.rays.reflection += rays.reflection;
+	worker.traced++;
+	_remaining--;
+
+	SendTile(worker);
+	return true;
+}
+
+void RenderFarm::Drop(unsigned int index)
+{
+	std::cout << "A worker dropped out, its tiles go to the others" << std::endl;
+	Worker worker = _workers[index];
+	CloseSocket(worker.socket);
+	_workers.erase(_workers.begin() + index);
+	_orphans.insert(_orphans.end(), worker.pending.begin(), worker.pending.end());
+	_orphans.insert(_orphans.end(), worker.run.begin(), worker.run.end());
+
+	// Workers that have run out of tiles aren't going to ask for more, so the orphans go to them now
+	if (_rendering)
+	{
+		for (Worker& other : _workers)
+		{
+			while ((int)other.pending.size() < FARM_TILES_IN_FLIGHT && !_orphans.empty())
+			{
+				SendTile(other);
+			}
+		}
+	}
+}
+
+bool RenderFarm::Render(const CameraRays& camera, Image& image, int frameNumber, FarmStats& stats)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	_camera = camera;
+	_width = image.width;
+	_height = image.height;
+	_frameNumber = frameNumber;
+	int tiles = TileCount(_width, _height);
+	_remaining = tiles;
+	_orphans.clear();
+	stats.rays = RayCounts();
+
+	// Each worker starts with an even share of the tiles, in one run so it traces neighbouring tiles
+	int workers = (int)_workers.size();
+	for (int i = 0; i < workers; ++i)
+	{
+		Worker& worker = _workers[i];
+		worker.run.clear();
+		worker.pending.clear();
+		worker.traced = 0;
+		worker.stolen = 0;
+		for (int tile = tiles * i / workers; tile < tiles * (i + 1) / workers; ++tile)
+		{
+			worker.run.push_back(tile);
+		}
+	}
+
+	_rendering = true;
+	for (unsigned int i = 0; i < _workers.size();)
+	{
+		if (StartWorker(_workers[i]))
+		{
+			++i;
+		}
+		else
+		{
+			Drop(i);
+		}
+	}
+
+	// Wait on every worker at once, and on the farm's socket for workers joining
+	std::vector<FarmSocket> ready;
+	while (_remaining > 0)
+	{
+		if (_workers.empty())
+		{
+			std::cout << "Every worker dropped out, " << _remaining << " tiles weren't traced" << std::endl;
+			_rendering = false;
+			return false;
+		}
+
+		if (!Wait(-1.0, ready))
+		{
+			_rendering = false;
+			return false;
+		}
+
+		for (unsigned int i = 0; i < _workers.size();)
+		{
+			if (std::find(ready.begin(), ready.end(), _workers[i].socket) != ready.end() && !ReceiveTile(_workers[i], image, stats))
+			{
+				Drop(i);
+				continue;
+			}
+			++i;
+		}
+	}
+	_rendering = false;
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	stats.tilesTraced.clear();
+	stats.tilesStolen.clear();
+	for (const Worker& worker : _workers)
+	{
+		stats.tilesTraced.push_back(worker.traced);
+		stats.tilesStolen.push_back(worker.stolen);
+	}
+	return true;
+}
+
+void RenderFarm::Shutdown()
+{
+	FarmHeader quit = { FARM_QUIT, 0 };
+	for (const Worker& worker : _workers)
+	{
+		SendAll(worker.socket, &quit, sizeof(quit));
+		CloseSocket(worker.socket);
+	}
+	_workers.clear();
+	for (const Joining& joining : _joining)
+	{
+		CloseSocket(joining.socket);
+	}
+	_joining.clear();
+
+	for (FarmProcess process : _processes)
+	{
+#if defined(_WIN32)
+		WaitForSingleObject(process, INFINITE);
+		CloseHandle(process);
+#else
+		waitpid(process, nullptr, 0);
+#endif
+	}
+	_processes.clear();
+
+	if (_listener != NO_SOCKET)
+	{
+		CloseSocket(_listener);
+		_listener = NO_SOCKET;
+	}
+}
+
+// Connects to the farm, trying each address host goes by
+static FarmSocket Connect(const std::string& host, int port)
+{
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+	{
+		return NO_SOCKET;
+	}
+
+	FarmSocket connection = NO_SOCKET;
+	for (addrinfo* address = addresses; address != nullptr && connection == NO_SOCKET; address = address->ai_next)
+	{
+		connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (connection != NO_SOCKET && connect(connection, address->ai_addr, (int)address->ai_addrlen) != 0)
+		{
+			CloseSocket(connection);
+			connection = NO_SOCKET;
+		}
+	}
+	freeaddrinfo(addresses);
+	return connection;
+}
+
+int RunFarmWorker(const std::string& host, int port, const CpuTracer& tracer, int triangles, ThreadPool& pool)
+{
+	StartSockets();
+
+	// The farm may not be listening yet, if the worker was started by hand
+	FarmSocket connection = NO_SOCKET;
+	for (int attempt = 0; attempt < CONNECT_ATTEMPTS && connection == NO_SOCKET; ++attempt)
+	{
+		connection = Connect(host, port);
+		if (connection == NO_SOCKET)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_WAIT_MILLISECONDS));
+		}
+	}
+	if (connection == NO_SOCKET)
+	{
+		std::cout << "Can't reach the render farm at " << host << ":" << port << std::endl;
+		StopSockets();
+		return 1;
+	}
+	SetNoDelay(connection);
+
+	FarmHeader hello = { FARM_HELLO, triangles };
+	bool connected = SendAll(connection, &hello, sizeof(hello));
+
+	// The image is the whole frame, but only the tiles this worker is sent are ever traced into it
+	FarmFrame frame = {};
+	Image image;
+	std::vector<glm::vec3> pixels;
+	FarmHeader header = { FARM_HELLO, 0 };
+	while (connected && ReceiveAll(connection, &header, sizeof(header)) && header.message != FARM_QUIT)
+	{
+		if (header.message == FARM_FRAME)
+		{
+			connected = ReceiveAll(connection, &frame, sizeof(frame));
+			image.Resize(frame.width, frame.height);
+			continue;
+		}
+		if (header.message != FARM_TILE)
+		{
+			break;
+		}
+
+		int x0, y0, x1, y1;
+		TileBounds(header.value, frame.width, frame.height, x0, y0, x1, y1);
+		RayCounts rays = tracer.RenderRegion(frame.camera, image, frame.frameNumber, pool, x0, y0, x1, y1);
+		pixels.clear();
+		for (int y = y0; y < y1; ++y)
+		{
+			pixels.insert(pixels.end(), &image.At(x0, y), &image.At(x0, y) + (x1 - x0));
+		}
+
+		FarmHeader reply = { FARM_PIXELS, header.value };
+		connected = SendAll(connection, &reply, sizeof(reply)) && SendAll(connection, &rays, sizeof(rays)) && SendAll(connection, pixels.data(), sizeof(glm::vec3) * pixels.size());
+	}
+
+	// Anything but being told to quit means the farm went away part way through
+	CloseSocket(connection);
+	StopSockets();
+	return connected && header.message == FARM_QUIT ? 0 : 1;
+}
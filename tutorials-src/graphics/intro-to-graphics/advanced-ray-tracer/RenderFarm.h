@@ -0,0 +1,127 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include "CpuTracer.h"
+
+// Sockets and processes as each system names them. These are Windows' SOCKET and HANDLE, without bringing in windows.h and its min and max macros.
+#if defined(_WIN32)
+typedef uintptr_t FarmSocket;
+typedef void* FarmProcess;
+#else
+typedef int FarmSocket;
+typedef int FarmProcess;
+#endif
+
+// Pixels per side of the tiles the farm hands out. Much bigger than the tracer's own tiles, so a worker's threads have plenty
+// to share and the time a tile spends going to and from the worker is small next to the time spent tracing it.
+const int FARM_TILE_SIZE = 64;
+// Tiles a worker is handed before it has sent any back, so it has the next one to start on while the last one's pixels are on their way
+const int FARM_TILES_IN_FLIGHT = 2;
+
+// How the farm rendered a frame
+struct FarmStats
+{
+	double milliseconds;
+	RayCounts rays;
+	// For each worker that took part, the tiles it traced and how many of those it stole from the others
+	std::vector<int> tilesTraced;
+	std::vector<int> tilesStolen;
+};
+
+// Renders frames on the CPU tracer across other processes, the workers, which can be on this machine or any other that can reach it.
+// Each worker builds the scene itself from the same command line, so all that goes to it is the camera, and all that comes back
+// is the pixels of the tiles it traced.
+// The frame's tiles are split between the workers in runs of neighbouring tiles, which they trace in order. Some tiles take far longer
+// than others (a tile of sky traces one ray per pixel, a tile of reflective cubes dozens), so a worker that runs out takes half of
+// what's left of the run with the most left in it, from the far end, where its owner would get to last. Workers that join part way
+// through start out by stealing, and the tiles of a worker that drops out are handed to the next worker to ask.
+// Workers and the farm send each other raw structs, so they have to share a byte order, which every x86 and ARM machine does.
+class RenderFarm
+{
+public:
+	// triangles is how many the scene has, workers whose scene has a different number are turned away.
+	RenderFarm(int triangles);
+	~RenderFarm();
+
+	// Listens for workers on port, 0 picks any free port. Only workers on this machine can connect unless listenAll is set.
+	bool Listen(int port, bool listenAll);
+	int Port() const;
+
+	// Starts count workers on this machine, each running program with arguments and then --farm-worker with where to connect
+	bool SpawnWorkers(const std::string& program, const std::vector<std::string>& arguments, int count);
+
+	// Waits up to timeoutSeconds for count workers to connect. Returns false if they don't.
+	bool WaitForWorkers(int count, double timeoutSeconds);
+
+	// Renders one frame into image, at image's size, the same as CpuTracer::Render would. Returns false if every worker drops out.
+	bool Render(const CameraRays& camera, Image& image, int frameNumber, FarmStats& stats);
+
+	// Tells every worker to quit, and waits for the ones it started to exit
+	void Shutdown();
+private:
+	struct Worker
+	{
+		FarmSocket socket;
+		// The tiles it will trace next, front first, and the ones it has been sent and not sent back
+		std::deque<int> run;
+		std::vector<int> pending;
+		int traced;
+		int stolen;
+	};
+
+	// A connection that hasn't yet said which scene it has. Its hello is read as it comes, between the workers' tiles,
+	// so one that is slow to send it, or never does, can't hold up the farm.
+	struct Joining
+	{
+		FarmSocket socket;
+		// The FarmHeader the worker sends first, and how many bytes of it have come
+		int32_t hello[2];
+		size_t received;
+		std::chrono::high_resolution_clock::time_point since;
+	};
+
+	// Accepts a connection, to join once its hello has come
+	void Accept();
+	// Reads what's there of a connection's hello. Once it's all come, the connection becomes a worker if its scene matches,
+	// or is turned away. Returns false once it's done joining either way.
+	bool ReadHello(Joining& joining);
+	// Waits up to timeoutSeconds, or for ever if it's negative, for a worker to send something, accepting connections and reading
+	// their hellos meanwhile. ready is set to the sockets of the workers with something to read. Returns false if waiting fails.
+	bool Wait(double timeoutSeconds, std::vector<FarmSocket>& ready);
+	// Sends a worker the frame and its first tiles. Returns false if the worker has gone.
+	bool StartWorker(Worker& worker);
+	// The tile a worker should trace next, from the orphans, its own run or someone else's, or -1 if there are none left
+	int NextTile(Worker& worker);
+	// Sends a worker its next tile, if there are any left. If the worker has gone, reading from it finds out.
+	void SendTile(Worker& worker);
+	// Reads a tile's pixels back into the image and sends the worker another. Returns false if the worker has gone.
+	bool ReceiveTile(Worker& worker, Image& image, FarmStats& stats);
+	// Forgets a worker that's gone, handing its tiles on to the others
+	void Drop(unsigned int index);
+
+	int _triangles;
+	FarmSocket _listener;
+	int _port;
+	std::vector<Worker> _workers;
+	std::vector<Joining> _joining;
+	std::vector<FarmProcess> _processes;
+
+	// The frame being rendered
+	bool _rendering;
+	CameraRays _camera;
+	int _width;
+	int _height;
+	int _frameNumber;
+	// Tiles not yet sent back
+	int _remaining;
+	// Tiles that dropped workers never sent back, handed out before anything else
+	std::deque<int> _orphans;
+};
+
+// The worker's side: connects to the farm at host, port and traces the tiles it's sent with tracer on pool until the farm says to quit.
+// triangles is how many the worker's scene has, for the farm to check. Returns what main should exit with.
+int RunFarmWorker(const std::string& host, int port, const CpuTracer& tracer, int triangles, ThreadPool& pool);
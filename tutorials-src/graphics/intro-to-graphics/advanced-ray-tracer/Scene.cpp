@@ -0,0 +1,414 @@
+#include "Scene.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+
+void Scene::AddTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 normal, glm::vec3 color)
+{
+	SceneTriangle t = SceneTriangle();
+	t.a = a;
+	t.b = b;
+	t.c = c;
+	t.normal = normal;
+	t.color = color;
+	triangles.push_back(t);
+}
+
+void Scene::AddSphere(glm::vec3 center, float radius, glm::vec3 color)
+{
+	SceneTriangle t = SceneTriangle();
+	t.kind = PRIMITIVE_SPHERE;
+	t.a = center;
+	t.radius = radius;
+	t.color = color;
+	triangles.push_back(t);
+}
+
+void Scene::AddBoxPrimitive(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 color)
+{
+	SceneTriangle t = SceneTriangle();
+	t.kind = PRIMITIVE_BOX;
+	t.a = boundsMin;
+	t.b = boundsMax;
+	t.color = color;
+	triangles.push_back(t);
+}
+
+void Scene::AddPlane(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 normal, glm::vec3 color)
+{
+	AddTriangle(a, b, c, normal, color);
+	triangles.back().kind = PRIMITIVE_PLANE;
+}
+
+void Scene::PrimitiveBounds(const SceneTriangle& t, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	switch (t.kind)
+	{
+	case PRIMITIVE_SPHERE:
+		boundsMin = t.a - glm::vec3(t.radius);
+		boundsMax = t.a + glm::vec3(t.radius);
+		break;
+	case PRIMITIVE_BOX:
+		boundsMin = t.a;
+		boundsMax = t.b;
+		break;
+	case PRIMITIVE_PLANE:
+	{
+		// The corner across from a
+		glm::vec3 d = t.b + t.c - t.a;
+		boundsMin = glm::min(glm::min(t.a, t.b), glm::min(t.c, d));
+		boundsMax = glm::max(glm::max(t.a, t.b), glm::max(t.c, d));
+		break;
+	}
+	default:
+		boundsMin = glm::min(t.a, glm::min(t.b, t.c));
+		boundsMax = glm::max(t.a, glm::max(t.b, t.c));
+		break;
+	}
+}
+
+void Scene::AddCubes(bool secondCube, bool analytic)
+{
+	glm::vec3 blue = glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::vec3 red = glm::vec3(1.0f, 0.0f, 0.0f);
+	int first = (int)triangles.size();
+
+	// Flat Box
+	// Top face triangles, or the same square as one plane
+	if (analytic)
+	{
+		AddPlane(glm::vec3(-5.0f, 0.0f, 5.0f), glm::vec3(-5.0f, 0.0f, -5.0f), glm::vec3(5.0f, 0.0f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f), blue);
+	}
+	else
+	{
+		AddTriangle(glm::vec3(-5.0f, 0.0f, 5.0f), glm::vec3(-5.0f, 0.0f, -5.0f), glm::vec3(5.0f, 0.0f, -5.0f), glm::vec3(0.0f, 1.0f, 0.0f), blue);
+		AddTriangle(glm::vec3(-5.0f, 0.0f, 5.0f), glm::vec3(5.0f, 0.0f, -5.0f), glm::vec3(5.0f, 0.0f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f), blue);
+	}
+
+	// Cube Box
+	// Back face triangles
+	AddTriangle(glm::vec3(-0.5f, 1.0f, -0.5f), glm::vec3(0.5f, 1.0f, -0.5f), glm::vec3(-0.5f, 2.0f, -0.5f), glm::vec3(0.0f, 0.0f, -1.0f), red);
+	AddTriangle(glm::vec3(0.5f, 1.0f, -0.5f), glm::vec3(0.5f, 2.0f, -0.5f), glm::vec3(-0.5f, 2.0f, -0.5f), glm::vec3(0.0f, 0.0f, -1.0f), red);
+	// Front face triangles
+	AddTriangle(glm::vec3(-0.5f, 1.0f, 0.5f), glm::vec3(-0.5f, 2.0f, 0.5f), glm::vec3(0.5f, 2.0f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f), red);
+	AddTriangle(glm::vec3(-0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 2.0f, 0.5f), glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f), red);
+	// Right face triangles
+	AddTriangle(glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 2.0f, 0.5f), glm::vec3(0.5f, 2.0f, -0.5f), glm::vec3(1.0f, 0.0f, 0.0f), red);
+	AddTriangle(glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 2.0f, -0.5f), glm::vec3(0.5f, 1.0f, -0.5f), glm::vec3(1.0f, 0.0f, 0.0f), red);
+	// Left face triangles
+	AddTriangle(glm::vec3(-0.5f, 1.0f, -0.5f), glm::vec3(-0.5f, 2.0f, -0.5f), glm::vec3(-0.5f, 2.0f, 0.5f), glm::vec3(-1.0f, 0.0f, 0.0f), red);
+	AddTriangle(glm::vec3(-0.5f, 1.0f, -0.5f), glm::vec3(-0.5f, 2.0f, 0.5f), glm::vec3(-0.5f, 1.0f, 0.5f), glm::vec3(-1.0f, 0.0f, 0.0f), red);
+	// Top face triangles
+	AddTriangle(glm::vec3(-0.5f, 2.0f, 0.5f), glm::vec3(-0.5f, 2.0f, -0.5f), glm::vec3(0.5f, 2.0f, -0.5f), glm::vec3(0.0f, 1.0f, 0.0f), red);
+	AddTriangle(glm::vec3(-0.5f, 2.0f, 0.5f), glm::vec3(0.5f, 2.0f, -0.5f), glm::vec3(0.5f, 2.0f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f), red);
+	// Bottom face triangles
+	AddTriangle(glm::vec3(-0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 1.0f, -0.5f), glm::vec3(0.0f, -1.0f, 0.0f), red);
+	AddTriangle(glm::vec3(-0.5f, 1.0f, 0.5f), glm::vec3(0.5f, 1.0f, -0.5f), glm::vec3(-0.5f, 1.0f, -0.5f), glm::vec3(0.0f, -1.0f, 0.0f), red);
+
+	// The lights of the original shader, all as bright as each other
+	AddLight(glm::vec3(5.0f, 3.0f, 0.0f), 6.0f);
+	AddLight(glm::vec3(-8.0f, 5.0f, 5.0f), 6.0f);
+	AddLight(glm::vec3(5.0f, 8.0f, -5.0f), 6.0f);
+	AddLight(glm::vec3(-5.0f, 5.0f, -5.0f), 6.0f);
+
+	if (!secondCube)
+	{
+		AddObject(first, glm::mat4(1.0f));
+		return;
+	}
+
+	// Cube Box 2
+	// Back face triangles
+	AddTriangle(glm::vec3(2.5f, 3.5f, 2.5f), glm::vec3(3.5f, 3.5f, 2.5f), glm::vec3(2.5f, 4.5f, 2.5f), glm::vec3(0.0f, 0.0f, -1.0f), red);
+	AddTriangle(glm::vec3(3.5f, 3.5f, 2.5f), glm::vec3(3.5f, 4.5f, 2.5f), glm::vec3(2.5f, 4.5f, 2.5f), glm::vec3(0.0f, 0.0f, -1.0f), red);
+	// Front face triangles
+	AddTriangle(glm::vec3(2.5f, 3.5f, 1.5f), glm::vec3(2.5f, 4.5f, 1.5f), glm::vec3(3.5f, 4.5f, 1.5f), glm::vec3(0.0f, 0.0f, 1.0f), red);
+	AddTriangle(glm::vec3(2.5f, 3.5f, 1.5f), glm::vec3(3.5f, 4.5f, 1.5f), glm::vec3(3.5f, 3.5f, 1.5f), glm::vec3(0.0f, 0.0f, 1.0f), red);
+	// Right face triangles
+	AddTriangle(glm::vec3(3.5f, 3.5f, 1.5f), glm::vec3(3.5f, 4.5f, 1.5f), glm::vec3(3.5f, 4.5f, 2.5f), glm::vec3(1.0f, 0.0f, 0.0f), red);
+	AddTriangle(glm::vec3(3.5f, 3.5f, 1.5f), glm::vec3(3.5f, 4.5f, 2.5f), glm::vec3(3.5f, 3.5f, 2.5f), glm::vec3(1.0f, 0.0f, 0.0f), red);
+	// Left face triangles
+	AddTriangle(glm::vec3(2.5f, 3.5f, 2.5f), glm::vec3(2.5f, 4.5f, 2.5f), glm::vec3(2.5f, 4.5f, 1.5f), glm::vec3(-1.0f, 0.0f, 0.0f), red);
+	AddTriangle(glm::vec3(2.5f, 3.5f, 2.5f), glm::vec3(2.5f, 4.5f, 1.5f), glm::vec3(2.5f, 3.5f, 1.5f), glm::vec3(-1.0f, 0.0f, 0.0f), red);
+	// Top face triangles
+	AddTriangle(glm::vec3(2.5f, 4.5f, 1.5f), glm::vec3(2.5f, 4.5f, 2.5f), glm::vec3(3.5f, 4.5f, 2.5f), glm::vec3(0.0f, 1.0f, 0.0f), red);
+	AddTriangle(glm::vec3(2.5f, 4.5f, 1.5f), glm::vec3(3.5f, 4.5f, 2.5f), glm::vec3(3.5f, 4.5f, 1.5f), glm::vec3(0.0f, 1.0f, 0.0f), red);
+	// Bottom face triangles
+	AddTriangle(glm::vec3(2.5f, 3.5f, 1.5f), glm::vec3(3.5f, 3.5f, 1.5f), glm::vec3(3.5f, 3.5f, 2.5f), glm::vec3(0.0f, -1.0f, 0.0f), red);
+	AddTriangle(glm::vec3(2.5f, 3.5f, 1.5f), glm::vec3(3.5f, 3.5f, 2.5f), glm::vec3(2.5f, 3.5f, 2.5f), glm::vec3(0.0f, -1.0f, 0.0f), red);
+
+	// The floor and the cubes never move, so they are all one object, already where they belong in the world
+	AddObject(first, glm::mat4(1.0f));
+}
+
+void Scene::AddObject(int firstTriangle, glm::mat4 transform)
+{
+	if (firstTriangle >= (int)triangles.size())
+	{
+		return;
+	}
+
+	SceneObject object;
+	object.firstTriangle = firstTriangle;
+	object.triangleCount = (int)triangles.size() - firstTriangle;
+	object.transform = transform;
+	objects.push_back(object);
+}
+
+void Scene::AddLight(glm::vec3 position, float intensity)
+{
+	SceneLight light;
+	light.position = position;
+	light.intensity = intensity;
+	lights.push_back(light);
+}
+
+void Scene::AddLights(int count)
+{
+	// Every third light is five times as bright as the dimmest, so picking lights by brightness has something to work with.
+	// Between them they give out as much light as the original four.
+	float total = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		total += 0.5f + (i % 3);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		// Spread them evenly over a disc with a spiral, each a little further round than the last by the golden angle, at heights from 3 to 8
+		float radius = 8.0f * std::sqrt((i + 0.5f) / count);
+		float angle = i * 2.39996f;
+		float height = 3.0f + 5.0f * std::fmod(i * 0.618034f, 1.0f);
+		AddLight(glm::vec3(radius * std::cos(angle), height, radius * std::sin(angle)), 24.0f * (0.5f + (i % 3)) / total);
+	}
+}
+
+Scene Scene::Flattened() const
+{
+	Scene world;
+	world.lights = lights;
+	world.triangles.reserve(triangles.size());
+	for (unsigned int i = 0; i < objects.size(); ++i)
+	{
+		const SceneObject& object = objects[i];
+		// Normals are moved by the inverse transpose, which keeps them at right angles to the surface
+		glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(object.transform)));
+		for (int j = object.firstTriangle; j < object.firstTriangle + object.triangleCount; ++j)
+		{
+			const SceneTriangle& t = triangles[j];
+			glm::vec3 a = glm::vec3(object.transform * glm::vec4(t.a, 1.0f));
+			glm::vec3 b = glm::vec3(object.transform * glm::vec4(t.b, 1.0f));
+			if (t.kind == PRIMITIVE_SPHERE)
+			{
+				world.AddSphere(a, t.radius * glm::length(glm::vec3(object.transform[0])), t.color);
+			}
+			else if (t.kind == PRIMITIVE_BOX)
+			{
+				world.AddBoxPrimitive(glm::min(a, b), glm::max(a, b), t.color);
+			}
+			else
+			{
+				world.AddTriangle(a, b, glm::vec3(object.transform * glm::vec4(t.c, 1.0f)), glm::normalize(normalTransform * t.normal), t.color);
+				world.triangles.back().kind = t.kind;
+			}
+		}
+	}
+	world.AddObject(0, glm::mat4(1.0f));
+	return world;
+}
+
+std::vector<TriangleEdges> Scene::Edges() const
+{
+	std::vector<TriangleEdges> edges(triangles.size(), TriangleEdges());
+	for (unsigned int i = 0; i < triangles.size(); ++i)
+	{
+		const SceneTriangle& t = triangles[i];
+		edges[i].kind = t.kind;
+		edges[i].v0 = t.a;
+		if (t.kind == PRIMITIVE_SPHERE)
+		{
+			edges[i].radius = t.radius;
+		}
+		else if (t.kind == PRIMITIVE_BOX)
+		{
+			edges[i].e1 = t.b;
+		}
+		else
+		{
+			edges[i].e1 = t.b - t.a;
+			edges[i].e2 = t.c - t.a;
+		}
+	}
+	return edges;
+}
+
+std::vector<TriangleSurface> Scene::Surfaces() const
+{
+	std::vector<TriangleSurface> surfaces(triangles.size(), TriangleSurface());
+	for (unsigned int i = 0; i < triangles.size(); ++i)
+	{
+		surfaces[i].normal = triangles[i].normal;
+		surfaces[i].color = triangles[i].color;
+	}
+	return surfaces;
+}
+
+void Scene::AddBox(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 color)
+{
+	glm::vec3 l = boundsMin;
+	glm::vec3 h = boundsMax;
+
+	// Same winding as the cubes above
+	AddTriangle(glm::vec3(l.x, l.y, l.z), glm::vec3(h.x, l.y, l.z), glm::vec3(l.x, h.y, l.z), glm::vec3(0.0f, 0.0f, -1.0f), color);
+	AddTriangle(glm::vec3(h.x, l.y, l.z), glm::vec3(h.x, h.y, l.z), glm::vec3(l.x, h.y, l.z), glm::vec3(0.0f, 0.0f, -1.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, h.z), glm::vec3(l.x, h.y, h.z), glm::vec3(h.x, h.y, h.z), glm::vec3(0.0f, 0.0f, 1.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, h.z), glm::vec3(h.x, h.y, h.z), glm::vec3(h.x, l.y, h.z), glm::vec3(0.0f, 0.0f, 1.0f), color);
+	AddTriangle(glm::vec3(h.x, l.y, h.z), glm::vec3(h.x, h.y, h.z), glm::vec3(h.x, h.y, l.z), glm::vec3(1.0f, 0.0f, 0.0f), color);
+	AddTriangle(glm::vec3(h.x, l.y, h.z), glm::vec3(h.x, h.y, l.z), glm::vec3(h.x, l.y, l.z), glm::vec3(1.0f, 0.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, l.z), glm::vec3(l.x, h.y, l.z), glm::vec3(l.x, h.y, h.z), glm::vec3(-1.0f, 0.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, l.z), glm::vec3(l.x, h.y, h.z), glm::vec3(l.x, l.y, h.z), glm::vec3(-1.0f, 0.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, h.y, h.z), glm::vec3(l.x, h.y, l.z), glm::vec3(h.x, h.y, l.z), glm::vec3(0.0f, 1.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, h.y, h.z), glm::vec3(h.x, h.y, l.z), glm::vec3(h.x, h.y, h.z), glm::vec3(0.0f, 1.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, h.z), glm::vec3(h.x, l.y, h.z), glm::vec3(h.x, l.y, l.z), glm::vec3(0.0f, -1.0f, 0.0f), color);
+	AddTriangle(glm::vec3(l.x, l.y, h.z), glm::vec3(h.x, l.y, l.z), glm::vec3(l.x, l.y, l.z), glm::vec3(0.0f, -1.0f, 0.0f), color);
+}
+
+void Scene::AddBoxes(int count, bool analytic)
+{
+	// Lay the boxes out on a square grid over the floor, with a little variation in height so they don't all line up
+	int side = (int)std::ceil(std::sqrt((float)count));
+	float spacing = 9.0f / side;
+	float size = spacing * 0.4f;
+	for (int i = 0; i < count; ++i)
+	{
+		float x = -4.5f + spacing * (i % side + 0.5f);
+		float z = -4.5f + spacing * (i / side + 0.5f);
+		float y = 0.25f + 0.25f * std::sin(x * 3.0f) * std::cos(z * 2.0f) + 0.25f;
+		glm::vec3 center = glm::vec3(x, y, z);
+		glm::vec3 color = glm::vec3(0.5f + 0.5f * std::sin(x), 0.5f + 0.5f * std::cos(z), 0.5f);
+
+		// Every box is an object of its own, built around its center and moved into place, so it can be moved again without touching its triangles
+		int first = (int)triangles.size();
+		if (analytic)
+		{
+			AddBoxPrimitive(glm::vec3(size * -0.5f), glm::vec3(size * 0.5f), color);
+		}
+		else
+		{
+			AddBox(glm::vec3(size * -0.5f), glm::vec3(size * 0.5f), color);
+		}
+		AddObject(first, glm::translate(glm::mat4(1.0f), center));
+	}
+}
+
+void Scene::AddSpheres(int count)
+{
+	// The same grid as AddBoxes, but floating higher, so spheres and boxes can be used together
+	int side = (int)std::ceil(std::sqrt((float)count));
+	float spacing = 9.0f / side;
+	float radius = spacing * 0.25f;
+	for (int i = 0; i < count; ++i)
+	{
+		float x = -4.5f + spacing * (i % side + 0.5f);
+		float z = -4.5f + spacing * (i / side + 0.5f);
+		float y = 1.0f + radius + 0.25f * std::cos(x * 2.0f) * std::sin(z * 3.0f);
+		glm::vec3 color = glm::vec3(0.5f, 0.5f + 0.5f * std::sin(z), 0.5f + 0.5f * std::cos(x));
+
+		// Like the boxes, every sphere is an object of its own, centered on its object's origin
+		int first = (int)triangles.size();
+		AddSphere(glm::vec3(0.0f), radius, color);
+		AddObject(first, glm::translate(glm::mat4(1.0f), glm::vec3(x, y, z)));
+	}
+}
+
+bool Scene::LoadOBJ(const std::string& fileName, glm::vec3 color)
+{
+	std::ifstream file(fileName, std::ios::in);
+	if (!file.good())
+	{
+		return false;
+	}
+
+	std::vector<glm::vec3> positions;
+	std::vector<int> faces;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string type;
+		stream >> type;
+		if (type == "v")
+		{
+			glm::vec3 p;
+			stream >> p.x >> p.y >> p.z;
+			positions.push_back(p);
+		}
+		else if (type == "f")
+		{
+			// Faces can be "1", "1/2" or "1/2/3", only the position index matters here. Polygons are split into a fan of triangles.
+			std::vector<int> polygon;
+			std::string vertex;
+			while (stream >> vertex)
+			{
+				int index = std::atoi(vertex.c_str());
+				index = index < 0 ? (int)positions.size() + index : index - 1;
+				// Indices count from 1, and negative ones back from the last vertex read, so 0 or going back past the first is malformed
+				if (index < 0)
+				{
+					return false;
+				}
+				polygon.push_back(index);
+			}
+			for (unsigned int i = 2; i < polygon.size(); ++i)
+			{
+				faces.push_back(polygon[0]);
+				faces.push_back(polygon[i - 1]);
+				faces.push_back(polygon[i]);
+			}
+		}
+	}
+
+	if (positions.empty())
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < faces.size(); ++i)
+	{
+		if (faces[i] >= (int)positions.size())
+		{
+			return false;
+		}
+	}
+
+	// Scale the model to two units tall and stand it on the floor in the middle of the scene
+	glm::vec3 boundsMin = positions[0];
+	glm::vec3 boundsMax = positions[0];
+	for (unsigned int i = 1; i < positions.size(); ++i)
+	{
+		boundsMin = glm::min(boundsMin, positions[i]);
+		boundsMax = glm::max(boundsMax, positions[i]);
+	}
+	float height = boundsMax.y - boundsMin.y;
+	float scale = height > 0.0f ? 2.0f / height : 1.0f;
+	glm::vec3 offset = glm::vec3(-(boundsMin.x + boundsMax.x) * 0.5f, -boundsMin.y, -(boundsMin.z + boundsMax.z) * 0.5f);
+	int first = (int)triangles.size();
+
+	for (unsigned int i = 0; i + 2 < faces.size(); i += 3)
+	{
+		glm::vec3 a = (positions[faces[i]] + offset) * scale;
+		glm::vec3 b = (positions[faces[i + 1]] + offset) * scale;
+		glm::vec3 c = (positions[faces[i + 2]] + offset) * scale;
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+		{
+			// Degenerate, it would never be hit anyway
+			continue;
+		}
+		AddTriangle(a, b, c, normal / length, color);
+	}
+	AddObject(first, glm::mat4(1.0f));
+	return true;
+}
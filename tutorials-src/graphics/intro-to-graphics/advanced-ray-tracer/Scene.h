@@ -0,0 +1,130 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <string>
+
+// What shape one of the scene's primitives is. Most are triangles, the rest are shapes a ray can be tested against exactly with a little
+// algebra. A sphere takes one of them where a mesh round enough to pass for one takes hundreds of triangles, and its normal is exact everywhere
+// rather than flat across each triangle. These match the defines in RayTracing.glsl.
+enum PrimitiveKind
+{
+	PRIMITIVE_TRIANGLE = 0,
+	// Centered on a with the given radius
+	PRIMITIVE_SPHERE = 1,
+	// An axis aligned box from a to b, in its object's space
+	PRIMITIVE_BOX = 2,
+	// A flat parallelogram, corners a, b and c and a fourth across from a. A plane that went on forever couldn't go in a tree, so it has edges like a triangle.
+	PRIMITIVE_PLANE = 3
+};
+
+// Everything about a primitive, as the scene is built. Usually a triangle with corners a, b and c, see PrimitiveKind for the others.
+// The tracers split it up, see TriangleEdges and TriangleSurface.
+struct SceneTriangle
+{
+	glm::vec3 a;
+	int kind;
+	glm::vec3 b;
+	float radius;
+	glm::vec3 c;
+	float padC;
+	glm::vec3 normal;
+	float padNormal;
+	glm::vec3 color;
+	float padColor;
+};
+
+// What a ray needs to test against a triangle and nothing else: its first corner and the two edges from it, which the test
+// would otherwise work out from the corners every time. Laid out to match the triangle struct in RayTracing.glsl under std430
+// packing, where every vec3 starts on a 16 byte boundary and the kind and radius fit in after one.
+// A plane is kept the same way as a triangle. A sphere only needs v0, its center, and radius, and a box goes from v0 to e1.
+struct TriangleEdges
+{
+	glm::vec3 v0;
+	int kind;
+	glm::vec3 e1;
+	float radius;
+	glm::vec3 e2;
+	float padE2;
+};
+
+// What shading a point on a triangle needs, only read once a ray has hit it. Laid out to match the surface struct in RayTracing.glsl.
+// Spheres and boxes have their normal worked out where they're hit, see PrimitiveNormal in BVH.h.
+struct TriangleSurface
+{
+	glm::vec3 normal;
+	float padNormal;
+	glm::vec3 color;
+	float padColor;
+};
+
+// A run of the scene's triangles that moves as one. Its triangles are in its own space, and transform places them in the world.
+struct SceneObject
+{
+	int firstTriangle;
+	int triangleCount;
+	glm::mat4 transform;
+};
+
+// A point light, shining the same in every direction and falling off with the square of the distance.
+struct SceneLight
+{
+	glm::vec3 position;
+	float intensity;
+};
+
+// The triangles the ray tracer renders. They used to be a constant array in the Fragment Shader,
+// now they are built here and uploaded to a shader storage buffer so the scene can be as large as we like.
+// Spheres, boxes and planes go in the same array as the triangles, so every tree and buffer handles them the same way.
+class Scene
+{
+public:
+	// The triangles and the four lights of the original shader. The basic and intermediate tracers only have the floor and the first cube.
+	// With analytic set the floor is a single plane rather than two triangles.
+	void AddCubes(bool secondCube, bool analytic = false);
+
+	// Adds a grid of count small cubes floating over the floor, 12 triangles each, or one box primitive each with analytic set.
+	// Useful for seeing how the tracer scales.
+	void AddBoxes(int count, bool analytic = false);
+
+	// Adds a grid of count spheres floating over the floor, above where AddBoxes puts its boxes, each one sphere primitive.
+	void AddSpheres(int count);
+
+	// Adds every face of an OBJ file, scaled to be two units tall and stood in the middle of the floor.
+	// Returns false if the file couldn't be read, or one of its faces uses a vertex it doesn't have.
+	bool LoadOBJ(const std::string& fileName, glm::vec3 color);
+
+	// Adds count lights of differing brightness scattered over the floor, between them as bright as the four original lights.
+	// Useful for seeing how the tracer scales with the number of lights.
+	void AddLights(int count);
+
+	void AddTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 normal, glm::vec3 color);
+	// Adds the 12 triangles of an axis aligned box
+	void AddBox(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 color);
+
+	// Add one primitive of each of the other kinds, see PrimitiveKind. The normal of a plane is given, a sphere's or a box's is worked out where it's hit.
+	void AddSphere(glm::vec3 center, float radius, glm::vec3 color);
+	void AddBoxPrimitive(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 color);
+	void AddPlane(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 normal, glm::vec3 color);
+
+	// The box around a primitive of any kind, for building trees over them
+	static void PrimitiveBounds(const SceneTriangle& t, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+	// Makes the triangles from firstTriangle to the end into an object. The Add functions above that add whole models do this themselves.
+	void AddObject(int firstTriangle, glm::mat4 transform);
+
+	void AddLight(glm::vec3 position, float intensity);
+
+	// A copy of the scene with every triangle moved into the world, as a single object. For tracers that don't handle objects (see SceneBVH.h).
+	// A sphere's radius is scaled by its object's scale along x, and a box stays axis aligned, so they only come out right for objects that are
+	// moved and scaled evenly, which is all that the scene builds them in.
+	Scene Flattened() const;
+
+	// The triangles split in two, in the same order: what the intersection test reads while walking the tree, and what shading reads
+	// at the hit. Keeping them apart means walking the tree only pulls in the 48 bytes a test needs, rather than the whole 80 byte triangle.
+	std::vector<TriangleEdges> Edges() const;
+	std::vector<TriangleSurface> Surfaces() const;
+
+	std::vector<SceneTriangle> triangles;
+	std::vector<SceneObject> objects;
+	std::vector<SceneLight> lights;
+};
@@ -0,0 +1,119 @@
+#include "SceneBVH.h"
+#include <algorithm>
+#include <cmath>
+
+// How much more expensive than when it was built the top level can get by refitting before it is built again
+const float REBUILD_COST = 1.3f;
+
+void SceneBVH::Build(Scene& scene)
+{
+	objectNodes.clear();
+	depth = 0;
+	int count = (int)scene.objects.size();
+	_objectRoot.resize(count);
+	_objectEnd.resize(count);
+	_objectMin.resize(count);
+	_objectMax.resize(count);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const SceneObject& object = scene.objects[i];
+		std::vector<SceneTriangle> triangles(scene.triangles.begin() + object.firstTriangle, scene.triangles.begin() + object.firstTriangle + object.triangleCount);
+		BVH tree;
+		tree.Build(triangles);
+		std::copy(triangles.begin(), triangles.end(), scene.triangles.begin() + object.firstTriangle);
+		depth = std::max(depth, tree.depth);
+
+		// Append the object's tree, moving its triangle indices and miss links along with it. A miss link of -1 still ends the walk.
+		int root = (int)objectNodes.size();
+		for (unsigned int j = 0; j < tree.nodes.size(); ++j)
+		{
+			BVHNode node = tree.nodes[j];
+			if (node.leaf != -1)
+			{
+				node.leaf += object.firstTriangle << LEAF_COUNT_BITS;
+			}
+			if (node.missIndex != -1)
+			{
+				node.missIndex += root;
+			}
+			objectNodes.push_back(node);
+		}
+
+		_objectRoot[i] = root;
+		_objectEnd[i] = (int)objectNodes.size();
+		_objectMin[i] = tree.nodes[0].boundsMin;
+		_objectMax[i] = tree.nodes[0].boundsMax;
+	}
+
+	BuildTop(scene);
+}
+
+bool SceneBVH::Update(const Scene& scene)
+{
+	WorldBounds(scene);
+
+	// Refit takes the bounds in leaf order
+	std::vector<glm::vec3> leafMin(_order.size());
+	std::vector<glm::vec3> leafMax(_order.size());
+	for (unsigned int i = 0; i < _order.size(); ++i)
+	{
+		leafMin[i] = _worldMin[_order[i]];
+		leafMax[i] = _worldMax[_order[i]];
+	}
+	top.Refit(leafMin, leafMax);
+	cost = top.Cost();
+
+	// Objects that have moved apart leave big, overlapping boxes behind them, and every ray pays for that
+	if (cost > builtCost * REBUILD_COST)
+	{
+		BuildTop(scene);
+		return true;
+	}
+
+	WriteInstances(scene);
+	return false;
+}
+
+void SceneBVH::BuildTop(const Scene& scene)
+{
+	WorldBounds(scene);
+	top.Build(_worldMin, _worldMax, _order);
+	builtCost = top.Cost();
+	cost = builtCost;
+	WriteInstances(scene);
+}
+
+void SceneBVH::WorldBounds(const Scene& scene)
+{
+	int count = (int)scene.objects.size();
+	_worldMin.resize(count);
+	_worldMax.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		// The box around the transformed box: its center moves with the transform, and each axis of the new box
+		// is as long as the old box's axes after they've been rotated, laid end to end along it
+		const glm::mat4& m = scene.objects[i].transform;
+		glm::vec3 center = glm::vec3(m * glm::vec4((_objectMin[i] + _objectMax[i]) * 0.5f, 1.0f));
+		glm::vec3 halfSize = (_objectMax[i] - _objectMin[i]) * 0.5f;
+		glm::vec3 extent;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			extent[axis] = std::abs(m[0][axis]) * halfSize.x + std::abs(m[1][axis]) * halfSize.y + std::abs(m[2][axis]) * halfSize.z;
+		}
+		_worldMin[i] = center - extent;
+		_worldMax[i] = center + extent;
+	}
+}
+
+void SceneBVH::WriteInstances(const Scene& scene)
+{
+	instances.resize(_order.size());
+	for (unsigned int i = 0; i < _order.size(); ++i)
+	{
+		int object = _order[i];
+		instances[i].worldToObject = glm::inverse(scene.objects[object].transform);
+		instances[i].root = _objectRoot[object];
+		instances[i].end = _objectEnd[object];
+	}
+}
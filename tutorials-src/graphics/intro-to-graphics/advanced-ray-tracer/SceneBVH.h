@@ -0,0 +1,60 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include "Scene.h"
+#include "BVH.h"
+
+// One object of the scene as the shaders see it, laid out to match the instance struct in RayTracing.glsl under std430 packing.
+struct SceneInstance
+{
+	// Rays are moved into the object's space rather than moving its triangles into the world
+	glm::mat4 worldToObject;
+	// The object's tree is the run of nodes [root, end) of SceneBVH::objectNodes
+	int root;
+	int end;
+	int pad[2];
+};
+
+// A two level hierarchy over a scene of objects. Every object has a tree of its own over its triangles, built once in the
+// object's space, and a small top level tree is built over the objects where they are in the world. Moving an object only
+// changes its transform, so rather than rebuilding everything, only the top level has to be fitted to the objects' new bounds.
+class SceneBVH
+{
+public:
+	// Builds a tree for every object, reordering the triangles within each object, then the top level. Upload the scene after building.
+	void Build(Scene& scene);
+
+	// Call after changing the transforms of the scene's objects. Refits the top level to where the objects are now, or if refitting
+	// has made it too much slower to trace than it was when it was built, builds it again. Returns true if it rebuilt.
+	bool Update(const Scene& scene);
+
+	// The trees of all the objects one after another, with their leaves and miss links pointing into the whole array
+	std::vector<BVHNode> objectNodes;
+	// The top level, its leaves refer to instances
+	BVH top;
+	// The objects in the order the top level's leaves refer to them
+	std::vector<SceneInstance> instances;
+	// Deepest of the objects' trees
+	int depth;
+
+	// The top level's cost when it was last built, and now. See BVH::Cost.
+	float builtCost;
+	float cost;
+private:
+	void BuildTop(const Scene& scene);
+	void WorldBounds(const Scene& scene);
+	void WriteInstances(const Scene& scene);
+
+	// For each object, where its tree is and its bounds in its own space
+	std::vector<int> _objectRoot;
+	std::vector<int> _objectEnd;
+	std::vector<glm::vec3> _objectMin;
+	std::vector<glm::vec3> _objectMax;
+
+	// Each object's bounds in the world, by object
+	std::vector<glm::vec3> _worldMin;
+	std::vector<glm::vec3> _worldMax;
+
+	// The object at each place in the top level's leaf order
+	std::vector<int> _order;
+};
@@ -0,0 +1,87 @@
+#include "TemporalCache.h"
+#include <algorithm>
+
+TemporalCache::TemporalCache() : _width(0), _height(0), _hasFrame(false), _hasHistory(false)
+{
+}
+
+void TemporalCache::Reset()
+{
+	_hasFrame = false;
+	_hasHistory = false;
+}
+
+void TemporalCache::BeginFrame(const CameraRays& camera, int width, int height)
+{
+	// A frame of another size has nothing to do with the last one
+	if (width != _width || height != _height)
+	{
+		_width = width;
+		_height = height;
+		_current.assign(width * height, HistoryEntry());
+		_previous.assign(width * height, HistoryEntry());
+		_hasFrame = true;
+		_hasHistory = false;
+		_camera = camera;
+		return;
+	}
+
+	// The frame before the first one after a reset isn't history, it was traced before the scene changed
+	_hasHistory = _hasFrame;
+	_hasFrame = true;
+	_previousCamera = _camera;
+	_camera = camera;
+	std::swap(_current, _previous);
+}
+
+int TemporalCache::Reproject(glm::vec3 point) const
+{
+	// The corner rays end on a parallelogram, so every ray through the screen is ray00 + u * right + v * up, for u and v from 0 to 1.
+	// Scale the ray toward the point out to that plane, then take it apart into u and v.
+	glm::vec3 right = _previousCamera.ray10 - _previousCamera.ray00;
+	glm::vec3 up = _previousCamera.ray01 - _previousCamera.ray00;
+	glm::vec3 normal = glm::cross(right, up);
+	glm::vec3 toPoint = point - _previousCamera.eye;
+	float planeDistance = glm::dot(_previousCamera.ray00, normal);
+	float pointDistance = glm::dot(toPoint, normal);
+	if (planeDistance * pointDistance <= 0.0f)
+	{
+		return -1;
+	}
+
+	glm::vec3 onPlane = toPoint * (planeDistance / pointDistance) - _previousCamera.ray00;
+	float area = glm::dot(normal, normal);
+	float u = glm::dot(glm::cross(onPlane, up), normal) / area;
+	float v = glm::dot(glm::cross(right, onPlane), normal) / area;
+	if (u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f)
+	{
+		return -1;
+	}
+
+	// v runs up from the bottom of the screen, the rows down from the top, see PixelDir in CpuTracer.cpp
+	int x = std::min((int)(u * _width), _width - 1);
+	int y = _height - 1 - std::min((int)(v * _height), _height - 1);
+	return y * _width + x;
+}
+
+const HistoryEntry* TemporalCache::Find(glm::vec3 point, int index) const
+{
+	if (!_hasHistory)
+	{
+		return nullptr;
+	}
+
+	int pixel = Reproject(point);
+	if (pixel == -1)
+	{
+		return nullptr;
+	}
+
+	// Something else was in front of the point last frame, or the pixel saw the same primitive somewhere else, which only happens along its edges
+	const HistoryEntry& entry = _previous[pixel];
+	if (entry.index != index || glm::length(entry.point - point) > HISTORY_DISTANCE * glm::length(point - _previousCamera.eye))
+	{
+		return nullptr;
+	}
+	return &entry;
+}
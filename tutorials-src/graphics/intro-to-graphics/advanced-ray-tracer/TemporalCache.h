@@ -0,0 +1,70 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+#include <cstdint>
+#include "CpuTracer.h"
+
+// These match the defines in RayTracing.glsl.
+// Frames a pixel's shadows and reflection are reused for at most before they're traced again.
+const int HISTORY_FRAMES = 8;
+// Most lights whose shadows can be kept, one bit of HistoryEntry::visible each. With more, or with sampled lights, only reflections are reused.
+const int HISTORY_MAX_LIGHTS = 32;
+// How far last frame's point can be from this frame's and still count as the same, for every unit of distance from the camera.
+const float HISTORY_DISTANCE = 0.01f;
+// A reflection is reused while the ray from the camera has turned less than this from the one it was traced for, as a cosine.
+const float HISTORY_COSINE = 0.9998f;
+
+// What a pixel's camera ray hit and what was traced from there, laid out to match historyEntry in RayTracing.glsl under std430 packing.
+struct HistoryEntry
+{
+	glm::vec3 point;
+	// The primitive the camera ray hit, -1 if it hit nothing
+	int index;
+	// The camera ray the reflection was traced for
+	glm::vec3 dir;
+	// Bit n is set if the n'th light reached the point
+	uint32_t visible;
+	// Everything the point's reflections brought, scaled by how much of it reaches the pixel
+	glm::vec3 reflection;
+	// Frames since the shadows and reflection were traced
+	int age;
+};
+
+// When the camera moves a little each frame, most of what it sees it also saw the frame before, and the shadow rays and reflections
+// traced for it then would mostly give the same answers again. The cache keeps what every pixel's rays found for one frame. Next frame,
+// each point the camera sees is projected back through the last frame's camera to the pixel it was seen at. If that pixel saw the same
+// primitive at about the same place, its shadows (and its reflection, if the camera hasn't turned much) are reused rather than traced.
+// If it saw something else, the point has just come out from behind something or onto the screen, and is traced from scratch.
+// The camera rays are always traced, since they're what finds out whether the history still holds. Nothing is reused for more than
+// HISTORY_FRAMES frames, so what drifts as the camera moves is put right, and pixels that start over are staggered so that each frame
+// retraces about the same number of them.
+class TemporalCache
+{
+public:
+	TemporalCache();
+
+	// Forgets everything, so the next frame is traced from scratch. Call it whenever the scene changes rather than the camera.
+	void Reset();
+
+	// Starts a frame from camera at the given size: what was written last frame becomes the history. CpuTracer::Render calls it.
+	void BeginFrame(const CameraRays& camera, int width, int height);
+
+	// Last frame's entry for the point the camera sees on primitive index, or nullptr if it's disoccluded, ie. last frame didn't see it
+	const HistoryEntry* Find(glm::vec3 point, int index) const;
+
+	// This frame's entry for a pixel, to fill in as it's traced
+	HistoryEntry& Current(int x, int y) { return _current[y * _width + x]; }
+private:
+	// The pixel of last frame's image the point was seen through, or -1 if it was off the screen or behind the camera
+	int Reproject(glm::vec3 point) const;
+
+	int _width;
+	int _height;
+	// Whether _current holds a frame, and whether _previous does, ie. there's anything to reuse this frame
+	bool _hasFrame;
+	bool _hasHistory;
+	CameraRays _camera;
+	CameraRays _previousCamera;
+	std::vector<HistoryEntry> _current;
+	std::vector<HistoryEntry> _previous;
+};
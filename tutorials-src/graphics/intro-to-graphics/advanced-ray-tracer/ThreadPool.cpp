@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int numThreads)
+{
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	_task = nullptr;
+	_next = 0;
+	_count = 0;
+	_generation = 0;
+	_busy = 0;
+	_quit = false;
+
+	for (int i = 1; i < numThreads; ++i)
+	{
+		_threads.push_back(std::thread(&ThreadPool::Worker, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_wake.notify_all();
+
+	for (unsigned int i = 0; i < _threads.size(); ++i)
+	{
+		_threads[i].join();
+	}
+}
+
+int ThreadPool::Size() const
+{
+	return (int)_threads.size() + 1;
+}
+
+void ThreadPool::Run(int count, const std::function<void(int, int)>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_count = count;
+		_next = 0;
+		_busy = (int)_threads.size();
+		++_generation;
+	}
+	_wake.notify_all();
+
+	Work(0);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [this] { return _busy == 0; });
+	_task = nullptr;
+}
+
+void ThreadPool::Worker(int thread)
+{
+	int generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&] { return _quit || _generation != generation; });
+			if (_quit)
+			{
+				return;
+			}
+			generation = _generation;
+		}
+
+		Work(thread);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (--_busy == 0)
+		{
+			_done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::Work(int thread)
+{
+	while (true)
+	{
+		int index = _next++;
+		if (index >= _count)
+		{
+			return;
+		}
+		(*_task)(index, thread);
+	}
+}
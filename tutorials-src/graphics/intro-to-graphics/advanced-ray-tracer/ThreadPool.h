@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// A fixed set of worker threads that are started once and reused for every Run, so rendering a frame
+// doesn't pay for creating threads. Work is handed out one index at a time from a shared counter,
+// which keeps every thread busy even when some tiles of the image are much more expensive than others.
+class ThreadPool
+{
+public:
+	// 0 uses one thread per hardware thread. The thread calling Run counts as one of them.
+	ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	int Size() const;
+
+	// Calls task(index, thread) for every index in [0, count) and returns once they have all finished.
+	// thread is in [0, Size()) and is never shared by two tasks running at the same time.
+	void Run(int count, const std::function<void(int, int)>& task);
+private:
+	void Worker(int thread);
+	void Work(int thread);
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	const std::function<void(int, int)>* _task;
+	std::atomic<int> _next;
+	int _count;
+	// Bumped by every Run so workers can tell a new batch from a spurious wake up
+	int _generation;
+	int _busy;
+	bool _quit;
+};
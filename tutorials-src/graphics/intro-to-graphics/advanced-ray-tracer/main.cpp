@@ -27,17 +27,130 @@ https://github.com/LWJGL/lwjgl3-wiki/wiki/2.6.1.-Ray-tracing-with-OpenGL-Compute
 Description:
 This program serves to demonstrate the concept of ray tracing. This
 builds off a previous Intermediate Ray Tracer, adding in reflections. 
-There are four point lights, specular and diffuse lighting, and shadows. 
-It is important to note that the light positions and triangles being 
-rendered are all hardcoded in the shader itself. Usually, you would 
-pass those values into the Fragment Shader via a Uniform Buffer.
+There are point lights, specular and diffuse lighting, and shadows. 
+The triangles and lights are built on the CPU (see Scene.h) and passed 
+in through shader storage buffers, along with a bounding volume 
+hierarchy over the triangles (see BVH.h). 
+Rays walk the hierarchy instead of testing every triangle, so the cost 
+of a ray grows with the log of the triangle count rather than linearly, 
+and scenes of hundreds of thousands of triangles can still be traced.
+
+Run with --boxes N to add N small boxes to the scene, or --obj file.obj 
+to load a model onto the floor. Shader storage buffers need OpenGL 4.3.
+
+Besides triangles the scene can hold spheres, boxes and flat planes, 
+each one primitive that rays test exactly, with a normal worked out 
+where they hit it (see PrimitiveKind in Scene.h). --spheres N adds N 
+spheres over the floor, and --analytic makes the cubes, the floor and 
+the --boxes boxes out of these instead of triangles, which is far fewer 
+primitives for the hierarchy to hold.
+
+Every box is an object with its own hierarchy, under a top level one 
+over where the objects are (see SceneBVH.h). --animate sets the boxes 
+going round the floor. Moving them only means refitting the top level 
+to where they are now, which is rebuilt once refitting has made it too 
+slow to trace. The window title shows how often each happens.
+
+Run with --lights N to add N more lights over the floor. Each point is 
+shaded by at most --light-samples of the lights (4 by default), picked 
+at random with the brighter ones more likely (see LightTable.h), so a 
+scene with hundreds of lights costs about the same as one with four. 
+With more lights than that each frame is noisy, so frames are averaged 
+while the camera is still, the same as progressive mode does.
+
+Rays from the camera reflect off what they hit, up to --bounces times 
+(1 by default). Each reflection is one ray for all the lights, and 
+passes on less of what it sees, so once there is little left to add, 
+paths end early at random by Russian roulette. The brighter paths that 
+carry on make up for them, and the bounce limit caps the cost.
+
+Run with --progressive N (2, 4 or 8) to trace only one pixel in every 
+N by N block each frame, accumulating the results while the camera is 
+still. Space pauses the camera so the picture can refine.
+
+Run with --compute to trace with a compute shader in 8x8 tiles instead
+of the Fragment Shader (see ComputeShader.glsl), or --wavefront to run
+it in stages that queue up the shadow rays. The window
+title shows how long the GPU spends on each frame. --compare-gpu holds
+the camera still, times each path and prints the results.
+
+Run with --hybrid to rasterize the scene into a G-buffer of the point, 
+normal and triangle each pixel sees (see RasterVertexShader.glsl), and 
+have the compute shader trace only the shadow rays and reflections from 
+there. The rasterizer projects through the same corner rays the tracer 
+shoots, so it sees what the camera rays would have hit, without a 
+single ray from the camera being traced. Spheres and boxes can't be 
+rasterized, so scenes with them (--analytic) trace with --compute 
+instead. The hybrid path doesn't use --temporal-cache.
+
+Run with --denoise to filter every frame with an edge avoiding -trous 
+filter guided by the normal, depth and albedo of what each pixel's ray 
+hit (see Denoiser.h and DenoiseShader.glsl), rather than averaging 
+frames. Shadows from sampled lights and reflections ended by Russian 
+roulette are noisy at one sample per pixel, and the filter smooths that 
+noise away without blurring across edges, so eg. --lights 64 
+--light-samples 1 --denoise traces a ray toward one light per point and 
+still looks clean while the camera moves. --denoise-iterations N sets 
+the passes (5 by default), each reaching twice as far as the last. The 
+denoiser follows the compute paths, so --denoise uses --compute unless 
+--wavefront is given. The CPU tracer denoises its render too.
+
+Run with --temporal-cache to reuse the last frame's shadow rays and 
+reflections wherever the camera still sees the same point (see 
+TemporalCache.h). Each point a camera ray hits is projected back 
+through the last frame's corner rays to the pixel that saw it then. If 
+that pixel saw the same primitive in the same place, its lights' 
+visibility is reused, and so is its reflection if the camera ray still 
+points much the same way. Points that have just come out from behind 
+something (disoccluded) are traced as usual, as is every point once 
+its history is a few frames old. While the camera moves slowly, most 
+shadow and reflection rays are never traced. Shadows are only kept for 
+up to 32 lights, all of them shading every point. Like the denoiser it 
+follows the compute paths, and the CPU tracer uses it when 
+benchmarking, where the camera moves from frame to frame.
+
+The same tracer also runs on the CPU (see CpuTracer.h), which renders 
+the starting view to an image without needing a window or a GPU:
+  --cpu out.ppm [--mode basic|intermediate|advanced] [--threads N] 
+  [--size W H] [--frames N] renders on the CPU and reports rays per 
+  second, averaging N frames to smooth out sampled lights and paths 
+  ended by Russian roulette.
+  Built with AVX2 the CPU tracer traces rays in packets of eight (see 
+  PacketBVH.h), --scalar turns that off and --compare-scalar renders 
+  both ways and reports the speedup.
+  --capture gpu.ppm saves the GPU's first frame (with the camera held 
+  still) and exits.
+  --diff a.ppm b.ppm compares two images, eg. a capture against a CPU 
+  render, to check the shader against the reference.
+  --farm N renders the --cpu image on N worker processes instead (see 
+  RenderFarm.h), started on this machine with the same options and 
+  --threads threads each (1 by default). The farm cuts the frame into 
+  64x64 tiles and gives each worker a run of them, and workers that run 
+  out steal from the others, so tiles that take longer don't hold the 
+  frame up. --farm-scaling renders with 1, 2, 4 and so on up to N 
+  workers and reports the rays per second and speedup of each. 
+  --farm-port P listens on port P of every network interface rather 
+  than a free port that only this machine can reach, so that workers on 
+  other machines can join with the same options plus --farm-worker 
+  HOST P. The farm doesn't denoise.
+
+Run with --benchmark out.json to time the tracers down scripted camera 
+paths (see Benchmark.h), the same frames on every run, and write the 
+time per frame, percentiles of the frame times and rays per second of 
+each kind (primary, shadow and reflection) as JSON. The CPU tracer runs 
+first, then each of the GPU paths in a hidden window, which also 
+works under a software OpenGL such as Mesa's llvmpipe 
+(LIBGL_ALWAYS_SOFTWARE=1) on machines without a GPU.
+  [--size W H] [--benchmark-frames N] sets the resolution and the 
+  frames per path (60 by default), --benchmark-path orbit|sweep|closeup 
+  runs one path rather than all of them, and --benchmark-tracers cpu|gpu 
+  runs only the CPU tracer or only the GPU paths. The CPU tracer takes 
+  --threads, --scalar and --mode as above.
 
 WARNING: Framerate may suffer depending on your hardware. This is a normal 
-problem with Ray Tracing. If it runs too slowly, try removing the second 
-cube from the triangles array in the Fragment Shader (and also adjusting 
-NUM_TRIANGLES accordingly). There are many optimization techniques out 
-there, but ultimately Ray Tracing is not typically used for Real-Time 
-rendering.
+problem with Ray Tracing. Every pixel traces one ray from the camera, then 
+a shadow ray for each light it is shaded by and a reflection ray, and the 
+same again for every point the reflections hit.
 */
 
 #include "GL/glew.h"
@@ -49,6 +162,20 @@ rendering.
 #include <string>
 #include <fstream>
 #include <vector>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include "Scene.h"
+#include "BVH.h"
+#include "SceneBVH.h"
+#include "LightTable.h"
+#include "CpuTracer.h"
+#include "Benchmark.h"
+#include "Denoiser.h"
+#include "TemporalCache.h"
+#include "RenderFarm.h"
 
 // This is your reference to your shader program.
 // This will be assigned with glCreateProgram().
@@ -74,6 +201,175 @@ glm::vec3 cameraPos;
 GLuint vbo;
 GLuint vao;
 
+// The scene's triangles and the bounding volume hierarchy built over them, along with the shader storage buffers they're uploaded to.
+// The GPU traces the scene as objects, each with a tree of its own under a top level tree (see SceneBVH.h). The CPU traces a copy of it flattened into one tree.
+Scene scene;
+SceneBVH sceneBvh;
+BVH bvh;
+// The triangles go up in two buffers, the corner and edges the intersection test reads, and the normal and color for shading what was hit.
+GLuint triangleBuffer;
+GLuint surfaceBuffer;
+GLuint nodeBuffer;
+// These change whenever objects move.
+GLuint instanceBuffer;
+GLuint topNodeBuffer;
+
+// The scene's lights, uploaded with the alias table that picks which of them shade each point.
+// Each point is shaded by lightSamples of them, or all of them if there are no more than that.
+LightTable lightTable;
+GLuint lightBuffer;
+int lightSamples;
+// How many times rays from the camera reflect, at most.
+int maxBounces;
+// Set when the lights are sampled, and so every frame is noisy. Frames are then averaged until the camera moves, counted by progressiveFrame.
+// The fragment path does this with progressive mode, tracing every pixel every frame if progressive mode wasn't asked for.
+bool accumulateLights;
+
+// With --animate, the boxes from --boxes go round the middle of the floor, the ones nearer the middle faster so they keep passing each other.
+// Only the top level of the hierarchy is fitted to where they have moved, and it is rebuilt once that has made it too slow.
+bool animate;
+int firstMovingObject;
+int endMovingObject;
+// Where each object was put by buildScene
+std::vector<glm::mat4> restTransforms;
+// How the top level was brought up to date since the title was last updated, and how long that took.
+int refits;
+int rebuilds;
+double updateMilliseconds;
+
+// Set from the command line, extra boxes, spheres and lights to add to the scene and a model to load.
+// With analytic set the cubes, floor and boxes are box and plane primitives rather than triangles.
+int numBoxes;
+int numSpheres;
+bool analytic;
+int numLights;
+std::string objFile;
+
+// If set, the first frame is saved to this file and the program exits. The camera holds still so the frame matches a CPU render.
+std::string captureFile;
+
+// If set, the tracers are timed down the benchmark's camera paths and the results written to this file (see runBenchmark).
+// The shaders then count the rays they trace into rayCountBuffer.
+std::string benchmarkFile;
+GLuint rayCountBuffer;
+// Frames the GPU renders before the timing starts, while the driver finishes setting the programs up.
+const int BENCHMARK_WARMUP_FRAMES = 2;
+
+// Whether the camera stops going around the scene. Space toggles it.
+bool cameraPaused;
+
+// Which way the GPU traces the frame. The fragment path draws a quad with the Fragment Shader. The compute paths dispatch
+// the Compute Shader in 8x8 tiles instead, either tracing each pixel start to finish or in waves through a queue of rays.
+// The hybrid path rasterizes what the camera sees and only traces from there.
+enum RenderPath
+{
+	FRAGMENT_PATH,
+	COMPUTE_PATH,
+	WAVEFRONT_PATH,
+	HYBRID_PATH
+};
+const char* pathNames[] = { "fragment", "compute", "wavefront", "hybrid" };
+RenderPath renderPath;
+
+// What each dispatch of the Compute Shader does, these match the defines in ComputeShader.glsl.
+const int TRACE_STAGE = 0;
+const int PRIMARY_STAGE = 1;
+const int SIZE_STAGE = 2;
+const int SECONDARY_STAGE = 3;
+const int RESOLVE_STAGE = 4;
+const int HYBRID_STAGE = 5;
+
+// The most triangles the Compute Shader copies into shared memory, matches ComputeShader.glsl.
+const int MAX_SHARED_TRIANGLES = 384;
+// Size of the Compute Shader's tiles, matches its local_size.
+const int TILE_SIZE = 8;
+
+// The compute program and the buffers only it uses: the top of the tree that it copies into shared memory, what each pixel's camera ray hit,
+// the queue of rays toward the lights and the size of the dispatch that traces them. It writes into outputTexture, which outputFramebuffer lets us copy to the window.
+GLuint computeProgram;
+GLuint compute_shader;
+GLuint treeletBuffer;
+GLuint hitBuffer;
+GLuint queueBuffer;
+GLuint dispatchBuffer;
+GLuint outputTexture;
+GLuint outputFramebuffer;
+
+// Measures how long the GPU spends on each frame's tracing, as opposed to how long the frame took, which waits on the vsync.
+GLuint timerQuery;
+double gpuMilliseconds;
+
+// With --compare-gpu, each path renders the same still frame for a while and the average times are printed.
+bool comparePaths;
+double pathMilliseconds[4];
+int pathFrames;
+const int WARMUP_FRAMES = 10;
+const int TIMED_FRAMES = 100;
+
+// Progressive mode. Rather than tracing every pixel every frame, each frame traces one pixel out of every progressiveStride by
+// progressiveStride block into an accumulation image, and a second program shows the average of what has been traced so far.
+// Frames cost a fraction of a full trace however big the scene is, and while the camera holds still the picture keeps refining,
+// each pass through the blocks adding another sample per pixel at a different spot within it, which smooths out the jagged edges.
+// 0 turns it off.
+int progressiveStride;
+// Frames traced since the camera last moved
+int progressiveFrame;
+// Offset within the block traced on each frame of a pass, and the frame each offset is traced on
+std::vector<glm::ivec2> traceOrder;
+std::vector<GLint> traceRank;
+GLuint displayProgram;
+GLuint display_shader;
+GLuint accumulationTexture;
+int screenWidth;
+int screenHeight;
+
+// Denoising, see Denoiser.h. The compute paths write each frame, along with a G-buffer of what every pixel's camera ray hit first,
+// into images the denoise program filters into the output image, denoiseIterations passes back and forth between the filter images. 0 turns it off.
+int denoiseIterations;
+GLuint denoiseProgram;
+GLuint denoise_shader;
+GLuint noisyTexture;
+GLuint normalDepthTexture;
+GLuint albedoTexture;
+GLuint filterTextures[2];
+
+// What each dispatch of the denoise program does, these match the defines in DenoiseShader.glsl.
+const int VARIANCE_STAGE = 0;
+const int ATROUS_STAGE = 1;
+
+// With --temporal-cache the compute paths reuse last frame's shadows and reflections wherever they still hold, see TemporalCache.h.
+// Each frame's history goes into one of historyBuffers while last frame's is read from the other, swapping every frame.
+// historyFrames counts the frames since there was last nothing to reuse, and historyCamera is the camera the last of them was traced from.
+bool temporalCache;
+GLuint historyBuffers[2];
+int historyFrames;
+CameraRays computeCamera;
+CameraRays historyCamera;
+
+// The hybrid path's rasterizer. rasterProgram draws the scene's triangles from rasterVbo into rasterFramebuffer, whose rasterTextures
+// are the G-buffer the Compute Shader reads on texture units 1 to 3: the point each pixel sees, the normal there and the triangle's index.
+// Each object's triangles are a run of rasterCount vertices from rasterFirst, drawn with its transform.
+// rasterReady is whether the scene could be rasterized and the hybrid path set up.
+bool rasterReady;
+GLuint rasterProgram;
+GLuint raster_vertex_shader;
+GLuint raster_fragment_shader;
+GLuint rasterVao;
+GLuint rasterVbo;
+GLuint rasterFramebuffer;
+GLuint rasterDepth;
+GLuint rasterTextures[3];
+std::vector<GLint> rasterFirst;
+std::vector<GLsizei> rasterCount;
+
+// A corner of a triangle in its object's space, as the rasterizer reads it. Every corner carries its triangle's normal and index.
+struct RasterVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	GLint triangle;
+};
+
 // A reference to our window.
 GLFWwindow* window;
 
@@ -127,6 +423,82 @@ void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, fl
 }
 
 
+// The compute program has its own copies of the camera uniforms. glProgramUniform sets them without having to switch to it.
+void setComputeCamera(glm::vec4 r00, glm::vec4 r01, glm::vec4 r10, glm::vec4 r11)
+{
+	if (computeProgram == 0)
+	{
+		return;
+	}
+
+	computeCamera.eye = cameraPos;
+	computeCamera.ray00 = glm::vec3(r00);
+	computeCamera.ray01 = glm::vec3(r01);
+	computeCamera.ray10 = glm::vec3(r10);
+	computeCamera.ray11 = glm::vec3(r11);
+	glProgramUniform3f(computeProgram, glGetUniformLocation(computeProgram, "eye"), cameraPos.x, cameraPos.y, cameraPos.z);
+	glProgramUniform3f(computeProgram, glGetUniformLocation(computeProgram, "ray00"), r00.x, r00.y, r00.z);
+	glProgramUniform3f(computeProgram, glGetUniformLocation(computeProgram, "ray01"), r01.x, r01.y, r01.z);
+	glProgramUniform3f(computeProgram, glGetUniformLocation(computeProgram, "ray10"), r10.x, r10.y, r10.z);
+	glProgramUniform3f(computeProgram, glGetUniformLocation(computeProgram, "ray11"), r11.x, r11.y, r11.z);
+}
+
+// Puts the camera at position, looking at center, and sets the uniform variables of the tracing programs to match.
+void setCamera(glm::vec3 position, glm::vec3 center)
+{
+	cameraPos = position;
+
+	// These are four corner ray variables to store the output from our calcCameraRays function.
+	glm::vec4 r00;
+	glm::vec4 r01;
+	glm::vec4 r10;
+	glm::vec4 r11;
+
+	// Call our function to calculate the four corner rays. Our FoV angle is 60 degrees and the ratio is the screen's, 800/600 unless benchmarking at another size.
+	calcCameraRays(cameraPos, center, glm::vec3(0.0f, 1.0f, 0.0f), 60.0f, (float)screenWidth / screenHeight, &r00, &r01, &r10, &r11);
+
+	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
+	glUniform3f(eye, cameraPos.x, cameraPos.y, cameraPos.z);
+	glUniform3f(ray00, r00.x, r00.y, r00.z);
+	glUniform3f(ray01, r01.x, r01.y, r01.z);
+	glUniform3f(ray10, r10.x, r10.y, r10.z);
+	glUniform3f(ray11, r11.x, r11.y, r11.z);
+	setComputeCamera(r00, r01, r10, r11);
+}
+
+// Moves the boxes around the middle of the floor, each bobbing up and down and spinning as it goes.
+void animateObjects(float time)
+{
+	for (int i = firstMovingObject; i < endMovingObject; ++i)
+	{
+		glm::vec3 rest = glm::vec3(restTransforms[i][3]);
+		float radius = glm::length(glm::vec2(rest.x, rest.z));
+		float angle = time * 2.0f / (radius + 1.0f);
+		float bob = 0.25f * std::sin(time * 3.0f + i);
+		glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, bob, 0.0f));
+		scene.objects[i].transform = orbit * restTransforms[i] * glm::rotate(glm::mat4(1.0f), time + i, glm::vec3(1.0f, 1.0f, 0.0f));
+	}
+}
+
+// Uploads the parts of the hierarchy that change when objects move, the instances and the top level tree, and the compute program's treelet of it.
+// glBufferData rather than glBufferSubData since a rebuilt top level can have a different number of nodes. GL_DYNAMIC_DRAW since they can change every frame.
+void uploadTopLevel()
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SceneInstance) * sceneBvh.instances.size(), sceneBvh.instances.data(), GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, topNodeBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BVHNode) * sceneBvh.top.nodes.size(), sceneBvh.top.nodes.data(), GL_DYNAMIC_DRAW);
+
+	if (computeProgram != 0)
+	{
+		std::vector<BVHTreeletNode> treelet;
+		sceneBvh.top.BuildTreelet(TREELET_LEVELS, treelet);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, treeletBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BVHTreeletNode) * treelet.size(), treelet.data(), GL_DYNAMIC_DRAW);
+	}
+}
+
 // This runs once a frame, before renderScene
 void update()
 {
@@ -139,48 +511,195 @@ void update()
 		// Calculate the FPS and set the window title to display it.
 		fps = frame / (dtime - timebase);
 		timebase = dtime;
-		frame = 0;
 
-		std::string s = "FPS: " + std::to_string(fps);
+		std::string s = "FPS: " + std::to_string(fps) + " GPU: " + std::to_string(gpuMilliseconds / frame) + "ms (" + pathNames[renderPath] + ") Triangles: " + std::to_string(scene.triangles.size());
+		if (progressiveStride > 0)
+		{
+			s += " Samples: " + std::to_string(progressiveFrame / (progressiveStride * progressiveStride));
+		}
+		else if (accumulateLights)
+		{
+			s += " Samples: " + std::to_string(progressiveFrame);
+		}
+
+		if (denoiseIterations > 0)
+		{
+			s += " Denoised";
+		}
+
+		if (temporalCache)
+		{
+			s += " Cached";
+		}
+
+		if (animate)
+		{
+			s += " Refits: " + std::to_string(refits) + " Rebuilds: " + std::to_string(rebuilds) + " Update: " + std::to_string(updateMilliseconds / frame) + "ms";
+		}
 
 		glfwSetWindowTitle(window, s.c_str());
+		frame = 0;
+		gpuMilliseconds = 0.0;
+		refits = 0;
+		rebuilds = 0;
+		updateMilliseconds = 0.0;
 	}
 
+	// Move the objects, and bring the hierarchy up to date with them. Not when capturing, which has to match the CPU's render of the scene as it was built.
+	if (animate && captureFile.empty())
+	{
+		animateObjects((float)dtime);
+
+		auto updateStart = std::chrono::high_resolution_clock::now();
+		if (sceneBvh.Update(scene))
+		{
+			rebuilds++;
+		}
+		else
+		{
+			refits++;
+		}
+		uploadTopLevel();
+		updateMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count();
+
+		// The scene has changed, so anything accumulated or cached so far is out of date.
+		progressiveFrame = 0;
+		historyFrames = 0;
+	}
+
+	// Hold the camera still if it's been paused, or if we're capturing a frame to compare against the CPU tracer or timing the paths against each other.
+	if (cameraPaused || !captureFile.empty() || comparePaths)
+	{
+		return;
+	}
+
+	// The camera is moving, so anything accumulated so far is out of date.
+	progressiveFrame = 0;
+
 	// For rotating the camera, we convert it to a vec4 and then do a rotation about the Y axis.
 	glm::vec4 tempPos = glm::vec4(cameraPos, 1.0f) * glm::rotate(glm::mat4(1.0f), glm::radians(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-	// Then we convert back to a vec3.
-	cameraPos = glm::vec3(tempPos.x, tempPos.y, tempPos.z);
+	// Then we convert back to a vec3, and point the camera from there at the middle of the scene.
+	setCamera(glm::vec3(tempPos.x, tempPos.y, tempPos.z), glm::vec3(0.0f, 0.5f, 0.0f));
+}
 
-	// These are our four corner ray variables.
-	glm::vec4 r00;
-	glm::vec4 r01;
-	glm::vec4 r10;
-	glm::vec4 r11;
+// Returns the index'th number of the Halton sequence in the given base, which spreads points evenly from 0 to 1 without clumping.
+// Used to pick where in the pixel each progressive pass traces through.
+float halton(int index, int base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f / base;
+	while (index > 0)
+	{
+		result += fraction * (index % base);
+		index /= base;
+		fraction /= base;
+	}
+	return result;
+}
 
-	// Call the function we created to calculate the corner rays.
-	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 60.0f, 800.0f / 600.0f, &r00, &r01, &r10, &r11);
+// Works out the order the pixels of a block are traced in for progressive mode, as a Bayer matrix. Each frame's pixel is as far
+// as it can be from the ones traced before it, so the picture fills in evenly rather than a row at a time. The stride has to be a power of two.
+void buildTraceOrder(int stride)
+{
+	traceRank.assign(1, 0);
+	for (int size = 1; size < stride; size *= 2)
+	{
+		// Each step doubles the matrix, putting four copies of it side by side, offset so they interleave.
+		std::vector<GLint> bigger(size * size * 4);
+		const int offsets[4] = { 0, 2, 3, 1 };
+		for (int y = 0; y < size * 2; ++y)
+		{
+			for (int x = 0; x < size * 2; ++x)
+			{
+				int quadrant = (y / size) * 2 + (x / size);
+				bigger[y * size * 2 + x] = traceRank[(y % size) * size + (x % size)] * 4 + offsets[quadrant];
+			}
+		}
+		traceRank = bigger;
+	}
 
-	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
-	glUniform3f(eye, cameraPos.x, cameraPos.y, cameraPos.z);
-	glUniform3f(ray00, r00.x, r00.y, r00.z);
-	glUniform3f(ray01, r01.x, r01.y, r01.z);
-	glUniform3f(ray10, r10.x, r10.y, r10.z);
-	glUniform3f(ray11, r11.x, r11.y, r11.z);
+	traceOrder.resize(stride * stride);
+	for (int i = 0; i < stride * stride; ++i)
+	{
+		traceOrder[traceRank[i]] = glm::ivec2(i % stride, i / stride);
+	}
 }
 
-// This function runs every frame
-void renderScene()
+// With --compare-gpu, renders TIMED_FRAMES frames down each path after letting it warm up, then moves on to the next.
+// Once all of them are done the average times are printed and the program exits. The hybrid path sits out if the scene can't be rasterized.
+void comparePathTimes(double milliseconds)
 {
-	// Clear the color buffer and the depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	pathFrames++;
+	if (pathFrames > WARMUP_FRAMES)
+	{
+		pathMilliseconds[renderPath] += milliseconds;
+	}
+	if (pathFrames < WARMUP_FRAMES + TIMED_FRAMES)
+	{
+		return;
+	}
 
-	// Clear the screen to black
-	glClearColor(0.0, 0.0, 0.0, 1.0);
+	pathMilliseconds[renderPath] /= TIMED_FRAMES;
+	std::cout << pathNames[renderPath] << ": " << pathMilliseconds[renderPath] << "ms";
+	if (renderPath != FRAGMENT_PATH)
+	{
+		std::cout << ", " << pathMilliseconds[FRAGMENT_PATH] / pathMilliseconds[renderPath] << "x the fragment path";
+	}
+	std::cout << std::endl;
 
+	pathFrames = 0;
+	if (renderPath == HYBRID_PATH || (renderPath == WAVEFRONT_PATH && !rasterReady))
+	{
+		glfwSetWindowShouldClose(window, GL_TRUE);
+		return;
+	}
+	renderPath = (RenderPath)(renderPath + 1);
+}
+
+// Traces the frame with the Fragment Shader, by drawing a quad over the whole screen.
+void renderFragment()
+{
 	// Bind the vao
 	glBindVertexArray(vao);
 
+	if (progressiveStride > 0)
+	{
+		// Which pass this is, and which pixel of each block this frame of the pass traces.
+		int perPass = progressiveStride * progressiveStride;
+		int pass = progressiveFrame / perPass;
+		int step = progressiveFrame % perPass;
+		glm::vec2 jitter = pass == 0 ? glm::vec2(0.0f) : glm::vec2(halton(pass, 2), halton(pass, 3)) - 0.5f;
+
+		glUniform1i(glGetUniformLocation(program, "progressive"), GL_TRUE);
+		glUniform1i(glGetUniformLocation(program, "pixelStride"), progressiveStride);
+		glUniform2i(glGetUniformLocation(program, "pixelOffset"), traceOrder[step].x, traceOrder[step].y);
+		glUniform2f(glGetUniformLocation(program, "jitter"), jitter.x, jitter.y);
+		glUniform1i(glGetUniformLocation(program, "firstPass"), pass == 0);
+		glUniform1i(glGetUniformLocation(program, "frameNumber"), progressiveFrame);
+		glUniform2i(glGetUniformLocation(program, "screenSize"), screenWidth, screenHeight);
+
+		// Trace into the accumulation image. The viewport covers one fragment per block, and nothing is written to the screen.
+		glViewport(0, 0, (screenWidth + progressiveStride - 1) / progressiveStride, (screenHeight + progressiveStride - 1) / progressiveStride);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+		// Make sure the tracing is done writing to the image before the display program reads it.
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		// Now draw the average of the samples to the whole screen.
+		glViewport(0, 0, screenWidth, screenHeight);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glUseProgram(displayProgram);
+		glUniform1i(glGetUniformLocation(displayProgram, "tracedPixels"), pass == 0 ? step + 1 : perPass);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+		// Go back to the tracing program, update() sets its uniforms.
+		glUseProgram(program);
+		progressiveFrame++;
+		return;
+	}
+
 	// Draw 4 vertices from the buffer as GL_TRIANGLE_FAN which will draw triangles fanning out from the first vertex.
 	// There are several different drawing modes, GL_TRIANGLES takes every 3 vertices and makes them a triangle.
 	// For reference, GL_TRIANGLE_STRIP would take each additional vertex after the first 3 and consider that a 
@@ -192,6 +711,592 @@ void renderScene()
 	// by tracing a ray.
 }
 
+// Filters the frame the Compute Shader traced into the output image. The first dispatch estimates how noisy each pixel is,
+// then each pass of the filter reads one filter image and writes the other, with its taps twice as far apart as the last's.
+void renderDenoise(GLuint groupsX, GLuint groupsY)
+{
+	GLint stage = glGetUniformLocation(denoiseProgram, "stage");
+	GLint stepSize = glGetUniformLocation(denoiseProgram, "stepSize");
+	GLint lastPass = glGetUniformLocation(denoiseProgram, "lastPass");
+	glUseProgram(denoiseProgram);
+
+	// The tracing has to be done writing the noisy frame and the G-buffer before they're read.
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	glUniform1i(stage, VARIANCE_STAGE);
+	glUniform1i(lastPass, GL_FALSE);
+	glBindImageTexture(6, filterTextures[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glDispatchCompute(groupsX, groupsY, 1);
+
+	glUniform1i(stage, ATROUS_STAGE);
+	for (int i = 0; i < denoiseIterations; ++i)
+	{
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(5, filterTextures[i % 2], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(6, filterTextures[(i + 1) % 2], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glUniform1i(stepSize, 1 << i);
+		glUniform1i(lastPass, i == denoiseIterations - 1);
+		glDispatchCompute(groupsX, groupsY, 1);
+	}
+}
+
+// The projection that puts every point in the world on the pixel whose camera ray goes through it, so the rasterizer sees just what the rays would.
+// The corner rays end on a parallelogram, so the ray toward any point is w * (ray00 + u * right + v * up) for u and v from 0 to 1, and the inverse
+// of the matrix with those three as its columns takes the point (less the eye) to (u * w, v * w, w). Clip space wants u and v from -1 to 1,
+// and w makes a depth the usual way, from -1 at nearDistance to 1 at farDistance, measured in lengths of the ray to the parallelogram.
+glm::mat4 rasterViewProjection(const CameraRays& camera)
+{
+	glm::mat3 toScreen = glm::inverse(glm::mat3(camera.ray10 - camera.ray00, camera.ray01 - camera.ray00, camera.ray00));
+	const float nearDistance = 0.01f;
+	const float farDistance = 100.0f;
+	glm::mat4 projection(0.0f);
+	for (int column = 0; column < 3; ++column)
+	{
+		// glm's matrices are indexed by column, then row
+		glm::vec3 screen = toScreen[column];
+		projection[column][0] = 2.0f * screen.x - screen.z;
+		projection[column][1] = 2.0f * screen.y - screen.z;
+		projection[column][2] = screen.z * (farDistance + nearDistance) / (farDistance - nearDistance);
+		projection[column][3] = screen.z;
+	}
+	projection[3][2] = -2.0f * farDistance * nearDistance / (farDistance - nearDistance);
+	return projection * glm::translate(glm::mat4(1.0f), -camera.eye);
+}
+
+// Rasterizes the scene into the hybrid path's G-buffer. Pixels that see nothing keep a triangle index of -1.
+void renderRaster()
+{
+	GLfloat noPoint[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	GLint noTriangle[4] = { -1, 0, 0, 0 };
+	GLfloat farDepth = 1.0f;
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rasterFramebuffer);
+	glClearBufferfv(GL_COLOR, 0, noPoint);
+	glClearBufferfv(GL_COLOR, 1, noPoint);
+	glClearBufferiv(GL_COLOR, 2, noTriangle);
+	glClearBufferfv(GL_DEPTH, 0, &farDepth);
+
+	glUseProgram(rasterProgram);
+	GLint objectToWorld = glGetUniformLocation(rasterProgram, "objectToWorld");
+	GLint normalToWorld = glGetUniformLocation(rasterProgram, "normalToWorld");
+	glm::mat4 viewProjection = rasterViewProjection(computeCamera);
+	glUniformMatrix4fv(glGetUniformLocation(rasterProgram, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+	glBindVertexArray(rasterVao);
+	for (unsigned int i = 0; i < scene.objects.size(); ++i)
+	{
+		// The same matrix the tracers turn normals into the world with, the transpose of the inverse of the transform
+		const glm::mat4& transform = scene.objects[i].transform;
+		glm::mat3 normalMatrix = glm::transpose(glm::mat3(glm::inverse(transform)));
+		glUniformMatrix4fv(objectToWorld, 1, GL_FALSE, glm::value_ptr(transform));
+		glUniformMatrix3fv(normalToWorld, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		glDrawArrays(GL_TRIANGLES, rasterFirst[i], rasterCount[i]);
+	}
+	glBindVertexArray(vao);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+// Traces the frame with the Compute Shader into the output image, then copies that to the window.
+void renderCompute()
+{
+	// One work group for every tile, rounding up so the tiles cover the edges of the screen.
+	GLuint groupsX = (screenWidth + TILE_SIZE - 1) / TILE_SIZE;
+	GLuint groupsY = (screenHeight + TILE_SIZE - 1) / TILE_SIZE;
+	GLint stage = glGetUniformLocation(computeProgram, "stage");
+	glUseProgram(computeProgram);
+	glUniform1i(glGetUniformLocation(computeProgram, "accumulate"), accumulateLights);
+	glUniform1i(glGetUniformLocation(computeProgram, "frameNumber"), progressiveFrame);
+	if (accumulateLights)
+	{
+		progressiveFrame++;
+	}
+
+	if (temporalCache)
+	{
+		// Last frame's history is read from one buffer while this frame's is written into the other.
+		// There's none to read on the first frame, or the first since objects moved.
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, historyBuffers[(historyFrames + 1) % 2]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, historyBuffers[historyFrames % 2]);
+		glUniform1i(glGetUniformLocation(computeProgram, "historyValid"), historyFrames > 0);
+		glUniform3f(glGetUniformLocation(computeProgram, "previousEye"), historyCamera.eye.x, historyCamera.eye.y, historyCamera.eye.z);
+		glUniform3f(glGetUniformLocation(computeProgram, "previousRay00"), historyCamera.ray00.x, historyCamera.ray00.y, historyCamera.ray00.z);
+		glUniform3f(glGetUniformLocation(computeProgram, "previousRay01"), historyCamera.ray01.x, historyCamera.ray01.y, historyCamera.ray01.z);
+		glUniform3f(glGetUniformLocation(computeProgram, "previousRay10"), historyCamera.ray10.x, historyCamera.ray10.y, historyCamera.ray10.z);
+		historyCamera = computeCamera;
+		historyFrames++;
+	}
+
+	if (renderPath == COMPUTE_PATH)
+	{
+		glUniform1i(stage, TRACE_STAGE);
+		glDispatchCompute(groupsX, groupsY, 1);
+	}
+	else if (renderPath == HYBRID_PATH)
+	{
+		// Rasterize, then trace the shadows and reflections of what each pixel sees. The G-buffer is read through samplers,
+		// which see what was drawn into the framebuffer without a barrier.
+		renderRaster();
+		glUseProgram(computeProgram);
+		glUniform1i(stage, HYBRID_STAGE);
+		glDispatchCompute(groupsX, groupsY, 1);
+	}
+	else
+	{
+		// Empty the queue, then trace a ray from the camera for every pixel, queueing up rays toward the lights for the ones that hit something.
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+		glUniform1i(stage, PRIMARY_STAGE);
+		glDispatchCompute(groupsX, groupsY, 1);
+
+		// Each stage reads what the one before it wrote to the buffers, so every dispatch waits for the last to finish writing them.
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glUniform1i(stage, SIZE_STAGE);
+		glDispatchCompute(1, 1, 1);
+
+		// Trace the queue with exactly as many work groups as it needs. The count comes from the dispatch buffer, so it has to be written before it is read as a command.
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+		glUniform1i(stage, SECONDARY_STAGE);
+		glDispatchComputeIndirect(0);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glUniform1i(stage, RESOLVE_STAGE);
+		glDispatchCompute(groupsX, groupsY, 1);
+	}
+
+	if (denoiseIterations > 0)
+	{
+		renderDenoise(groupsX, groupsY);
+	}
+
+	// Make sure the image has been written before it is copied to the window.
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebuffer);
+	glBlitFramebuffer(0, 0, screenWidth, screenHeight, 0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	glUseProgram(program);
+}
+
+// This function runs every frame. Returns how long the GPU spent tracing the frame, in milliseconds.
+double renderScene()
+{
+	// Clear the color buffer and the depth buffer
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// Clear the screen to black
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+
+	// Time the GPU's work on the frame. Reading the result straight away waits for the GPU to finish, which is fine for measuring.
+	glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+	if (renderPath == FRAGMENT_PATH)
+	{
+		renderFragment();
+	}
+	else
+	{
+		renderCompute();
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+
+	GLuint64 nanoseconds = 0;
+	glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+	gpuMilliseconds += nanoseconds / 1000000.0;
+
+	if (comparePaths)
+	{
+		comparePathTimes(nanoseconds / 1000000.0);
+	}
+	return nanoseconds / 1000000.0;
+}
+
+// Space pauses and unpauses the camera, which is when progressive mode gets to refine the picture.
+void keyCallback(GLFWwindow*, int key, int, int action, int)
+{
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+	{
+		cameraPaused = !cameraPaused;
+	}
+}
+
+// Builds the scene, the two cubes on a floor that used to be hardcoded in the shader, plus whatever was asked for on the command line.
+// The basic and intermediate tracers only had the first cube. The hierarchy over it is built by whichever tracer renders it.
+// It starts from an empty scene, so the benchmark can build it for the CPU tracer and then again for the GPU.
+void buildScene(bool secondCube)
+{
+	scene = Scene();
+	scene.AddCubes(secondCube, analytic);
+	if (numLights > 0)
+	{
+		scene.AddLights(numLights);
+	}
+	firstMovingObject = (int)scene.objects.size();
+	if (numBoxes > 0)
+	{
+		scene.AddBoxes(numBoxes, analytic);
+	}
+	if (numSpheres > 0)
+	{
+		scene.AddSpheres(numSpheres);
+	}
+	endMovingObject = (int)scene.objects.size();
+	if (!objFile.empty() && !scene.LoadOBJ(objFile, glm::vec3(0.8f, 0.8f, 0.8f)))
+	{
+		std::cout << "Can't read file: " << objFile << std::endl;
+	}
+
+	restTransforms.resize(scene.objects.size());
+	for (unsigned int i = 0; i < scene.objects.size(); ++i)
+	{
+		restTransforms[i] = scene.objects[i].transform;
+	}
+}
+
+// The CPU tracer's version of setCamera, the camera at position looking at center with the given screen ratio.
+CameraRays cpuCamera(glm::vec3 position, glm::vec3 center, float ratio)
+{
+	glm::vec4 r00;
+	glm::vec4 r01;
+	glm::vec4 r10;
+	glm::vec4 r11;
+	CameraRays camera;
+	camera.eye = position;
+	calcCameraRays(camera.eye, center, glm::vec3(0.0f, 1.0f, 0.0f), 60.0f, ratio, &r00, &r01, &r10, &r11);
+	camera.ray00 = glm::vec3(r00);
+	camera.ray01 = glm::vec3(r01);
+	camera.ray10 = glm::vec3(r10);
+	camera.ray11 = glm::vec3(r11);
+	return camera;
+}
+
+// Renders the starting view on the CPU instead of the GPU and saves it, no window or OpenGL needed.
+// This is what the shaders are checked against, and how the tutorials render on machines without a GPU.
+// packets picks between packet tracing and one ray at a time, compareScalar renders both ways and reports the speedup.
+// frames is how many frames to average, which only makes a difference when the lights are sampled.
+int renderCpu(std::string fileName, TracerMode mode, int numThreads, int width, int height, bool packets, bool compareScalar, int frames)
+{
+	buildScene(mode == TracerMode::Advanced);
+
+	// The CPU tracer doesn't know about objects, it traces every triangle where it is in the world, under one tree.
+	Scene world = scene.Flattened();
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	bvh.Build(world.triangles);
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+	std::cout << world.triangles.size() << " triangles, " << bvh.nodes.size() << " nodes, depth " << bvh.depth << ", built in " << buildTime << "ms" << std::endl;
+
+	// The same camera as init() sets up, with the ratio following the image size.
+	CameraRays camera = cpuCamera(glm::vec3(4.0f, 8.0f, 8.0f), glm::vec3(0.0f, 0.5f, 0.0f), (float)width / height);
+
+	ThreadPool pool(numThreads);
+	CpuTracer tracer(world, bvh, mode, lightSamples, maxBounces);
+	tracer.SetPacketTracing(packets);
+	Image image(width, height);
+
+	// The first frame is the one the GPU traces first, the rest are averaged in as the GPU does while the camera is still.
+	// It's the first frame's G-buffer that guides the denoiser, the camera rays hit the same things every frame.
+	GBuffer gbuffer;
+	auto start = std::chrono::high_resolution_clock::now();
+	RayCounts rays = tracer.Render(camera, image, 0, pool, denoiseIterations > 0 ? &gbuffer : nullptr);
+	Image frameImage(width, height);
+	for (int frameNumber = 1; frameNumber < frames; ++frameNumber)
+	{
+		RayCounts frameRays = tracer.Render(camera, frameImage, frameNumber, pool);
+		rays.primary += frameRays.primary;
+		rays.shadow += frameRays.shadow;
+		rays.reflection += frameRays.reflection;
+		for (unsigned int i = 0; i < image.pixels.size(); ++i)
+		{
+			image.pixels[i] += (frameImage.pixels[i] - image.pixels[i]) / (float)(frameNumber + 1);
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << width << "x" << height << " on " << pool.Size() << " threads in " << seconds * 1000.0 << "ms" << (tracer.PacketTracing() ? " with packets" : " one ray at a time") << std::endl;
+	std::cout << "Rays: " << rays.primary << " primary, " << rays.shadow << " shadow, " << rays.reflection << " reflection, " << rays.Total() / seconds / 1000000.0 << " million rays/s" << std::endl;
+
+	if (compareScalar)
+	{
+		// The same frame traced one ray at a time, it should come out the same apart from rounding
+		Image scalarImage(width, height);
+		tracer.SetPacketTracing(false);
+		start = std::chrono::high_resolution_clock::now();
+		tracer.Render(camera, scalarImage, 0, pool);
+		double scalarSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		ImageDiff diff;
+		Image::Diff(image, scalarImage, 2.0f / 255.0f, diff);
+		std::cout << "One ray at a time: " << scalarSeconds * 1000.0 << "ms, " << rays.Total() / scalarSeconds / 1000000.0 << " million rays/s, speedup " << scalarSeconds / seconds << "x" << std::endl;
+		std::cout << "Max error " << diff.maxError * 255.0f << "/255, " << diff.differing << " of " << image.pixels.size() << " pixels differ" << std::endl;
+	}
+
+	if (denoiseIterations > 0)
+	{
+		// The packet tracer's image goes through the wide filter passes, one ray at a time through the one pixel at a time passes
+		Denoiser denoiser(denoiseIterations);
+		denoiser.SetSIMD(tracer.PacketTracing());
+		start = std::chrono::high_resolution_clock::now();
+		denoiser.Filter(image, gbuffer, pool);
+		double denoiseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Denoised in " << denoiseIterations << " passes, " << denoiseSeconds * 1000.0 << "ms" << (denoiser.SIMD() ? " 8 pixels at a time" : " one pixel at a time") << std::endl;
+	}
+
+	if (!image.WritePPM(fileName))
+	{
+		std::cout << "Can't write file: " << fileName << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// How long the render farm waits for the workers it starts to build their scenes and connect
+const double FARM_START_SECONDS = 60.0;
+
+// Renders the same image as renderCpu on a render farm of workerCount worker processes on this machine, and saves it.
+// program and arguments are the command line the workers are started with, they build their scene from it just as this does.
+// With scaling, it renders with 1, 2, 4 and so on up to workerCount workers, starting new ones each time, and reports how the throughput grows.
+// A port other than 0 is listened on by every network interface, so workers on other machines can join too.
+int renderFarm(std::string fileName, TracerMode mode, int width, int height, int frames, int workerCount, bool scaling, int port, const std::string& program, const std::vector<std::string>& arguments)
+{
+	buildScene(mode == TracerMode::Advanced);
+	int triangles = (int)scene.Flattened().triangles.size();
+	CameraRays camera = cpuCamera(glm::vec3(4.0f, 8.0f, 8.0f), glm::vec3(0.0f, 0.5f, 0.0f), (float)width / height);
+
+	std::vector<int> workerCounts;
+	for (int count = 1; scaling && count < workerCount; count *= 2)
+	{
+		workerCounts.push_back(count);
+	}
+	workerCounts.push_back(workerCount);
+
+	Image image(width, height);
+	Image frameImage(width, height);
+	double firstRate = 0.0;
+	for (int count : workerCounts)
+	{
+		RenderFarm farm(triangles);
+		if (!farm.Listen(port, port != 0) || !farm.SpawnWorkers(program, arguments, count) || !farm.WaitForWorkers(count, FARM_START_SECONDS))
+		{
+			std::cout << "Can't start a render farm of " << count << " workers" << std::endl;
+			return 1;
+		}
+
+		// Frames after the first are averaged in, the same as renderCpu. The time is only the rendering, not starting the workers.
+		FarmStats stats;
+		RayCounts rays = RayCounts();
+		double milliseconds = 0.0;
+		int stolen = 0;
+		for (int frameNumber = 0; frameNumber < frames; ++frameNumber)
+		{
+			if (!farm.Render(camera, frameNumber == 0 ? image : frameImage, frameNumber, stats))
+			{
+				return 1;
+			}
+			milliseconds += stats.milliseconds;
+			rays.primary += stats.rays.primary;
+			rays.shadow += stats.rays.shadow;
+			rays.reflection += stats.rays.reflection;
+			for (unsigned int i = 0; i < stats.tilesStolen.size(); ++i)
+			{
+				stolen += stats.tilesStolen[i];
+			}
+			for (unsigned int i = 0; frameNumber > 0 && i < image.pixels.size(); ++i)
+			{
+				image.pixels[i] += (frameImage.pixels[i] - image.pixels[i]) / (float)(frameNumber + 1);
+			}
+		}
+		farm.Shutdown();
+
+		// Speedup is against the first worker count tried, and efficiency is how much of the extra workers' share of it that is
+		double rate = rays.Total() / (milliseconds / 1000.0);
+		if (firstRate == 0.0)
+		{
+			firstRate = rate;
+		}
+		double speedup = rate / firstRate;
+		std::cout << count << (count == 1 ? " worker: " : " workers: ") << milliseconds / frames << "ms per frame, " << rate / 1000000.0 << " million rays/s, ";
+		if (workerCounts.size() > 1)
+		{
+			std::cout << speedup << "x the " << workerCounts[0] << " worker rate, " << 100.0 * speedup * workerCounts[0] / count << "% efficiency, ";
+		}
+		std::cout << stolen << " tiles stolen" << std::endl;
+		std::cout << "  Tiles per worker on the last frame:";
+		for (unsigned int i = 0; i < stats.tilesTraced.size(); ++i)
+		{
+			std::cout << " " << stats.tilesTraced[i];
+		}
+		std::cout << std::endl;
+	}
+
+	if (!image.WritePPM(fileName))
+	{
+		std::cout << "Can't write file: " << fileName << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Runs as one of a render farm's workers, tracing the tiles the farm at host, port sends until it's done with us.
+// The scene is built from the same command line as the farm's, which checks that the two match.
+int farmWorker(const std::string& host, int port, TracerMode mode, int numThreads, bool packets)
+{
+	buildScene(mode == TracerMode::Advanced);
+	Scene world = scene.Flattened();
+	bvh.Build(world.triangles);
+	ThreadPool pool(numThreads);
+	CpuTracer tracer(world, bvh, mode, lightSamples, maxBounces);
+	tracer.SetPacketTracing(packets);
+	return RunFarmWorker(host, port, tracer, (int)world.triangles.size(), pool);
+}
+
+// Times the CPU tracer down each of the paths, frames frames apiece, and adds the runs to report.
+void benchmarkCpu(BenchmarkReport& report, const std::vector<CameraPath>& paths, int frames, TracerMode mode, int numThreads, int width, int height, bool packets)
+{
+	buildScene(mode == TracerMode::Advanced);
+	Scene world = scene.Flattened();
+	bvh.Build(world.triangles);
+
+	ThreadPool pool(numThreads);
+	CpuTracer tracer(world, bvh, mode, lightSamples, maxBounces);
+	tracer.SetPacketTracing(packets);
+	Image image(width, height);
+	report.Describe("cpuThreads", pool.Size());
+
+	// Denoising is part of each frame's time. The cache carries on from frame to frame down each path, starting empty.
+	TemporalCache cache;
+	GBuffer gbuffer;
+	Denoiser denoiser(std::max(1, denoiseIterations));
+	denoiser.SetSIMD(tracer.PacketTracing());
+
+	std::string name = tracer.PacketTracing() ? "cpu-packets" : "cpu-scalar";
+	for (const CameraPath& path : paths)
+	{
+		BenchmarkRun run = { name, path.name, width, height, std::vector<double>(), RayCounts() };
+		cache.Reset();
+		for (int i = 0; i < frames; ++i)
+		{
+			CameraPose pose = path.At(i, frames);
+			CameraRays camera = cpuCamera(pose.eye, pose.center, (float)width / height);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			RayCounts rays = tracer.Render(camera, image, 0, pool, denoiseIterations > 0 ? &gbuffer : nullptr, temporalCache ? &cache : nullptr);
+			if (denoiseIterations > 0)
+			{
+				denoiser.Filter(image, gbuffer, pool);
+			}
+			run.AddFrame(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count(), rays);
+		}
+		report.Add(run);
+	}
+}
+
+// Times each of the GPU paths down each of the camera paths, frames frames apiece, and adds the runs to report. The frames are never
+// shown, only traced into the hidden window's back buffer, and each is timed by the GPU's timer query and has its rays counted by the shaders.
+void benchmarkGpu(BenchmarkReport& report, const std::vector<CameraPath>& paths, int frames)
+{
+	report.Describe("glRenderer", (const char*)glGetString(GL_RENDERER));
+	report.Describe("glVersion", (const char*)glGetString(GL_VERSION));
+
+	// Only the compute paths denoise and cache, so the fragment path sits out when they're on. The hybrid path needs a scene it can rasterize.
+	for (int p = denoiseIterations > 0 || temporalCache ? COMPUTE_PATH : FRAGMENT_PATH; p <= (rasterReady ? HYBRID_PATH : WAVEFRONT_PATH); ++p)
+	{
+		renderPath = (RenderPath)p;
+		for (const CameraPath& path : paths)
+		{
+			BenchmarkRun run = { std::string("gpu-") + pathNames[p], path.name, screenWidth, screenHeight, std::vector<double>(), RayCounts() };
+			historyFrames = 0;
+			for (int i = -BENCHMARK_WARMUP_FRAMES; i < frames; ++i)
+			{
+				CameraPose pose = path.At(std::max(i, 0), frames);
+				setCamera(pose.eye, pose.center);
+
+				GLuint counts[3] = { 0, 0, 0 };
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayCountBuffer);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+
+				double milliseconds = renderScene();
+
+				// The shaders' writes to the counts have to land before they're read back.
+				glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayCountBuffer);
+				glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+				if (i >= 0)
+				{
+					RayCounts rays = { counts[0], counts[1], counts[2] };
+					run.AddFrame(milliseconds, rays);
+				}
+			}
+			report.Add(run);
+		}
+	}
+}
+
+// Prints the benchmark's results and writes them to benchmarkFile, along with the size of the scene they were measured on.
+int writeBenchmark(BenchmarkReport& report)
+{
+	report.Describe("triangles", (double)scene.triangles.size());
+	report.Describe("lights", (double)scene.lights.size());
+	report.Print();
+	if (!report.WriteJSON(benchmarkFile))
+	{
+		std::cout << "Can't write file: " << benchmarkFile << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Compares two saved images, eg. a GPU capture against a CPU render, and prints how far apart they are.
+int diffImages(std::string fileA, std::string fileB)
+{
+	Image a;
+	Image b;
+	if (!a.ReadPPM(fileA) || !b.ReadPPM(fileB))
+	{
+		std::cout << "Can't read " << fileA << " and " << fileB << std::endl;
+		return 1;
+	}
+
+	// Channels more than 2/255 apart count as different, anything less is rounding in the two pipelines.
+	ImageDiff diff;
+	if (!Image::Diff(a, b, 2.0f / 255.0f, diff))
+	{
+		std::cout << "The images are different sizes." << std::endl;
+		return 1;
+	}
+
+	std::cout << "Max error " << diff.maxError * 255.0f << "/255, RMSE " << diff.rmse * 255.0f << "/255, PSNR " << diff.psnr << "dB, " << diff.differing << " of " << a.pixels.size() << " pixels differ" << std::endl;
+	return diff.differing == 0 ? 0 : 2;
+}
+
+// Saves what's in the back buffer, which is the frame that was just rendered.
+void captureFrame(std::string fileName)
+{
+	int width;
+	int height;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	// OpenGL's rows start at the bottom of the window, the image's start at the top.
+	std::vector<float> rgb(width * height * 3);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, rgb.data());
+
+	Image image(width, height);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			float* p = &rgb[((height - 1 - y) * width + x) * 3];
+			image.At(x, y) = glm::vec3(p[0], p[1], p[2]);
+		}
+	}
+
+	if (image.WritePPM(fileName))
+	{
+		std::cout << "Saved " << fileName << std::endl;
+	}
+	else
+	{
+		std::cout << "Can't write file: " << fileName << std::endl;
+	}
+}
+
 // This method reads the text from a file.
 // Realistically, we wouldn't want plain text shaders hardcoded in, we'd rather read them in from a separate file so that the shader code is separated.
 std::string readShader(std::string fileName)
@@ -233,6 +1338,29 @@ std::string readShader(std::string fileName)
 	return shaderCode;
 }
 
+// Pastes the shared tracing code into a shader where it has the line #include "RayTracing.glsl".
+// GLSL has no #include, so without this the shader would fail to compile on that line.
+// When benchmarking it defines COUNT_RAYS first, so the shader counts its rays, and when denoising it defines DENOISE, so the Compute Shader writes the G-buffer.
+std::string includeRayTracing(std::string shaderCode)
+{
+	std::string include = "#include \"RayTracing.glsl\"";
+	size_t position = shaderCode.find(include);
+	if (position != std::string::npos)
+	{
+		std::string defines = benchmarkFile.empty() ? "" : "#define COUNT_RAYS\n";
+		if (denoiseIterations > 0)
+		{
+			defines += "#define DENOISE\n";
+		}
+		if (temporalCache)
+		{
+			defines += "#define TEMPORAL_CACHE\n";
+		}
+		shaderCode.replace(position, include.size(), defines + readShader("RayTracing.glsl"));
+	}
+	return shaderCode;
+}
+
 // This method will consolidate some of the shader code we've written to return a GLuint to the compiled shader.
 // It only requires the shader source code and the shader type.
 GLuint createShader(std::string sourceCode, GLenum shaderType)
@@ -272,6 +1400,111 @@ GLuint createShader(std::string sourceCode, GLenum shaderType)
 	return shader;
 }
 
+// Makes a texture the size of the screen for shaders to use as an image, and binds it to the image unit.
+GLuint createScreenImage(GLuint unit, GLenum format)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, format, screenWidth, screenHeight);
+	glBindImageTexture(unit, texture, 0, GL_FALSE, 0, GL_READ_WRITE, format);
+	return texture;
+}
+
+// Whether every primitive in the scene is flat, which is all the hybrid path's rasterizer can draw.
+bool sceneRasterizable()
+{
+	for (const SceneTriangle& t : scene.triangles)
+	{
+		if (t.kind != PRIMITIVE_TRIANGLE && t.kind != PRIMITIVE_PLANE)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Sets up the hybrid path: the raster program, the scene's triangles as vertices, and the G-buffer it draws them into.
+void initRaster()
+{
+	raster_vertex_shader = createShader(readShader("RasterVertexShader.glsl"), GL_VERTEX_SHADER);
+	raster_fragment_shader = createShader(readShader("RasterFragmentShader.glsl"), GL_FRAGMENT_SHADER);
+	rasterProgram = glCreateProgram();
+	glAttachShader(rasterProgram, raster_vertex_shader);
+	glAttachShader(rasterProgram, raster_fragment_shader);
+	glLinkProgram(rasterProgram);
+
+	// Every triangle becomes three vertices, in the scene's order so each object's are together. A plane is two triangles,
+	// its corners a, b and c, then b, the corner across from a and c.
+	std::vector<RasterVertex> vertices;
+	rasterFirst.clear();
+	rasterCount.clear();
+	for (const SceneObject& object : scene.objects)
+	{
+		rasterFirst.push_back((GLint)vertices.size());
+		for (int i = object.firstTriangle; i < object.firstTriangle + object.triangleCount; ++i)
+		{
+			const SceneTriangle& t = scene.triangles[i];
+			vertices.push_back({ t.a, t.normal, i });
+			vertices.push_back({ t.b, t.normal, i });
+			vertices.push_back({ t.c, t.normal, i });
+			if (t.kind == PRIMITIVE_PLANE)
+			{
+				vertices.push_back({ t.b, t.normal, i });
+				vertices.push_back({ t.b + t.c - t.a, t.normal, i });
+				vertices.push_back({ t.c, t.normal, i });
+			}
+		}
+		rasterCount.push_back((GLsizei)vertices.size() - rasterFirst.back());
+	}
+
+	glGenVertexArrays(1, &rasterVao);
+	glBindVertexArray(rasterVao);
+	glGenBuffers(1, &rasterVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, rasterVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(RasterVertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(RasterVertex), (void*)offsetof(RasterVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(RasterVertex), (void*)offsetof(RasterVertex, normal));
+	// The index stays an integer, glVertexAttribPointer would turn it into a float
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(2, 1, GL_INT, sizeof(RasterVertex), (void*)offsetof(RasterVertex, triangle));
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	// The G-buffer, read by the Compute Shader with texelFetch, so it needs no filtering, on texture units 1 to 3.
+	// Points and normals are full floats, since the shadow and reflection rays start from them.
+	GLenum formats[3] = { GL_RGBA32F, GL_RGBA32F, GL_R32I };
+	const char* samplers[3] = { "rasterPositions", "rasterNormals", "rasterTriangles" };
+	glGenTextures(3, rasterTextures);
+	for (int i = 0; i < 3; ++i)
+	{
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_2D, rasterTextures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], screenWidth, screenHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glProgramUniform1i(computeProgram, glGetUniformLocation(computeProgram, samplers[i]), 1 + i);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glGenRenderbuffers(1, &rasterDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, rasterDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, screenWidth, screenHeight);
+
+	GLenum attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glGenFramebuffers(1, &rasterFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rasterFramebuffer);
+	for (int i = 0; i < 3; ++i)
+	{
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, attachments[i], GL_TEXTURE_2D, rasterTextures[i], 0);
+	}
+	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rasterDepth);
+	glDrawBuffers(3, attachments);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
 // Initialization code
 void init()
 {
@@ -281,7 +1514,7 @@ void init()
 
 	// Read in the shader code from a file.
 	std::string vertShader = readShader("VertexShader.glsl");
-	std::string fragShader = readShader("FragmentShader.glsl");
+	std::string fragShader = includeRayTracing(readShader("FragmentShader.glsl"));
 
 	// createShader consolidates all of the shader compilation code
 	vertex_shader = createShader(vertShader, GL_VERTEX_SHADER);
@@ -353,6 +1586,192 @@ void init()
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
 	// You'll note sizeof(glm::vec2) is our stride, because each vertex is that size.
 
+	// Build the scene and the hierarchy over it. The hierarchy reorders the triangles, so this has to happen before they are uploaded.
+	buildScene(true);
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	sceneBvh.Build(scene);
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+	std::cout << scene.triangles.size() << " triangles in " << scene.objects.size() << " objects, " << sceneBvh.objectNodes.size() << " nodes, depth " << sceneBvh.depth
+		<< ", top level " << sceneBvh.top.nodes.size() << " nodes, built in " << buildTime << "ms" << std::endl;
+
+	// The hybrid path is set up when it's asked for, compared or benchmarked, as long as the rasterizer can draw everything in the scene.
+	rasterReady = false;
+	if (renderPath == HYBRID_PATH || comparePaths || !benchmarkFile.empty())
+	{
+		rasterReady = sceneRasterizable();
+		if (!rasterReady && renderPath == HYBRID_PATH)
+		{
+			std::cout << "Spheres and boxes can't be rasterized, tracing with --compute instead" << std::endl;
+			renderPath = COMPUTE_PATH;
+		}
+	}
+
+	// Shader storage buffers are created like any other buffer, then bound to the numbered binding point that the shader's buffer block names.
+	// GL_STATIC_DRAW since they're written once and read by every pixel of every frame.
+	std::vector<TriangleEdges> edges = scene.Edges();
+	glGenBuffers(1, &triangleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TriangleEdges) * edges.size(), edges.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleBuffer);
+
+	std::vector<TriangleSurface> surfaces = scene.Surfaces();
+	glGenBuffers(1, &surfaceBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TriangleSurface) * surfaces.size(), surfaces.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, surfaceBuffer);
+
+	glGenBuffers(1, &nodeBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BVHNode) * sceneBvh.objectNodes.size(), sceneBvh.objectNodes.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodeBuffer);
+
+	// The instances and the top level are uploaded by uploadTopLevel, once the compute program's treelet buffer is there too.
+	glGenBuffers(1, &instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, instanceBuffer);
+	glGenBuffers(1, &topNodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, topNodeBuffer);
+
+	// The lights with their alias table. Bindings 8 and 9 are past the 8 bindings OpenGL 4.3 has to have, but every desktop driver has more.
+	lightTable.Build(scene.lights, lightSamples);
+	glGenBuffers(1, &lightBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(LightTableEntry) * lightTable.entries.size(), lightTable.entries.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, lightBuffer);
+	glUniform1i(glGetUniformLocation(program, "lightSamples"), lightSamples);
+	glUniform1i(glGetUniformLocation(program, "maxBounces"), maxBounces);
+	glUniform1i(glGetUniformLocation(program, "frameNumber"), 0);
+
+	// Sampled lights are averaged over frames, except when timing the paths, which only compares tracing whole frames, and when denoising, which smooths each frame instead.
+	accumulateLights = lightTable.Sampled() && !comparePaths && benchmarkFile.empty() && denoiseIterations == 0;
+	if (accumulateLights && renderPath == FRAGMENT_PATH && progressiveStride == 0)
+	{
+		progressiveStride = 1;
+	}
+
+	// Where the shaders count their rays when benchmarking, three counts set back to 0 before every frame.
+	if (!benchmarkFile.empty())
+	{
+		glGenBuffers(1, &rayCountBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayCountBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 3, nullptr, GL_DYNAMIC_READ);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, rayCountBuffer);
+	}
+
+	// Set up the compute paths. They're also set up for --compare-gpu and --benchmark, which start on the fragment path and move on to them.
+	glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+	computeProgram = 0;
+	if (renderPath != FRAGMENT_PATH || comparePaths || !benchmarkFile.empty())
+	{
+		compute_shader = createShader(includeRayTracing(readShader("ComputeShader.glsl")), GL_COMPUTE_SHADER);
+		computeProgram = glCreateProgram();
+		glAttachShader(computeProgram, compute_shader);
+		glLinkProgram(computeProgram);
+
+		// The top of the top level tree for shared memory, and how many triangles fit there with it.
+		glGenBuffers(1, &treeletBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, treeletBuffer);
+		glProgramUniform1i(computeProgram, glGetUniformLocation(computeProgram, "sharedTriangleCount"), std::min((int)scene.triangles.size(), MAX_SHARED_TRIANGLES));
+		glProgramUniform1i(computeProgram, glGetUniformLocation(computeProgram, "lightSamples"), lightSamples);
+		glProgramUniform1i(computeProgram, glGetUniformLocation(computeProgram, "maxBounces"), maxBounces);
+
+		// The wavefront path's buffers, a hit for every pixel and room in the queue for a ray toward every light each of them is shaded by.
+		// The queue starts with its length, padded out to 16 bytes where the rays start under std430 packing. GL_DYNAMIC_COPY since the GPU writes and reads them every frame.
+		int pixels = screenWidth * screenHeight;
+		glGenBuffers(1, &hitBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, hitBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLint) * 12 * pixels, nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, hitBuffer);
+
+		glGenBuffers(1, &queueBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLint) * 4 * (1 + pixels * lightTable.PerPoint()), nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, queueBuffer);
+
+		// The dispatch buffer is both written by the shader and read by glDispatchComputeIndirect.
+		GLuint groups[3] = { 0, 1, 1 };
+		glGenBuffers(1, &dispatchBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, dispatchBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(groups), groups, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, dispatchBuffer);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatchBuffer);
+
+		// Two frames of the cache's history, an entry for every pixel. renderCompute binds them, swapping them every frame.
+		if (temporalCache)
+		{
+			glGenBuffers(2, historyBuffers);
+			for (int i = 0; i < 2; ++i)
+			{
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, historyBuffers[i]);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(HistoryEntry) * pixels, nullptr, GL_DYNAMIC_COPY);
+			}
+			historyFrames = 0;
+		}
+
+		// The image the Compute Shader writes, on image unit 1, and a framebuffer around it to copy it to the window with.
+		glGenTextures(1, &outputTexture);
+		glBindTexture(GL_TEXTURE_2D, outputTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, screenWidth, screenHeight);
+		glBindImageTexture(1, outputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+		glGenFramebuffers(1, &outputFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		if (rasterReady)
+		{
+			initRaster();
+		}
+
+		// The denoiser, and the images it shares with the Compute Shader: the noisy frame and the G-buffer on image units 2 to 4.
+		// The filter images go on units 5 and 6, which renderDenoise swaps between passes.
+		if (denoiseIterations > 0)
+		{
+			denoise_shader = createShader(readShader("DenoiseShader.glsl"), GL_COMPUTE_SHADER);
+			denoiseProgram = glCreateProgram();
+			glAttachShader(denoiseProgram, denoise_shader);
+			glLinkProgram(denoiseProgram);
+
+			noisyTexture = createScreenImage(2, GL_RGBA32F);
+			normalDepthTexture = createScreenImage(3, GL_RGBA32F);
+			albedoTexture = createScreenImage(4, GL_RGBA8);
+			filterTextures[0] = createScreenImage(5, GL_RGBA32F);
+			filterTextures[1] = createScreenImage(6, GL_RGBA32F);
+		}
+	}
+	uploadTopLevel();
+	glGenQueries(1, &timerQuery);
+	gpuMilliseconds = 0.0;
+
+	// Set up progressive mode, and the compute paths' averaging of sampled lights. The accumulation image holds a running sum of samples
+	// for every pixel, in floating point so it doesn't saturate.
+	glUniform1i(glGetUniformLocation(program, "progressive"), GL_FALSE);
+	progressiveFrame = 0;
+	if (progressiveStride > 0 || accumulateLights)
+	{
+		glGenTextures(1, &accumulationTexture);
+		glBindTexture(GL_TEXTURE_2D, accumulationTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, screenWidth, screenHeight);
+		// Bind it as image unit 0, which every program reads the accumulation image from.
+		glBindImageTexture(0, accumulationTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	}
+	if (progressiveStride > 0)
+	{
+		buildTraceOrder(progressiveStride);
+
+		// The display program draws the same quad with the same Vertex Shader.
+		display_shader = createShader(readShader("ProgressiveShader.glsl"), GL_FRAGMENT_SHADER);
+		displayProgram = glCreateProgram();
+		glAttachShader(displayProgram, vertex_shader);
+		glAttachShader(displayProgram, display_shader);
+		glLinkProgram(displayProgram);
+
+		glUseProgram(displayProgram);
+		glUniform1i(glGetUniformLocation(displayProgram, "pixelStride"), progressiveStride);
+		glUniform1iv(glGetUniformLocation(displayProgram, "order"), (GLsizei)traceRank.size(), traceRank.data());
+		glUseProgram(program);
+	}
+
 	// This gets us a reference to the uniform variables in the vertex shader, which are called by the same name here as in the shader.
 	// We're using these variables to define the camera. The eye is the camera position, and teh rays are the four corner rays of what the camera sees.
 	// Only 2 parameters required: A reference to the shader program and the name of the uniform variable within the shader code.
@@ -362,25 +1781,8 @@ void init()
 	ray10 = glGetUniformLocation(program, "ray10");
 	ray11 = glGetUniformLocation(program, "ray11");
 
-	// This is where we'll set up our camera location at.
-	cameraPos = glm::vec3(4.0f, 8.0f, 8.0f);
-
-	// These are four corner ray variables to store the output from our calcCameraRays function.
-	glm::vec4 r00;
-	glm::vec4 r01;
-	glm::vec4 r10;
-	glm::vec4 r11;
-
-	// Call our function to calculate the four corner rays. We're choosing to make the point the camera centeras on at 0, 0.5, 0.
-	// Our FoV angle is 60 degrees and our ratio is 800/600 which is just the pixel ratio.
-	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 60.0f, 800.0f/600.0f, &r00, &r01, &r10, &r11);
-
-	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
-	glUniform3f(eye, cameraPos.x, cameraPos.y, cameraPos.z);
-	glUniform3f(ray00, r00.x, r00.y, r00.z);
-	glUniform3f(ray01, r01.x, r01.y, r01.z);
-	glUniform3f(ray10, r10.x, r10.y, r10.z);
-	glUniform3f(ray11, r11.x, r11.y, r11.z);
+	// This is where we'll set up our camera location at. We're choosing to make the point the camera centers on at 0, 0.5, 0.
+	setCamera(glm::vec3(4.0f, 8.0f, 8.0f), glm::vec3(0.0f, 0.5f, 0.0f));
 
 	// This is not necessary, but I prefer to handle my vertices in the clockwise order. glFrontFace defines which face of the triangles you're drawing is the front.
 	// Essentially, if you draw your vertices in counter-clockwise order, by default (in OpenGL) the front face will be facing you/the screen. If you draw them clockwise, the front face 
@@ -397,22 +1799,310 @@ int main(int argc, char **argv)
 	timebase = 0.0;
 	fps = 0;
 
+	// Read the command line options.
+	numBoxes = 0;
+	numSpheres = 0;
+	analytic = false;
+	denoiseIterations = 0;
+	temporalCache = false;
+	numLights = 0;
+	lightSamples = 4;
+	maxBounces = 1;
+	int frames = 1;
+	std::string cpuFile;
+	TracerMode mode = TracerMode::Advanced;
+	int numThreads = 0;
+	int width = 800;
+	int height = 600;
+	std::string diffA;
+	std::string diffB;
+	bool packets = true;
+	bool compareScalar = false;
+	int farmWorkers = 0;
+	bool farmScaling = false;
+	int farmPort = 0;
+	std::string farmHost;
+	int benchmarkFrames = 60;
+	std::string benchmarkPath;
+	std::string benchmarkTracers = "all";
+	cameraPaused = false;
+	progressiveStride = 0;
+	renderPath = FRAGMENT_PATH;
+	comparePaths = false;
+	animate = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--boxes" && i + 1 < argc)
+		{
+			numBoxes = std::atoi(argv[++i]);
+		}
+		else if (arg == "--spheres" && i + 1 < argc)
+		{
+			numSpheres = std::atoi(argv[++i]);
+		}
+		else if (arg == "--analytic")
+		{
+			analytic = true;
+		}
+		else if (arg == "--lights" && i + 1 < argc)
+		{
+			numLights = std::atoi(argv[++i]);
+		}
+		else if (arg == "--light-samples" && i + 1 < argc)
+		{
+			lightSamples = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--bounces" && i + 1 < argc)
+		{
+			maxBounces = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			frames = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--obj" && i + 1 < argc)
+		{
+			objFile = argv[++i];
+		}
+		else if (arg == "--capture" && i + 1 < argc)
+		{
+			captureFile = argv[++i];
+		}
+		else if (arg == "--cpu" && i + 1 < argc)
+		{
+			cpuFile = argv[++i];
+		}
+		else if (arg == "--mode" && i + 1 < argc)
+		{
+			std::string name = argv[++i];
+			mode = name == "basic" ? TracerMode::Basic : (name == "intermediate" ? TracerMode::Intermediate : TracerMode::Advanced);
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			numThreads = std::atoi(argv[++i]);
+		}
+		else if (arg == "--size" && i + 2 < argc)
+		{
+			width = std::atoi(argv[++i]);
+			height = std::atoi(argv[++i]);
+		}
+		else if (arg == "--progressive" && i + 1 < argc)
+		{
+			// Round down to a power of two, up to 8x8 blocks.
+			int stride = std::atoi(argv[++i]);
+			progressiveStride = stride >= 8 ? 8 : (stride >= 4 ? 4 : (stride >= 2 ? 2 : 1));
+		}
+		else if (arg == "--animate")
+		{
+			animate = true;
+		}
+		else if (arg == "--compute")
+		{
+			renderPath = COMPUTE_PATH;
+		}
+		else if (arg == "--wavefront")
+		{
+			renderPath = WAVEFRONT_PATH;
+		}
+		else if (arg == "--hybrid")
+		{
+			renderPath = HYBRID_PATH;
+		}
+		else if (arg == "--compare-gpu")
+		{
+			comparePaths = true;
+		}
+		else if (arg == "--denoise")
+		{
+			denoiseIterations = denoiseIterations > 0 ? denoiseIterations : 5;
+		}
+		else if (arg == "--denoise-iterations" && i + 1 < argc)
+		{
+			denoiseIterations = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--temporal-cache")
+		{
+			temporalCache = true;
+		}
+		else if (arg == "--scalar")
+		{
+			packets = false;
+		}
+		else if (arg == "--farm" && i + 1 < argc)
+		{
+			farmWorkers = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--farm-scaling")
+		{
+			farmScaling = true;
+		}
+		else if (arg == "--farm-port" && i + 1 < argc)
+		{
+			farmPort = std::atoi(argv[++i]);
+		}
+		else if (arg == "--farm-worker" && i + 2 < argc)
+		{
+			farmHost = argv[++i];
+			farmPort = std::atoi(argv[++i]);
+		}
+		else if (arg == "--compare-scalar")
+		{
+			compareScalar = true;
+		}
+		else if (arg == "--benchmark" && i + 1 < argc)
+		{
+			benchmarkFile = argv[++i];
+		}
+		else if (arg == "--benchmark-frames" && i + 1 < argc)
+		{
+			benchmarkFrames = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--benchmark-path" && i + 1 < argc)
+		{
+			benchmarkPath = argv[++i];
+		}
+		else if (arg == "--benchmark-tracers" && i + 1 < argc)
+		{
+			benchmarkTracers = argv[++i];
+		}
+		else if (arg == "--diff" && i + 2 < argc)
+		{
+			diffA = argv[++i];
+			diffB = argv[++i];
+		}
+	}
+
+	// Comparing starts on the fragment path. Progressive mode only applies to the fragment path, and the paths are only compared tracing whole frames.
+	// The benchmark does the same, and runs on its own without the other modes.
+	if (!benchmarkFile.empty())
+	{
+		comparePaths = false;
+		animate = false;
+		captureFile.clear();
+		renderPath = FRAGMENT_PATH;
+	}
+	if (comparePaths)
+	{
+		renderPath = FRAGMENT_PATH;
+		pathFrames = 0;
+		denoiseIterations = 0;
+		temporalCache = false;
+	}
+
+	// The denoiser follows the compute paths, which write the G-buffer it needs, and so does the cache, which they keep the history of.
+	if ((denoiseIterations > 0 || temporalCache) && renderPath == FRAGMENT_PATH)
+	{
+		renderPath = COMPUTE_PATH;
+	}
+	if (renderPath != FRAGMENT_PATH || comparePaths || !benchmarkFile.empty())
+	{
+		progressiveStride = 0;
+	}
+
+	// The benchmark's camera paths, or just the one asked for.
+	BenchmarkReport report;
+	std::vector<CameraPath> paths;
+	for (const CameraPath& path : BenchmarkPaths())
+	{
+		if (benchmarkPath.empty() || path.name == benchmarkPath)
+		{
+			paths.push_back(path);
+		}
+	}
+	if (!benchmarkFile.empty())
+	{
+		if (paths.empty())
+		{
+			std::cout << "No camera path called " << benchmarkPath << std::endl;
+			return 1;
+		}
+		report.Describe("lightSamples", lightSamples);
+		report.Describe("bounces", maxBounces);
+		report.Describe("denoiseIterations", denoiseIterations);
+		report.Describe("temporalCache", temporalCache ? "on" : "off");
+	}
+
+	// These don't need a window.
+	if (!farmHost.empty())
+	{
+		return farmWorker(farmHost, farmPort, mode, numThreads, packets);
+	}
+	if (!diffA.empty())
+	{
+		return diffImages(diffA, diffB);
+	}
+	if (!cpuFile.empty() && farmWorkers > 0)
+	{
+		// The workers get the same options, which they build the scene from. Anything of ours they don't need they ignore,
+		// and --threads comes last so it's the one they go by.
+		std::vector<std::string> arguments(argv + 1, argv + argc);
+		arguments.push_back("--threads");
+		arguments.push_back(std::to_string(numThreads > 0 ? numThreads : 1));
+		return renderFarm(cpuFile, mode, width, height, frames, farmWorkers, farmScaling, farmPort, argv[0], arguments);
+	}
+	if (!cpuFile.empty())
+	{
+		return renderCpu(cpuFile, mode, numThreads, width, height, packets, compareScalar, frames);
+	}
+	if (!benchmarkFile.empty() && benchmarkTracers != "gpu")
+	{
+		benchmarkCpu(report, paths, benchmarkFrames, mode, numThreads, width, height, packets);
+	}
+	if (!benchmarkFile.empty() && benchmarkTracers == "cpu")
+	{
+		return writeBenchmark(report);
+	}
+
 	// Initializes the GLFW library
 	glfwInit();
 
+	// Shader storage buffers are part of OpenGL 4.3, so ask for at least that.
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	// The benchmark renders at the size asked for, in a window that is never shown.
+	if (!benchmarkFile.empty())
+	{
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	}
+
 	// Creates a window given (width, height, title, monitorPtr, windowPtr).
 	// Don't worry about the last two, as they have to do with controlling which monitor to display on and having a reference to other windows. Leaving them as nullptr is fine.
-	window = glfwCreateWindow(800, 600, "Basic Ray Tracer", nullptr, nullptr);
+	window = benchmarkFile.empty() ? glfwCreateWindow(800, 600, "Basic Ray Tracer", nullptr, nullptr) : glfwCreateWindow(width, height, "Ray Tracer Benchmark", nullptr, nullptr);
+
+	// This fails if the hardware or driver can't give us a 4.3 context. The benchmark still writes out what the CPU tracer measured.
+	if (window == nullptr)
+	{
+		std::cout << "Couldn't create an OpenGL 4.3 window." << std::endl;
+		glfwTerminate();
+		if (!benchmarkFile.empty() && benchmarkTracers != "gpu")
+		{
+			writeBenchmark(report);
+		}
+		return 1;
+	}
 
 	// Makes the OpenGL context current for the created window.
 	glfwMakeContextCurrent(window);
 
+	// Listen for the space bar.
+	glfwSetKeyCallback(window, keyCallback);
+
 	// Sets the number of screen updates to wait before swapping the buffers.
 	glfwSwapInterval(1);
 
 	// Initializes most things needed before the main loop
 	init();
 
+	// The benchmark renders all its frames in one go, and never enters the main loop.
+	if (!benchmarkFile.empty())
+	{
+		benchmarkGpu(report, paths, benchmarkFrames);
+		glfwSetWindowShouldClose(window, GL_TRUE);
+	}
+
 	// Enter the main loop.
 	while (!glfwWindowShouldClose(window))
 	{
@@ -422,6 +2112,13 @@ int main(int argc, char **argv)
 		// Call the render function.
 		renderScene();
 
+		// Save the first frame and stop if we were asked to.
+		if (!captureFile.empty())
+		{
+			captureFrame(captureFile);
+			glfwSetWindowShouldClose(window, GL_TRUE);
+		}
+
 		// Swaps the back buffer to the front buffer
 		// Remember, you're rendering to the back buffer, then once rendering is complete, you're moving the back buffer to the front so it can be displayed.
 		glfwSwapBuffers(window);
@@ -436,13 +2133,72 @@ int main(int argc, char **argv)
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
 	glDeleteProgram(program);
+	glDeleteQueries(1, &timerQuery);
+	if (computeProgram != 0)
+	{
+		glDeleteShader(compute_shader);
+		glDeleteProgram(computeProgram);
+		glDeleteBuffers(1, &treeletBuffer);
+		glDeleteBuffers(1, &hitBuffer);
+		glDeleteBuffers(1, &queueBuffer);
+		glDeleteBuffers(1, &dispatchBuffer);
+		glDeleteFramebuffers(1, &outputFramebuffer);
+		glDeleteTextures(1, &outputTexture);
+		if (denoiseIterations > 0)
+		{
+			glDeleteShader(denoise_shader);
+			glDeleteProgram(denoiseProgram);
+			glDeleteTextures(1, &noisyTexture);
+			glDeleteTextures(1, &normalDepthTexture);
+			glDeleteTextures(1, &albedoTexture);
+			glDeleteTextures(2, filterTextures);
+		}
+		if (temporalCache)
+		{
+			glDeleteBuffers(2, historyBuffers);
+		}
+		if (rasterReady)
+		{
+			glDeleteShader(raster_vertex_shader);
+			glDeleteShader(raster_fragment_shader);
+			glDeleteProgram(rasterProgram);
+			glDeleteVertexArrays(1, &rasterVao);
+			glDeleteBuffers(1, &rasterVbo);
+			glDeleteFramebuffers(1, &rasterFramebuffer);
+			glDeleteRenderbuffers(1, &rasterDepth);
+			glDeleteTextures(3, rasterTextures);
+		}
+	}
+	if (progressiveStride > 0)
+	{
+		glDeleteShader(display_shader);
+		glDeleteProgram(displayProgram);
+	}
+	if (progressiveStride > 0 || accumulateLights)
+	{
+		glDeleteTextures(1, &accumulationTexture);
+	}
 	// Note: If at any point you stop using a "program" or shaders, you should free the data up then and there.
 
 	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &triangleBuffer);
+	glDeleteBuffers(1, &surfaceBuffer);
+	glDeleteBuffers(1, &nodeBuffer);
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteBuffers(1, &topNodeBuffer);
+	glDeleteBuffers(1, &lightBuffer);
+	if (!benchmarkFile.empty())
+	{
+		glDeleteBuffers(1, &rayCountBuffer);
+	}
 	glDeleteVertexArrays(1, &vao);
 
 	// Frees up GLFW memory
 	glfwTerminate();
 
+	if (!benchmarkFile.empty())
+	{
+		return writeBenchmark(report);
+	}
 	return 0;
 }
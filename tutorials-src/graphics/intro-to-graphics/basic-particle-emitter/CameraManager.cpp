@@ -7,6 +7,7 @@
 glm::mat4 CameraManager::_proj;
 glm::mat4 CameraManager::_view;
 glm::vec4 CameraManager::_camPos;
+float CameraManager::_far;
 glm::vec2 CameraManager::_position;
 RenderObject* CameraManager::_skybox;
 
@@ -14,6 +15,7 @@ void CameraManager::Init(float aspectRatio, float fov, float near, float far)
 {
 	_proj = glm::perspectiveFov(fov, aspectRatio, 1.0f / aspectRatio, near, far);
 	_position = glm::vec2(0.0f, 0.0f);
+	_far = far;
 }
 
 void CameraManager::Update(float dt)
@@ -56,6 +58,12 @@ void CameraManager::Update(float dt)
 	}
 }
 
+void CameraManager::LookAt(const glm::vec3& eye, const glm::vec3& target)
+{
+	_camPos = glm::vec4(eye, 1.0f);
+	_view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
 void CameraManager::DumpData()
 {
 	
@@ -76,6 +84,11 @@ glm::vec4 CameraManager::CamPos()
 	return _camPos;
 }
 
+float CameraManager::FarPlane()
+{
+	return _far;
+}
+
 RenderObject* CameraManager::Skybox()
 {
 	return _skybox;
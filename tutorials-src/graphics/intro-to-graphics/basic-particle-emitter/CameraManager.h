@@ -10,16 +10,20 @@ class CameraManager
 public:
 	static void Init(float aspectRatio, float fov, float near, float far);
 	static void Update(float dt);
+	// Points the camera without touching input or gl, for running without a window
+	static void LookAt(const glm::vec3& eye, const glm::vec3& target);
 	static void DumpData(); 
 	static glm::mat4 ViewMat();
 	static glm::mat4 ProjMat();
 	static glm::vec4 CamPos();
+	static float FarPlane();
 	static RenderObject* Skybox();
 	static void Skybox(RenderObject* newSkybox);
 private:
 	static glm::mat4 _proj;
 	static glm::mat4 _view;
 	static glm::vec4 _camPos;
+	static float _far;
 
 	static glm::vec2 _position;
 
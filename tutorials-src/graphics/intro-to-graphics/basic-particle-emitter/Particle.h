@@ -0,0 +1,13 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+
+// Everything but velocity is uploaded to the gpu
+struct Particle
+{
+	glm::vec4 position_age;
+	glm::vec3 color;
+	float size;
+	glm::vec3 velocity;
+	// Layer of ResourceManager::spriteArray the particle is textured with
+	float layer;
+};
@@ -0,0 +1,180 @@
+#pragma once
+#include <tuple>
+#include <utility>
+#include <cmath>
+#include "Particle.h"
+
+// Affectors change a particle's velocity, color or size each step before it is moved.
+// Every affector has an Apply(Particle&, age, dt) where age runs from 0 when the particle is emitted
+// to 1 when it dies. They aren't virtual, a system's set of affectors is baked into one
+// AffectorKernel type so the compiler can inline the whole set into a single loop.
+
+// Constant acceleration, eg. gravity or wind
+struct Gravity
+{
+	glm::vec3 acceleration;
+
+	Gravity(const glm::vec3& accel) : acceleration(accel) {}
+
+	void Apply(Particle& p, float /*age*/, float dt) const
+	{
+		p.velocity += acceleration * dt;
+	}
+};
+
+// Slows particles down in proportion to their speed
+struct LinearDrag
+{
+	float coefficient;
+
+	LinearDrag(float drag) : coefficient(drag) {}
+
+	void Apply(Particle& p, float /*age*/, float dt) const
+	{
+		float factor = 1.0f - coefficient * dt;
+		p.velocity *= factor > 0.0f ? factor : 0.0f;
+	}
+};
+
+// Pulls particles toward a point with inverse square falloff, negative strength pushes them away
+struct Attractor
+{
+	glm::vec3 position;
+	float strength;
+	// Keeps the force finite for particles passing through the point
+	float minDistance;
+
+	Attractor(const glm::vec3& pos, float str, float minDist = 0.1f) : position(pos), strength(str), minDistance(minDist) {}
+
+	void Apply(Particle& p, float /*age*/, float dt) const
+	{
+		glm::vec3 toAttractor = position - glm::vec3(p.position_age);
+		float distSq = glm::dot(toAttractor, toAttractor);
+		float minDistSq = minDistance * minDistance;
+		distSq = distSq > minDistSq ? distSq : minDistSq;
+		p.velocity += toAttractor * (strength * dt / (distSq * std::sqrt(distSq)));
+	}
+};
+
+// Swirls particles around an axis through a point
+struct Vortex
+{
+	glm::vec3 center;
+	// Normalized, the swirl follows the right hand rule around it
+	glm::vec3 axis;
+	float strength;
+
+	Vortex(const glm::vec3& c, const glm::vec3& ax, float str) : center(c), axis(glm::normalize(ax)), strength(str) {}
+
+	void Apply(Particle& p, float /*age*/, float dt) const
+	{
+		p.velocity += glm::cross(axis, glm::vec3(p.position_age) - center) * (strength * dt);
+	}
+};
+
+// Turbulence from the curl of a smooth potential field. Curl fields have no divergence,
+// so particles swirl without bunching up or spreading out.
+struct CurlNoise
+{
+	// Higher frequencies give smaller eddies
+	float frequency;
+	float strength;
+
+	CurlNoise(float freq, float str) : frequency(freq), strength(str) {}
+
+	void Apply(Particle& p, float /*age*/, float dt) const
+	{
+		glm::vec3 x = glm::vec3(p.position_age) * frequency;
+
+		// The potential is psi = (sin(y)cos(1.3z), sin(z)cos(1.7x), sin(x)cos(1.1y)), its curl is worked out by hand here
+		float sx = std::sin(x.x), cx = std::cos(x.x);
+		float sy = std::sin(x.y), cy = std::cos(x.y);
+		float sz = std::sin(x.z), cz = std::cos(x.z);
+		float sx17 = std::sin(1.7f * x.x), cx17 = std::cos(1.7f * x.x);
+		float sy11 = std::sin(1.1f * x.y), cy11 = std::cos(1.1f * x.y);
+		float sz13 = std::sin(1.3f * x.z), cz13 = std::cos(1.3f * x.z);
+
+		glm::vec3 curl = glm::vec3(
+			-1.1f * sx * sy11 - cz * cx17,		// dPsiZ/dy - dPsiY/dz
+			-1.3f * sy * sz13 - cx * cy11,		// dPsiX/dz - dPsiZ/dx
+			-1.7f * sz * sx17 - cy * cz13);		// dPsiY/dx - dPsiX/dy
+
+		p.velocity += curl * (strength * dt);
+	}
+};
+
+// Blends the particle's color from start to end over its life
+struct ColorOverAge
+{
+	glm::vec3 start;
+	glm::vec3 end;
+
+	ColorOverAge(const glm::vec3& startColor, const glm::vec3& endColor) : start(startColor), end(endColor) {}
+
+	void Apply(Particle& p, float age, float /*dt*/) const
+	{
+		p.color = start + (end - start) * age;
+	}
+};
+
+// Blends the particle's size from start to end over its life
+struct SizeOverAge
+{
+	float start;
+	float end;
+
+	SizeOverAge(float startSize, float endSize) : start(startSize), end(endSize) {}
+
+	void Apply(Particle& p, float age, float /*dt*/) const
+	{
+		p.size = start + (end - start) * age;
+	}
+};
+
+// The one virtual call a system makes per step. Everything per particle happens inside Update.
+class ParticleKernel
+{
+public:
+	virtual ~ParticleKernel() {}
+	virtual void Update(Particle* particles, int numParticles, float lifetime, float dt) const = 0;
+};
+
+// Ages and moves every live particle, running each affector in the order they were given.
+// AffectorKernel<> with no affectors is plain ballistic motion.
+template <typename... Affectors>
+class AffectorKernel : public ParticleKernel
+{
+public:
+	AffectorKernel(const Affectors&... affectors) : _affectors(affectors...) {}
+
+	void Update(Particle* particles, int numParticles, float lifetime, float dt) const override
+	{
+		float invLifetime = 1.0f / lifetime;
+		for (int i = 0; i < numParticles; ++i)
+		{
+			Particle& p = particles[i];
+			if (p.position_age.w >= 0.0f && p.position_age.w < lifetime)
+			{
+				ApplyAll(p, p.position_age.w * invLifetime, dt, std::index_sequence_for<Affectors...>());
+				p.position_age += glm::vec4(p.velocity * dt, dt);
+			}
+			else if (p.position_age.w >= 0.0f)
+			{
+				p.position_age.w = -1.0f;
+			}
+		}
+	}
+private:
+	template <std::size_t... I>
+	void ApplyAll(Particle& p, float age, float dt, std::index_sequence<I...>) const
+	{
+		// Expands to one Apply call per affector, in order
+		int expand[] = { 0, (std::get<I>(_affectors).Apply(p, age, dt), 0)... };
+		// With no affectors, nothing uses them
+		(void)expand;
+		(void)age;
+		(void)dt;
+	}
+
+	std::tuple<Affectors...> _affectors;
+};
@@ -0,0 +1,108 @@
+#include "ParticleBenchmark.h"
+#include "ParticleManager.h"
+#include "CameraManager.h"
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+// Configurations past this many pooled particles in total are skipped
+const int MAX_TOTAL_PARTICLES = 4 * 1024 * 1024;
+const float STEP = 1.0f / 60.0f;
+const int TIMED_STEPS = 20;
+// Steps this long are used to get to a steady number of live particles quickly
+const float WARMUP_STEP = 0.25f;
+
+void NullUploadSink::Upload(ParticleBatch& batch)
+{
+	size_t floats = PARTICLE_VERTEX_FLOATS * batch.count;
+	if (_staging.size() < floats)
+	{
+		_staging.resize(floats);
+	}
+	memcpy(&_staging[0], &batch.vertices[0], sizeof(GLfloat) * floats);
+}
+
+void NullUploadSink::Release()
+{
+	_staging = std::vector<GLfloat>();
+}
+
+void ParticleBenchmark::Run()
+{
+	const int systemCounts[] = { 1, 16, 256 };
+	const int poolSizes[] = { 1024, 16384, 131072 };
+	const float frequencies[] = { 100.0f, 1000.0f, 10000.0f };
+	const float lifetimes[] = { 1.0f, 4.0f };
+
+	NullUploadSink sink;
+	CameraManager::LookAt(glm::vec3(0.0f, 0.0f, -8.0f), glm::vec3(0.0f, 0.0f, 0.0f));
+
+	std::cout << "systems, pool, frequency, lifetime, live, update ms/step, ns/particle/step, emit ns/particle, upload MB/step, est. GB/s" << std::endl;
+	for (int c = 0; c < 3; ++c)
+	{
+		for (int p = 0; p < 3; ++p)
+		{
+			if (systemCounts[c] * poolSizes[p] > MAX_TOTAL_PARTICLES)
+			{
+				continue;
+			}
+			for (int f = 0; f < 3; ++f)
+			{
+				for (int l = 0; l < 2; ++l)
+				{
+					ParticleManager::Init(ParticleRenderPath::InstancedQuads, &sink);
+
+					// Spread the systems over a square in front of the camera
+					int side = (int)std::ceil(std::sqrt((float)systemCounts[c]));
+					for (int i = 0; i < systemCounts[c]; ++i)
+					{
+						ParticleSystem* system = ParticleManager::Get(ParticleManager::InitParticleSystem(1, poolSizes[p]));
+						system->transform.position = glm::vec3((i % side) * 0.5f - side * 0.25f, (i / side) * 0.5f - side * 0.25f, 0.0f);
+						system->frequency = frequencies[f];
+						system->lifetime = lifetimes[l];
+						system->initialSpeed = 1.0f;
+						system->arc = 60;
+						ParticleManager::SetAffectors(system,
+							Gravity(glm::vec3(0.0f, -0.5f, 0.0f)),
+							LinearDrag(0.2f),
+							ColorOverAge(glm::vec3(1.0f, 0.9f, 0.2f), glm::vec3(0.8f, 0.1f, 0.0f)),
+							SizeOverAge(0.1f, 0.02f));
+					}
+
+					for (float t = 0.0f; t < lifetimes[l]; t += WARMUP_STEP)
+					{
+						ParticleManager::Update(WARMUP_STEP);
+					}
+
+					double updateTime = 0.0, emitTime = 0.0;
+					double live = 0.0, emitted = 0.0, stepped = 0.0, uploadBytes = 0.0;
+					for (int step = 0; step < TIMED_STEPS; ++step)
+					{
+						ParticleManager::Update(STEP);
+						const ParticleStats& stats = ParticleManager::Stats();
+						updateTime += stats.updateTime;
+						emitTime += stats.emitTime;
+						live += stats.liveParticles;
+						emitted += stats.emitted;
+						stepped += stats.steppedParticles;
+						uploadBytes += (double)stats.uploadBytes;
+					}
+
+					// Bytes Update has to move at least, the kernels read and write the whole pool, the sort reads each
+					// live particle and its order and key, and the upload is written once when gathered and read once by the sink
+					double bytes = stepped * sizeof(Particle) * 2.0 + live * (sizeof(Particle) + sizeof(GLuint) + sizeof(GLushort)) + uploadBytes * 2.0;
+
+					std::cout << systemCounts[c] << ", " << poolSizes[p] << ", " << frequencies[f] << ", " << lifetimes[l] << ", "
+						<< (int)(live / TIMED_STEPS) << ", "
+						<< updateTime / TIMED_STEPS << ", "
+						<< (live > 0.0 ? updateTime * 1000000.0 / live : 0.0) << ", "
+						<< (emitted > 0.0 ? emitTime * 1000000.0 / emitted : 0.0) << ", "
+						<< uploadBytes / TIMED_STEPS / (1024.0 * 1024.0) << ", "
+						<< (updateTime > 0.0 ? bytes / (updateTime / 1000.0) / 1e9 : 0.0) << std::endl;
+
+					ParticleManager::DumpData();
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "ParticleUploadSink.h"
+
+// Stands in for the gpu when benchmarking. Batches are copied into a staging buffer, as a driver would on upload,
+// and nothing is drawn, so no window or gl context is needed.
+class NullUploadSink : public ParticleUploadSink
+{
+public:
+	void Init(ParticleRenderPath) override {}
+	void CreateBatch(ParticleBatch&) override {}
+	void Upload(ParticleBatch& batch) override;
+	void Draw(const std::vector<ParticleBatch>&) override {}
+	void DestroyBatch(ParticleBatch&) override {}
+	void Release() override;
+private:
+	std::vector<GLfloat> _staging;
+};
+
+// Run with --benchmark. Drives ParticleManager::Update headless over a sweep of system counts, pool sizes,
+// emission frequencies and lifetimes, and prints the cost per particle per step, the cost of emission and
+// an estimate of the memory bandwidth Update reached.
+class ParticleBenchmark
+{
+public:
+	static void Run();
+};
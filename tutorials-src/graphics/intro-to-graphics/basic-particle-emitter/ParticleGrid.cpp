@@ -0,0 +1,130 @@
+#include "ParticleGrid.h"
+#include <thread>
+#include <algorithm>
+
+// Below this many particles the cost of starting threads outweighs the sort itself
+const int PARALLEL_THRESHOLD = 8192;
+const unsigned int MAX_THREADS = 8;
+
+// Splits [0, count) into one contiguous chunk per thread and runs func(thread, begin, end) on each
+template <typename Func>
+static void RunChunks(int count, unsigned int numThreads, Func func)
+{
+	if (numThreads == 1)
+	{
+		func(0, 0, count);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads - 1);
+	int chunk = (count + numThreads - 1) / numThreads;
+	for (unsigned int t = 1; t < numThreads; ++t)
+	{
+		int begin = std::min(count, (int)t * chunk);
+		int end = std::min(count, begin + chunk);
+		threads.push_back(std::thread(func, t, begin, end));
+	}
+	func(0, 0, std::min(count, chunk));
+
+	for (unsigned int t = 0; t < threads.size(); ++t)
+	{
+		threads[t].join();
+	}
+}
+
+ParticleGrid::ParticleGrid()
+{
+	_invCellSize = 1.0f;
+	_tableSize = 0;
+}
+
+void ParticleGrid::Build(const Particle* particles, int numParticles, float cellSize)
+{
+	_invCellSize = 1.0f / cellSize;
+
+	_live.clear();
+	for (int i = 0; i < numParticles; ++i)
+	{
+		if (particles[i].position_age.w >= 0.0f)
+		{
+			_live.push_back(i);
+		}
+	}
+	int count = (int)_live.size();
+
+	// Keep the table at least twice the particle count so most buckets hold a single cell
+	GLuint tableSize = 64;
+	while (tableSize < (GLuint)count * 2)
+	{
+		tableSize <<= 1;
+	}
+	_tableSize = tableSize;
+
+	unsigned int numThreads = 1;
+	if (count >= PARALLEL_THRESHOLD)
+	{
+		numThreads = std::max(1u, std::min(MAX_THREADS, std::thread::hardware_concurrency()));
+	}
+
+	_cellStart.assign(tableSize + 1, 0);
+	_indices.resize(count);
+	_positions.resize(count);
+	_cells.resize(count);
+	_buckets.resize(count);
+	_threadCounts.assign(tableSize * numThreads, 0);
+
+	// Count, each thread hashes its own chunk of particles into its own histogram
+	RunChunks(count, numThreads, [&](unsigned int thread, int begin, int end)
+	{
+		GLuint* counts = &_threadCounts[thread * tableSize];
+		for (int i = begin; i < end; ++i)
+		{
+			const glm::vec4& p = particles[_live[i]].position_age;
+			GLuint bucket = Hash((int)std::floor(p.x * _invCellSize), (int)std::floor(p.y * _invCellSize), (int)std::floor(p.z * _invCellSize));
+			_buckets[i] = bucket;
+			++counts[bucket];
+		}
+	});
+
+	// Prefix sum over buckets, and within each bucket over threads so every thread knows where its share goes.
+	// Chunks are in order, so the result is the same as a serial stable sort.
+	GLuint offset = 0;
+	for (GLuint bucket = 0; bucket < tableSize; ++bucket)
+	{
+		_cellStart[bucket] = offset;
+		for (unsigned int thread = 0; thread < numThreads; ++thread)
+		{
+			GLuint bucketCount = _threadCounts[thread * tableSize + bucket];
+			_threadCounts[thread * tableSize + bucket] = offset;
+			offset += bucketCount;
+		}
+	}
+	_cellStart[tableSize] = offset;
+
+	// Scatter
+	RunChunks(count, numThreads, [&](unsigned int thread, int begin, int end)
+	{
+		GLuint* offsets = &_threadCounts[thread * tableSize];
+		for (int i = begin; i < end; ++i)
+		{
+			GLuint destination = offsets[_buckets[i]]++;
+			const glm::vec4& p = particles[_live[i]].position_age;
+			_indices[destination] = _live[i];
+			_positions[destination] = glm::vec3(p);
+			_cells[destination].x = (int)std::floor(p.x * _invCellSize);
+			_cells[destination].y = (int)std::floor(p.y * _invCellSize);
+			_cells[destination].z = (int)std::floor(p.z * _invCellSize);
+		}
+	});
+}
+
+int ParticleGrid::Count() const
+{
+	return (int)_indices.size();
+}
+
+const std::vector<GLuint>& ParticleGrid::Indices() const
+{
+	return _indices;
+}
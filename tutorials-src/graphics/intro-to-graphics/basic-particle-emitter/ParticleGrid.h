@@ -0,0 +1,91 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <cmath>
+#include "Particle.h"
+
+// A uniform grid over the live particles of a system, hashed into a table so it doesn't need bounds.
+// It is rebuilt every step with a counting sort that groups particle indices by cell, after which finding
+// everything within a radius only looks at the handful of cells around it rather than every particle.
+class ParticleGrid
+{
+public:
+	ParticleGrid();
+
+	// Buckets every live particle. Queries are cheapest when cellSize is about the largest query radius.
+	void Build(const Particle* particles, int numParticles, float cellSize);
+
+	// Calls func(particleIndex, offset, distSq) for each live particle within radius of center,
+	// where offset is the particle's position minus center.
+	template <typename Func>
+	void ForEachInRadius(const glm::vec3& center, float radius, Func func) const
+	{
+		if (_cellStart.empty())
+		{
+			return;
+		}
+
+		float radiusSq = radius * radius;
+		int minX = (int)std::floor((center.x - radius) * _invCellSize), maxX = (int)std::floor((center.x + radius) * _invCellSize);
+		int minY = (int)std::floor((center.y - radius) * _invCellSize), maxY = (int)std::floor((center.y + radius) * _invCellSize);
+		int minZ = (int)std::floor((center.z - radius) * _invCellSize), maxZ = (int)std::floor((center.z + radius) * _invCellSize);
+
+		for (int z = minZ; z <= maxZ; ++z)
+		{
+			for (int y = minY; y <= maxY; ++y)
+			{
+				for (int x = minX; x <= maxX; ++x)
+				{
+					GLuint bucket = Hash(x, y, z);
+					GLuint end = _cellStart[bucket + 1];
+					for (GLuint i = _cellStart[bucket]; i < end; ++i)
+					{
+						// Other cells can hash to the same bucket, only take the ones that are really in this cell
+						// so that nothing is visited twice.
+						if (_cells[i].x != x || _cells[i].y != y || _cells[i].z != z)
+						{
+							continue;
+						}
+
+						glm::vec3 offset = _positions[i] - center;
+						float distSq = glm::dot(offset, offset);
+						if (distSq <= radiusSq)
+						{
+							func(_indices[i], offset, distSq);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Number of live particles in the grid, and the pool indices of them grouped by cell
+	int Count() const;
+	const std::vector<GLuint>& Indices() const;
+private:
+	struct Cell
+	{
+		int x, y, z;
+	};
+
+	GLuint Hash(int x, int y, int z) const
+	{
+		return ((GLuint)x * 73856093u ^ (GLuint)y * 19349663u ^ (GLuint)z * 83492791u) & (_tableSize - 1);
+	}
+
+	float _invCellSize;
+	GLuint _tableSize;
+
+	// Bucket b holds entries _cellStart[b] up to _cellStart[b + 1]
+	std::vector<GLuint> _cellStart;
+	// Sorted by bucket, positions and cells are copied alongside so queries read them contiguously
+	std::vector<GLuint> _indices;
+	std::vector<glm::vec3> _positions;
+	std::vector<Cell> _cells;
+
+	// Build scratch
+	std::vector<GLuint> _live;
+	std::vector<GLuint> _buckets;
+	std::vector<GLuint> _threadCounts;
+};
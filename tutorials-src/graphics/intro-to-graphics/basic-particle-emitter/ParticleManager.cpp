@@ -1,23 +1,81 @@
 #include "ParticleManager.h"
+#include "CameraManager.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <random>
 #include <glm/gtc/random.hpp>
 #include <iostream>
+#include <chrono>
+#include <queue>
 
-std::vector<ParticleSystem> ParticleManager::_pSystems;
+std::vector<ParticleManager::Slot> ParticleManager::_slots;
+std::vector<GLuint> ParticleManager::_freeSlots;
+std::vector<GLuint> ParticleManager::_active;
+ParticleSlab ParticleManager::_slab;
+std::vector<ParticleCollider> ParticleManager::_colliders;
+ParticleRenderPath ParticleManager::_renderPath;
+ParticleUploadSink* ParticleManager::_sink;
+GLParticleUploadSink ParticleManager::_glSink;
+ParticleStats ParticleManager::_stats;
+ParticleBudget ParticleManager::_budget;
+unsigned int ParticleManager::_budgetCursor;
+std::vector<ParticleBatch> ParticleManager::_batches;
 
-void ParticleManager::Init()
+// Grid cell size for systems that collide with the scene but don't interact with each other
+const float COLLISION_CELL_SIZE = 0.25f;
+
+// Longest step a system is given at once, time a far away or deferred system falls behind past this is dropped
+const float MAX_STEP = 0.25f;
+
+void ParticleManager::Init(ParticleRenderPath renderPath, ParticleUploadSink* sink)
 {
-	_pSystems = std::vector<ParticleSystem>();
+	_slots = std::vector<Slot>();
+	_freeSlots = std::vector<GLuint>();
+	_active = std::vector<GLuint>();
+	_colliders = std::vector<ParticleCollider>();
+	_stats = ParticleStats();
+	_renderPath = renderPath;
+	_budgetCursor = 0;
+	_batches = std::vector<ParticleBatch>();
+
+	// No limits until SetBudget is called
+	_budget = ParticleBudget();
+	_budget.maxStepInterval = 1;
+	_budget.minEmissionScale = 1.0f;
+	_budget.offscreen = ParticleCullMode::Simulate;
+
+	_sink = sink ? sink : &_glSink;
+	_sink->Init(_renderPath);
 }
 
 void ParticleManager::Update(float dt)
 {
 	Transform* transform;
-	unsigned int size = _pSystems.size();
+	glm::mat4 view = CameraManager::ViewMat();
+	float maxDepth = CameraManager::FarPlane();
+	glm::vec3 camPos = glm::vec3(CameraManager::CamPos());
+	glm::vec4 frustum[6];
+	FrustumPlanes(CameraManager::ProjMat() * view, frustum);
+
+	_stats = ParticleStats();
+	std::chrono::high_resolution_clock::time_point updateStart = std::chrono::high_resolution_clock::now();
+
+	// Particles already alive, emission stops once the budget is used up
+	int allowance = 0;
+	unsigned int size = _active.size();
 	for (unsigned int i = 0; i < size; ++i)
 	{
-		transform = &_pSystems[i].transform;
+		allowance -= _slots[_active[i]].system->sortData.count;
+	}
+	allowance += _budget.maxLiveParticles;
+
+	std::vector<GLuint> finished;
+	// Start somewhere different each frame so the same systems aren't always the ones pushed past the time budget
+	_budgetCursor = size > 0 ? (_budgetCursor + 1) % size : 0;
+	for (unsigned int n = 0; n < size; ++n)
+	{
+		unsigned int i = (n + _budgetCursor) % size;
+		ParticleSystem* system = _slots[_active[i]].system;
+		transform = &system->transform;
 		// Apply velocities
 		transform->position += transform->linearVelocity;
 		transform->rotation = glm::slerp(transform->rotation, transform->rotation * transform->angularVelocity, dt);
@@ -34,85 +92,346 @@ void ParticleManager::Update(float dt)
 		glm::mat4 scale = glm::scale(glm::mat4(), transform->scale);
 
 		transform->model = parentModel * (transform->translate * rotate * scale);
-		
-		ParticleSystem* system = &_pSystems[i];
-		system->timeSinceLastEmission += dt;
-
-		// Emit as many particles as need to be emitted based on the frequency of emission.
-		while (system->timeSinceLastEmission >= 1.0f / system->frequency)
-		{
-			system->particles[system->nextAvailableParticle].position_age = transform->model * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-			system->particles[system->nextAvailableParticle].position_age.w = 0.0f;
 
-			system->particles[system->nextAvailableParticle].color = glm::ballRand(0.5f) + glm::vec3(0.5f, 0.5f, 0.5f);
+		// Decide how often this system is stepped and how much it emits from how far away it is and whether it can be seen.
+		// Without a bound set, nothing can move further from the emitter than it is thrown in one lifetime.
+		glm::vec3 emitterPos = glm::vec3(transform->model[3]);
+		float bound = system->boundingRadius >= 0.0f ? system->boundingRadius : system->initialSpeed * system->lifetime + system->initialSize;
+		system->visible = InFrustum(frustum, emitterPos, bound);
 
-			// Find a random velocity vector within the cone created by the arc of emission attached to the emitter
-			float angle = (float)(rand() % system->arc * 1000) / 2000.0f;
-			float bearing = (float)(rand() % (int)(2000.0f * 3.1415926535f)) / 1000.0f;
-			glm::vec3 axis = glm::vec3(1.0f * cosf(bearing), 0.0f, 1.0f * sinf(bearing));
-			glm::vec4 direction = glm::vec4(0.0f, 1.0f, 0.0, 0.0f) * glm::mat4_cast(glm::angleAxis(angle, axis));
+		float lod = 0.0f;
+		if (_budget.lodFar > _budget.lodNear)
+		{
+			lod = glm::clamp((glm::length(emitterPos - camPos) - _budget.lodNear) / (_budget.lodFar - _budget.lodNear), 0.0f, 1.0f);
+		}
+		int interval = 1 + (int)(lod * (_budget.maxStepInterval - 1) + 0.5f);
+		float emissionScale = 1.0f + (_budget.minEmissionScale - 1.0f) * lod;
 
-			system->particles[system->nextAvailableParticle].velocity = glm::vec3(direction * transform->model * system->initialSpeed);
-			system->nextAvailableParticle = (system->nextAvailableParticle + 1) % system->numParticles;
+		if (!system->visible)
+		{
+			if (_budget.offscreen == ParticleCullMode::Freeze)
+			{
+				++_stats.frozenSystems;
+				_stats.liveParticles += system->sortData.count;
+				continue;
+			}
+			if (_budget.offscreen == ParticleCullMode::Coarse)
+			{
+				interval = _budget.maxStepInterval;
+				emissionScale = _budget.minEmissionScale;
+				++_stats.coarseSystems;
+			}
+		}
+		else
+		{
+			++_stats.visibleSystems;
+		}
+		if (interval > 1)
+		{
+			++_stats.lodSystems;
+		}
 
-			system->timeSinceLastEmission -= 1.0f / system->frequency;
+		// Time that hasn't been simulated yet is carried over to the system's next step
+		system->pendingTime += dt;
+		++system->framesSinceStep;
+		double simTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count();
+		bool overTime = _budget.maxSimTime > 0.0f && simTime > _budget.maxSimTime;
+		if (system->framesSinceStep < interval || overTime)
+		{
+			_stats.deferredSystems += overTime ? 1 : 0;
+			_stats.liveParticles += system->sortData.count;
+			continue;
 		}
+		float stepDt = system->pendingTime < MAX_STEP ? system->pendingTime : MAX_STEP;
+		system->pendingTime = 0.0f;
+		system->framesSinceStep = 0;
+
+		system->age += stepDt;
+		bool emitting = system->duration < 0.0f || system->age <= system->duration;
 
-		for (int i = 0; i < system->numParticles; ++i)
+		// Emit the burst, then as many particles as need to be emitted based on the frequency of emission.
+		int toEmit = system->burst;
+		system->burst = 0;
+		if (emitting && system->frequency > 0.0f)
 		{
-			if (system->particles[i].position_age.w >= 0.0f && system->particles[i].position_age.w < system->lifetime)
+			system->timeSinceLastEmission += stepDt * emissionScale;
+			while (system->timeSinceLastEmission >= 1.0f / system->frequency)
 			{
-				system->particles[i].position_age += glm::vec4(system->particles[i].velocity * dt, dt);
+				++toEmit;
+				system->timeSinceLastEmission -= 1.0f / system->frequency;
 			}
-			else if (system->particles[i].position_age.w > system->lifetime)
+		}
+		toEmit = toEmit < system->numParticles ? toEmit : system->numParticles;
+		if (_budget.maxLiveParticles > 0 && toEmit > allowance)
+		{
+			_stats.droppedEmissions += toEmit - (allowance > 0 ? allowance : 0);
+			toEmit = allowance > 0 ? allowance : 0;
+		}
+		allowance -= toEmit;
+		if (toEmit > 0)
+		{
+			std::chrono::high_resolution_clock::time_point emitStart = std::chrono::high_resolution_clock::now();
+			for (int j = 0; j < toEmit; ++j)
 			{
-				system->particles[i].position_age.w = -1.0f;
+				Emit(system);
 			}
+			_stats.emitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - emitStart).count();
+			_stats.emitted += toEmit;
+		}
+
+		system->kernel->Update(system->particles, system->numParticles, system->lifetime, stepDt);
+		_stats.steppedParticles += system->numParticles;
+
+		if (system->interactions.radius > 0.0f || system->interactions.collide)
+		{
+			std::chrono::high_resolution_clock::time_point interactStart = std::chrono::high_resolution_clock::now();
+			Interact(system, stepDt);
+			_stats.interactionTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - interactStart).count();
 		}
+		++_stats.steppedSystems;
+
+		// Blending with depth writes off only composites correctly if particles are drawn back to front
+		std::chrono::high_resolution_clock::time_point sortStart = std::chrono::high_resolution_clock::now();
+		SortPath sortPath = ParticleSorter::Sort(system->sortData, system->particles, system->numParticles, view, maxDepth);
+		_stats.sortTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sortStart).count();
+
+		_stats.liveParticles += system->sortData.count;
+		if (system->destroyWhenDone && !emitting && system->sortData.count == 0)
+		{
+			finished.push_back(_active[i]);
+			continue;
+		}
+		switch (sortPath)
+		{
+		case SortPath::None: ++_stats.unchangedSorts; break;
+		case SortPath::Insertion: ++_stats.insertionSorts; break;
+		case SortPath::Radix: ++_stats.radixSorts; break;
+		}
+	}
+
+	// Destroyed after the loop so _active isn't reordered under it
+	for (unsigned int i = 0; i < finished.size(); ++i)
+	{
+		Destroy(finished[i]);
+	}
+	_stats.liveSystems = _active.size();
+
+	BuildBatches();
+	_stats.updateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count();
+}
 
-		memcpy(system->particleBuffer, system->particles, sizeof(Particle) * system->numParticles);
+void ParticleManager::FrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6])
+{
+	// Each plane is the last row of the matrix plus or minus one of the others, normalized so distances come out in world units
+	glm::vec4 rowX = glm::vec4(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 rowY = glm::vec4(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 rowZ = glm::vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 rowW = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+	planes[0] = rowW + rowX;
+	planes[1] = rowW - rowX;
+	planes[2] = rowW + rowY;
+	planes[3] = rowW - rowY;
+	planes[4] = rowW + rowZ;
+	planes[5] = rowW - rowZ;
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
 
-		glBindVertexArray(system->vao);
-		glBindBuffer(GL_ARRAY_BUFFER, system->vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * system->numParticles, system->particleBuffer, GL_DYNAMIC_DRAW);
+bool ParticleManager::InFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+		{
+			return false;
+		}
 	}
+	return true;
+}
+
+void ParticleManager::Emit(ParticleSystem* system)
+{
+	Particle& particle = system->particles[system->nextAvailableParticle];
+	particle.position_age = system->transform.model * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	particle.position_age.w = 0.0f;
+
+	particle.color = glm::ballRand(0.5f) + glm::vec3(0.5f, 0.5f, 0.5f);
+	particle.size = system->initialSize;
+	particle.layer = (float)system->textureLayer;
+
+	// Find a random velocity vector within the cone created by the arc of emission attached to the emitter
+	float angle = (float)(rand() % system->arc * 1000) / 2000.0f;
+	float bearing = (float)(rand() % (int)(2000.0f * 3.1415926535f)) / 1000.0f;
+	glm::vec3 axis = glm::vec3(1.0f * cosf(bearing), 0.0f, 1.0f * sinf(bearing));
+	glm::vec4 direction = glm::vec4(0.0f, 1.0f, 0.0, 0.0f) * glm::mat4_cast(glm::angleAxis(angle, axis));
+
+	particle.velocity = glm::vec3(direction * system->transform.model * system->initialSpeed);
+	system->nextAvailableParticle = (system->nextAvailableParticle + 1) % system->numParticles;
 }
 
 void ParticleManager::Draw()
 {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(GL_FALSE);
-	unsigned int size = _pSystems.size();
+	_sink->Draw(_batches);
+}
+
+void ParticleManager::BuildBatches()
+{
+	_stats.drawCalls = 0;
+	unsigned int numBatches = _batches.size();
+	for (unsigned int b = 0; b < numBatches; ++b)
+	{
+		_batches[b].count = 0;
+	}
+
+	// Group the visible systems by shader, making batches for shaders that haven't been seen before
+	std::vector<std::vector<ParticleSystem*>> batchSystems(_batches.size());
+	unsigned int size = _active.size();
 	for (unsigned int i = 0; i < size; ++i)
 	{
-		glUseProgram(_pSystems[i].shader);
-		glBindVertexArray(_pSystems[i].vao);
-		glBindTexture(GL_TEXTURE_2D, _pSystems[i].texture);
-		glDrawArrays(GL_POINTS, 0, _pSystems[i].numParticles);
+		ParticleSystem* system = _slots[_active[i]].system;
+		if (!system->visible || system->sortData.count == 0)
+		{
+			continue;
+		}
+		unsigned int b = GetBatch(system->shader);
+		if (b >= batchSystems.size())
+		{
+			batchSystems.resize(b + 1);
+		}
+		batchSystems[b].push_back(system);
+	}
+
+	for (unsigned int b = 0; b < batchSystems.size(); ++b)
+	{
+		ParticleBatch& batch = _batches[b];
+		const std::vector<ParticleSystem*>& systems = batchSystems[b];
+		int total = 0;
+		for (unsigned int i = 0; i < systems.size(); ++i)
+		{
+			total += systems[i]->sortData.count;
+		}
+		if (total == 0)
+		{
+			continue;
+		}
+		batch.vertices.resize(total * PARTICLE_VERTEX_FLOATS);
+
+		// Each system's order is already back to front, and every system's keys are quantized the same way from the same camera,
+		// so merging the orders gives back to front across the whole batch. The heap holds each system's nearest unmerged particle.
+		typedef std::pair<GLushort, unsigned int> Head;
+		std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+		std::vector<int> next(systems.size(), 0);
+		for (unsigned int i = 0; i < systems.size(); ++i)
+		{
+			heads.push(Head(systems[i]->sortData.keys[0], i));
+		}
+
+		GLfloat* vertex = &batch.vertices[0];
+		while (!heads.empty())
+		{
+			unsigned int i = heads.top().second;
+			heads.pop();
+			const ParticleSortData& sortData = systems[i]->sortData;
+			// The system at the top of the heap keeps it until one of its particles is nearer than another system's
+			int end = next[i];
+			GLushort limit = heads.empty() ? 0xFFFF : heads.top().first;
+			do
+			{
+				const Particle& p = systems[i]->particles[sortData.order[end]];
+				memcpy(vertex, &p, sizeof(GLfloat) * 8);
+				vertex[8] = p.layer;
+				vertex += PARTICLE_VERTEX_FLOATS;
+				++end;
+			} while (end < sortData.count && sortData.keys[end] <= limit);
+
+			next[i] = end;
+			if (end < sortData.count)
+			{
+				heads.push(Head(sortData.keys[end], i));
+			}
+		}
+
+		batch.count = total;
+		_sink->Upload(batch);
+		_stats.uploadBytes += sizeof(GLfloat) * PARTICLE_VERTEX_FLOATS * total;
+		++_stats.drawCalls;
 	}
-	glDisable(GL_BLEND);
-	glDepthMask(GL_TRUE);
 }
 
-void ParticleManager::DumpData()
+unsigned int ParticleManager::GetBatch(GLint shader)
 {
-	unsigned int size = _pSystems.size();
+	unsigned int size = _batches.size();
 	for (unsigned int i = 0; i < size; ++i)
 	{
-		glDeleteBuffers(1, &_pSystems[i].vbo);
-		glDeleteVertexArrays(1, &_pSystems[i].vao);
-		delete[] _pSystems[i].particles;
-		delete[] _pSystems[i].particleBuffer;
+		if (_batches[i].shader == shader)
+		{
+			return i;
+		}
+	}
+
+	ParticleBatch batch;
+	batch.shader = shader;
+	batch.vao = 0;
+	batch.vbo = 0;
+	batch.count = 0;
+	_sink->CreateBatch(batch);
+
+	_batches.push_back(batch);
+	return size;
+}
+
+void ParticleManager::DumpData()
+{
+	while (!_active.empty())
+	{
+		Destroy(_active.back());
+	}
+	for (unsigned int i = 0; i < _slots.size(); ++i)
+	{
+		delete _slots[i].system->grid;
+		delete _slots[i].system;
+	}
+	_slots.clear();
+	_freeSlots.clear();
+	_slab.Release();
+
+	for (unsigned int i = 0; i < _batches.size(); ++i)
+	{
+		_sink->DestroyBatch(_batches[i]);
 	}
+	_batches.clear();
+	_sink->Release();
 }
 
-ParticleSystem* ParticleManager::InitParticleSystem(GLint shader, int numParticles)
+ParticleSystemHandle ParticleManager::InitParticleSystem(GLint shader, int numParticles)
 {
-	unsigned int index = _pSystems.size();
-	_pSystems.push_back(ParticleSystem());
+	// Reuse a destroyed system's slot, and with it its grid, before making a new one
+	GLuint index;
+	if (!_freeSlots.empty())
+	{
+		index = _freeSlots.back();
+		_freeSlots.pop_back();
+	}
+	else
+	{
+		index = _slots.size();
+		Slot slot;
+		slot.system = new ParticleSystem();
+		slot.system->grid = nullptr;
+		slot.generation = 0;
+		slot.alive = false;
+		slot.activeIndex = 0;
+		_slots.push_back(slot);
+	}
+
+	Slot& slot = _slots[index];
+	slot.alive = true;
+	slot.activeIndex = _active.size();
+	_active.push_back(index);
 
-	ParticleSystem* system = &_pSystems[index];
+	ParticleSystem* system = slot.system;
 
 	system->transform = Transform();
 	system->transform.position = glm::vec3();
@@ -131,34 +450,232 @@ ParticleSystem* ParticleManager::InitParticleSystem(GLint shader, int numParticl
 	system->lifetime = 0.0f;
 	system->arc = 0;
 	system->numParticles = numParticles;
-	system->texture = 0;
+	system->textureLayer = 0;
 	system->nextAvailableParticle = 0;
-	
-	system->particles = new Particle[numParticles];
+	system->frequency = 0.0f;
+	system->initialSpeed = 0.0f;
+	system->initialSize = 0.1f;
+	system->burst = 0;
+	system->duration = -1.0f;
+	system->destroyWhenDone = false;
+	system->age = 0.0f;
+	system->boundingRadius = -1.0f;
+	system->pendingTime = 0.0f;
+	system->framesSinceStep = 0;
+	system->visible = true;
+	system->kernel = new AffectorKernel<>();
+	system->interactions = ParticleInteractions();
+	system->densities = nullptr;
+
+	system->particles = (Particle*)_slab.Alloc(sizeof(Particle) * numParticles);
 	for (int i = 0; i < numParticles; ++i)
 	{
 		system->particles[i].position_age = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+		system->particles[i].color = glm::vec3();
+		system->particles[i].size = 0.0f;
 		system->particles[i].velocity = glm::vec3();
+		system->particles[i].layer = 0.0f;
+	}
+
+	ParticleSorter::Alloc(system->sortData, numParticles, _slab);
+
+	// The batch for the shader is made now so the first update doesn't have to
+	GetBatch(shader);
+
+	ParticleSystemHandle handle;
+	handle.index = index;
+	handle.generation = slot.generation;
+	return handle;
+}
+
+ParticleSystemHandle ParticleManager::InitOneShot(GLint shader, int numParticles, const glm::vec3& position)
+{
+	ParticleSystemHandle handle = InitParticleSystem(shader, numParticles);
+	ParticleSystem* system = Get(handle);
+	system->transform.position = position;
+	system->burst = numParticles;
+	system->duration = 0.0f;
+	system->destroyWhenDone = true;
+	return handle;
+}
+
+void ParticleManager::DestroyParticleSystem(ParticleSystemHandle handle)
+{
+	if (Get(handle))
+	{
+		Destroy(handle.index);
+	}
+}
+
+ParticleSystem* ParticleManager::Get(ParticleSystemHandle handle)
+{
+	if (handle.index >= _slots.size() || !_slots[handle.index].alive || _slots[handle.index].generation != handle.generation)
+	{
+		return nullptr;
+	}
+	return _slots[handle.index].system;
+}
+
+void ParticleManager::Destroy(GLuint index)
+{
+	Slot& slot = _slots[index];
+	ParticleSystem* system = slot.system;
+
+	_slab.Free(system->particles, sizeof(Particle) * system->numParticles);
+	_slab.Free(system->densities, sizeof(float) * system->numParticles);
+	ParticleSorter::Release(system->sortData, _slab);
+	delete system->kernel;
+	system->kernel = nullptr;
+
+	// Fill the gap in the active list with the last active system
+	GLuint last = _active.back();
+	_active[slot.activeIndex] = last;
+	_slots[last].activeIndex = slot.activeIndex;
+	_active.pop_back();
+
+	slot.alive = false;
+	++slot.generation;
+	_freeSlots.push_back(index);
+}
+
+void ParticleManager::AddCollider(RenderObject* object, float radius)
+{
+	ParticleCollider collider;
+	collider.object = object;
+	collider.radius = radius;
+	_colliders.push_back(collider);
+}
+
+void ParticleManager::Interact(ParticleSystem* system, float dt)
+{
+	const ParticleInteractions& settings = system->interactions;
+	Particle* particles = system->particles;
+
+	if (!system->grid)
+	{
+		system->grid = new ParticleGrid();
+	}
+	if (!system->densities)
+	{
+		system->densities = (float*)_slab.Alloc(sizeof(float) * system->numParticles);
+	}
+	ParticleGrid& grid = *system->grid;
+	grid.Build(particles, system->numParticles, settings.radius > 0.0f ? settings.radius : COLLISION_CELL_SIZE);
+
+	const std::vector<GLuint>& live = grid.Indices();
+	int count = grid.Count();
+
+	if (settings.radius > 0.0f)
+	{
+		float h = settings.radius;
+		float hSq = h * h;
+		// Normalization constants for the poly6 density kernel and the gradient of the spiky pressure kernel
+		float poly6 = 315.0f / (64.0f * 3.1415926535f * powf(h, 9.0f));
+		float spikyGrad = -45.0f / (3.1415926535f * powf(h, 6.0f));
+
+		// Walking the live list in grid order means neighbouring queries touch the same cells one after another
+		if (settings.stiffness > 0.0f)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				GLuint index = live[i];
+				float density = 0.0f;
+				grid.ForEachInRadius(glm::vec3(particles[index].position_age), h, [&](GLuint, const glm::vec3&, float distSq)
+				{
+					float w = hSq - distSq;
+					density += w * w * w;
+				});
+				system->densities[index] = density * poly6;
+			}
+		}
+
+		// Velocities are only written here and positions and densities only read, so the visiting order doesn't matter
+		for (int i = 0; i < count; ++i)
+		{
+			GLuint index = live[i];
+			Particle& p = particles[index];
+			float pressure = settings.stiffness > 0.0f ? settings.stiffness * (system->densities[index] - settings.restDensity) : 0.0f;
+			glm::vec3 push = glm::vec3();
+			grid.ForEachInRadius(glm::vec3(p.position_age), h, [&](GLuint other, const glm::vec3& offset, float distSq)
+			{
+				if (other == index || distSq <= 0.0f)
+				{
+					return;
+				}
+				float dist = sqrtf(distSq);
+				// offset points from this particle toward the other, so pushing is along -offset
+				glm::vec3 away = offset / -dist;
+
+				push += away * (settings.separation * (1.0f - dist / h));
+
+				if (settings.stiffness > 0.0f)
+				{
+					float otherPressure = settings.stiffness * (system->densities[other] - settings.restDensity);
+					float sharedPressure = (pressure + otherPressure) * 0.5f;
+					if (sharedPressure > 0.0f)
+					{
+						float falloff = h - dist;
+						push -= away * (spikyGrad * falloff * falloff * sharedPressure / system->densities[other]);
+					}
+				}
+			});
+			p.velocity += push * dt;
+		}
+	}
+
+	if (settings.collide)
+	{
+		unsigned int numColliders = _colliders.size();
+		for (unsigned int c = 0; c < numColliders; ++c)
+		{
+			const glm::mat4& model = _colliders[c].object->transform().model;
+			glm::vec3 center = glm::vec3(model * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+			float radius = _colliders[c].radius * scale;
+
+			// Only the cells the sphere overlaps are searched
+			grid.ForEachInRadius(center, radius, [&](GLuint index, const glm::vec3& offset, float distSq)
+			{
+				Particle& p = particles[index];
+				float dist = sqrtf(distSq);
+				glm::vec3 normal = dist > 0.0f ? offset / dist : glm::vec3(0.0f, 1.0f, 0.0f);
+
+				// Put the particle back on the surface and reflect the part of its velocity heading inward
+				glm::vec3 surface = center + normal * radius;
+				p.position_age = glm::vec4(surface, p.position_age.w);
+				float inward = glm::dot(p.velocity, normal);
+				if (inward < 0.0f)
+				{
+					p.velocity -= normal * (inward * (1.0f + settings.restitution));
+				}
+			});
+		}
 	}
+}
 
-	system->particleBuffer = new GLubyte[sizeof(Particle) * numParticles];
-	memcpy(system->particleBuffer, system->particles, sizeof(Particle) * numParticles);
+ParticleRenderPath ParticleManager::RenderPath()
+{
+	return _renderPath;
+}
 
-	glGenVertexArrays(1, &system->vao);
-	glBindVertexArray(system->vao);
+const ParticleStats& ParticleManager::Stats()
+{
+	return _stats;
+}
 
-	glGenBuffers(1, &system->vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, system->vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * numParticles, system->particleBuffer, GL_DYNAMIC_DRAW);
-	
-	GLuint pos_ageAttrib = glGetAttribLocation(shader, "position_age");
-	glEnableVertexAttribArray(pos_ageAttrib);
-	glVertexAttribPointer(pos_ageAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), 0);
+void ParticleManager::SetBudget(const ParticleBudget& budget)
+{
+	_budget = budget;
+	_budget.maxStepInterval = _budget.maxStepInterval > 1 ? _budget.maxStepInterval : 1;
+}
 
-	GLuint colorAttrib = glGetAttribLocation(shader, "color");
-	glEnableVertexAttribArray(colorAttrib);
-	glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(sizeof(GLfloat) * 4));
-	
-	return system;
+const ParticleBudget& ParticleManager::Budget()
+{
+	return _budget;
+}
+
+const ParticleSlab& ParticleManager::Slab()
+{
+	return _slab;
 }
 
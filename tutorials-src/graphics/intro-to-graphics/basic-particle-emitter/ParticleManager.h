@@ -2,25 +2,94 @@
 #include <vector>
 
 #include "RenderObject.h"
+#include "Particle.h"
+#include "ParticleSorter.h"
+#include "ParticleAffectors.h"
+#include "ParticleGrid.h"
+#include "ParticleSlab.h"
+#include "ParticleUploadSink.h"
 
-struct Particle
+// How the particles of a system interact with each other and with the scene. Everything is off when zeroed.
+struct ParticleInteractions
 {
-	glm::vec4 position_age;
-	glm::vec3 color;
-	glm::vec3 velocity;
+	// Particles closer than this push on each other, it is also the cell size of the system's grid
+	float radius;
+	// How hard overlapping particles are pushed apart
+	float separation;
+	// SPH style pressure, particles packed denser than restDensity are pushed apart in proportion to stiffness
+	float stiffness;
+	float restDensity;
+	// Whether particles bounce off the colliders added with ParticleManager::AddCollider
+	bool collide;
+	// Fraction of the speed into a collider that is kept when bouncing off it
+	float restitution;
+};
+
+// What happens to systems whose bounds are outside the view frustum
+enum class ParticleCullMode
+{
+	// Stepped like any other system
+	Simulate,
+	// Stepped as if they were at the far LOD distance
+	Coarse,
+	// Not stepped or emitting at all until they come back into view
+	Freeze
+};
+
+// Limits on the cost of all particle systems together, see ParticleManager::SetBudget.
+// Systems are also always skipped by Draw while they are outside the view frustum.
+struct ParticleBudget
+{
+	// No more particles are emitted while this many are alive, 0 for no limit
+	int maxLiveParticles;
+	// Milliseconds of Update per frame after which the remaining systems wait for the next frame, 0 for no limit
+	float maxSimTime;
+	// Distances from the camera to the emitter between which systems fade from full detail to the coarsest.
+	// LOD is off when lodFar isn't past lodNear.
+	float lodNear;
+	float lodFar;
+	// At lodFar a system is stepped once every maxStepInterval frames, with the time of all of them,
+	// and emits minEmissionScale as many particles
+	int maxStepInterval;
+	float minEmissionScale;
+	ParticleCullMode offscreen;
+};
+
+// A RenderObject particles bounce off, approximated by a sphere around its origin
+struct ParticleCollider
+{
+	RenderObject* object;
+	// Before the object's scale is applied
+	float radius;
+};
+
+// Refers to a particle system without pointing into the manager's storage. Once the system is destroyed its slot
+// is reused with a new generation, so an old handle just stops resolving instead of pointing at someone else's system.
+struct ParticleSystemHandle
+{
+	GLuint index;
+	GLuint generation;
 };
 
 struct ParticleSystem
 {
-	GLuint vao;
-	GLuint vbo;
 	Transform transform;
-	GLuint texture;
+	// Layer of ResourceManager::spriteArray given to the particles this system emits
+	GLuint textureLayer;
+	// Systems with the same shader are drawn together in one batch
 	GLint shader;
+	// From the manager's slab
 	Particle* particles;
-	GLubyte* particleBuffer;
 	float timeSinceLastEmission;
 	int nextAvailableParticle;
+	// Moves the particles each step, set with ParticleManager::SetAffectors
+	ParticleKernel* kernel;
+	ParticleInteractions interactions;
+	// Only created once the system has interactions, and kept with the system's slot for the next system created in it
+	ParticleGrid* grid;
+	float* densities;
+	// Draw order of the live particles, kept back to front for blending
+	ParticleSortData sortData;
 
 	int numParticles; 
 	// Length of time before the particle disappears
@@ -31,16 +100,122 @@ struct ParticleSystem
 	float frequency;
 	// The speed of a particle when it is emitted
 	float initialSpeed;
+	// The size of a particle when it is emitted
+	float initialSize;
+	// Number of particles emitted all at once on the system's first update
+	int burst;
+	// Seconds the system keeps emitting for, negative emits forever
+	float duration;
+	// Destroy the system once it has stopped emitting and its last particle has died
+	bool destroyWhenDone;
+	// Seconds since the system was created
+	float age;
+	// How far particles get from the emitter, for frustum tests. Negative estimates it from speed and lifetime.
+	float boundingRadius;
+	// Budget bookkeeping, time not simulated yet and frames since the system was last stepped
+	float pendingTime;
+	int framesSinceStep;
+	// Whether the system's bounds were in the view frustum on the latest update
+	bool visible;
+};
+
+// Timings and counts from the most recent call to ParticleManager::Update
+struct ParticleStats
+{
+	int liveSystems;
+	int liveParticles;
+	int unchangedSorts;
+	int insertionSorts;
+	int radixSorts;
+	// Time spent depth sorting all systems, in milliseconds
+	double sortTime;
+	// Time spent building grids and resolving interactions and collisions, in milliseconds
+	double interactionTime;
+	// The whole of Update, in milliseconds
+	double updateTime;
+	// Time spent emitting new particles, in milliseconds, and how many were emitted
+	double emitTime;
+	int emitted;
+	// Pool entries the affector kernels ran over, live or not
+	int steppedParticles;
+	// One per shader with anything visible to draw, and the vertex data sent to the upload sink for them
+	int drawCalls;
+	size_t uploadBytes;
+
+	// Budget decisions. Systems inside the frustum, outside it and coarsely stepped or frozen,
+	// stepped less than every frame because of distance, and put off because the frame ran out of time.
+	int visibleSystems;
+	int coarseSystems;
+	int frozenSystems;
+	int lodSystems;
+	int deferredSystems;
+	int steppedSystems;
+	// Particles that would have been emitted but for maxLiveParticles
+	int droppedEmissions;
 };
 
 class ParticleManager
 {
 public:
-	static void Init();
+	// Batches go to sink, or are drawn with gl if it is nullptr. The sink must outlive the manager's data.
+	static void Init(ParticleRenderPath renderPath = ParticleRenderPath::GeometryShader, ParticleUploadSink* sink = nullptr);
 	static void Update(float dt);
 	static void Draw();
 	static void DumpData();
-	static ParticleSystem* InitParticleSystem(GLint shader, int numParticles);
+	static ParticleSystemHandle InitParticleSystem(GLint shader, int numParticles);
+	// A system that emits all of its particles at position on its first update and destroys itself once they have all died.
+	// Set its lifetime, speed, texture layer and so on through Get before the next update.
+	static ParticleSystemHandle InitOneShot(GLint shader, int numParticles, const glm::vec3& position);
+	static void DestroyParticleSystem(ParticleSystemHandle handle);
+	// nullptr if the system has been destroyed. The pointer is only good until the system is destroyed.
+	static ParticleSystem* Get(ParticleSystemHandle handle);
+	static const ParticleStats& Stats();
+	static const ParticleSlab& Slab();
+	static void SetBudget(const ParticleBudget& budget);
+	static const ParticleBudget& Budget();
+	static void AddCollider(RenderObject* object, float radius);
+	static ParticleRenderPath RenderPath();
+
+	// Replaces the system's affectors, eg. SetAffectors(system, Gravity(glm::vec3(0.0f, -1.0f, 0.0f)), LinearDrag(0.5f)).
+	// Each combination of affector types becomes its own update loop with the affectors inlined.
+	template <typename... Affectors>
+	static void SetAffectors(ParticleSystem* system, const Affectors&... affectors)
+	{
+		delete system->kernel;
+		system->kernel = new AffectorKernel<Affectors...>(affectors...);
+	}
 private:
-	static std::vector<ParticleSystem> _pSystems;
+	struct Slot
+	{
+		// Allocated the first time the slot is used and kept until DumpData
+		ParticleSystem* system;
+		GLuint generation;
+		bool alive;
+		// Where this slot is in _active
+		GLuint activeIndex;
+	};
+
+	static void Emit(ParticleSystem* system);
+	static void Interact(ParticleSystem* system, float dt);
+	static void BuildBatches();
+	// Index of the shader's batch in _batches
+	static unsigned int GetBatch(GLint shader);
+	static void Destroy(GLuint slot);
+	static void FrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]);
+	static bool InFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius);
+
+	static std::vector<Slot> _slots;
+	static std::vector<GLuint> _freeSlots;
+	// Slots of the systems that are alive, in creation order but for systems swapped in to fill the gap left by a destroyed one
+	static std::vector<GLuint> _active;
+	static ParticleSlab _slab;
+	static std::vector<ParticleCollider> _colliders;
+	static ParticleRenderPath _renderPath;
+	static std::vector<ParticleBatch> _batches;
+	static ParticleUploadSink* _sink;
+	static GLParticleUploadSink _glSink;
+	static ParticleStats _stats;
+	static ParticleBudget _budget;
+	// Where in _active the latest update started
+	static unsigned int _budgetCursor;
 };
\ No newline at end of file
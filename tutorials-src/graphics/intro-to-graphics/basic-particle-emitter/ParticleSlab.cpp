@@ -0,0 +1,84 @@
+#include "ParticleSlab.h"
+
+// Smallest block handed out, smaller requests share this class
+const size_t MIN_BLOCK = 256;
+// Small classes are carved out of slabs of this size, larger blocks get a slab of their own
+const size_t SLAB_SIZE = 256 * 1024;
+
+ParticleSlab::ParticleSlab()
+{
+	_reserved = 0;
+	_inUse = 0;
+}
+
+int ParticleSlab::SizeClass(size_t bytes)
+{
+	int sizeClass = 0;
+	while ((MIN_BLOCK << sizeClass) < bytes)
+	{
+		++sizeClass;
+	}
+	return sizeClass;
+}
+
+void* ParticleSlab::Alloc(size_t bytes)
+{
+	int sizeClass = SizeClass(bytes);
+	size_t blockSize = MIN_BLOCK << sizeClass;
+	if ((int)_freeLists.size() <= sizeClass)
+	{
+		_freeLists.resize(sizeClass + 1);
+	}
+
+	std::vector<void*>& freeList = _freeLists[sizeClass];
+	if (freeList.empty())
+	{
+		// Carve a new slab into as many blocks of this class as fit
+		size_t slabSize = blockSize > SLAB_SIZE ? blockSize : SLAB_SIZE;
+		GLubyte* slab = new GLubyte[slabSize];
+		_slabs.push_back(slab);
+		_reserved += slabSize;
+		for (size_t offset = slabSize; offset >= blockSize; offset -= blockSize)
+		{
+			freeList.push_back(slab + offset - blockSize);
+		}
+	}
+
+	void* block = freeList.back();
+	freeList.pop_back();
+	_inUse += blockSize;
+	return block;
+}
+
+void ParticleSlab::Free(void* block, size_t bytes)
+{
+	if (!block)
+	{
+		return;
+	}
+	int sizeClass = SizeClass(bytes);
+	_freeLists[sizeClass].push_back(block);
+	_inUse -= MIN_BLOCK << sizeClass;
+}
+
+void ParticleSlab::Release()
+{
+	for (unsigned int i = 0; i < _slabs.size(); ++i)
+	{
+		delete[] _slabs[i];
+	}
+	_slabs.clear();
+	_freeLists.clear();
+	_reserved = 0;
+	_inUse = 0;
+}
+
+size_t ParticleSlab::Reserved() const
+{
+	return _reserved;
+}
+
+size_t ParticleSlab::InUse() const
+{
+	return _inUse;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <cstddef>
+
+// Hands out the per particle arrays of every system from a few large slabs instead of the heap.
+// Requests are rounded up to a power of two size class, and freed blocks go on that class's free list,
+// so once the effects in a scene have warmed up, creating and destroying systems doesn't allocate at all.
+class ParticleSlab
+{
+public:
+	ParticleSlab();
+
+	void* Alloc(size_t bytes);
+	// bytes must be the same as was passed to Alloc
+	void Free(void* block, size_t bytes);
+	// Returns every slab to the heap, any block still in use is invalid after this
+	void Release();
+
+	// Bytes taken from the heap and bytes currently handed out
+	size_t Reserved() const;
+	size_t InUse() const;
+private:
+	static int SizeClass(size_t bytes);
+
+	// Index i holds free blocks of MIN_BLOCK << i bytes
+	std::vector<std::vector<void*>> _freeLists;
+	std::vector<GLubyte*> _slabs;
+	size_t _reserved;
+	size_t _inUse;
+};
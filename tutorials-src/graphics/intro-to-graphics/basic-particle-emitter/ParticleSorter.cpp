@@ -0,0 +1,166 @@
+#include "ParticleSorter.h"
+#include <utility>
+
+// Number of distinct depth values a key can take
+const float MAX_KEY = 65535.0f;
+
+void ParticleSorter::Alloc(ParticleSortData& data, int numParticles, ParticleSlab& slab)
+{
+	data.order = (GLuint*)slab.Alloc(sizeof(GLuint) * numParticles);
+	data.orderScratch = (GLuint*)slab.Alloc(sizeof(GLuint) * numParticles);
+	data.keys = (GLushort*)slab.Alloc(sizeof(GLushort) * numParticles);
+	data.keyScratch = (GLushort*)slab.Alloc(sizeof(GLushort) * numParticles);
+	data.listed = (GLubyte*)slab.Alloc(numParticles);
+	memset(data.listed, 0, numParticles);
+	data.count = 0;
+	data.capacity = numParticles;
+}
+
+void ParticleSorter::Release(ParticleSortData& data, ParticleSlab& slab)
+{
+	slab.Free(data.order, sizeof(GLuint) * data.capacity);
+	slab.Free(data.orderScratch, sizeof(GLuint) * data.capacity);
+	slab.Free(data.keys, sizeof(GLushort) * data.capacity);
+	slab.Free(data.keyScratch, sizeof(GLushort) * data.capacity);
+	slab.Free(data.listed, data.capacity);
+	data.count = 0;
+	data.capacity = 0;
+}
+
+SortPath ParticleSorter::Sort(ParticleSortData& data, const Particle* particles, int numParticles, const glm::mat4& view, float maxDepth)
+{
+	// Drop particles that died since last frame but keep the survivors in last frame's order,
+	// that order is what makes this frame cheap to sort.
+	int count = 0;
+	for (int i = 0; i < data.count; ++i)
+	{
+		GLuint index = data.order[i];
+		if (particles[index].position_age.w >= 0.0f)
+		{
+			data.order[count++] = index;
+		}
+		else
+		{
+			data.listed[index] = 0;
+		}
+	}
+
+	// Append anything emitted since last frame
+	for (int i = 0; i < numParticles; ++i)
+	{
+		if (!data.listed[i] && particles[i].position_age.w >= 0.0f)
+		{
+			data.order[count++] = i;
+			data.listed[i] = 1;
+		}
+	}
+	data.count = count;
+
+	// Only the z row of the view matrix is needed to get view depth
+	glm::vec4 depthRow = glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+	float keyScale = MAX_KEY / maxDepth;
+
+	// Farther particles get smaller keys so ascending order is back to front.
+	// Count how many neighbours are out of order while we're here.
+	int descents = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const glm::vec4& p = particles[data.order[i]].position_age;
+		float depth = -(depthRow.x * p.x + depthRow.y * p.y + depthRow.z * p.z + depthRow.w);
+		float key = MAX_KEY - depth * keyScale;
+		key = key < 0.0f ? 0.0f : key;
+		key = key > MAX_KEY ? MAX_KEY : key;
+		data.keys[i] = (GLushort)key;
+
+		if (i > 0 && data.keys[i - 1] > data.keys[i])
+		{
+			++descents;
+		}
+	}
+
+	if (descents == 0)
+	{
+		return SortPath::None;
+	}
+
+	// A few particles drifted past their neighbours, which is the common case from one frame to the next.
+	// Insertion sort is linear in that case, but give up if it turns out to be doing too much work.
+	if (descents <= count / 16 && InsertionSort(data, count * 4))
+	{
+		return SortPath::Insertion;
+	}
+
+	RadixSort(data);
+	return SortPath::Radix;
+}
+
+bool ParticleSorter::InsertionSort(ParticleSortData& data, int maxShifts)
+{
+	int shifts = 0;
+	for (int i = 1; i < data.count; ++i)
+	{
+		GLushort key = data.keys[i];
+		GLuint index = data.order[i];
+		int j = i - 1;
+		while (j >= 0 && data.keys[j] > key)
+		{
+			data.keys[j + 1] = data.keys[j];
+			data.order[j + 1] = data.order[j];
+			--j;
+			++shifts;
+		}
+		data.keys[j + 1] = key;
+		data.order[j + 1] = index;
+
+		// Bailing out part way is fine, order still holds every live particle exactly once
+		if (shifts > maxShifts)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void ParticleSorter::RadixSort(ParticleSortData& data)
+{
+	// Build the histograms for both 8 bit digits in one pass
+	int histograms[2][256] = {};
+	for (int i = 0; i < data.count; ++i)
+	{
+		++histograms[0][data.keys[i] & 0xFF];
+		++histograms[1][data.keys[i] >> 8];
+	}
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int* histogram = histograms[pass];
+		int shift = pass * 8;
+
+		// If every key has the same digit this pass wouldn't move anything.
+		// Particles usually span a narrow depth range so the high digit is often skipped.
+		if (histogram[(data.keys[0] >> shift) & 0xFF] == data.count)
+		{
+			continue;
+		}
+
+		// Turn the counts into starting offsets
+		int offset = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			int bucketCount = histogram[i];
+			histogram[i] = offset;
+			offset += bucketCount;
+		}
+
+		// Scatter, this is stable so the previous pass's order is kept within each bucket
+		for (int i = 0; i < data.count; ++i)
+		{
+			int destination = histogram[(data.keys[i] >> shift) & 0xFF]++;
+			data.keyScratch[destination] = data.keys[i];
+			data.orderScratch[destination] = data.order[i];
+		}
+
+		std::swap(data.keys, data.keyScratch);
+		std::swap(data.order, data.orderScratch);
+	}
+}
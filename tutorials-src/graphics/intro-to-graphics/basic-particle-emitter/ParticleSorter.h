@@ -0,0 +1,44 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Particle.h"
+#include "ParticleSlab.h"
+
+// Which sort path was taken for a system on a given frame
+enum class SortPath
+{
+	None,		// Order from last frame was still back to front
+	Insertion,	// Order was nearly sorted and was fixed up in place
+	Radix		// Order changed too much and was radix sorted
+};
+
+// Persistent per system sort state. The draw order is kept between frames so that a nearly
+// unchanged view only needs a cheap fix up rather than a full sort.
+struct ParticleSortData
+{
+	// Indices of the live particles, back to front. Systems drawn together are merged in this order.
+	GLuint* order;
+	GLuint* orderScratch;
+	// Quantized view depth of order[i], larger keys are closer to the camera
+	GLushort* keys;
+	GLushort* keyScratch;
+	// 1 if the particle at that pool index already has a place in order
+	GLubyte* listed;
+	int count;
+	// Size of the arrays above
+	int capacity;
+};
+
+class ParticleSorter
+{
+public:
+	static void Alloc(ParticleSortData& data, int numParticles, ParticleSlab& slab);
+	static void Release(ParticleSortData& data, ParticleSlab& slab);
+
+	// Rebuilds data.order from last frame's order so it holds every live particle sorted back to front.
+	// maxDepth is the view distance that maps to the largest key, particles past it share the farthest key.
+	static SortPath Sort(ParticleSortData& data, const Particle* particles, int numParticles, const glm::mat4& view, float maxDepth);
+private:
+	static bool InsertionSort(ParticleSortData& data, int maxShifts);
+	static void RadixSort(ParticleSortData& data);
+};
@@ -0,0 +1,119 @@
+#include "ParticleUploadSink.h"
+#include "ResourceManager.h"
+
+GLParticleUploadSink::GLParticleUploadSink()
+{
+	_renderPath = ParticleRenderPath::GeometryShader;
+	_quadVbo = 0;
+}
+
+void GLParticleUploadSink::Init(ParticleRenderPath renderPath)
+{
+	_renderPath = renderPath;
+	_quadVbo = 0;
+
+	if (_renderPath == ParticleRenderPath::InstancedQuads)
+	{
+		// Drawn as a triangle strip
+		GLfloat corners[] = {
+			-1.0f, -1.0f,
+			1.0f, -1.0f,
+			-1.0f, 1.0f,
+			1.0f, 1.0f
+		};
+		glGenBuffers(1, &_quadVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, _quadVbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	}
+}
+
+void GLParticleUploadSink::CreateBatch(ParticleBatch& batch)
+{
+	GLint shader = batch.shader;
+
+	glGenVertexArrays(1, &batch.vao);
+	glBindVertexArray(batch.vao);
+
+	glGenBuffers(1, &batch.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+
+	// Points read one vertex per particle, instanced quads read the same data once per instance
+	GLsizei stride = sizeof(GLfloat) * PARTICLE_VERTEX_FLOATS;
+	GLuint divisor = _renderPath == ParticleRenderPath::InstancedQuads ? 1 : 0;
+
+	GLuint pos_ageAttrib = glGetAttribLocation(shader, "position_age");
+	glEnableVertexAttribArray(pos_ageAttrib);
+	glVertexAttribPointer(pos_ageAttrib, 4, GL_FLOAT, GL_FALSE, stride, 0);
+	glVertexAttribDivisor(pos_ageAttrib, divisor);
+
+	GLuint colorAttrib = glGetAttribLocation(shader, "color");
+	glEnableVertexAttribArray(colorAttrib);
+	glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 4));
+	glVertexAttribDivisor(colorAttrib, divisor);
+
+	GLuint sizeAttrib = glGetAttribLocation(shader, "size");
+	glEnableVertexAttribArray(sizeAttrib);
+	glVertexAttribPointer(sizeAttrib, 1, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 7));
+	glVertexAttribDivisor(sizeAttrib, divisor);
+
+	GLuint layerAttrib = glGetAttribLocation(shader, "layer");
+	glEnableVertexAttribArray(layerAttrib);
+	glVertexAttribPointer(layerAttrib, 1, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 8));
+	glVertexAttribDivisor(layerAttrib, divisor);
+
+	if (_renderPath == ParticleRenderPath::InstancedQuads)
+	{
+		GLuint cornerAttrib = glGetAttribLocation(shader, "corner");
+		glBindBuffer(GL_ARRAY_BUFFER, _quadVbo);
+		glEnableVertexAttribArray(cornerAttrib);
+		glVertexAttribPointer(cornerAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 2, 0);
+	}
+}
+
+void GLParticleUploadSink::Upload(ParticleBatch& batch)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * PARTICLE_VERTEX_FLOATS * batch.count, &batch.vertices[0], GL_DYNAMIC_DRAW);
+}
+
+void GLParticleUploadSink::Draw(const std::vector<ParticleBatch>& batches)
+{
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+
+	// Every sprite is a layer of the same texture, so it is bound once for all of them
+	glBindTexture(GL_TEXTURE_2D_ARRAY, ResourceManager::spriteArray);
+	unsigned int size = batches.size();
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (batches[i].count == 0)
+		{
+			continue;
+		}
+		glUseProgram(batches[i].shader);
+		glBindVertexArray(batches[i].vao);
+		if (_renderPath == ParticleRenderPath::InstancedQuads)
+		{
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batches[i].count);
+		}
+		else
+		{
+			glDrawArrays(GL_POINTS, 0, batches[i].count);
+		}
+	}
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+}
+
+void GLParticleUploadSink::DestroyBatch(ParticleBatch& batch)
+{
+	glDeleteBuffers(1, &batch.vbo);
+	glDeleteVertexArrays(1, &batch.vao);
+}
+
+void GLParticleUploadSink::Release()
+{
+	glDeleteBuffers(1, &_quadVbo);
+	_quadVbo = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+
+// How particles are turned into quads on the gpu
+enum class ParticleRenderPath
+{
+	// Each particle is a point expanded by particleGeo.glsl, draws with ResourceManager::particleShader
+	GeometryShader,
+	// A static quad instanced once per live particle, draws with ResourceManager::particleInstancedShader
+	InstancedQuads
+};
+
+// Position, age, color, size and texture layer are all the gpu needs from a particle
+const int PARTICLE_VERTEX_FLOATS = 9;
+
+// The visible particles of every system with the same shader, merged back to front into one vertex stream
+struct ParticleBatch
+{
+	GLint shader;
+	GLuint vao;
+	GLuint vbo;
+	std::vector<GLfloat> vertices;
+	int count;
+};
+
+// Where ParticleManager sends its batches. Everything the particle manager does with gl goes through here,
+// so the simulation can run without a window or context by handing it a sink that doesn't draw.
+class ParticleUploadSink
+{
+public:
+	virtual ~ParticleUploadSink() {}
+
+	virtual void Init(ParticleRenderPath renderPath) = 0;
+	// Called once when a batch's shader is first seen
+	virtual void CreateBatch(ParticleBatch& batch) = 0;
+	// Called each update for batches with anything to draw, the first count vertices are filled in
+	virtual void Upload(ParticleBatch& batch) = 0;
+	virtual void Draw(const std::vector<ParticleBatch>& batches) = 0;
+	virtual void DestroyBatch(ParticleBatch& batch) = 0;
+	virtual void Release() = 0;
+};
+
+// Draws batches with the particle shaders, this is what ParticleManager uses unless given another sink
+class GLParticleUploadSink : public ParticleUploadSink
+{
+public:
+	GLParticleUploadSink();
+
+	void Init(ParticleRenderPath renderPath) override;
+	void CreateBatch(ParticleBatch& batch) override;
+	void Upload(ParticleBatch& batch) override;
+	void Draw(const std::vector<ParticleBatch>& batches) override;
+	void DestroyBatch(ParticleBatch& batch) override;
+	void Release() override;
+private:
+	ParticleRenderPath _renderPath;
+	// The four corners of the quad every particle instance is drawn with
+	GLuint _quadVbo;
+};
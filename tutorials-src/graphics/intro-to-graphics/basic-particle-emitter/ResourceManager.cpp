@@ -7,6 +7,7 @@
 
 GLint ResourceManager::phongShader;
 GLint ResourceManager::particleShader;
+GLint ResourceManager::particleInstancedShader;
 
 GLuint ResourceManager::phongVertShader;
 GLuint ResourceManager::phongFragShader;
@@ -14,6 +15,7 @@ GLuint ResourceManager::phongFragShader;
 GLuint ResourceManager::particleVertShader;
 GLuint ResourceManager::particleGeoShader;
 GLuint ResourceManager::particleFragShader;
+GLuint ResourceManager::particleInstVertShader;
 
 UniformBuffer ResourceManager::perModelBuffer;
 UniformBuffer ResourceManager::cameraBuffer;
@@ -27,7 +29,7 @@ Mesh ResourceManager::sphere;
 Mesh ResourceManager::cube;
 Mesh ResourceManager::plane;
 
-GLuint ResourceManager::spriteTex;
+GLuint ResourceManager::spriteArray;
 
 void ResourceManager::Init()
 {
@@ -39,6 +41,7 @@ void ResourceManager::Init()
 	particleVertShader = CompileShader("particleVert.glsl", GL_VERTEX_SHADER);
 	particleGeoShader = CompileShader("particleGeo.glsl", GL_GEOMETRY_SHADER);
 	particleFragShader = CompileShader("particleFrag.glsl", GL_FRAGMENT_SHADER);
+	particleInstVertShader = CompileShader("particleInstVert.glsl", GL_VERTEX_SHADER);
 
 	shaders[0] = phongFragShader;
 	shaders[1] = phongVertShader;
@@ -75,9 +78,21 @@ void ResourceManager::Init()
 	uCameraBlockIndex = glGetUniformBlockIndex(particleShader, "camera");
 	glUniformBlockBinding(particleShader, uCameraBlockIndex, CAMERA_BIND_POINT);
 
+	// Draws the same particles as instanced quads without a geometry stage
+	particleShaders[0] = particleFragShader;
+	particleShaders[1] = particleInstVertShader;
+
+	particleInstancedShader = LinkShaderProgram(particleShaders, 2, 0, "outColor");
+
+	uCameraBlockIndex = glGetUniformBlockIndex(particleInstancedShader, "camera");
+	glUniformBlockBinding(particleInstancedShader, uCameraBlockIndex, CAMERA_BIND_POINT);
+
 	LoadOBJ("Sphere.obj", sphere, phongShader);
 	//LoadOBJ("../Resources/meshes/Cube.obj", cube, phongShader);
 	//LoadOBJ("../Resources/meshes/Plane.obj", plane, phongShader);
+
+	// Every particle sprite is a layer of one texture array, so particles with different sprites can share a draw call.
+	// Layers all have the size of the first sprite.
     const char *fileLoc = "sprite.png";
 
 	FIBITMAP* bitmap = FreeImage_Load(
@@ -88,22 +103,47 @@ void ResourceManager::Init()
 
 	pImage = FreeImage_ConvertTo32Bits(bitmap);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, FreeImage_GetWidth(pImage), FreeImage_GetHeight(pImage),
-		0, GL_BGRA, GL_UNSIGNED_BYTE, static_cast<void*>(FreeImage_GetBits(pImage)));
+	GLsizei width = FreeImage_GetWidth(pImage);
+	GLsizei height = FreeImage_GetHeight(pImage);
+
+	glGenTextures(1, &spriteArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, spriteArray);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, NUM_SPRITE_LAYERS, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, SPRITE_FLARE, width, height, 1,
+		GL_BGRA, GL_UNSIGNED_BYTE, static_cast<void*>(FreeImage_GetBits(pImage)));
 
 	FreeImage_Unload(bitmap);
 	FreeImage_Unload(pImage);
 
+	// The dot is a white disc fading out toward its edge, made here rather than loaded
+	GLubyte* dot = new GLubyte[width * height * 4];
+	for (GLsizei y = 0; y < height; ++y)
+	{
+		for (GLsizei x = 0; x < width; ++x)
+		{
+			float u = (x + 0.5f) / width * 2.0f - 1.0f;
+			float v = (y + 0.5f) / height * 2.0f - 1.0f;
+			float falloff = 1.0f - sqrtf(u * u + v * v);
+			falloff = falloff > 0.0f ? falloff : 0.0f;
+			GLubyte* texel = dot + (y * width + x) * 4;
+			texel[0] = texel[1] = texel[2] = 255;
+			texel[3] = (GLubyte)(falloff * falloff * 255.0f);
+		}
+	}
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, SPRITE_DOT, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, dot);
+	delete[] dot;
+
 	// Sets texture parameters, given a target, symbolic name of the texture parameter, and a value for that parameter.
 	// Valid symbolic names are GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, or GL_TEXTURE_WRAP_T.
 	// Each has their own different set of values as well.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	// Generates a mipmap for the texture, and there's no reason not to.
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// Generates a mipmap for the texture, and there's no reason not to. Array layers are mipmapped separately.
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 }
 
 void ResourceManager::DumpData()
@@ -121,11 +161,14 @@ void ResourceManager::DumpData()
 	glDeleteShader(particleVertShader);
 	glDeleteProgram(particleShader);
 
+	glDeleteShader(particleInstVertShader);
+	glDeleteProgram(particleInstancedShader);
+
 	ReleaseBuffer(perModelBuffer);
 	ReleaseBuffer(cameraBuffer);
 	ReleaseBuffer(lightsBuffer);
 
-	glDeleteTextures(1, &spriteTex);
+	glDeleteTextures(1, &spriteArray);
 }
 
 char* ResourceManager::ReadTextFile(const char* filepath)
@@ -33,6 +33,14 @@ struct UniformBuffer
 	GLubyte* data;
 };
 
+// Layers of ResourceManager::spriteArray
+enum SpriteLayer
+{
+	SPRITE_FLARE,	// sprite.png
+	SPRITE_DOT,		// A soft round dot
+	NUM_SPRITE_LAYERS
+};
+
 class ResourceManager
 {
 public:
@@ -41,6 +49,7 @@ public:
 
 	static GLint phongShader;
 	static GLint particleShader;
+	static GLint particleInstancedShader;
 
 	static GLuint phongFragShader;
 	static GLuint phongVertShader;
@@ -48,6 +57,7 @@ public:
 	static GLuint particleVertShader;
 	static GLuint particleGeoShader;
 	static GLuint particleFragShader;
+	static GLuint particleInstVertShader;
 
 	static UniformBuffer perModelBuffer;
 	static UniformBuffer cameraBuffer;
@@ -57,7 +67,7 @@ public:
 	static Mesh cube;
 	static Mesh plane;
 
-	static GLuint spriteTex;
+	static GLuint spriteArray;
 
 private:
 	static char* ReadTextFile(const char* filepath);
@@ -49,8 +49,43 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 *
 *	6) ParticleManager
 *	- This class maintains all of the data relating to the particle effects in the scene. It contains an array of particle systems which in turn hold 
-*	arrays of particles which contain the positions, colors, ages, and velocities of each particle in the system.
+*	arrays of particles which contain the positions, colors, ages, and velocities of each particle in the system. Systems are referred to by
+*	generational handles, so a handle to a destroyed system resolves to nothing rather than to whatever system reused its slot. A destroyed
+*	system's slot is reused by the next system created, and one-shot systems (hold space) destroy themselves once their particles die.
+*	A ParticleBudget caps the number of live particles and the time spent updating per frame. Far away systems are stepped less often and
+*	emit less, and systems outside the view frustum are skipped when drawing and can be coarsely simulated or frozen. What the budget did
+*	each frame is in ParticleStats and the window title.
+*	Systems aren't drawn one at a time. After updating, the visible particles of every system sharing a shader are merged back to front into
+*	one vertex stream and drawn with a single call. Each particle carries the layer of ResourceManager's sprite texture array it is drawn with,
+*	so systems with different sprites still share the draw.
+*
+*	ParticleSlab
+*	- A slab allocator with power of two size classes that the particle arrays of every system come from, so spawning and destroying
+*	thousands of short lived systems a second recycles the same memory instead of going to the heap. Its usage is shown in the window title.
+*
+*	ParticleAffectors
+*	- Gravity, drag, attractors, vortices, curl noise and color/size over age. A particle system is given any combination of these with
+*	ParticleManager::SetAffectors, which builds an update loop specialized for exactly that combination through templates. There is one
+*	virtual call per system per frame rather than one per particle per affector.
+*
+*	ParticleGrid
+*	- A hashed uniform grid rebuilt each step with a (multithreaded, for large systems) counting sort. Systems with interactions turned on use
+*	it to find nearby particles for separation and SPH style pressure, and to find the particles inside the RenderObjects registered as
+*	colliders, so the cost grows with the number of particles rather than the number of pairs of them.
+*
+*	ParticleSorter
+*	- Particles are blended with depth writes off, so they have to be drawn back to front. Each system keeps the draw order of its live particles
+*	from the previous frame and the sorter only fixes it up, using an insertion sort when little has moved and a radix sort on quantized view
+*	depth when it has. The time spent sorting is shown in the window title.
 *	
+*	ParticleUploadSink
+*	- Everything ParticleManager does with gl goes through an upload sink. The default one creates the batch buffers, uploads and draws them.
+*
+*	ParticleBenchmark
+*	- Run with --benchmark. Swaps in a sink that only copies the batches, so it needs no window or context, and times ParticleManager::Update over a
+*	sweep of system counts, pool sizes, emission frequencies and lifetimes. It prints ns per particle per step, the cost of emitting a particle,
+*	the upload size and an estimate of the memory bandwidth reached, which is what to check a change to Update against.
+*
 *	RenderObject
 *	- Tracks the instance of an object that can be drawn to the screen. Contains data for transforms, a mesh, a shader, drawing mode (eg triangles,
 *	lines), and a layer. The layer is a value that can be used to mask certain objects from a draw call. The object has a layer which is some power
@@ -71,16 +106,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 *	- Applies projection and view matrices to the particle positions, does not use the model matrix as it was already applied on the cpu side.
 *
 *	particleGeo.glsl
-*	- Receives position values from the vertex shader and converts them into quads and adds texture coordinates.
+*	- Receives position values from the vertex shader and converts them into quads sized by the particle's size and adds texture coordinates.
+*
+*	particleInstVert.glsl
+*	- An alternative to the vertex and geometry shaders above, run with --instanced. Each live particle is an instance of a static four corner
+*	quad, so the quads are built without a geometry stage, which many drivers and software rasterizers run slowly. --render-benchmark times
+*	both paths at 10k to 1M particles.
 *
 *	particleFrag.glsl
-*	- Samples the bound texture based on coordinates from the geo shader and adds the color from the vertex buffer.
+*	- Samples the particle's layer of the sprite texture array based on coordinates from the geo shader and adds the color from the vertex buffer.
 */
 
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 #include <ctime>
 #include <random>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <iostream>
 
 #include "CameraManager.h"
 #include "LightingManager.h"
@@ -90,12 +134,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ResourceManager.h"
 #include "RenderObject.h"
 #include "ParticleManager.h"
+#include "ParticleBenchmark.h"
 
 #include <stdexcept>
+#include <glm/gtc/random.hpp>
 
 GLFWwindow* window;
 
-ParticleSystem* pSystem;
+// Time since the window title stats were last refreshed
+float statsTimer;
+
+// Pass --instanced to draw particles as instanced quads instead of through the geometry shader
+ParticleRenderPath renderPath = ParticleRenderPath::GeometryShader;
+
+// The shader matching renderPath
+GLint particleShader;
+ParticleSystemHandle fountain;
+// Time since the last one-shot burst while space is held
+float burstTimer;
 Light* light0;
 RenderObject* sphere1;
 
@@ -109,14 +165,59 @@ void InitScene()
 	sphere1 = RenderManager::InitRenderObject(&ResourceManager::sphere, ResourceManager::phongShader, GL_TRIANGLES, 1);
 	sphere1->transform().position = glm::vec3(-2.0f, 0.0f, -3.5f);
 
-	pSystem = ParticleManager::InitParticleSystem(ResourceManager::particleShader, 1000);
+	particleShader = renderPath == ParticleRenderPath::InstancedQuads ? ResourceManager::particleInstancedShader : ResourceManager::particleShader;
+	fountain = ParticleManager::InitParticleSystem(particleShader, 1000);
+	ParticleSystem* pSystem = ParticleManager::Get(fountain);
 	pSystem->transform.position.x = 1.0f;
 	pSystem->frequency = 100.0f;
 	pSystem->initialSpeed = 1.0f;
 	pSystem->lifetime = 5.0f;
 	pSystem->arc = 25;
 	pSystem->transform.angularVelocity = glm::angleAxis(100.0f, glm::vec3(1.0f, 1.0f, 1.0f));
-	pSystem->texture = ResourceManager::spriteTex;
+	pSystem->textureLayer = SPRITE_FLARE;
+
+	// Fall under gravity with a bit of turbulence, shrinking and cooling from yellow to red as they age
+	ParticleManager::SetAffectors(pSystem,
+		Gravity(glm::vec3(0.0f, -0.5f, 0.0f)),
+		LinearDrag(0.2f),
+		CurlNoise(1.5f, 0.5f),
+		ColorOverAge(glm::vec3(1.0f, 0.9f, 0.2f), glm::vec3(0.8f, 0.1f, 0.0f)),
+		SizeOverAge(0.1f, 0.02f));
+
+	// Keep the particles from clumping and let them bounce off the sphere
+	pSystem->interactions.radius = 0.1f;
+	pSystem->interactions.separation = 1.0f;
+	pSystem->interactions.collide = true;
+	pSystem->interactions.restitution = 0.5f;
+	ParticleManager::AddCollider(sphere1, 1.0f);
+
+	// Keep the cost bounded however long space is held. Systems more than 5 units from the camera are stepped less often and emit less,
+	// down to every fourth frame and a quarter of their particles at 20 units, and systems out of view are only coarsely simulated.
+	ParticleBudget budget = ParticleBudget();
+	budget.maxLiveParticles = 20000;
+	budget.maxSimTime = 4.0f;
+	budget.lodNear = 5.0f;
+	budget.lodFar = 20.0f;
+	budget.maxStepInterval = 4;
+	budget.minEmissionScale = 0.25f;
+	budget.offscreen = ParticleCullMode::Coarse;
+	ParticleManager::SetBudget(budget);
+}
+
+// Sets off a short lived spray of sparks somewhere in front of the camera. The system cleans itself up once the sparks have burnt out.
+void SpawnBurst()
+{
+	glm::vec3 position = glm::vec3(glm::linearRand(-3.0f, 3.0f), glm::linearRand(-1.0f, 2.0f), glm::linearRand(-5.0f, -2.0f));
+	ParticleSystem* burst = ParticleManager::Get(ParticleManager::InitOneShot(particleShader, 64, position));
+	burst->lifetime = 1.0f;
+	burst->initialSpeed = 1.5f;
+	burst->arc = 360;
+	burst->textureLayer = SPRITE_DOT;
+	ParticleManager::SetAffectors(burst,
+		Gravity(glm::vec3(0.0f, -2.0f, 0.0f)),
+		LinearDrag(1.0f),
+		ColorOverAge(glm::vec3(1.0f, 1.0f, 0.8f), glm::vec3(0.2f, 0.4f, 1.0f)),
+		SizeOverAge(0.05f, 0.0f));
 }
 
 void init()
@@ -147,7 +248,7 @@ void init()
 	LightingManager::Init();
 	InputManager::Init(window);
 	CameraManager::Init(800.0f / 600.0f, 45.0f, 0.1f, 100.0f);
-	ParticleManager::Init();
+	ParticleManager::Init(renderPath);
 
 	glfwSetTime(0.0);
 
@@ -174,6 +275,17 @@ void step()
 
 	RenderManager::Update(dt);
 
+	// Hold space to set off fifty bursts a second
+	if (InputManager::spaceKey())
+	{
+		burstTimer += dt;
+		while (burstTimer > 0.02f)
+		{
+			SpawnBurst();
+			burstTimer -= 0.02f;
+		}
+	}
+
 	ParticleManager::Update(dt);
 
 	LightingManager::Update(dt);
@@ -182,6 +294,28 @@ void step()
 
 	ParticleManager::Draw();
 
+	// Show the cost of depth sorting the particles for the latest frame, refreshed every second
+	statsTimer += dt;
+	if (statsTimer > 1.0f)
+	{
+		statsTimer = 0.0f;
+		const ParticleStats& stats = ParticleManager::Stats();
+		std::string title = "Particles - systems: " + std::to_string(stats.liveSystems) +
+			" live: " + std::to_string(stats.liveParticles) +
+			" draws: " + std::to_string(stats.drawCalls) +
+			" slab: " + std::to_string(ParticleManager::Slab().InUse() / 1024) + "/" + std::to_string(ParticleManager::Slab().Reserved() / 1024) + "KB" +
+			" sort: " + std::to_string(stats.sortTime) + "ms (" +
+			std::to_string(stats.radixSorts) + " radix, " +
+			std::to_string(stats.insertionSorts) + " insertion, " +
+			std::to_string(stats.unchangedSorts) + " unchanged)" +
+			" budget: " + std::to_string(stats.steppedSystems) + " stepped, " +
+			std::to_string(stats.lodSystems) + " lod, " +
+			std::to_string(stats.coarseSystems + stats.frozenSystems) + " culled, " +
+			std::to_string(stats.deferredSystems) + " deferred, " +
+			std::to_string(stats.droppedEmissions) + " dropped";
+		glfwSetWindowTitle(window, title.c_str());
+	}
+
 	// Swap buffers
 	glfwSwapBuffers(window);
 }
@@ -197,10 +331,111 @@ void cleanUp()
 	glfwTerminate();
 }
 
-int main()
+// Run with --render-benchmark. Times a single system of 10k, 100k and 1M live particles on both render paths
+// and prints the cpu time of ParticleManager::Update and the gpu time of ParticleManager::Draw.
+void RenderBenchmark()
 {
+	const int numSizes = 3;
+	const int sizes[numSizes] = { 10000, 100000, 1000000 };
+	const int warmupFrames = 5;
+	const int timedFrames = 30;
+
+	ParticleRenderPath paths[2] = { ParticleRenderPath::GeometryShader, ParticleRenderPath::InstancedQuads };
+	GLint shaders[2] = { ResourceManager::particleShader, ResourceManager::particleInstancedShader };
+	const char* names[2] = { "geometry shader", "instanced quads" };
+
+	GLuint timer;
+	glGenQueries(1, &timer);
+
+	// The sort needs a view matrix
+	CameraManager::Update(0.0f);
+
+	// Throw away the demo scene's systems
+	ParticleManager::DumpData();
+
+	std::cout << "path, particles, update ms, draw ms" << std::endl;
+	for (int p = 0; p < 2; ++p)
+	{
+		for (int s = 0; s < numSizes; ++s)
+		{
+			ParticleManager::Init(paths[p]);
+			ParticleSystem* system = ParticleManager::Get(ParticleManager::InitParticleSystem(shaders[p], sizes[s]));
+			system->frequency = (float)sizes[s];
+			system->initialSpeed = 1.0f;
+			system->lifetime = 1000.0f;
+			system->arc = 360;
+			system->textureLayer = SPRITE_FLARE;
+
+			// One second at this frequency fills the whole pool, then let it spread out
+			ParticleManager::Update(1.0f);
+
+			double updateTime = 0.0;
+			double drawTime = 0.0;
+			for (int frame = 0; frame < warmupFrames + timedFrames; ++frame)
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				ParticleManager::Update(1.0f / 60.0f);
+				double frameUpdateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+				glBeginQuery(GL_TIME_ELAPSED, timer);
+				ParticleManager::Draw();
+				glEndQuery(GL_TIME_ELAPSED);
+
+				GLuint64 elapsed;
+				glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed);
+				glfwSwapBuffers(window);
+
+				if (frame >= warmupFrames)
+				{
+					updateTime += frameUpdateTime;
+					drawTime += elapsed / 1000000.0;
+				}
+			}
+
+			std::cout << names[p] << ", " << sizes[s] << ", " << updateTime / timedFrames << ", " << drawTime / timedFrames << std::endl;
+			ParticleManager::DumpData();
+		}
+	}
+
+	glDeleteQueries(1, &timer);
+
+	// Leave an empty manager behind for cleanUp
+	ParticleManager::Init(renderPath);
+}
+
+int main(int argc, char **argv)
+{
+	bool benchmark = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--instanced") == 0)
+		{
+			renderPath = ParticleRenderPath::InstancedQuads;
+		}
+		else if (strcmp(argv[i], "--render-benchmark") == 0)
+		{
+			benchmark = true;
+		}
+		else if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			// Simulation only, before any window or context is made
+			CameraManager::Init(800.0f / 600.0f, 45.0f, 0.1f, 100.0f);
+			ParticleBenchmark::Run();
+			return 0;
+		}
+	}
+
 	init();
 
+	if (benchmark)
+	{
+		RenderBenchmark();
+		cleanUp();
+		return 0;
+	}
+
 	while (!glfwWindowShouldClose(window))
 	{
 		step();
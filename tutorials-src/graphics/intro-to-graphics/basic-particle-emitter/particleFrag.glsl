@@ -4,10 +4,11 @@ out vec4 outColor;
 
 in vec2 TexCoord;
 in vec3 FragColor;
+flat in float FragLayer;
 
-uniform sampler2D tex;
+uniform sampler2DArray tex;
 
 void main()
 {
-	outColor = texture(tex, TexCoord) * vec4(FragColor, 1.0);
+	outColor = texture(tex, vec3(TexCoord, FragLayer)) * vec4(FragColor, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 440
+
+// One of the four corners of the quad, from a static buffer shared by every particle
+in vec2 corner;
+
+// Per instance, one particle each
+in vec4 position_age;
+in vec3 color;
+in float size;
+in float layer;
+
+layout (std140) uniform camera
+{
+	mat4 viewMat;
+	mat4 projMat;
+	vec4 camPos;
+};
+
+out vec2 TexCoord;
+out vec3 FragColor;
+flat out float FragLayer;
+
+void main()
+{
+	// Same quad the geometry shader builds, offset from the particle's center in clip space
+	gl_Position = projMat * viewMat * vec4(position_age.xyz, 1.0) + vec4(corner * size, 0.0, 0.0);
+	TexCoord = corner * 0.5 + 0.5;
+	FragColor = color;
+	FragLayer = layer;
+}
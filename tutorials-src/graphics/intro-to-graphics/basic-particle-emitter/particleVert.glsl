@@ -2,6 +2,8 @@
 
 in vec4 position_age;
 in vec3 color;
+in float size;
+in float layer;
 
 layout (std140) uniform camera
 {
@@ -12,10 +14,14 @@ layout (std140) uniform camera
 
 out vec4 Position_Age;
 out vec3 Color;
+out float Size;
+out float Layer;
 
 void main()
 {
 	gl_Position = projMat * viewMat * vec4(position_age.xyz, 1.0);
 	Position_Age = position_age;
 	Color = color;
+	Size = size;
+	Layer = layer;
 }
\ No newline at end of file
@@ -196,6 +196,23 @@ bool intersectTriangles(vec3 origin, vec3 dir, out hitinfo info)
 	return found;
 }
 
+// Determines whether a ray hits anything before it has gone maxDist. This is all a shadow needs to know: any surface at all in the way
+// puts the point in shadow, so unlike intersectTriangles, which has to look at every triangle to find the closest, this stops at the first one it finds.
+bool occluded(vec3 origin, vec3 dir, float maxDist)
+{
+	for(int i = 0; i < NUM_TRIANGLES; i++)
+	{
+		float t = rayIntersectsTriangle(origin, dir, triangles[i].a, triangles[i].b, triangles[i].c);
+
+		if(t != -1.0 && t < maxDist)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 // Takes the position of a light, a vector from the point of collision toward the light, a vector direction from the origin toward the point of collision,
 // a hitinfo object containing data in regards to the ray-triangle collision, and a float determining the brightness of a light.
 // This will calculate the color of a given pixel as given by a light source.
@@ -204,19 +221,12 @@ vec3 addToPixColor(vec3 lightPos, vec3 pointToLight, vec3 dir, hitinfo eyeHitPoi
 	// Get the distance from point on surface to light
 	float dist = length(pointToLight);
 
-	// Create a hitinfo object to store the collision.
-	hitinfo lightRender;
-
-	// Now we render things from the light point of view, so we call intersectTriangles passing in the light position as the origin.
+	// Now we render things from the light point of view, so we cast a ray with the light position as the origin.
 	// The direction vector is from the light position toward the point on the triangle that we're trying to render.
-	if(intersectTriangles(lightPos, normalize(eyeHitPoint.point - lightPos), lightRender))
+	// If it hits any surface more than a little (0.1) short of the point, then this is in shadow, since the light is hitting another object first.
+	if(occluded(lightPos, normalize(eyeHitPoint.point - lightPos), dist - 0.1))
 	{
-		// If the distance from the point to the light is farther than the distance from the light to the first surface it hits
-		if(dist - length(lightPos - lightRender.point) > 0.1)
-		{
-			// Then this is in shadow, since the light is hitting another object first.
-			return vec3(0.0, 0.0, 0.0);
-		}
+		return vec3(0.0, 0.0, 0.0);
 	}
 
 	// Normalize our pointToLight.
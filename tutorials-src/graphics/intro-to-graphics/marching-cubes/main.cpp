@@ -33,8 +33,13 @@ since each each vertex can either be a part or not, we have a combination of 2^8
 scenarios. But these can be reduced to 15 unique cases which  can be transformed to reproduce 
 the other formations.
 
-These 8 values can be stored in 1 byte using each bit to represent a corner. In this example,
-we are using bool variables instead, for ease of understanding.  
+These 8 values are stored in 1 byte, the cube index, using each bit to represent a corner.
+The cube index looks up which of the cube's 12 edges the surface crosses, and the triangles
+to draw between those edges, in two tables (see MarchingCubesTables.h). Every one of the 256
+cases is in the tables, so each cube takes the same few steps whatever case it is.
+Where the surface crosses an edge is found by interpolating between the values of the
+sphere's field at its two corners, rather than always taking the middle of the edge, which
+gives a smoother sphere for the same grid.
 
 in this example all the logic is in the setup().
 
@@ -45,25 +50,26 @@ https://en.wikipedia.org/wiki/Marching_cubes
 */
 
 #include "GLIncludes.h"
+#include "MarchingCubesTables.h"
 
 #define GridSize 30
-#define radius 1.0f/(float)GridSize	
+// The grid reaches this far from the origin along each axis, a little past the sphere so that the surface closes inside it.
+#define GridExtent 1.2f
+#define CellSize (2.0f * GridExtent / (float)GridSize)
 
 struct gridCell
 {
-	glm::vec3 position;
-	bool X, Xy, Xyz, Xz;													// Edges
-	bool Y, Yx, Yxz, Yz;
-	bool Z, Zx, Zxy, Zy;
-
-	bool A1, B1, C1, D1, A2, B2, C2, D2;									// Vertices
-
-	std::vector<glm::vec3> adjacentPoints;
+	glm::vec3 position;														// Corner 0, the one with the smallest x, y and z
+	unsigned char cubeIndex;												// Bit n is set if corner n is inside the sphere
 };
 
 #pragma region program specific Data members
 gridCell matrix[GridSize][GridSize][GridSize];
 
+// The sphere's field at every corner of the grid. Neighbouring cubes share corners, so each is only worked out once,
+// and both cubes along an edge see the same values and put the surface in the same place on it.
+float field[GridSize + 1][GridSize + 1][GridSize + 1];
+
 int vertexCount = 0;
 std::vector<VertexFormat> CPUbuffer;
 #pragma endregion
@@ -158,16 +164,16 @@ struct stuff_for_drawing{
 //Since we are only drawing a single object, we need only 1 VBO. Thus we create an object of Stuff_for_drawing on a global scope
 stuff_for_drawing base;
 
-//This function checks if the passed value is true, if it is then it sets to false, else it sets to true. 
-//If we had used bits to represent them, then we can simply use the XOR function.
-bool setTrue(bool var)
+//The field whose surface we draw: how far a point is outside the sphere of radius 1, negative inside it.
+float sphereField(glm::vec3 point)
 {
-	if (var)
-		var = false;
-	else
-		var = true;
+	return glm::length(point) - 1.0f;
+}
 
-	return var;
+//The position of a corner of the grid.
+glm::vec3 gridCorner(int i, int j, int k)
+{
+	return glm::vec3(i, j, k) * CellSize - glm::vec3(GridExtent);
 }
 
 //This function pushes data onto the buffer we will later send to the GPU. It also updates the vertexcount to keep track of it.
@@ -192,280 +198,58 @@ void setup()
 	base.numberOfVertices = 0;
 
 	CPUbuffer.clear();
+	vertexCount = 0;
 
-	//Find all the points which lie inside the or outside the sphere
-	for (int i = 0; i < GridSize; i++)
-		for (int j = 0; j < GridSize; j++)
-			for (int k = 0; k < GridSize; k++)
-			{
-				matrix[i][j][k].position.x = (i * 2.0f / (float)GridSize) -1.0f;
-				matrix[i][j][k].position.y = (j * 2.0f / (float)GridSize) -1.0f;
-				matrix[i][j][k].position.z = (k * 2.0f / (float)GridSize) -1.0f;
-
-				//for each cube in the grid, check for all 8 corners.
-				if (glm::length(matrix[i][j][k].position + glm::vec3(-radius, -radius, radius)) <= 1.0f)
-					matrix[i][j][k].A1 = true;
-				else
-					matrix[i][j][k].A1 = false;
-
-				if (glm::length(matrix[i][j][k].position + glm::vec3(radius, -radius, radius))<= 1.0f)
-					matrix[i][j][k].B1 = true;
-				else
-					matrix[i][j][k].B1 = false;
-
-				if (glm::length(matrix[i][j][k].position + glm::vec3(radius, radius, radius))<= 1.0f)
-					matrix[i][j][k].C1 = true;
-				else
-					matrix[i][j][k].C1 = false;
-
-				if (glm::length(matrix[i][j][k].position + glm::vec3(-radius, radius, radius))<= 1.0f)
-					matrix[i][j][k].D1 = true;
-				else
-					matrix[i][j][k].D1 = false;
-
-				if (glm::length(matrix[i][j][k].position + glm::vec3(-radius, -radius, -radius))<= 1.0f)
-					matrix[i][j][k].A2 = true;
-				else
-					matrix[i][j][k].A2 = false;
-
-				if (glm::length(matrix[i][j][k].position + glm::vec3(radius, -radius, -radius))<= 1.0f)
-					matrix[i][j][k].B2 = true;										 
-				else																 
-					matrix[i][j][k].B2 = false;										 
-																					 
-				if (glm::length(matrix[i][j][k].position + glm::vec3(radius, radius, -radius))<= 1.0f)
-					matrix[i][j][k].C2 = true;										 
-				else																 
-					matrix[i][j][k].C2 = false;										 
-																					 
-				if (glm::length(matrix[i][j][k].position + glm::vec3(-radius, radius, -radius))<= 1.0f)
-					matrix[i][j][k].D2 = true;
-				else
-					matrix[i][j][k].D2 = false;
-				
-				//set all the edges to false to start with.
-				matrix[i][j][k].X = false;
-				matrix[i][j][k].Xy = false;
-				matrix[i][j][k].Xyz = false;
-				matrix[i][j][k].Xz = false;
-
-				matrix[i][j][k].Y = false;
-				matrix[i][j][k].Yx = false;
-				matrix[i][j][k].Yz = false;
-				matrix[i][j][k].Yxz = false;
-
-				matrix[i][j][k].Z = false;
-				matrix[i][j][k].Zx = false;
-				matrix[i][j][k].Zy = false;
-				matrix[i][j][k].Zxy = false;
-			}
+	//Sample the field at every corner of the grid.
+	for (int i = 0; i <= GridSize; i++)
+		for (int j = 0; j <= GridSize; j++)
+			for (int k = 0; k <= GridSize; k++)
+				field[i][j][k] = sphereField(gridCorner(i, j, k));
 
-	
-	for (int i = 0; i < GridSize; i++)
-		for (int j = 0; j < GridSize; j++)
-			for (int k = 0; k < GridSize; k++)
-			{
-				// if all the points are ture or false, then the cube wither lies completly outside or complettly inside the object. 
-				// In all other cases, we need to set true the edges in cantact with the highlighted corners.
-				if (matrix[i][j][k].A1 || matrix[i][j][k].B1 || matrix[i][j][k].C1 || matrix[i][j][k].D1 || matrix[i][j][k].A2 || matrix[i][j][k].B2 || matrix[i][j][k].C2 || matrix[i][j][k].D2 &&
-					(matrix[i][j][k].A1 && matrix[i][j][k].B1 && matrix[i][j][k].C1 && matrix[i][j][k].D1 && matrix[i][j][k].A2 && matrix[i][j][k].B2 && matrix[i][j][k].C2 && matrix[i][j][k].D2 == false))
-				{
-					if (matrix[i][j][k].A1)
-					{
-						matrix[i][j][k].X = setTrue(matrix[i][j][k].X);
-						matrix[i][j][k].Y = setTrue(matrix[i][j][k].Y);
-						matrix[i][j][k].Z = setTrue(matrix[i][j][k].Z);
-					}
-		
-					if (matrix[i][j][k].B1)
-					{
-						matrix[i][j][k].X = setTrue(matrix[i][j][k].X);
-						matrix[i][j][k].Yx = setTrue(matrix[i][j][k].Yx);
-						matrix[i][j][k].Zx = setTrue(matrix[i][j][k].Zx);
-					}
-		
-					if (matrix[i][j][k].C1)
-					{
-						matrix[i][j][k].Xy = setTrue(matrix[i][j][k].Xy);
-						matrix[i][j][k].Yx = setTrue(matrix[i][j][k].Yx);
-						matrix[i][j][k].Zxy = setTrue(matrix[i][j][k].Zxy);
-					}
-		
-					if (matrix[i][j][k].D1)
-					{
-						matrix[i][j][k].Xy = setTrue(matrix[i][j][k].Xy);
-						matrix[i][j][k].Y = setTrue(matrix[i][j][k].Y);
-						matrix[i][j][k].Zy = setTrue(matrix[i][j][k].Zy);
-					}
-		
-					if (matrix[i][j][k].A2)
-					{
-						matrix[i][j][k].Xz = setTrue(matrix[i][j][k].Xz);
-						matrix[i][j][k].Yz = setTrue(matrix[i][j][k].Yz);
-						matrix[i][j][k].Z = setTrue(matrix[i][j][k].Z);
-					}
-		
-					if (matrix[i][j][k].B2)
-					{
-						matrix[i][j][k].Xz = setTrue(matrix[i][j][k].Xz);
-						matrix[i][j][k].Yxz = setTrue(matrix[i][j][k].Yxz);
-						matrix[i][j][k].Zx = setTrue(matrix[i][j][k].Zx);
-					}
-		
-					if (matrix[i][j][k].C2)
-					{
-						matrix[i][j][k].Xyz = setTrue(matrix[i][j][k].Xyz);
-						matrix[i][j][k].Yxz = setTrue(matrix[i][j][k].Yxz);
-						matrix[i][j][k].Zxy = setTrue(matrix[i][j][k].Zxy);
-					}
-		
-					if (matrix[i][j][k].D2)
-					{
-						matrix[i][j][k].Xyz = setTrue(matrix[i][j][k].Xyz);
-						matrix[i][j][k].Yz = setTrue(matrix[i][j][k].Yz);
-						matrix[i][j][k].Zy = setTrue(matrix[i][j][k].Zy);
-					}
-			}
-	}
-
-	//At this point we know every vertex on the edge of the every single cube which needs to be drawn to depict the surface.
-	int verticesToDraw = 0;
-	glm::vec3 a, b, c;
-
-	//This is where use another algorithm to conpute the mesh using the points given to us. (INCOMPLETE)
 	for (int i = 0; i < GridSize; i++)
 	{
 		for (int j = 0; j < GridSize; j++)
 		{
 			for (int k = 0; k < GridSize; k++)
 			{
-				//First we push all the vertices to draw to a vector buffer.
-				matrix[i][j][k].adjacentPoints.clear();
-				verticesToDraw = 0;
-				glm::vec3 Position = matrix[i][j][k].position;
-				//X-axis
-				if (matrix[i][j][k].X)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(0, -radius, radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Xy)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(0, radius, radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Xyz)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(0, radius, -radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Xz)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(0, -radius, -radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				//Yaxis
-				if (matrix[i][j][k].Y)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(-radius, 0, radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Yx)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(radius, 0, radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Yxz)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(radius, 0, -radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Yz)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(-radius, 0, -radius);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				//Z-axis
-				if (matrix[i][j][k].Z)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(-radius, -radius, 0);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Zx)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(radius, -radius, 0);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Zxy)
-				{
-					verticesToDraw++;
-					Position += glm::vec3(radius, radius, 0);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
-				}
-				if (matrix[i][j][k].Zy)
+				gridCell& cell = matrix[i][j][k];
+				cell.position = gridCorner(i, j, k);
+
+				//Each corner inside the sphere sets its bit of the cube index. The comparison is 0 or 1, so there is nothing to branch on.
+				float values[8];
+				int cubeIndex = 0;
+				for (int c = 0; c < 8; c++)
 				{
-					verticesToDraw++;
-					Position += glm::vec3(-radius, radius, 0);
-					matrix[i][j][k].adjacentPoints.push_back(Position);
-					//glVertex3fv((float*)&Position);
-					Position = matrix[i][j][k].position;
+					values[c] = field[i + cornerOffsets[c][0]][j + cornerOffsets[c][1]][k + cornerOffsets[c][2]];
+					cubeIndex |= (values[c] < 0.0f) << c;
 				}
+				cell.cubeIndex = (unsigned char)cubeIndex;
 
-				//Depending on the number of points we can roughly deduce the kind of shape we need to draw.
-				//Here we are doing only the basic three cases of the 15 possible cases to render a sphere.
-				switch (verticesToDraw)
+				//If all the corners are inside, or all outside, the cube lies completely inside or outside the sphere and no edge is crossed.
+				int edges = edgeTable[cubeIndex];
+				if (edges == 0)
+					continue;
+
+				//Find where the surface crosses each edge it crosses, by how far the field is from 0 at either end.
+				//The corners come from the grid rather than from this cube's position, so the cubes either side of an edge get exactly the same point.
+				glm::vec3 edgePoints[12];
+				for (int e = 0; e < 12; e++)
 				{
-				case 3: 
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[2]);
-					break;
-				case 4:
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[2]);
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[3]);
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[2], matrix[i][j][k].adjacentPoints[3]);
-					break;
-				case 5:
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[2]);
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[1], matrix[i][j][k].adjacentPoints[3]);
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[0], matrix[i][j][k].adjacentPoints[3], matrix[i][j][k].adjacentPoints[4]);
-					pushToCPUBuffer(matrix[i][j][k].adjacentPoints[2], matrix[i][j][k].adjacentPoints[3], matrix[i][j][k].adjacentPoints[4]);
-					break;
-				default:
-					//std::cout << "\n " << matrix[i][j][k].adjacentPoints.size();
-					break;
+					if (edges & (1 << e))
+					{
+						int a = edgeCorners[e][0];
+						int b = edgeCorners[e][1];
+						float t = values[a] / (values[a] - values[b]);
+						glm::vec3 cornerA = gridCorner(i + cornerOffsets[a][0], j + cornerOffsets[a][1], k + cornerOffsets[a][2]);
+						glm::vec3 cornerB = gridCorner(i + cornerOffsets[b][0], j + cornerOffsets[b][1], k + cornerOffsets[b][2]);
+						edgePoints[e] = glm::mix(cornerA, cornerB, t);
+					}
 				}
 
+				//The triangle table lists the triangles three edges at a time, up to the -1 that ends them.
+				const int* triangles = triTable[cubeIndex];
+				for (int t = 0; triangles[t] != -1; t += 3)
+					pushToCPUBuffer(edgePoints[triangles[t]], edgePoints[triangles[t + 1]], edgePoints[triangles[t + 2]]);
 			}
 		}
 	}
@@ -661,8 +445,6 @@ void checkTime()
 // This function runs every frame
 void renderScene()
 {
-	std::vector<glm::vec3> adjacentPoints;
-
 	// Clear the color buffer and the depth buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -687,30 +469,6 @@ void renderScene()
 	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VertexFormat), (void*)offsetof(VertexFormat, color));
 
 	glDrawArrays(GL_TRIANGLES, 0, vertexCount);
-	glm::vec3 Position;
-	
-	//glBegin(GL_LINES);
-	//for (int i = 0; i < GridSize; i++)
-	//{
-	//	for (int j = 0; j < GridSize; j++)
-	//	{
-	//		for (int k = 0; k < GridSize; k++)
-	//		{
-	//			for (int l = 0; l < matrix[i][j][k].adjacentPoints.size(); l++)
-	//			{
-	//				for (int m = l + 1; m < matrix[i][j][k].adjacentPoints.size(); m++)
-	//				{
-	//					//if (glm::distance(matrix[i][j][k].adjacentPoints[m], matrix[i][j][k].adjacentPoints[l]) <= 2 * radius)
-	//					{
-	//						glVertex3fv((float*)&matrix[i][j][k].adjacentPoints[l]);
-	//						glVertex3fv((float*)&matrix[i][j][k].adjacentPoints[m]);
-	//					}
-	//				}
-	//			}
-	//		}
-	//	}
-	//}
-	//glEnd();
 }
 
 // This function is used to handle key inputs.